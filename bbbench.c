@@ -0,0 +1,642 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "blackboard.h"
+#include "histogram.h"
+
+#define NS_PER_SEC         1000000000ULL
+#define BENCH_DRAIN_NS     (5 * NS_PER_SEC)
+#define BENCH_CONNECT_MS   5000
+
+typedef enum BenchOp {
+    BENCH_SHOW,
+    BENCH_POST,
+    BENCH_CLEAR,
+    BENCH_NUM_OPS,
+} BenchOp;
+
+static const char *opNames[BENCH_NUM_OPS] = { "show", "post", "clear" };
+
+/**
+ * The benchmark command line arguments.
+ */
+typedef struct BenchArgs {
+    const char *svrHost;
+    const char *svrPort;
+    int         numThreads;
+    int         numConns;          // Across all threads
+    double      rate;              // Requests per second across all threads
+    double      duration;          // Seconds, including the warmup
+    double      warmup;            // Seconds not measured
+    int         mix[BENCH_NUM_OPS];// Relative weights
+    int         minSize;           // POST payload bytes
+    int         maxSize;
+    int         numBoards;
+    int         batch;             // Posts per POST request
+    bool        compress;          // Ask for compressed boards
+    bool        json;
+} BenchArgs;
+
+/**
+ * A request waiting for its reply: the argument of its callback.
+ */
+typedef struct BenchSent {
+    struct BenchSent   *next;       // On the thread's free list
+    struct BenchThread *thread;
+    uint64_t            intended;   // When the schedule said to send it
+    BenchOp             op;
+} BenchSent;
+
+/**
+ * Per-thread state and results.  Each thread has a client of its own,
+ * with its share of the connections, and polls it itself.
+ */
+typedef struct BenchThread {
+    pthread_t   thread;
+    int         id;
+    BbClient   *client;
+    int         numConns;
+    unsigned    seed;
+    BenchSent  *freeSent;
+    uint64_t    sent;
+    uint64_t    completed;
+    uint64_t    errors;
+    uint64_t    measured;    // Completed within the measured window
+    BbStats     stats;       // Of the client, once done
+    Histogram  *hist[BENCH_NUM_OPS];
+} BenchThread;
+
+static BenchArgs benchArgs;
+static uint64_t  startNs;      // Schedule start, shared by all threads
+static uint64_t  measureNs;    // End of the warmup
+static uint64_t  endNs;        // Nothing is scheduled from here on
+static char      payload[MAX_POST_DATA_SIZE];
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The monotonic clock in nanoseconds.
+ *
+ **************************************************************************
+ */
+static inline uint64_t
+NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the usage message and exit the program.
+ *
+ **************************************************************************
+ */
+static void
+Usage(const char *prog) // IN
+{
+    Log("Usage:\n");
+    Log("    %s [options] <server_host> <server_port>\n", prog);
+    Log("Options:\n");
+    Log("    -t, --threads N     Load generating threads (default 1)\n");
+    Log("    -c, --conns N       Connections across all threads "
+        "(default 16)\n");
+    Log("    -r, --rate N        Requests per second to send (default "
+        "10000)\n");
+    Log("    -d, --duration S    Seconds to run (default 10)\n");
+    Log("    -W, --warmup S      Seconds at the start not measured "
+        "(default 1)\n");
+    Log("    -x, --mix S:P:C     Relative weights of SHOW, POST and CLEAR "
+        "(default 90:10:0)\n");
+    Log("    -s, --size N[-M]    POST payload bytes, uniform in N..M "
+        "(default 64)\n");
+    Log("    -b, --boards N      Spread requests over N boards "
+        "(default 1)\n");
+    Log("    -B, --batch N       Send each POST as a POST_BATCH of N posts "
+        "(default 1)\n");
+    Log("    -z, --compress      Ask for compressed SHOW replies\n");
+    Log("    -j, --json          Print the results as JSON\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Parse the benchmark command line arguments.
+ *
+ **************************************************************************
+ */
+static void
+ParseArgs(int argc,          // IN
+          char *argv[],      // IN
+          BenchArgs *args)   // OUT
+{
+    static const struct option options[] = {
+        { "threads",  required_argument, NULL, 't' },
+        { "conns",    required_argument, NULL, 'c' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup",   required_argument, NULL, 'W' },
+        { "mix",      required_argument, NULL, 'x' },
+        { "size",     required_argument, NULL, 's' },
+        { "boards",   required_argument, NULL, 'b' },
+        { "batch",    required_argument, NULL, 'B' },
+        { "compress", no_argument,       NULL, 'z' },
+        { "json",     no_argument,       NULL, 'j' },
+        { NULL,       0,                 NULL, 0   },
+    };
+    int opt;
+
+    memset(args, 0, sizeof *args);
+    args->numThreads        = 1;
+    args->numConns          = 16;
+    args->rate              = 10000;
+    args->duration          = 10;
+    args->warmup            = 1;
+    args->mix[BENCH_SHOW]   = 90;
+    args->mix[BENCH_POST]   = 10;
+    args->minSize           = 64;
+    args->maxSize           = 64;
+    args->numBoards         = 1;
+    args->batch             = 1;
+
+    while ((opt = getopt_long(argc, argv, "t:c:r:d:W:x:s:b:B:zj",
+                              options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            args->numThreads = atoi(optarg);
+            break;
+        case 'c':
+            args->numConns = atoi(optarg);
+            break;
+        case 'r':
+            args->rate = atof(optarg);
+            break;
+        case 'd':
+            args->duration = atof(optarg);
+            break;
+        case 'W':
+            args->warmup = atof(optarg);
+            break;
+        case 'x':
+            if (sscanf(optarg, "%d:%d:%d", &args->mix[BENCH_SHOW],
+                       &args->mix[BENCH_POST], &args->mix[BENCH_CLEAR]) != 3 ||
+                args->mix[BENCH_SHOW] < 0 || args->mix[BENCH_POST] < 0 ||
+                args->mix[BENCH_CLEAR] < 0 ||
+                args->mix[BENCH_SHOW] + args->mix[BENCH_POST] +
+                args->mix[BENCH_CLEAR] == 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 's':
+            switch (sscanf(optarg, "%d-%d", &args->minSize, &args->maxSize)) {
+            case 1:
+                args->maxSize = args->minSize;
+                break;
+            case 2:
+                break;
+            default:
+                Usage(argv[0]);
+            }
+            break;
+        case 'b':
+            args->numBoards = atoi(optarg);
+            break;
+        case 'B':
+            args->batch = atoi(optarg);
+            break;
+        case 'z':
+            args->compress = true;
+            break;
+        case 'j':
+            args->json = true;
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 2 ||
+        args->numThreads <= 0 || args->numConns < args->numThreads ||
+        args->rate <= 0 || args->duration <= 0 ||
+        args->warmup < 0 || args->warmup >= args->duration ||
+        args->minSize <= 0 || args->maxSize < args->minSize ||
+        args->numBoards <= 0 || args->batch <= 0 ||
+        (args->batch > 1 ? (long)args->batch *
+                           (args->maxSize + sizeof(MsgBatchItem)) :
+                           args->maxSize) > MAX_POST_DATA_SIZE) {
+        Usage(argv[0]);
+    }
+    args->svrHost = argv[optind];
+    args->svrPort = argv[optind + 1];
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Account for a reply.
+ *
+ * Latency runs from when the request was due, not when it was written,
+ * so time spent queued behind a slow reply is counted instead of hidden.
+ * Requests still unanswered when the client is destroyed are not
+ * counted as completed.
+ *
+ **************************************************************************
+ */
+static void
+BenchComplete(void *arg,         // IN: BenchSent
+              BbReply *reply)    // IN
+{
+    BenchSent *s = arg;
+    BenchThread *t = s->thread;
+    uint64_t now = NowNs();
+
+    if (reply->status != BB_ERR_CLOSED) {
+        t->completed++;
+        if (reply->status != MSG_STATUS_SUCCESS) {
+            t->errors++;
+        }
+        if (s->intended >= measureNs && s->intended < endNs) {
+            t->measured++;
+            HistRecord(t->hist[s->op], now - s->intended);
+        }
+    }
+    s->next = t->freeSent;
+    t->freeSent = s;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send one request, due at intended.
+ *
+ * The operation, board and payload size are drawn at random according to
+ * the command line.  The client picks the connection.
+ *
+ **************************************************************************
+ */
+static void
+BenchSend(BenchThread *t,      // IN/OUT
+          uint64_t intended)   // IN
+{
+    int total = benchArgs.mix[BENCH_SHOW] + benchArgs.mix[BENCH_POST] +
+                benchArgs.mix[BENCH_CLEAR];
+    int pick = rand_r(&t->seed) % total;
+    const char *posts[benchArgs.batch];
+    int sizes[benchArgs.batch];
+    char title[MAX_TITLE_LEN + 1];
+    BenchSent *s = t->freeSent;
+    BenchOp op;
+    bool ok;
+    int i;
+
+    for (op = 0; pick >= benchArgs.mix[op]; op++) {
+        pick -= benchArgs.mix[op];
+    }
+    if (op == BENCH_POST) {
+        for (i = 0; i < benchArgs.batch; i++) {
+            sizes[i] = benchArgs.minSize;
+            if (benchArgs.maxSize > benchArgs.minSize) {
+                sizes[i] += rand_r(&t->seed) %
+                            (benchArgs.maxSize - benchArgs.minSize + 1);
+            }
+            posts[i] = payload;
+        }
+    }
+    snprintf(title, sizeof title, "bench%d",
+             rand_r(&t->seed) % benchArgs.numBoards);
+
+    if (s != NULL) {
+        t->freeSent = s->next;
+    } else if ((s = malloc(sizeof *s)) == NULL) {
+        Error("Failed to allocate a request\n");
+        exit(EXIT_FAILURE);
+    }
+    s->thread   = t;
+    s->intended = intended;
+    s->op       = op;
+
+    switch (op) {
+    case BENCH_SHOW:
+        ok = BbShow(t->client, title, BenchComplete, s);
+        break;
+    case BENCH_POST:
+        ok = benchArgs.batch > 1 ?
+             BbPostBatch(t->client, title, posts, sizes, benchArgs.batch,
+                         BenchComplete, s) :
+             BbPost(t->client, title, payload, sizes[0], BenchComplete, s);
+        break;
+    default:
+        ok = BbClear(t->client, title, BenchComplete, s);
+        break;
+    }
+    if (!ok) {
+        exit(EXIT_FAILURE);
+    }
+    t->sent++;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Connect this thread's share of the connections.
+ *
+ **************************************************************************
+ */
+static void
+BenchThreadInit(BenchThread *t)  // IN/OUT
+{
+    BbConfig cfg;
+    int i;
+
+    for (i = 0; i < BENCH_NUM_OPS; i++) {
+        t->hist[i] = HistAlloc();
+        if (t->hist[i] == NULL) {
+            Error("Failed to allocate the thread state\n");
+            while (--i >= 0) {
+                HistFree(t->hist[i]);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+    t->seed = t->id * 7919 + 1;
+
+    BbConfigInit(&cfg, benchArgs.svrHost, benchArgs.svrPort);
+    cfg.numConns = t->numConns;
+    cfg.compress = benchArgs.compress;
+    t->client = BbClientCreate(&cfg);
+    if (t->client == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    if (!BbClientWaitReady(t->client, BENCH_CONNECT_MS)) {
+        Error("Failed to connect to the server\n");
+        exit(EXIT_FAILURE);
+    }
+    if (benchArgs.compress && !(BbClientCaps(t->client) & MSG_CAP_LZ)) {
+        Error("The server does not support compression\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief A load generating thread.
+ *
+ * Requests are sent open loop: the k-th one is due at a fixed time from
+ * the start, whether or not earlier ones were answered, and goes to the
+ * least loaded of the thread's connections.  A thread that falls behind
+ * sends what is overdue at once and the delay shows up in the latencies.
+ * Once the schedule ends, outstanding replies are awaited for a few
+ * seconds.
+ *
+ **************************************************************************
+ */
+static void *
+BenchThreadLoop(void *arg)  // IN
+{
+    BenchThread *t = arg;
+    double interval = NS_PER_SEC * benchArgs.numThreads / benchArgs.rate;
+    double offset = interval * t->id / benchArgs.numThreads;
+    uint64_t k = 0, due = startNs + (uint64_t)offset;
+
+    for (;;) {
+        uint64_t now = NowNs();
+        int timeout;
+
+        while (due < endNs && due <= now) {
+            BenchSend(t, due);
+            due = startNs + (uint64_t)(offset + interval * ++k);
+        }
+
+        if (due >= endNs) {
+            if (BbClientPending(t->client) == 0 ||
+                now >= endNs + BENCH_DRAIN_NS) {
+                break;
+            }
+            timeout = 100;
+        } else {
+            /* Sleep until the next request is due; spin if that's soon. */
+            timeout = due > now ? (due - now) / 1000000 : 0;
+        }
+        BbClientPoll(t->client, timeout);
+    }
+
+    BbClientGetStats(t->client, &t->stats);
+    BbClientDestroy(t->client);
+    while (t->freeSent != NULL) {
+        BenchSent *s = t->freeSent;
+
+        t->freeSent = s->next;
+        free(s);
+    }
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print one line of latency percentiles, in microseconds.
+ *
+ **************************************************************************
+ */
+static void
+PrintLatency(const char *name,     // IN
+             const Histogram *h)   // IN
+{
+    static const double pcts[] = { 50, 90, 99, 99.9, 99.99 };
+    int i;
+
+    if (benchArgs.json) {
+        printf("    \"%s\": { \"count\": %llu, \"mean\": %.1f", name,
+               (unsigned long long)h->count, HistMean(h) / 1000);
+        for (i = 0; i < ARRAYSIZE(pcts); i++) {
+            printf(", \"p%g\": %.1f", pcts[i],
+                   HistPercentile(h, pcts[i]) / 1000.0);
+        }
+        printf(", \"max\": %.1f }", h->max / 1000.0);
+        return;
+    }
+
+    printf("%-8s %10llu %9.1f", name, (unsigned long long)h->count,
+           HistMean(h) / 1000);
+    for (i = 0; i < ARRAYSIZE(pcts); i++) {
+        printf(" %9.1f", HistPercentile(h, pcts[i]) / 1000.0);
+    }
+    printf(" %9.1f\n", h->max / 1000.0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Merge the threads' results and print them.
+ *
+ **************************************************************************
+ */
+static void
+PrintResults(BenchThread *threads)  // IN
+{
+    Histogram *all = HistAlloc(), *ops[BENCH_NUM_OPS];
+    uint64_t sent = 0, completed = 0, errors = 0, measured = 0, rxBytes = 0;
+    uint64_t lost = 0;
+    double window = benchArgs.duration - benchArgs.warmup;
+    int i, op;
+
+    for (op = 0; op < BENCH_NUM_OPS; op++) {
+        ops[op] = all != NULL ? HistAlloc() : NULL;
+        if (ops[op] == NULL) {
+            Error("Failed to allocate the results\n");
+            while (--op >= 0) {
+                HistFree(ops[op]);
+            }
+            HistFree(all);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < benchArgs.numThreads; i++) {
+        sent      += threads[i].sent;
+        completed += threads[i].completed;
+        errors    += threads[i].errors;
+        measured  += threads[i].measured;
+        rxBytes   += threads[i].stats.rxBytes;
+        lost      += threads[i].stats.failures;
+        for (op = 0; op < BENCH_NUM_OPS; op++) {
+            HistAdd(ops[op], threads[i].hist[op]);
+            HistAdd(all, threads[i].hist[op]);
+        }
+    }
+
+    if (benchArgs.json) {
+        printf("{\n  \"rate\": %.0f, \"threads\": %d, \"conns\": %d, "
+               "\"duration\": %.1f, \"warmup\": %.1f, \"batch\": %d,\n",
+               benchArgs.rate, benchArgs.numThreads, benchArgs.numConns,
+               benchArgs.duration, benchArgs.warmup, benchArgs.batch);
+        printf("  \"sent\": %llu, \"completed\": %llu, \"errors\": %llu, "
+               "\"unanswered\": %llu, \"throughput\": %.1f, "
+               "\"rx_bytes\": %llu, \"conns_lost\": %llu,\n",
+               (unsigned long long)sent, (unsigned long long)completed,
+               (unsigned long long)errors,
+               (unsigned long long)(sent - completed), measured / window,
+               (unsigned long long)rxBytes, (unsigned long long)lost);
+        printf("  \"latency_us\": {\n");
+        PrintLatency("all", all);
+        for (op = 0; op < BENCH_NUM_OPS; op++) {
+            if (ops[op]->count > 0) {
+                printf(",\n");
+                PrintLatency(opNames[op], ops[op]);
+            }
+        }
+        printf("\n  }\n}\n");
+    } else {
+        printf("Target %.0f req/s over %d connection(s), %d thread(s), "
+               "%.1fs (%.1fs warmup)\n", benchArgs.rate, benchArgs.numConns,
+               benchArgs.numThreads, benchArgs.duration, benchArgs.warmup);
+        if (benchArgs.batch > 1) {
+            printf("Each POST is a POST_BATCH of %d posts\n",
+                   benchArgs.batch);
+        }
+        printf("Sent %llu, completed %llu, errors %llu, unanswered %llu\n",
+               (unsigned long long)sent, (unsigned long long)completed,
+               (unsigned long long)errors,
+               (unsigned long long)(sent - completed));
+        if (lost > 0) {
+            printf("Lost %llu connection(s)\n",
+                   (unsigned long long)lost);
+        }
+        printf("Received %.1f MB, %.0f bytes per reply\n",
+               rxBytes / 1e6, completed > 0 ? (double)rxBytes / completed : 0);
+        printf("Throughput %.1f req/s\n\n", measured / window);
+        printf("%-8s %10s %9s %9s %9s %9s %9s %9s %9s\n", "latency",
+               "count", "mean", "p50", "p90", "p99", "p99.9", "p99.99",
+               "max");
+        PrintLatency("all", all);
+        for (op = 0; op < BENCH_NUM_OPS; op++) {
+            if (ops[op]->count > 0) {
+                PrintLatency(opNames[op], ops[op]);
+            }
+        }
+        printf("(microseconds, from when each request was due)\n");
+    }
+
+    HistFree(all);
+    for (op = 0; op < BENCH_NUM_OPS; op++) {
+        HistFree(ops[op]);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Main entry point.
+ *
+ **************************************************************************
+ */
+int
+main(int argc, char *argv[])
+{
+    BenchThread *threads;
+    int i, err;
+
+    ParseArgs(argc, argv, &benchArgs);
+    signal(SIGPIPE, SIG_IGN);
+    memset(payload, 'x', sizeof payload);
+
+    threads = calloc(benchArgs.numThreads, sizeof *threads);
+    if (threads == NULL) {
+        Error("Failed to allocate the threads\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < benchArgs.numThreads; i++) {
+        threads[i].id       = i;
+        threads[i].numConns = benchArgs.numConns / benchArgs.numThreads +
+                              (i < benchArgs.numConns % benchArgs.numThreads);
+        BenchThreadInit(&threads[i]);
+    }
+
+    startNs   = NowNs() + NS_PER_SEC / 10;
+    measureNs = startNs + benchArgs.warmup * NS_PER_SEC;
+    endNs     = startNs + benchArgs.duration * NS_PER_SEC;
+
+    for (i = 0; i < benchArgs.numThreads; i++) {
+        err = pthread_create(&threads[i].thread, NULL, BenchThreadLoop,
+                             &threads[i]);
+        if (err != 0) {
+            Error("Failed to start a thread: %s\n", strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < benchArgs.numThreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    PrintResults(threads);
+    return 0;
+}
@@ -0,0 +1,424 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "common.h"
+#include "blackboard.h"
+
+#define CHECK_TIMEOUT_MS   5000
+#define CHECK_NUM_POSTS    200
+#define CHECK_BIG_POST     20000
+
+/**
+ * What a check remembers of the board it works on: the contents the
+ * server should have, and those a subscription has pieced together.
+ */
+typedef struct CheckBoard {
+    char   title[MAX_TITLE_LEN + 1];
+    char  *expect;
+    int    expectSize;
+    char  *seen;          // From NOTIFY messages
+    int    seenSize;
+    int    notifies;
+} CheckBoard;
+
+/**
+ * The reply a request got, copied out of its callback.
+ */
+typedef struct CheckReply {
+    bool     done;
+    int      status;
+    MsgType  type;
+    char    *data;        // Decompressed board, if the reply has one
+    int      dataSize;
+} CheckReply;
+
+static BbClient *client;
+static int       numChecks;
+static char      payload[MAX_POST_DATA_SIZE + 1];
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the usage message and exit the program.
+ *
+ **************************************************************************
+ */
+static void
+Usage(const char *prog) // IN
+{
+    Log("Usage:\n");
+    Log("    %s [options] <server_host> <server_port>\n", prog);
+    Log("Options:\n");
+    Log("    -z, --compress      Ask for compressed boards and posts\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Count a check, and exit the program if it failed.
+ *
+ **************************************************************************
+ */
+static void
+Check(bool ok,            // IN
+      const char *what)   // IN
+{
+    numChecks++;
+    if (!ok) {
+        Error("FAILED: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append size bytes to a growing buffer.
+ *
+ **************************************************************************
+ */
+static void
+BufAppend(char **buf,         // IN/OUT
+          int *len,           // IN/OUT
+          const char *data,   // IN
+          int size)           // IN
+{
+    *buf = realloc(*buf, *len + size + 1);
+    if (*buf == NULL) {
+        Error("Failed to allocate %d bytes\n", *len + size + 1);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(*buf + *len, data, size);
+    *len += size;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Callback of a request: keep its reply for CheckWait().
+ *
+ **************************************************************************
+ */
+static void
+CheckComplete(void *arg,         // IN: CheckReply
+              BbReply *reply)    // IN
+{
+    CheckReply *r = arg;
+    const char *data = reply->data;
+    int size = reply->dataSize;
+
+    if (reply->type == MSG_BOARD || reply->type == MSG_BOARD_LZ) {
+        data = BbReplyBoard(reply, &size);
+    }
+    r->done     = true;
+    r->status   = reply->status;
+    r->type     = reply->type;
+    r->dataSize = 0;
+    if (data != NULL && size > 0) {
+        BufAppend(&r->data, &r->dataSize, data, size);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Callback of the subscription: apply each NOTIFY to the copy.
+ *
+ **************************************************************************
+ */
+static void
+CheckNotify(void *arg,         // IN: CheckBoard
+            BbReply *reply)    // IN
+{
+    CheckBoard *b = arg;
+
+    if (reply->type != MSG_NOTIFY) {
+        return;
+    }
+    b->notifies++;
+    if (reply->status == MSG_STATUS_RESET) {
+        b->seenSize = 0;
+    }
+    BufAppend(&b->seen, &b->seenSize, reply->data, reply->dataSize);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Poll until r has its reply, exiting if it does not come.
+ *
+ **************************************************************************
+ */
+static void
+CheckWait(CheckReply *r,      // IN
+          const char *what)   // IN
+{
+    int waitedMs;
+
+    for (waitedMs = 0; !r->done && waitedMs < CHECK_TIMEOUT_MS;
+         waitedMs += 10) {
+        BbClientPoll(client, 10);
+    }
+    Check(r->done, what);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Post size bytes to the board and expect status in reply.
+ *
+ * The post is kept in b's expected contents if it succeeds.
+ *
+ **************************************************************************
+ */
+static void
+CheckPost(CheckBoard *b,        // IN/OUT
+          const char *data,     // IN
+          int size,             // IN
+          int status)           // IN
+{
+    CheckReply r = { 0 };
+
+    Check(BbPost(client, b->title, data, size, CheckComplete, &r),
+          "queue a POST");
+    CheckWait(&r, "reply to a POST");
+    Check(r.status == status, "status of a POST");
+    if (status == MSG_STATUS_SUCCESS) {
+        BufAppend(&b->expect, &b->expectSize, data, size);
+        BufAppend(&b->expect, &b->expectSize, "\n", 1);
+    }
+    free(r.data);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief SHOW the board and compare it with what was posted.
+ *
+ **************************************************************************
+ */
+static void
+CheckShow(CheckBoard *b)  // IN
+{
+    CheckReply r = { 0 };
+
+    Check(BbShow(client, b->title, CheckComplete, &r), "queue a SHOW");
+    CheckWait(&r, "reply to a SHOW");
+    Check(r.status == MSG_STATUS_SUCCESS, "status of a SHOW");
+    Check(r.dataSize == b->expectSize &&
+          (r.dataSize == 0 || memcmp(r.data, b->expect, r.dataSize) == 0),
+          "board shown matches the posts");
+    free(r.data);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Whether the subscription's copy matches what was posted.
+ *
+ **************************************************************************
+ */
+static bool
+SeenMatches(const CheckBoard *b)  // IN
+{
+    return b->seenSize == b->expectSize &&
+           (b->seenSize == 0 || memcmp(b->seen, b->expect, b->seenSize) == 0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Poll until the subscription's copy matches the board.
+ *
+ **************************************************************************
+ */
+static void
+CheckNotified(CheckBoard *b)  // IN
+{
+    int waitedMs;
+
+    for (waitedMs = 0; waitedMs < CHECK_TIMEOUT_MS; waitedMs += 10) {
+        if (SeenMatches(b)) {
+            break;
+        }
+        BbClientPoll(client, 10);
+    }
+    Check(SeenMatches(b),
+          "board pushed to a subscriber matches the posts");
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run every request type against the board, checking each reply.
+ *
+ * Posts of all sizes go out back to back, pipelined on the client's one
+ * connection so they land in order; the board is then read back whole,
+ * as a subscriber sees it, and after a CLEAR.
+ *
+ **************************************************************************
+ */
+static void
+CheckBoardOps(CheckBoard *b)  // IN/OUT
+{
+    CheckReply posts[CHECK_NUM_POSTS];
+    CheckReply r = { 0 };
+    BbSub *sub;
+    int i, size;
+
+    sub = BbSubscribe(client, b->title, CheckNotify, b);
+    Check(sub != NULL, "queue a SUBSCRIBE");
+
+    CheckPost(b, "hello", 5, MSG_STATUS_SUCCESS);
+    CheckShow(b);
+
+    memset(posts, 0, sizeof posts);
+    for (i = 0; i < CHECK_NUM_POSTS; i++) {
+        size = i == CHECK_NUM_POSTS / 2 ? CHECK_BIG_POST : 1 + i * 7;
+        Check(BbPost(client, b->title, payload + i, size, CheckComplete,
+                     &posts[i]),
+              "queue a POST");
+        BufAppend(&b->expect, &b->expectSize, payload + i, size);
+        BufAppend(&b->expect, &b->expectSize, "\n", 1);
+    }
+    for (i = 0; i < CHECK_NUM_POSTS; i++) {
+        CheckWait(&posts[i], "reply to a pipelined POST");
+        Check(posts[i].status == MSG_STATUS_SUCCESS,
+              "status of a pipelined POST");
+        free(posts[i].data);
+    }
+    CheckShow(b);
+    CheckNotified(b);
+    Check(b->notifies > 0, "a subscriber is notified");
+
+    CheckPost(b, payload, MAX_POST_DATA_SIZE + 1, MSG_STATUS_TOO_LARGE);
+    CheckPost(b, payload, MAX_POST_DATA_SIZE, MSG_STATUS_SUCCESS);
+    CheckShow(b);
+
+    Check(BbClear(client, b->title, CheckComplete, &r), "queue a CLEAR");
+    CheckWait(&r, "reply to a CLEAR");
+    Check(r.status == MSG_STATUS_SUCCESS, "status of a CLEAR");
+    free(r.data);
+    b->expectSize = 0;
+    CheckShow(b);
+    CheckNotified(b);
+
+    memset(&r, 0, sizeof r);
+    Check(BbUnsubscribe(client, sub, CheckComplete, &r),
+          "queue an UNSUBSCRIBE");
+    CheckWait(&r, "reply to an UNSUBSCRIBE");
+    Check(r.status == MSG_STATUS_SUCCESS, "status of an UNSUBSCRIBE");
+    free(r.data);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Check that LIST names the board and STATS answers.
+ *
+ **************************************************************************
+ */
+static void
+CheckServerOps(const CheckBoard *b)  // IN
+{
+    CheckReply r = { 0 };
+    char line[MAX_TITLE_LEN + 3];
+    char *titles = NULL;
+    int len = 0;
+
+    Check(BbList(client, CheckComplete, &r), "queue a LIST");
+    CheckWait(&r, "reply to a LIST");
+    Check(r.status == MSG_STATUS_SUCCESS && r.type == MSG_TITLES,
+          "status of a LIST");
+    BufAppend(&titles, &len, "\n", 1);
+    BufAppend(&titles, &len, r.data, r.dataSize);
+    titles[len] = '\0';
+    snprintf(line, sizeof line, "\n%s\n", b->title);
+    Check(strstr(titles, line) != NULL, "LIST names the board");
+    free(titles);
+    free(r.data);
+
+    memset(&r, 0, sizeof r);
+    Check(BbStatsText(client, CheckComplete, &r), "queue a STATS");
+    CheckWait(&r, "reply to a STATS");
+    Check(r.type == MSG_STATS_TEXT && r.dataSize > 0, "reply to a STATS");
+    free(r.data);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "compress", no_argument,       NULL, 'z' },
+        { NULL,       0,                 NULL, 0   },
+    };
+    CheckBoard board;
+    BbConfig cfg;
+    int opt, i;
+
+    BbConfigInit(&cfg, NULL, NULL);
+    while ((opt = getopt_long(argc, argv, "z", options, NULL)) != -1) {
+        switch (opt) {
+        case 'z':
+            cfg.compress = true;
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2) {
+        Usage(argv[0]);
+    }
+    cfg.host = argv[optind];
+    cfg.port = argv[optind + 1];
+
+    signal(SIGPIPE, SIG_IGN);
+    for (i = 0; i < (int)sizeof payload; i++) {
+        payload[i] = 'a' + i % 26;
+    }
+
+    client = BbClientCreate(&cfg);
+    if (client == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    Check(BbClientWaitReady(client, CHECK_TIMEOUT_MS),
+          "connect to the server");
+
+    memset(&board, 0, sizeof board);
+    snprintf(board.title, sizeof board.title, "bbcheck-%d", getpid());
+    CheckBoardOps(&board);
+    CheckServerOps(&board);
+
+    BbClientDestroy(client);
+    free(board.expect);
+    free(board.seen);
+    printf("%d checks passed\n", numChecks);
+    return 0;
+}
@@ -0,0 +1,1780 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "lz.h"
+#include "recvbuf.h"
+#include "blackboard.h"
+
+#define BB_NS_PER_MS      1000000ULL
+#define BB_TICK_MS        100            // Timeouts are checked this often
+#define BB_MAX_EVENTS     64
+#define BB_MAX_REPLY      (1 << 30)      // Larger is a broken stream
+
+typedef enum BbConnState {
+    BB_CONN_DOWN,         // Waiting to connect again at retryNs
+    BB_CONN_CONNECTING,   // connect() in progress
+    BB_CONN_HELLO,        // Asked for compression, no requests yet
+    BB_CONN_READY,
+} BbConnState;
+
+/**
+ * A queued or sent request: msg and its payload, as sent.  Requests the
+ * client makes itself (HELLO, resubscriptions) have no callback.
+ */
+typedef struct BbOp {
+    struct BbOp  *next;
+    BbCallback    cb;
+    void         *arg;
+    BbSub        *sub;        // Of a SUBSCRIBE or UNSUBSCRIBE
+    bool          internal;   // Not counted in BbClientPending()
+    uint64_t      queuedNs;
+    uint64_t      sentNs;
+    MsgHdr        msg;
+} BbOp;
+
+/**
+ * A subscription.  While its connection is up it is on that connection's
+ * list under the reqId of the SUBSCRIBE; otherwise on the client's
+ * orphans until a connection is ready to take it.
+ */
+struct BbSub {
+    BbSub              *next;
+    struct BbConn      *conn;
+    unsigned            reqId;
+    char                title[MAX_TITLE_LEN + 1];
+    bool                havePos;
+    MsgBoardPos         pos;      // Where the last NOTIFY left off
+    BbCallback          cb;
+    void               *arg;
+};
+
+/**
+ * One connection of the pool.  Replies come back in request order, so
+ * the requests in flight are a FIFO.
+ */
+typedef struct BbConn {
+    struct BbClient    *client;
+    int                 sd;
+    BbConnState         state;
+    const struct addrinfo *addr;   // Being connected to
+    RecvBuf             in;
+    char               *out;       // Requests not yet written
+    int                 outLen;
+    int                 outCap;
+    bool                wantOut;   // Registered for EPOLLOUT
+    BbOp               *head;
+    BbOp              **tail;
+    int                 inFlight;
+    unsigned            nextReqId;
+    unsigned            caps;
+    BbSub              *subs;
+    uint64_t            retryNs;
+    int                 retryMs;
+    uint64_t            deadlineNs;   // CONNECTING: give up
+    uint64_t            activeNs;     // Last sent or received
+} BbConn;
+
+struct BbClient {
+    BbConfig            cfg;
+    char               *host;
+    char               *port;
+    struct addrinfo    *addrs;
+    int                 epfd;
+    int                 wakeFd;
+    BbConn             *conns;
+    int                 rr;
+
+    /* Requests made by any thread, taken by the poller. */
+    pthread_mutex_t     lock;
+    BbOp               *submitted;
+    BbOp              **submittedTail;
+    bool                wakePending;
+
+    /* Only used by the poller. */
+    BbOp               *queued;       // Waiting for a connection
+    BbOp              **queuedTail;
+    BbSub              *orphans;
+    uint64_t            tickNs;
+
+    pthread_t           thread;
+    bool                threadStarted;
+    atomic_bool         stop;
+
+    atomic_int          pending;
+    atomic_uint         caps;
+    _Atomic uint64_t    stats[sizeof(BbStats) / sizeof(uint64_t)];
+};
+
+#define BB_STAT(field)   (offsetof(BbStats, field) / sizeof(uint64_t))
+
+static void BbConnFail(BbConn *conn, int status);
+static void BbConnSend(BbConn *conn, BbOp *op);
+static void BbCloseConns(BbClient *c);
+static void BbTakeSubmitted(BbClient *c);
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The monotonic clock in nanoseconds.
+ *
+ **************************************************************************
+ */
+static inline uint64_t
+BbNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add to a client counter.
+ *
+ **************************************************************************
+ */
+static inline void
+BbStatAdd(BbClient *c,     // IN
+          size_t field,    // IN: BB_STAT()
+          uint64_t n)      // IN
+{
+    atomic_fetch_add_explicit(&c->stats[field], n, memory_order_relaxed);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Fill in the defaults for a server at host and port.
+ *
+ **************************************************************************
+ */
+void
+BbConfigInit(BbConfig *cfg,        // OUT
+             const char *host,     // IN
+             const char *port)     // IN
+{
+    memset(cfg, 0, sizeof *cfg);
+    cfg->host       = host;
+    cfg->port       = port;
+    cfg->numConns   = BB_DEFAULT_CONNS;
+    cfg->timeoutMs  = BB_DEFAULT_TIMEOUT_MS;
+    cfg->healthMs   = BB_DEFAULT_HEALTH_MS;
+    cfg->retryMinMs = BB_DEFAULT_RETRY_MIN_MS;
+    cfg->retryMaxMs = BB_DEFAULT_RETRY_MAX_MS;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Create a client.  Connections are made by BbClientPoll().
+ *
+ * The server's name is resolved here, once, so polling never blocks on
+ * DNS.  Returns NULL on failure.
+ *
+ **************************************************************************
+ */
+BbClient *
+BbClientCreate(const BbConfig *cfg)  // IN
+{
+    struct addrinfo hints;
+    struct epoll_event ev;
+    BbClient *c;
+    int err, i;
+
+    if (cfg->numConns <= 0 || cfg->depth < 0 || cfg->timeoutMs <= 0 ||
+        cfg->healthMs <= 0 || cfg->retryMinMs <= 0 ||
+        cfg->retryMaxMs < cfg->retryMinMs) {
+        Error("Invalid client configuration\n");
+        return NULL;
+    }
+
+    c = calloc(1, sizeof *c);
+    if (c == NULL) {
+        Error("Failed to allocate the client\n");
+        return NULL;
+    }
+    c->cfg    = *cfg;
+    c->epfd   = -1;
+    c->wakeFd = -1;
+    c->host   = strdup(cfg->host);
+    c->port   = strdup(cfg->port);
+    c->conns  = calloc(cfg->numConns, sizeof *c->conns);
+    pthread_mutex_init(&c->lock, NULL);
+    c->submittedTail = &c->submitted;
+    c->queuedTail    = &c->queued;
+    if (c->host == NULL || c->port == NULL || c->conns == NULL) {
+        Error("Failed to allocate the client\n");
+        BbClientDestroy(c);
+        return NULL;
+    }
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    err = getaddrinfo(c->host, c->port, &hints, &c->addrs);
+    if (err != 0) {
+        Error("Failed to resolve %s: %s\n", c->host, gai_strerror(err));
+        c->addrs = NULL;
+        BbClientDestroy(c);
+        return NULL;
+    }
+
+    c->epfd   = epoll_create1(EPOLL_CLOEXEC);
+    c->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (c->epfd < 0 || c->wakeFd < 0 ||
+        epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->wakeFd, &ev) < 0) {
+        perror("Failed to set up the client's epoll instance");
+        BbClientDestroy(c);
+        return NULL;
+    }
+
+    for (i = 0; i < cfg->numConns; i++) {
+        BbConn *conn = &c->conns[i];
+
+        conn->client  = c;
+        conn->sd      = -1;
+        conn->state   = BB_CONN_DOWN;
+        conn->retryMs = cfg->retryMinMs;
+        conn->tail    = &conn->head;
+        RecvBufInit(&conn->in);
+    }
+    return c;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Complete a request: run its callback and free it.
+ *
+ **************************************************************************
+ */
+static void
+BbOpComplete(BbClient *c,        // IN
+             BbOp *op,           // IN
+             BbReply *reply)     // IN/OUT
+{
+    if (op->cb != NULL) {
+        op->cb(op->arg, reply);
+    }
+    free(reply->unpacked);
+    reply->unpacked = NULL;
+    if (!op->internal) {
+        BbStatAdd(c, BB_STAT(requests), 1);
+        if (reply->status < 0) {
+            BbStatAdd(c, BB_STAT(errors), 1);
+        }
+        atomic_fetch_sub(&c->pending, 1);
+    }
+    free(op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Complete a request that got no reply.
+ *
+ **************************************************************************
+ */
+static void
+BbOpFail(BbClient *c,    // IN
+         BbOp *op,       // IN
+         int status)     // IN: BB_ERR_*
+{
+    BbReply reply;
+
+    memset(&reply, 0, sizeof reply);
+    reply.status = status;
+    MsgGetTitle(&op->msg, reply.title);
+    BbOpComplete(c, op, &reply);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop and free a client.
+ *
+ * Requests still outstanding complete with BB_ERR_CLOSED, on the calling
+ * thread; subscriptions are freed.  Not to be called from a callback.
+ *
+ **************************************************************************
+ */
+void
+BbClientDestroy(BbClient *c)  // IN
+{
+    BbOp *op;
+    BbSub *sub;
+
+    if (c->threadStarted) {
+        uint64_t one = 1;
+
+        atomic_store(&c->stop, true);
+        if (write(c->wakeFd, &one, sizeof one) < 0) {
+            perror("Failed to wake the client thread");
+        }
+        pthread_join(c->thread, NULL);
+    }
+
+    if (c->conns != NULL) {
+        BbCloseConns(c);
+        BbTakeSubmitted(c);
+    }
+    while ((sub = c->orphans) != NULL) {
+        c->orphans = sub->next;
+        free(sub);
+    }
+    while ((op = c->queued) != NULL) {
+        c->queued = op->next;
+        free(op->sub);
+        BbOpFail(c, op, BB_ERR_CLOSED);
+    }
+
+    if (c->addrs != NULL) {
+        freeaddrinfo(c->addrs);
+    }
+    if (c->wakeFd >= 0) {
+        close(c->wakeFd);
+    }
+    if (c->epfd >= 0) {
+        close(c->epfd);
+    }
+    pthread_mutex_destroy(&c->lock);
+    free(c->conns);
+    free(c->host);
+    free(c->port);
+    free(c);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The client thread: poll until BbClientDestroy().
+ *
+ **************************************************************************
+ */
+static void *
+BbClientLoop(void *arg)  // IN
+{
+    BbClient *c = arg;
+
+    while (!atomic_load(&c->stop)) {
+        BbClientPoll(c, -1);
+    }
+    BbCloseConns(c);
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Have a thread of the client's own do its I/O and run the
+ * callbacks.  The application must not poll from then on.
+ *
+ **************************************************************************
+ */
+bool
+BbClientStart(BbClient *c)  // IN
+{
+    int err = pthread_create(&c->thread, NULL, BbClientLoop, c);
+
+    if (err != 0) {
+        Error("Failed to start the client thread: %s\n", strerror(err));
+        return false;
+    }
+    c->threadStarted = true;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief An fd that is readable whenever BbClientPoll() has work.
+ *
+ **************************************************************************
+ */
+int
+BbClientFd(BbClient *c)  // IN
+{
+    return c->epfd;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Requests made and not yet completed.
+ *
+ **************************************************************************
+ */
+int
+BbClientPending(BbClient *c)  // IN
+{
+    return atomic_load(&c->pending);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The MSG_CAP_* the server granted the last connection made.
+ *
+ **************************************************************************
+ */
+unsigned
+BbClientCaps(BbClient *c)  // IN
+{
+    return atomic_load(&c->caps);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy out the client's counters.
+ *
+ **************************************************************************
+ */
+void
+BbClientGetStats(BbClient *c,       // IN
+                 BbStats *stats)    // OUT
+{
+    uint64_t *out = (uint64_t *)stats;
+    int i;
+
+    for (i = 0; i < ARRAYSIZE(c->stats); i++) {
+        out[i] = atomic_load_explicit(&c->stats[i], memory_order_relaxed);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate a request of the given type with room for dataSize
+ * bytes of payload.  Returns NULL if the title does not fit.
+ *
+ **************************************************************************
+ */
+static BbOp *
+BbOpAlloc(MsgType type,          // IN
+          const char *title,     // IN
+          int dataSize,          // IN
+          BbCallback cb,         // IN
+          void *arg)             // IN
+{
+    BbOp *op;
+
+    if (title != NULL && strlen(title) > MAX_TITLE_LEN) {
+        Error("Board titles are at most %d characters\n", MAX_TITLE_LEN);
+        return NULL;
+    }
+    op = malloc(sizeof *op + dataSize);
+    if (op == NULL) {
+        Error("Failed to allocate a request\n");
+        return NULL;
+    }
+    memset(op, 0, sizeof *op);
+    op->cb           = cb;
+    op->arg          = arg;
+    op->msg.type     = type;
+    op->msg.dataSize = dataSize;
+    MsgSetTitle(&op->msg, title != NULL ? title : "");
+    return op;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Hand a request to the poller.
+ *
+ * The poller is woken only by the first request it has not taken yet,
+ * so a burst of requests costs one write to the eventfd.
+ *
+ **************************************************************************
+ */
+static bool
+BbSubmit(BbClient *c,  // IN
+         BbOp *op)     // IN
+{
+    bool wake;
+
+    op->queuedNs = BbNowNs();
+    if (!op->internal) {
+        atomic_fetch_add(&c->pending, 1);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    *c->submittedTail = op;
+    c->submittedTail  = &op->next;
+    wake = !c->wakePending;
+    c->wakePending = true;
+    pthread_mutex_unlock(&c->lock);
+
+    if (wake) {
+        uint64_t one = 1;
+
+        if (write(c->wakeFd, &one, sizeof one) < 0 && errno != EAGAIN) {
+            perror("Failed to wake the client");
+        }
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Submit a request with no payload.
+ *
+ **************************************************************************
+ */
+static bool
+BbSimple(BbClient *c,          // IN
+         MsgType type,         // IN
+         const char *title,    // IN
+         BbCallback cb,        // IN
+         void *arg)            // IN
+{
+    BbOp *op = BbOpAlloc(type, title, 0, cb, arg);
+
+    return op != NULL && BbSubmit(c, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Ask for a board.  The reply is a BOARD, or a BOARD_LZ.
+ *
+ **************************************************************************
+ */
+bool
+BbShow(BbClient *c,          // IN
+       const char *title,    // IN
+       BbCallback cb,        // IN
+       void *arg)            // IN
+{
+    return BbSimple(c, MSG_SHOW, title, cb, arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Ask for what a board gained since pos, as a BOARD_DELTA.
+ *
+ **************************************************************************
+ */
+bool
+BbShowSince(BbClient *c,              // IN
+            const char *title,        // IN
+            const MsgBoardPos *pos,   // IN
+            BbCallback cb,            // IN
+            void *arg)                // IN
+{
+    BbOp *op = BbOpAlloc(MSG_SHOW_SINCE, title, sizeof *pos, cb, arg);
+
+    if (op == NULL) {
+        return false;
+    }
+    memcpy(op->msg.data, pos, sizeof *pos);
+    return BbSubmit(c, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Post to a board.  The data is copied; it is sent compressed if
+ * the connection allows it and that makes it smaller.
+ *
+ **************************************************************************
+ */
+bool
+BbPost(BbClient *c,          // IN
+       const char *title,    // IN
+       const char *data,     // IN
+       int dataSize,         // IN
+       BbCallback cb,        // IN
+       void *arg)            // IN
+{
+    BbOp *op = BbOpAlloc(MSG_POST, title, dataSize, cb, arg);
+
+    if (op == NULL) {
+        return false;
+    }
+    memcpy(op->msg.data, data, dataSize);
+    return BbSubmit(c, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Post several messages to a board in one POST_BATCH.
+ *
+ **************************************************************************
+ */
+bool
+BbPostBatch(BbClient *c,                // IN
+            const char *title,          // IN
+            const char *const posts[],  // IN
+            const int sizes[],          // IN
+            int numPosts,               // IN
+            BbCallback cb,              // IN
+            void *arg)                  // IN
+{
+    BbOp *op;
+    char *p;
+    int dataSize = 0;
+    int i;
+
+    for (i = 0; i < numPosts; i++) {
+        dataSize += sizeof(MsgBatchItem) + sizes[i];
+    }
+    op = BbOpAlloc(MSG_POST_BATCH, title, dataSize, cb, arg);
+    if (op == NULL) {
+        return false;
+    }
+
+    p = op->msg.data;
+    for (i = 0; i < numPosts; i++) {
+        MsgBatchItem item;
+
+        memset(&item, 0, sizeof item);
+        item.dataSize = sizes[i];
+        memcpy(p, &item, sizeof item);
+        memcpy(p + sizeof item, posts[i], sizes[i]);
+        p += sizeof item + sizes[i];
+    }
+    return BbSubmit(c, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Clear a board.
+ *
+ **************************************************************************
+ */
+bool
+BbClear(BbClient *c,          // IN
+        const char *title,    // IN
+        BbCallback cb,        // IN
+        void *arg)            // IN
+{
+    return BbSimple(c, MSG_CLEAR, title, cb, arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Ask for the titles of the boards, as a TITLES reply.
+ *
+ **************************************************************************
+ */
+bool
+BbList(BbClient *c,          // IN
+       BbCallback cb,        // IN
+       void *arg)            // IN
+{
+    return BbSimple(c, MSG_LIST, NULL, cb, arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Ask for the server metrics, as a STATS_TEXT reply.
+ *
+ **************************************************************************
+ */
+bool
+BbStatsText(BbClient *c,          // IN
+            BbCallback cb,        // IN
+            void *arg)            // IN
+{
+    return BbSimple(c, MSG_STATS, NULL, cb, arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Subscribe to a board.
+ *
+ * cb gets the STATUS reply, then a NOTIFY for every change from then on,
+ * until BbUnsubscribe().  If the connection fails, the subscription is
+ * renewed on another one from the position of the last NOTIFY, so the
+ * first NOTIFY after that covers what was missed.  Returns NULL on
+ * failure.
+ *
+ **************************************************************************
+ */
+BbSub *
+BbSubscribe(BbClient *c,          // IN
+            const char *title,    // IN
+            BbCallback cb,        // IN
+            void *arg)            // IN
+{
+    BbSub *sub;
+    BbOp *op = BbOpAlloc(MSG_SUBSCRIBE, title, 0, cb, arg);
+
+    if (op == NULL) {
+        return NULL;
+    }
+    sub = calloc(1, sizeof *sub);
+    if (sub == NULL) {
+        Error("Failed to allocate a subscription\n");
+        free(op);
+        return NULL;
+    }
+    snprintf(sub->title, sizeof sub->title, "%s", title);
+    sub->cb  = cb;
+    sub->arg = arg;
+    op->sub  = sub;
+    BbSubmit(c, op);
+    return sub;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief End a subscription and free it.  cb, if any, gets the STATUS
+ * reply; no NOTIFY is delivered once the poller has taken the request.
+ *
+ **************************************************************************
+ */
+bool
+BbUnsubscribe(BbClient *c,     // IN
+              BbSub *sub,      // IN
+              BbCallback cb,   // IN
+              void *arg)       // IN
+{
+    BbOp *op = BbOpAlloc(MSG_UNSUBSCRIBE, sub->title, 0, cb, arg);
+
+    if (op == NULL) {
+        return false;
+    }
+    op->sub = sub;
+    return BbSubmit(c, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The board a BOARD, BOARD_LZ, BOARD_DELTA or NOTIFY carries,
+ * decompressed if need be.  Returns NULL if it does not decompress.
+ *
+ **************************************************************************
+ */
+const char *
+BbReplyBoard(BbReply *reply,  // IN/OUT
+             int *size)       // OUT
+{
+    MsgLzHdr lz;
+
+    if (reply->type != MSG_BOARD_LZ) {
+        *size = reply->dataSize;
+        return reply->data;
+    }
+    if (reply->unpacked == NULL) {
+        if (reply->dataSize < sizeof lz) {
+            return NULL;
+        }
+        memcpy(&lz, reply->data, sizeof lz);
+        reply->unpacked = lz.rawSize >= 0 ? malloc(MAX(lz.rawSize, 1))
+                                          : NULL;
+        if (reply->unpacked == NULL ||
+            !LzDecompress(reply->data + sizeof lz,
+                          reply->dataSize - sizeof lz, reply->unpacked,
+                          lz.rawSize)) {
+            Error("Failed to decompress the board\n");
+            free(reply->unpacked);
+            reply->unpacked = NULL;
+            return NULL;
+        }
+        reply->dataSize = lz.rawSize;
+        reply->type     = MSG_BOARD;
+        reply->data     = reply->unpacked;
+    }
+    *size = reply->dataSize;
+    return reply->unpacked;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief A reply status, or a BB_ERR_*, as text.
+ *
+ **************************************************************************
+ */
+const char *
+BbStatusToString(int status)  // IN
+{
+    switch (status) {
+    case BB_ERR_DISCONNECTED:
+        return "connection lost";
+    case BB_ERR_TIMEOUT:
+        return "timed out";
+    case BB_ERR_CLOSED:
+        return "client closed";
+    default:
+        return MsgStatusToString(status);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Register for EPOLLOUT only while output is waiting.
+ *
+ **************************************************************************
+ */
+static void
+BbConnWatchOut(BbConn *conn,   // IN/OUT
+               bool wantOut)   // IN
+{
+    struct epoll_event ev;
+
+    if (conn->wantOut == wantOut) {
+        return;
+    }
+    ev.events   = EPOLLIN | (wantOut ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(conn->client->epfd, EPOLL_CTL_MOD, conn->sd, &ev);
+    conn->wantOut = wantOut;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write as much queued output as the socket takes.
+ *
+ **************************************************************************
+ */
+static void
+BbConnFlush(BbConn *conn)  // IN/OUT
+{
+    int off = 0;
+
+    while (off < conn->outLen) {
+        int n = send(conn->sd, conn->out + off, conn->outLen - off,
+                     MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            BbConnFail(conn, BB_ERR_DISCONNECTED);
+            return;
+        }
+        off += n;
+    }
+    BbStatAdd(conn->client, BB_STAT(txBytes), off);
+    memmove(conn->out, conn->out + off, conn->outLen - off);
+    conn->outLen -= off;
+    BbConnWatchOut(conn, conn->outLen > 0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make room for len more bytes of output.
+ *
+ **************************************************************************
+ */
+static bool
+BbConnReserve(BbConn *conn,  // IN/OUT
+              int len)       // IN
+{
+    if (conn->outCap - conn->outLen < len) {
+        int cap = MAX(conn->outCap * 2, conn->outLen + len);
+        char *out = realloc(conn->out, cap);
+
+        if (out == NULL) {
+            Error("Failed to allocate the output buffer\n");
+            return false;
+        }
+        conn->out    = out;
+        conn->outCap = cap;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a POST compressed, if that makes it smaller.
+ *
+ **************************************************************************
+ */
+static bool
+BbConnPackPost(BbConn *conn,   // IN/OUT
+               BbOp *op)       // IN
+{
+    int dataSize = op->msg.dataSize;
+    char *p = conn->out + conn->outLen;
+    MsgHdr hdr = op->msg;
+    MsgLzHdr lz;
+    int n;
+
+    n = LzCompress(op->msg.data, dataSize, p + sizeof hdr + sizeof lz,
+                   dataSize - 1);
+    if (n <= 0) {
+        return false;
+    }
+    memset(&lz, 0, sizeof lz);
+    lz.rawSize   = dataSize;
+    hdr.type     = MSG_POST_LZ;
+    hdr.dataSize = sizeof lz + n;
+    memcpy(p, &hdr, sizeof hdr);
+    memcpy(p + sizeof hdr, &lz, sizeof lz);
+    conn->outLen += sizeof hdr + hdr.dataSize;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a request on a connection and add it to those in flight.
+ *
+ **************************************************************************
+ */
+static void
+BbConnSend(BbConn *conn,  // IN/OUT
+           BbOp *op)      // IN
+{
+    int len = sizeof op->msg + op->msg.dataSize;
+
+    op->msg.reqId = conn->nextReqId++;
+    op->sentNs    = BbNowNs();
+    op->next      = NULL;
+    *conn->tail   = op;
+    conn->tail    = &op->next;
+    conn->inFlight++;
+    conn->activeNs = op->sentNs;
+
+    if (op->msg.type == MSG_SUBSCRIBE) {
+        op->sub->conn  = conn;
+        op->sub->reqId = op->msg.reqId;
+        op->sub->next  = conn->subs;
+        conn->subs     = op->sub;
+    }
+
+    if (!BbConnReserve(conn, len + sizeof(MsgLzHdr))) {
+        BbConnFail(conn, BB_ERR_DISCONNECTED);
+        return;
+    }
+    if (op->msg.type == MSG_POST && (conn->caps & MSG_CAP_LZ) &&
+        op->msg.dataSize >= MSG_LZ_MIN_SIZE && BbConnPackPost(conn, op)) {
+        return;
+    }
+    memcpy(conn->out + conn->outLen, &op->msg, len);
+    conn->outLen += len;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send a request the client makes on its own behalf.
+ *
+ **************************************************************************
+ */
+static void
+BbConnSendInternal(BbConn *conn,         // IN/OUT
+                   MsgType type,         // IN
+                   const char *title,    // IN
+                   const void *data,     // IN
+                   int dataSize,         // IN
+                   BbSub *sub)           // IN
+{
+    BbOp *op = BbOpAlloc(type, title, dataSize, NULL, NULL);
+
+    if (op == NULL) {
+        BbConnFail(conn, BB_ERR_DISCONNECTED);
+        return;
+    }
+    op->internal = true;
+    op->sub      = sub;
+    memcpy(op->msg.data, data, dataSize);
+    BbConnSend(conn, op);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send a HELLO asking for the capabilities the client wants.
+ *
+ * Doubles as the health check of a quiet connection: the server answers
+ * it like any request, and asking again changes nothing.
+ *
+ **************************************************************************
+ */
+static void
+BbConnHello(BbConn *conn)  // IN/OUT
+{
+    unsigned want = conn->client->cfg.compress ? MSG_CAP_LZ : 0;
+
+    BbConnSendInternal(conn, MSG_HELLO, NULL, &want, sizeof want, NULL);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start taking requests on a connection, and give it the
+ * subscriptions that lost theirs.
+ *
+ **************************************************************************
+ */
+static void
+BbConnReady(BbConn *conn)  // IN/OUT
+{
+    BbClient *c = conn->client;
+
+    conn->state   = BB_CONN_READY;
+    conn->retryMs = c->cfg.retryMinMs;
+    atomic_store(&c->caps, conn->caps);
+    BbStatAdd(c, BB_STAT(connects), 1);
+
+    while (c->orphans != NULL && conn->state == BB_CONN_READY) {
+        BbSub *sub = c->orphans;
+
+        c->orphans = sub->next;
+        BbConnSendInternal(conn, MSG_SUBSCRIBE, sub->title, &sub->pos,
+                           sub->havePos ? sizeof sub->pos : 0, sub);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Close a connection and fail the requests in flight on it.
+ *
+ * Its subscriptions wait for another connection.  The connection is
+ * tried again after a backoff that doubles with each failure in a row.
+ *
+ **************************************************************************
+ */
+static void
+BbConnFail(BbConn *conn,  // IN/OUT
+           int status)    // IN: BB_ERR_*
+{
+    BbClient *c = conn->client;
+    BbOp *head = conn->head;
+    BbSub *sub;
+
+    if (conn->sd >= 0) {
+        close(conn->sd);
+        conn->sd = -1;
+    }
+    if (conn->state == BB_CONN_READY) {
+        BbStatAdd(c, BB_STAT(failures), 1);
+    }
+    conn->state    = BB_CONN_DOWN;
+    conn->retryNs  = BbNowNs() + conn->retryMs * BB_NS_PER_MS;
+    conn->retryMs  = MIN(conn->retryMs * 2, c->cfg.retryMaxMs);
+    conn->head     = NULL;
+    conn->tail     = &conn->head;
+    conn->inFlight = 0;
+    conn->outLen   = 0;
+    conn->wantOut  = false;
+    conn->caps     = 0;
+    RecvBufFree(&conn->in);
+
+    while ((sub = conn->subs) != NULL) {
+        conn->subs = sub->next;
+        sub->conn  = NULL;
+        sub->next  = c->orphans;
+        c->orphans = sub;
+    }
+
+    /*
+     * A subscription whose request was lost simply waits, as above; the
+     * callback of its first request only ever sees the server's answer.
+     */
+    while (head != NULL) {
+        BbOp *op = head;
+
+        head = op->next;
+        if (op->msg.type == MSG_SUBSCRIBE && status != BB_ERR_CLOSED) {
+            op->cb = NULL;
+        }
+        BbOpFail(c, op, status);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Close every connection, failing what is in flight with
+ * BB_ERR_CLOSED.  Called by the thread that polls, as the receive
+ * buffers are its own.
+ *
+ **************************************************************************
+ */
+static void
+BbCloseConns(BbClient *c)  // IN
+{
+    int i;
+
+    for (i = 0; i < c->cfg.numConns; i++) {
+        BbConn *conn = &c->conns[i];
+
+        if (conn->state != BB_CONN_DOWN) {
+            BbConnFail(conn, BB_ERR_CLOSED);
+        }
+        free(conn->out);
+        conn->out    = NULL;
+        conn->outCap = 0;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start connecting to the next address of the server.
+ *
+ **************************************************************************
+ */
+static void
+BbConnConnect(BbConn *conn,   // IN/OUT
+              uint64_t now)   // IN
+{
+    BbClient *c = conn->client;
+    struct epoll_event ev;
+    int one = 1;
+
+    conn->addr = conn->addr != NULL && conn->addr->ai_next != NULL ?
+                 conn->addr->ai_next : c->addrs;
+    conn->sd = socket(conn->addr->ai_family,
+                      conn->addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      conn->addr->ai_protocol);
+    if (conn->sd < 0) {
+        perror("Failed to allocate a client socket");
+        BbConnFail(conn, BB_ERR_DISCONNECTED);
+        return;
+    }
+    setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    conn->state      = BB_CONN_CONNECTING;
+    conn->deadlineNs = now + c->cfg.timeoutMs * BB_NS_PER_MS;
+    conn->nextReqId  = 1;
+    ev.events   = EPOLLOUT;
+    ev.data.ptr = conn;
+    conn->wantOut = true;
+    if ((connect(conn->sd, conn->addr->ai_addr, conn->addr->ai_addrlen) < 0 &&
+         errno != EINPROGRESS) ||
+        epoll_ctl(c->epfd, EPOLL_CTL_ADD, conn->sd, &ev) < 0) {
+        BbConnFail(conn, BB_ERR_DISCONNECTED);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The non-blocking connect() finished.
+ *
+ **************************************************************************
+ */
+static void
+BbConnConnected(BbConn *conn)  // IN/OUT
+{
+    int err = 0;
+    socklen_t len = sizeof err;
+
+    if (getsockopt(conn->sd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+        err != 0) {
+        BbConnFail(conn, BB_ERR_DISCONNECTED);
+        return;
+    }
+    conn->activeNs = BbNowNs();
+    BbConnWatchOut(conn, false);
+    if (conn->client->cfg.compress) {
+        conn->state = BB_CONN_HELLO;
+        BbConnHello(conn);
+    } else {
+        BbConnReady(conn);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Deliver a NOTIFY to its subscription.
+ *
+ **************************************************************************
+ */
+static void
+BbConnNotify(BbConn *conn,       // IN
+             BbReply *reply,     // IN/OUT
+             unsigned reqId)     // IN
+{
+    BbSub *sub;
+
+    for (sub = conn->subs; sub != NULL; sub = sub->next) {
+        if (sub->reqId == reqId) {
+            break;
+        }
+    }
+    /* Pushed before the server saw an UNSUBSCRIBE. */
+    if (sub == NULL) {
+        return;
+    }
+    sub->pos     = reply->pos;
+    sub->havePos = true;
+    sub->cb(sub->arg, reply);
+    free(reply->unpacked);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handle one complete message from the server.
+ *
+ * Returns false if the stream makes no sense.
+ *
+ **************************************************************************
+ */
+static bool
+BbConnReceive(BbConn *conn,           // IN/OUT
+              const MsgHdr *msg,      // IN
+              const char *data)       // IN
+{
+    BbClient *c = conn->client;
+    BbOp *op = conn->head;
+    BbReply reply;
+
+    memset(&reply, 0, sizeof reply);
+    reply.status   = msg->status;
+    reply.type     = msg->type;
+    reply.data     = data;
+    reply.dataSize = msg->dataSize;
+    MsgGetTitle(msg, reply.title);
+
+    if (msg->type == MSG_BOARD_DELTA || msg->type == MSG_NOTIFY) {
+        if (msg->dataSize < sizeof reply.pos) {
+            return false;
+        }
+        memcpy(&reply.pos, data, sizeof reply.pos);
+        reply.data     += sizeof reply.pos;
+        reply.dataSize -= sizeof reply.pos;
+    }
+    if (msg->type == MSG_NOTIFY) {
+        BbConnNotify(conn, &reply, msg->reqId);
+        return true;
+    }
+
+    if (op == NULL || msg->reqId != op->msg.reqId) {
+        Error("Unexpected reply message type %d for request %u\n",
+              msg->type, msg->reqId);
+        return false;
+    }
+    conn->head = op->next;
+    if (conn->head == NULL) {
+        conn->tail = &conn->head;
+    }
+    conn->inFlight--;
+
+    switch (op->msg.type) {
+    case MSG_HELLO:
+        if (msg->type != MSG_HELLO || msg->dataSize < sizeof conn->caps) {
+            return false;
+        }
+        memcpy(&conn->caps, data, sizeof conn->caps);
+        if (conn->state == BB_CONN_HELLO) {
+            BbConnReady(conn);
+        }
+        break;
+    case MSG_SUBSCRIBE:
+        if (msg->status != MSG_STATUS_SUCCESS && op->sub != NULL &&
+            op->sub->conn == conn) {
+            BbSub **link;
+
+            /* Refused: the subscription is idle until unsubscribed. */
+            for (link = &conn->subs; *link != op->sub;
+                 link = &(*link)->next) {
+            }
+            *link = op->sub->next;
+            op->sub->conn = NULL;
+            op->sub->next = NULL;
+            if (op->cb == NULL) {
+                op->sub->cb(op->sub->arg, &reply);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    BbOpComplete(c, op, &reply);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Read and handle everything the server sent.
+ *
+ **************************************************************************
+ */
+static void
+BbConnRead(BbConn *conn)  // IN/OUT
+{
+    BbClient *c = conn->client;
+
+    for (;;) {
+        int n = RecvBufFill(&conn->in, conn->sd);
+
+        if (n == 0) {
+            BbConnFail(conn, BB_ERR_DISCONNECTED);
+            return;
+        } else if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            BbConnFail(conn, BB_ERR_DISCONNECTED);
+            return;
+        }
+        BbStatAdd(c, BB_STAT(rxBytes), n);
+        conn->activeNs = BbNowNs();
+
+        while (RecvBufLen(&conn->in) >= sizeof(MsgHdr)) {
+            MsgHdr msg;
+            int len;
+
+            memcpy(&msg, RecvBufData(&conn->in), sizeof msg);
+            if (msg.dataSize < 0 || msg.dataSize > BB_MAX_REPLY) {
+                Error("Invalid reply payload size %d\n", msg.dataSize);
+                BbConnFail(conn, BB_ERR_DISCONNECTED);
+                return;
+            }
+            len = sizeof msg + msg.dataSize;
+            if (!RecvBufReserve(&conn->in, len)) {
+                BbConnFail(conn, BB_ERR_DISCONNECTED);
+                return;
+            }
+            if (RecvBufLen(&conn->in) < len) {
+                break;
+            }
+            if (!BbConnReceive(conn, &msg,
+                               RecvBufData(&conn->in) + sizeof msg)) {
+                BbConnFail(conn, BB_ERR_DISCONNECTED);
+                return;
+            }
+            if (conn->state == BB_CONN_DOWN) {
+                return;
+            }
+            RecvBufConsume(&conn->in, len);
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Forget a subscription about to be freed.
+ *
+ * A SUBSCRIBE not sent yet is dropped; one in flight is left to complete
+ * without it.
+ *
+ **************************************************************************
+ */
+static void
+BbCancelSubscribe(BbClient *c,  // IN
+                  BbSub *sub)   // IN
+{
+    BbOp **link;
+    int i;
+
+    for (i = 0; i < c->cfg.numConns; i++) {
+        BbOp *op;
+
+        for (op = c->conns[i].head; op != NULL; op = op->next) {
+            if (op->sub == sub) {
+                op->sub = NULL;
+            }
+        }
+    }
+    for (link = &c->queued; *link != NULL; link = &(*link)->next) {
+        BbOp *op = *link;
+
+        if (op->sub == sub) {
+            *link = op->next;
+            if (*link == NULL) {
+                c->queuedTail = link;
+            }
+            BbOpFail(c, op, BB_ERR_CLOSED);
+            return;
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take the requests other threads (or callbacks) made.
+ *
+ * UNSUBSCRIBE is acted on here, so no NOTIFY reaches the callback after
+ * this poll.
+ *
+ **************************************************************************
+ */
+static void
+BbTakeSubmitted(BbClient *c)  // IN
+{
+    BbOp *op, *next;
+
+    pthread_mutex_lock(&c->lock);
+    op = c->submitted;
+    c->submitted     = NULL;
+    c->submittedTail = &c->submitted;
+    c->wakePending   = false;
+    pthread_mutex_unlock(&c->lock);
+
+    for (; op != NULL; op = next) {
+        BbSub *sub = op->sub;
+        BbSub **link;
+
+        next = op->next;
+        op->next = NULL;
+        if (op->msg.type != MSG_UNSUBSCRIBE) {
+            *c->queuedTail = op;
+            c->queuedTail  = &op->next;
+            continue;
+        }
+
+        /* Goes out on the subscription's own connection, if it has one. */
+        link = sub->conn != NULL ? &sub->conn->subs : &c->orphans;
+        for (; *link != NULL && *link != sub; link = &(*link)->next) {
+        }
+        if (*link == sub) {
+            *link = sub->next;
+        }
+        BbCancelSubscribe(c, sub);
+        op->sub = NULL;
+        if (sub->conn != NULL && sub->conn->state == BB_CONN_READY) {
+            BbConnSend(sub->conn, op);
+        } else {
+            BbReply reply;
+
+            memset(&reply, 0, sizeof reply);
+            reply.type = MSG_STATUS;
+            snprintf(reply.title, sizeof reply.title, "%s", sub->title);
+            BbOpComplete(c, op, &reply);
+        }
+        free(sub);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send queued requests on the ready connections with the fewest
+ * in flight, as far as the depth allows, then write them out.
+ *
+ **************************************************************************
+ */
+static void
+BbDispatch(BbClient *c)  // IN
+{
+    int depth = c->cfg.depth;
+    int i;
+
+    while (c->queued != NULL) {
+        BbConn *best = NULL;
+        BbOp *op = c->queued;
+
+        for (i = 0; i < c->cfg.numConns; i++) {
+            BbConn *conn = &c->conns[(c->rr + i) % c->cfg.numConns];
+
+            if (conn->state == BB_CONN_READY &&
+                (depth == 0 || conn->inFlight < depth) &&
+                (best == NULL || conn->inFlight < best->inFlight)) {
+                best = conn;
+            }
+        }
+        if (best == NULL) {
+            break;
+        }
+        c->rr = (c->rr + 1) % c->cfg.numConns;
+
+        c->queued = op->next;
+        if (c->queued == NULL) {
+            c->queuedTail = &c->queued;
+        }
+        BbConnSend(best, op);
+    }
+
+    for (i = 0; i < c->cfg.numConns; i++) {
+        BbConn *conn = &c->conns[i];
+
+        if (conn->state >= BB_CONN_HELLO && conn->outLen > 0 &&
+            !conn->wantOut) {
+            BbConnFlush(conn);
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Connect, time out and check connections as their time comes.
+ *
+ **************************************************************************
+ */
+static void
+BbTick(BbClient *c,     // IN
+       uint64_t now)    // IN
+{
+    uint64_t timeoutNs = c->cfg.timeoutMs * BB_NS_PER_MS;
+    uint64_t healthNs  = c->cfg.healthMs * BB_NS_PER_MS;
+    int i;
+
+    for (i = 0; i < c->cfg.numConns; i++) {
+        BbConn *conn = &c->conns[i];
+
+        switch (conn->state) {
+        case BB_CONN_DOWN:
+            if (now >= conn->retryNs) {
+                BbConnConnect(conn, now);
+            }
+            break;
+        case BB_CONN_CONNECTING:
+            if (now >= conn->deadlineNs) {
+                BbConnFail(conn, BB_ERR_TIMEOUT);
+            }
+            break;
+        default:
+            if (conn->head != NULL && now - conn->head->sentNs > timeoutNs) {
+                Error("No reply from the server in %d ms\n",
+                      c->cfg.timeoutMs);
+                BbConnFail(conn, BB_ERR_TIMEOUT);
+            } else if (conn->head == NULL &&
+                       now - conn->activeNs >= healthNs) {
+                BbConnHello(conn);
+            }
+            break;
+        }
+    }
+
+    /* Requests waiting longer than a reply may take give up. */
+    while (c->queued != NULL && now - c->queued->queuedNs > timeoutNs) {
+        BbOp *op = c->queued;
+
+        c->queued = op->next;
+        if (c->queued == NULL) {
+            c->queuedTail = &c->queued;
+        }
+        if (op->sub != NULL) {
+            /* The subscription is made once a connection is. */
+            op->sub->next = c->orphans;
+            c->orphans    = op->sub;
+        }
+        BbOpFail(c, op, BB_ERR_TIMEOUT);
+    }
+    c->tickNs = now;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Do the client's I/O and run callbacks, waiting up to timeoutMs
+ * (-1 for as long as it takes) for something to happen.
+ *
+ * Returns the number of events handled.
+ *
+ **************************************************************************
+ */
+int
+BbClientPoll(BbClient *c,     // IN
+             int timeoutMs)   // IN
+{
+    struct epoll_event events[BB_MAX_EVENTS];
+    uint64_t now = BbNowNs();
+    int wait, n, i;
+
+    if (now - c->tickNs >= BB_TICK_MS * BB_NS_PER_MS) {
+        BbTick(c, now);
+    }
+    BbTakeSubmitted(c);
+    BbDispatch(c);
+
+    wait = BB_TICK_MS - (int)((now - c->tickNs) / BB_NS_PER_MS);
+    if (timeoutMs >= 0) {
+        wait = MIN(wait, timeoutMs);
+    }
+    n = epoll_wait(c->epfd, events, BB_MAX_EVENTS, MAX(wait, 0));
+    for (i = 0; i < n; i++) {
+        BbConn *conn = events[i].data.ptr;
+
+        if (conn == NULL) {
+            uint64_t count;
+
+            if (read(c->wakeFd, &count, sizeof count) < 0 &&
+                errno != EAGAIN) {
+                perror("Failed to read the client's eventfd");
+            }
+            continue;
+        }
+        if (conn->state == BB_CONN_CONNECTING) {
+            BbConnConnected(conn);
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            BbConnRead(conn);
+        }
+        if ((events[i].events & EPOLLOUT) && conn->state != BB_CONN_DOWN) {
+            BbConnFlush(conn);
+        }
+    }
+
+    /* What the callbacks asked for goes out now. */
+    BbTakeSubmitted(c);
+    BbDispatch(c);
+    return MAX(n, 0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send the requests made so far without waiting or handling
+ * replies, for a caller that polls later.
+ *
+ **************************************************************************
+ */
+void
+BbClientFlush(BbClient *c)  // IN
+{
+    BbTakeSubmitted(c);
+    BbDispatch(c);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Poll until every connection is ready, for up to timeoutMs.
+ *
+ **************************************************************************
+ */
+bool
+BbClientWaitReady(BbClient *c,     // IN
+                  int timeoutMs)   // IN
+{
+    uint64_t end = BbNowNs() + timeoutMs * BB_NS_PER_MS;
+
+    for (;;) {
+        int ready = 0, i;
+        uint64_t now;
+
+        for (i = 0; i < c->cfg.numConns; i++) {
+            ready += c->conns[i].state == BB_CONN_READY;
+        }
+        if (ready == c->cfg.numConns) {
+            return true;
+        }
+        now = BbNowNs();
+        if (now >= end) {
+            return false;
+        }
+        BbClientPoll(c, (end - now) / BB_NS_PER_MS + 1);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Poll until every request made has completed, for up to
+ * timeoutMs (-1 for as long as it takes).
+ *
+ **************************************************************************
+ */
+bool
+BbClientDrain(BbClient *c,     // IN
+              int timeoutMs)   // IN
+{
+    uint64_t end = BbNowNs() + timeoutMs * BB_NS_PER_MS;
+
+    while (BbClientPending(c) > 0) {
+        uint64_t now = BbNowNs();
+
+        if (timeoutMs < 0) {
+            BbClientPoll(c, -1);
+        } else if (now >= end) {
+            return false;
+        } else {
+            BbClientPoll(c, (end - now) / BB_NS_PER_MS + 1);
+        }
+    }
+    return true;
+}
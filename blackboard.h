@@ -0,0 +1,132 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _BLACKBOARD_H_
+#define _BLACKBOARD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * libblackboard: a non-blocking client of the board server.
+ *
+ * A BbClient keeps a pool of connections to one server.  Requests are
+ * queued from any thread and return at once; each is sent on the ready
+ * connection with the fewest requests in flight, pipelined behind them,
+ * and its callback runs with the reply.  Connections are checked with a
+ * HELLO whenever they have been quiet for a while, closed when a reply
+ * is overdue, and reopened with exponential backoff; subscriptions move
+ * to another connection by themselves and carry on from the last
+ * position they saw.  A request in flight on a connection that fails is
+ * not resent, as the server may have applied it: its callback gets
+ * BB_ERR_DISCONNECTED or BB_ERR_TIMEOUT.
+ *
+ * The client does its I/O and runs callbacks in BbClientPoll(), called
+ * either by the application's own loop (BbClientFd() is an fd to wait
+ * on) or by a thread of the client's own after BbClientStart().  Only
+ * one thread may poll, or call BbClientFlush() to send requests at once.
+ */
+
+#define BB_DEFAULT_CONNS          1
+#define BB_DEFAULT_TIMEOUT_MS     10000   // For a reply, or a connection
+#define BB_DEFAULT_HEALTH_MS      1000    // Quiet this long: send a HELLO
+#define BB_DEFAULT_RETRY_MIN_MS   100
+#define BB_DEFAULT_RETRY_MAX_MS   5000
+
+/*
+ * Failures of a request that never got a reply, in BbReply.status.
+ */
+#define BB_ERR_DISCONNECTED   (-1)   // Its connection failed
+#define BB_ERR_TIMEOUT        (-2)   // No reply, or no connection, in time
+#define BB_ERR_CLOSED         (-3)   // Client destroyed, or unsubscribed
+
+/**
+ * How to reach the server and how hard to use it.
+ */
+typedef struct BbConfig {
+    const char *host;
+    const char *port;
+    int         numConns;      // Connections in the pool
+    int         depth;         // Requests in flight per connection, 0 any
+    bool        compress;      // Ask for compressed boards, compress posts
+    int         timeoutMs;
+    int         healthMs;
+    int         retryMinMs;
+    int         retryMaxMs;
+} BbConfig;
+
+/**
+ * What a request got back.  data is valid until the callback returns.
+ *
+ * status is the reply's MsgStatus, or one of the BB_ERR_* with type 0.
+ * For BOARD_DELTA and NOTIFY, pos is the position the data brings the
+ * reader to and data excludes it; a BOARD_LZ is left compressed until
+ * BbReplyBoard() is asked for it.  The STATUS reply to a POST_BATCH
+ * carries one status byte per item.
+ */
+typedef struct BbReply {
+    int           status;
+    MsgType       type;
+    char          title[MAX_TITLE_LEN + 1];
+    const char   *data;
+    int           dataSize;
+    MsgBoardPos   pos;
+    char         *unpacked;   // Owned by the client
+} BbReply;
+
+typedef void (*BbCallback)(void *arg, BbReply *reply);
+
+/**
+ * Traffic of a client so far.
+ */
+typedef struct BbStats {
+    uint64_t  requests;       // Completed, with a reply or an error
+    uint64_t  errors;         // Completed with a BB_ERR_*
+    uint64_t  txBytes;
+    uint64_t  rxBytes;
+    uint64_t  connects;       // Connections made ready
+    uint64_t  failures;       // Connections lost
+} BbStats;
+
+typedef struct BbClient BbClient;
+typedef struct BbSub BbSub;
+
+void BbConfigInit(BbConfig *cfg, const char *host, const char *port);
+BbClient *BbClientCreate(const BbConfig *cfg);
+void BbClientDestroy(BbClient *c);
+bool BbClientStart(BbClient *c);
+int  BbClientFd(BbClient *c);
+int  BbClientPoll(BbClient *c, int timeoutMs);
+void BbClientFlush(BbClient *c);
+bool BbClientWaitReady(BbClient *c, int timeoutMs);
+bool BbClientDrain(BbClient *c, int timeoutMs);
+int  BbClientPending(BbClient *c);
+unsigned BbClientCaps(BbClient *c);
+void BbClientGetStats(BbClient *c, BbStats *stats);
+
+bool BbShow(BbClient *c, const char *title, BbCallback cb, void *arg);
+bool BbShowSince(BbClient *c, const char *title, const MsgBoardPos *pos,
+                 BbCallback cb, void *arg);
+bool BbPost(BbClient *c, const char *title, const char *data, int dataSize,
+            BbCallback cb, void *arg);
+bool BbPostBatch(BbClient *c, const char *title, const char *const posts[],
+                 const int sizes[], int numPosts, BbCallback cb, void *arg);
+bool BbClear(BbClient *c, const char *title, BbCallback cb, void *arg);
+bool BbList(BbClient *c, BbCallback cb, void *arg);
+bool BbStatsText(BbClient *c, BbCallback cb, void *arg);
+BbSub *BbSubscribe(BbClient *c, const char *title, BbCallback cb,
+                   void *arg);
+bool BbUnsubscribe(BbClient *c, BbSub *sub, BbCallback cb, void *arg);
+
+const char *BbReplyBoard(BbReply *reply, int *size);
+const char *BbStatusToString(int status);
+
+#endif
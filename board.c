@@ -0,0 +1,772 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "rcu.h"
+#include "board.h"
+#include "lz.h"
+
+
+static pthread_mutex_t  poolLock     = PTHREAD_MUTEX_INITIALIZER;
+static BoardChunk      *poolFree[BOARD_CHUNK_CLASSES];
+static size_t           poolBytes    = 0;
+static size_t           poolMaxBytes = BOARD_DEFAULT_MEM_LIMIT;
+static atomic_ullong    packCount    = 0;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Set the most memory all boards together may use for their data.
+ *
+ * Must be called before any board is created.
+ *
+ **************************************************************************
+ */
+void
+BoardSetMemLimit(size_t bytes)  // IN
+{
+    poolMaxBytes = bytes;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Report the memory the chunk pool holds, in use or free, and the
+ *        most it may grow to.
+ *
+ **************************************************************************
+ */
+void
+BoardMemUsage(size_t *used,   // OUT
+              size_t *limit)  // OUT
+{
+    pthread_mutex_lock(&poolLock);
+    *used = poolBytes;
+    pthread_mutex_unlock(&poolLock);
+    *limit = poolMaxBytes;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Give free chunks back to malloc until size more bytes fit under
+ *        the memory limit.
+ *
+ * A free chunk only serves its own class, so without this, churn on
+ * small boards could leave the pool at its limit with nothing in use and
+ * no way to allocate a larger chunk.  Largest classes go first so as few
+ * chunks as possible are freed.  Call with poolLock held.
+ *
+ **************************************************************************
+ */
+static void
+BoardPoolTrim(size_t size)  // IN
+{
+    int cls;
+
+    for (cls = BOARD_CHUNK_CLASSES - 1;
+         cls >= 0 && poolBytes + size > poolMaxBytes;
+         cls--) {
+        while (poolFree[cls] != NULL && poolBytes + size > poolMaxBytes) {
+            BoardChunk *chunk = poolFree[cls];
+
+            poolFree[cls] = chunk->next;
+            poolBytes    -= BoardChunkSize(cls);
+            free(chunk);
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take a chunk of class cls from the pool, growing the pool up to
+ *        the memory limit.
+ *
+ **************************************************************************
+ */
+static BoardChunk *
+BoardChunkAlloc(int cls)  // IN
+{
+    size_t size = BoardChunkSize(cls);
+    BoardChunk *chunk = NULL;
+
+    pthread_mutex_lock(&poolLock);
+    if (poolFree[cls] != NULL) {
+        chunk         = poolFree[cls];
+        poolFree[cls] = chunk->next;
+    } else {
+        BoardPoolTrim(size);
+        if (poolBytes + size <= poolMaxBytes) {
+            chunk = malloc(sizeof *chunk + size);
+            if (chunk != NULL) {
+                poolBytes += size;
+            }
+        }
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    if (chunk != NULL) {
+        chunk->next = NULL;
+        chunk->cls  = cls;
+    }
+    return chunk;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Return a list of chunks to the pool.
+ *
+ * Classes never decrease along a list, so only the first few chunks are
+ * smaller than BOARD_CHUNK_SIZE; the run of full-size chunks behind them
+ * is spliced onto its free list in one step.
+ *
+ **************************************************************************
+ */
+static void
+BoardChunkFreeList(BoardChunk *head,  // IN
+                   BoardChunk *tail)  // IN
+{
+    pthread_mutex_lock(&poolLock);
+    while (head != NULL && head->cls < BOARD_CHUNK_CLASSES - 1) {
+        BoardChunk *next = head->next;
+        head->next = poolFree[head->cls];
+        poolFree[head->cls] = head;
+        head = next;
+    }
+    if (head != NULL) {
+        tail->next = poolFree[BOARD_CHUNK_CLASSES - 1];
+        poolFree[BOARD_CHUNK_CLASSES - 1] = head;
+    }
+    pthread_mutex_unlock(&poolLock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate an empty log.
+ *
+ **************************************************************************
+ */
+static BoardLog *
+BoardLogAlloc(void)
+{
+    BoardLog *log;
+
+    log = calloc(1, sizeof *log);
+    if (log == NULL) {
+        Error("Failed to allocate a board log\n");
+        return NULL;
+    }
+    atomic_init(&log->refs, 1);
+    return log;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drop a reference to a log, returning its chunks on the last one.
+ *
+ **************************************************************************
+ */
+static void
+BoardLogRelease(BoardLog *log)  // IN
+{
+    if (atomic_fetch_sub_explicit(&log->refs, 1, memory_order_acq_rel) == 1) {
+        if (log->head != NULL) {
+            BoardChunkFreeList(log->head, log->tail);
+        }
+        free(log);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate a version covering the first dataSize bytes of log.
+ *
+ * The version takes over the caller's reference to log.
+ *
+ **************************************************************************
+ */
+static BoardVersion *
+BoardVersionAlloc(BoardLog *log,  // IN
+                  int dataSize,   // IN
+                  BoardSeq seq)   // IN
+{
+    BoardVersion *v;
+
+    v = malloc(sizeof *v);
+    if (v == NULL) {
+        Error("Failed to allocate a board version\n");
+        return NULL;
+    }
+    atomic_init(&v->refs, 1);
+    v->log      = log;
+    v->dataSize = dataSize;
+    v->seq      = seq;
+    atomic_init(&v->packed, NULL);
+    return v;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make v the current version and retire the previous one.
+ *
+ * Called with writeLock held.  The board's own reference to the old
+ * version is dropped after an RCU grace period, so a reader that loaded
+ * the old pointer can still take its reference safely.
+ *
+ **************************************************************************
+ */
+static void
+BoardPublish(WhiteBoard *board,   // IN
+             BoardVersion *v)     // IN
+{
+    BoardVersion *old;
+
+    old = atomic_exchange(&board->current, v);
+    RcuRetire(old, BoardRelease);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an empty board.
+ *
+ * Sequence numbers start from the current time in microseconds, so they
+ * keep increasing across a restart and a client holding a position from
+ * before it is sent the whole board.
+ *
+ **************************************************************************
+ */
+bool
+BoardInit(WhiteBoard *board)  // OUT
+{
+    struct timeval now;
+    BoardLog *log;
+    BoardVersion *v;
+
+    log = BoardLogAlloc();
+    if (log == NULL) {
+        return false;
+    }
+    gettimeofday(&now, NULL);
+    log->startSeq = (BoardSeq)now.tv_sec * 1000000 + now.tv_usec;
+
+    v = BoardVersionAlloc(log, 0, log->startSeq);
+    if (v == NULL) {
+        BoardLogRelease(log);
+        return false;
+    }
+    atomic_init(&board->current, v);
+    pthread_mutex_init(&board->writeLock, NULL);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take a reference to the current contents of the board.
+ *
+ * Never blocks.  The snapshot stays valid and unchanged until released
+ * with BoardRelease(), however long that takes.
+ *
+ **************************************************************************
+ */
+BoardVersion *
+BoardSnapshot(WhiteBoard *board)  // IN
+{
+    BoardVersion *v;
+
+    RcuReadLock();
+    v = atomic_load(&board->current);
+    BoardRetain(v);
+    RcuReadUnlock();
+
+    return v;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take another reference to a version the caller already holds.
+ *
+ **************************************************************************
+ */
+void
+BoardRetain(BoardVersion *v)  // IN
+{
+    atomic_fetch_add_explicit(&v->refs, 1, memory_order_relaxed);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drop a reference to a board version.
+ *
+ **************************************************************************
+ */
+void
+BoardRelease(void *version)  // IN
+{
+    BoardVersion *v = version;
+
+    if (atomic_fetch_sub_explicit(&v->refs, 1, memory_order_acq_rel) == 1) {
+        BoardLogRelease(v->log);
+        free(atomic_load_explicit(&v->packed, memory_order_relaxed));
+        free(v);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy bytes into the log at (*chunk, *off), following next links.
+ *
+ **************************************************************************
+ */
+static void
+BoardCopyIn(BoardChunk **chunk,  // IN/OUT
+            int *off,            // IN/OUT
+            const char *data,    // IN
+            int dataSize)        // IN
+{
+    while (dataSize > 0) {
+        int n;
+
+        if (*off == BoardChunkSize((*chunk)->cls)) {
+            *chunk = (*chunk)->next;
+            *off   = 0;
+        }
+        n = MIN(dataSize, BoardChunkSize((*chunk)->cls) - *off);
+        memcpy((*chunk)->data + *off, data, n);
+        *off     += n;
+        data     += n;
+        dataSize -= n;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Build the version following cur with dataSize more bytes, and a
+ *        newline if asked for.
+ *
+ * Only the bytes past cur are written, so readers of older versions are
+ * undisturbed and the cost is O(dataSize).  The new version is not
+ * published.  Called with writeLock held, unless the log is private to
+ * the caller.  Returns NULL, leaving the log unchanged, if the memory
+ * limit was reached.
+ *
+ **************************************************************************
+ */
+static BoardVersion *
+BoardExtend(const BoardVersion *cur,   // IN
+            const char *data,          // IN
+            int dataSize,              // IN
+            bool newline)              // IN
+{
+    static const char nl = '\n';
+    BoardVersion *v;
+    BoardLog *log = cur->log;
+    BoardChunk *first = NULL, *last = NULL, *chunk;
+    long needed, start, lastStart = 0;
+    int size = dataSize + (newline ? 1 : 0);
+    int cls, off;
+
+    if (dataSize > INT_MAX - 1 - cur->dataSize) {
+        return NULL;
+    }
+
+    /*
+     * Grab every chunk up front so a failure leaves the log untouched.
+     * Each new chunk is at least one class above the last, and big enough
+     * for the rest of the data if a class allows.
+     */
+    needed = cur->dataSize + size - log->capacity;
+    start  = log->capacity;
+    cls    = log->tail != NULL ? log->tail->cls : -1;
+    while (needed > 0) {
+        cls = MIN(cls + 1, BOARD_CHUNK_CLASSES - 1);
+        while (cls < BOARD_CHUNK_CLASSES - 1 && BoardChunkSize(cls) < needed) {
+            cls++;
+        }
+        chunk = BoardChunkAlloc(cls);
+        if (chunk == NULL) {
+            goto fail;
+        }
+        if (first == NULL) {
+            first = chunk;
+        } else {
+            last->next = chunk;
+        }
+        last      = chunk;
+        lastStart = start;
+        start    += BoardChunkSize(cls);
+        needed   -= BoardChunkSize(cls);
+    }
+
+    atomic_fetch_add_explicit(&log->refs, 1, memory_order_relaxed);
+    v = BoardVersionAlloc(log, cur->dataSize + size, cur->seq + 1);
+    if (v == NULL) {
+        atomic_fetch_sub_explicit(&log->refs, 1, memory_order_relaxed);
+        goto fail;
+    }
+
+    if (cur->dataSize == log->capacity) {
+        chunk = first;
+        off   = 0;
+    } else {
+        chunk = log->tail;
+        off   = cur->dataSize - log->tailStart;
+    }
+
+    if (first != NULL) {
+        if (log->tail != NULL) {
+            log->tail->next = first;
+        } else {
+            log->head = first;
+        }
+        log->tail      = last;
+        log->capacity  = start;
+        log->tailStart = lastStart;
+    }
+
+    BoardCopyIn(&chunk, &off, data, dataSize);
+    if (newline) {
+        BoardCopyIn(&chunk, &off, &nl, 1);
+    }
+    return v;
+
+fail:
+    if (first != NULL) {
+        BoardChunkFreeList(first, last);
+    }
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append a post, followed by a newline, to the board.
+ *
+ * Returns false, leaving the board unchanged, if the memory limit was
+ * reached.
+ *
+ **************************************************************************
+ */
+bool
+BoardAppend(WhiteBoard *board,          // IN
+            const char *data,           // IN
+            int dataSize,               // IN
+            BoardCommitFunc commit,     // IN: May be NULL
+            void *arg)                  // IN
+{
+    BoardVersion *v;
+
+    if (dataSize <= 0) {
+        return true;
+    }
+
+    pthread_mutex_lock(&board->writeLock);
+    v = BoardExtend(atomic_load(&board->current), data, dataSize, true);
+    if (v == NULL) {
+        pthread_mutex_unlock(&board->writeLock);
+        return false;
+    }
+    BoardPublish(board, v);
+    if (commit != NULL) {
+        commit(arg, v->seq);
+    }
+    pthread_mutex_unlock(&board->writeLock);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Replace the contents of the board with data, as version seq.
+ *
+ * For loading saved boards: data is taken as is, and the new log starts
+ * at seq so that no position from before it is taken as current.
+ *
+ **************************************************************************
+ */
+bool
+BoardRestore(WhiteBoard *board,   // IN
+             const char *data,    // IN
+             int dataSize,        // IN
+             BoardSeq seq)        // IN
+{
+    BoardLog *log;
+    BoardVersion *empty, *v;
+
+    log = BoardLogAlloc();
+    if (log == NULL) {
+        return false;
+    }
+    empty = BoardVersionAlloc(log, 0, seq - 1);
+    if (empty == NULL) {
+        BoardLogRelease(log);
+        return false;
+    }
+    v = BoardExtend(empty, data, dataSize, false);
+    BoardRelease(empty);
+    if (v == NULL) {
+        return false;
+    }
+    log->startSeq = seq;
+
+    pthread_mutex_lock(&board->writeLock);
+    BoardPublish(board, v);
+    pthread_mutex_unlock(&board->writeLock);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Remove all posts from the board.
+ *
+ * The old log goes back to the pool as a whole once its last reader is
+ * done with it.
+ *
+ **************************************************************************
+ */
+bool
+BoardClear(WhiteBoard *board,          // IN
+           BoardCommitFunc commit,     // IN: May be NULL
+           void *arg)                  // IN
+{
+    BoardLog *log;
+    BoardVersion *v;
+
+    log = BoardLogAlloc();
+    if (log == NULL) {
+        return false;
+    }
+    v = BoardVersionAlloc(log, 0, 0);
+    if (v == NULL) {
+        BoardLogRelease(log);
+        return false;
+    }
+
+    pthread_mutex_lock(&board->writeLock);
+    v->seq = log->startSeq = atomic_load(&board->current)->seq + 1;
+    BoardPublish(board, v);
+    if (commit != NULL) {
+        commit(arg, v->seq);
+    }
+    pthread_mutex_unlock(&board->writeLock);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Check whether the bytes a reader saw at (seq, offset) are still
+ *        the first offset bytes of version v.
+ *
+ * True unless the board was cleared after seq, since appends never touch
+ * bytes that were already published.
+ *
+ **************************************************************************
+ */
+bool
+BoardVersionHas(const BoardVersion *v,   // IN
+                BoardSeq seq,            // IN
+                int offset)              // IN
+{
+    return seq >= v->log->startSeq && seq <= v->seq &&
+           offset >= 0 && offset <= v->dataSize;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Position a cursor at the start of a version.
+ *
+ **************************************************************************
+ */
+void
+BoardCursorInit(BoardCursor *cur,         // OUT
+                const BoardVersion *v)    // IN
+{
+    BoardCursorSeek(cur, v, 0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Position a cursor offset bytes into a version.
+ *
+ **************************************************************************
+ */
+void
+BoardCursorSeek(BoardCursor *cur,         // OUT
+                const BoardVersion *v,    // IN
+                int offset)               // IN
+{
+    cur->chunk     = NULL;
+    cur->off       = 0;
+    cur->bytesLeft = v->dataSize - offset;
+    if (cur->bytesLeft <= 0) {
+        cur->bytesLeft = 0;
+        return;
+    }
+
+    cur->chunk = v->log->head;
+    while (offset >= BoardChunkSize(cur->chunk->cls)) {
+        offset    -= BoardChunkSize(cur->chunk->cls);
+        cur->chunk = cur->chunk->next;
+    }
+    cur->off = offset;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Return the next contiguous run of bytes, or 0 at the end.
+ *
+ * Never looks past the version's own bytes, so it is safe to call while
+ * a writer appends to the same log.
+ *
+ **************************************************************************
+ */
+int
+BoardCursorNext(BoardCursor *cur,     // IN/OUT
+                const char **data)    // OUT
+{
+    int n;
+
+    if (cur->bytesLeft == 0) {
+        return 0;
+    }
+
+    n = MIN(cur->bytesLeft, BoardChunkSize(cur->chunk->cls) - cur->off);
+    *data = cur->chunk->data + cur->off;
+    cur->off        = 0;
+    cur->bytesLeft -= n;
+    if (cur->bytesLeft > 0) {
+        cur->chunk = cur->chunk->next;
+    }
+    return n;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The compressed contents of v, compressing them on first use.
+ *
+ * The result lives as long as v.  Readers that race to compress a new
+ * version each do the work, but only one result is kept; after that
+ * every reader of the version shares it.  Returns NULL if memory ran
+ * out.
+ *
+ **************************************************************************
+ */
+const BoardPacked *
+BoardPack(BoardVersion *v)  // IN
+{
+    BoardPacked *p, *expected = NULL;
+    BoardCursor cur;
+    const char *src = NULL;
+    char *flat = NULL;
+    int n;
+
+    p = atomic_load_explicit(&v->packed, memory_order_acquire);
+    if (p != NULL) {
+        return p;
+    }
+
+    /* The compressor wants the contents in one piece. */
+    BoardCursorInit(&cur, v);
+    n = BoardCursorNext(&cur, &src);
+    if (n < v->dataSize) {
+        char *dst;
+
+        flat = malloc(v->dataSize);
+        if (flat == NULL) {
+            return NULL;
+        }
+        memcpy(flat, src, n);
+        for (dst = flat + n; (n = BoardCursorNext(&cur, &src)) > 0; dst += n) {
+            memcpy(dst, src, n);
+        }
+        src = flat;
+    }
+
+    /* Keep the result only if it is smaller; otherwise size stays 0. */
+    p = malloc(sizeof *p + v->dataSize);
+    if (p == NULL) {
+        free(flat);
+        return NULL;
+    }
+    p->size = LzCompress(src, v->dataSize, p->data, v->dataSize - 1);
+    free(flat);
+    if (p->size < v->dataSize / 2) {
+        BoardPacked *q = realloc(p, sizeof *p + p->size);
+        p = q != NULL ? q : p;
+    }
+    atomic_fetch_add_explicit(&packCount, 1, memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&v->packed, &expected, p,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+        free(p);
+        p = expected;
+    }
+    return p;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief How many times BoardPack() has compressed a version.
+ *
+ **************************************************************************
+ */
+unsigned long long
+BoardPackCount(void)
+{
+    return atomic_load_explicit(&packCount, memory_order_relaxed);
+}
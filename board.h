@@ -0,0 +1,136 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _BOARD_H_
+#define _BOARD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * Chunks come in size classes of 256 bytes, 1 KB, 4 KB and 16 KB.  A log
+ * starts small and moves up one class per chunk, so thousands of short
+ * boards stay cheap while large ones are mostly 16 KB chunks.
+ */
+#define BOARD_CHUNK_CLASSES       4
+#define BOARD_CHUNK_MIN_SIZE      256
+#define BOARD_CHUNK_SIZE          (BOARD_CHUNK_MIN_SIZE << \
+                                   (2 * (BOARD_CHUNK_CLASSES - 1)))
+#define BOARD_DEFAULT_MEM_LIMIT   (64 * 1024 * 1024)
+
+typedef unsigned long long BoardSeq;
+
+/**
+ * A piece of board storage, allocated from the chunk pool.
+ */
+typedef struct BoardChunk {
+    struct BoardChunk *next;
+    int                cls;
+    char               data[0];
+} BoardChunk;
+
+/**
+ * An append-only list of chunks whose classes never decrease.  Bytes below
+ * a published size are never modified, so every version of the board
+ * shares the log it was cut from.
+ */
+typedef struct BoardLog {
+    atomic_int   refs;
+    BoardChunk  *head;
+    BoardChunk  *tail;       // Written only under the board's writeLock
+    long         capacity;   // Total bytes in all chunks
+    long         tailStart;  // Offset of tail->data[0]
+    BoardSeq     startSeq;   // Version that started the log (a CLEAR)
+} BoardLog;
+
+/**
+ * The contents of a version compressed with LzCompress(), made once and
+ * shared by every reply that sends them.  size is 0 if the contents did
+ * not compress.
+ */
+typedef struct BoardPacked {
+    int   size;
+    char  data[0];
+} BoardPacked;
+
+/**
+ * An immutable, reference-counted version of the board contents: the
+ * first dataSize bytes of log.  seq goes up by one with every change.
+ */
+typedef struct BoardVersion {
+    atomic_int  refs;
+    BoardLog   *log;
+    int         dataSize;
+    BoardSeq    seq;
+    _Atomic(struct BoardPacked *) packed;   // Built by BoardPack()
+} BoardVersion;
+
+/**
+ * Walks the bytes of a version one chunk at a time.
+ */
+typedef struct BoardCursor {
+    const BoardChunk *chunk;
+    int               off;
+    int               bytesLeft;
+} BoardCursor;
+
+/**
+ * A white board.  Readers take snapshots without locking; writers are
+ * serialized by writeLock and publish a new version on every change.
+ */
+typedef struct WhiteBoard {
+    _Atomic(BoardVersion *) current;
+    pthread_mutex_t         writeLock;
+} WhiteBoard;
+
+/*
+ * Called under the board's writeLock right after a change is published as
+ * version seq, so changes reach a journal in the order they are applied.
+ */
+typedef void (*BoardCommitFunc)(void *arg, BoardSeq seq);
+
+void BoardSetMemLimit(size_t bytes);
+bool BoardInit(WhiteBoard *board);
+BoardVersion *BoardSnapshot(WhiteBoard *board);
+void BoardRetain(BoardVersion *v);
+void BoardRelease(void *version);
+bool BoardAppend(WhiteBoard *board, const char *data, int dataSize,
+                 BoardCommitFunc commit, void *arg);
+bool BoardClear(WhiteBoard *board, BoardCommitFunc commit, void *arg);
+bool BoardRestore(WhiteBoard *board, const char *data, int dataSize,
+                  BoardSeq seq);
+void BoardMemUsage(size_t *used, size_t *limit);
+const BoardPacked *BoardPack(BoardVersion *v);
+unsigned long long BoardPackCount(void);
+
+/*
+ * Bytes on the board now.  Only for callers inside an RCU read-side
+ * section, such as BoardTableForEach callbacks; others take a snapshot.
+ */
+static inline int
+BoardPeekSize(WhiteBoard *board)
+{
+    return atomic_load(&board->current)->dataSize;
+}
+
+static inline int
+BoardChunkSize(int cls)
+{
+    return BOARD_CHUNK_MIN_SIZE << (2 * cls);
+}
+
+bool BoardVersionHas(const BoardVersion *v, BoardSeq seq, int offset);
+
+void BoardCursorInit(BoardCursor *cur, const BoardVersion *v);
+void BoardCursorSeek(BoardCursor *cur, const BoardVersion *v, int offset);
+int  BoardCursorNext(BoardCursor *cur, const char **data);
+
+#endif
@@ -0,0 +1,304 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "rcu.h"
+#include "boardtable.h"
+
+
+/**
+ **************************************************************************
+ *
+ * \brief FNV-1a hash of a title.
+ *
+ * Also picks the shard that owns the board in a sharded server.
+ *
+ **************************************************************************
+ */
+unsigned
+BoardTitleHash(const char *title)  // IN
+{
+    unsigned hash = 2166136261u;
+
+    while (*title != '\0') {
+        hash ^= (unsigned char)*title++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate an empty slot array of the given power-of-two size.
+ *
+ **************************************************************************
+ */
+static BoardSlots *
+BoardSlotsAlloc(size_t numSlots)  // IN
+{
+    BoardSlots *s;
+
+    s = calloc(1, sizeof *s + numSlots * sizeof s->slots[0]);
+    if (s == NULL) {
+        Error("Failed to allocate %zu board table slots\n", numSlots);
+        return NULL;
+    }
+    s->mask = numSlots - 1;
+    return s;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Find the entry for title, or the empty slot where it would go.
+ *
+ **************************************************************************
+ */
+static _Atomic(BoardEntry *) *
+BoardSlotsProbe(BoardSlots *s,        // IN
+                const char *title,    // IN
+                unsigned hash,        // IN
+                BoardEntry **found)   // OUT
+{
+    size_t i;
+
+    for (i = hash & s->mask; ; i = (i + 1) & s->mask) {
+        BoardEntry *e = atomic_load_explicit(&s->slots[i],
+                                             memory_order_acquire);
+        if (e == NULL ||
+            (e->hash == hash && strcmp(e->title, title) == 0)) {
+            *found = e;
+            return &s->slots[i];
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an empty table.
+ *
+ **************************************************************************
+ */
+bool
+BoardTableInit(BoardTable *table)  // OUT
+{
+    BoardSlots *s = BoardSlotsAlloc(BOARDTABLE_MIN_SLOTS);
+
+    if (s == NULL) {
+        return false;
+    }
+    atomic_init(&table->slots, s);
+    pthread_mutex_init(&table->lock, NULL);
+    table->count = 0;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Double the slot array.
+ *
+ * Called with table->lock held.  Readers still probing the old array
+ * find every entry there, so it is retired rather than freed.
+ *
+ **************************************************************************
+ */
+static bool
+BoardTableGrow(BoardTable *table)  // IN
+{
+    BoardSlots *old = atomic_load(&table->slots);
+    BoardSlots *s;
+    size_t i;
+
+    s = BoardSlotsAlloc((old->mask + 1) * 2);
+    if (s == NULL) {
+        return false;
+    }
+
+    for (i = 0; i <= old->mask; i++) {
+        BoardEntry *e = atomic_load_explicit(&old->slots[i],
+                                             memory_order_relaxed);
+        BoardEntry *dummy;
+        if (e != NULL) {
+            atomic_init(BoardSlotsProbe(s, e->title, e->hash, &dummy), e);
+        }
+    }
+
+    atomic_store(&table->slots, s);
+    RcuRetire(old, free);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Find the board with the given title, creating it if asked to.
+ *
+ * Returns NULL if there is no such board, or it could not be created.
+ *
+ **************************************************************************
+ */
+BoardEntry *
+BoardTableLookup(BoardTable *table,   // IN
+                 const char *title,   // IN
+                 bool create)         // IN
+{
+    unsigned hash = BoardTitleHash(title);
+    _Atomic(BoardEntry *) *slot;
+    BoardEntry *e;
+
+    RcuReadLock();
+    BoardSlotsProbe(atomic_load(&table->slots), title, hash, &e);
+    RcuReadUnlock();
+
+    if (e != NULL || !create) {
+        return e;
+    }
+
+    pthread_mutex_lock(&table->lock);
+
+    /* Keep the load factor under 3/4 so probe sequences stay short. */
+    if ((table->count + 1) * 4 > (atomic_load(&table->slots)->mask + 1) * 3 &&
+        !BoardTableGrow(table)) {
+        pthread_mutex_unlock(&table->lock);
+        return NULL;
+    }
+
+    slot = BoardSlotsProbe(atomic_load(&table->slots), title, hash, &e);
+    if (e == NULL) {
+        e = calloc(1, sizeof *e);
+        if (e == NULL || !BoardInit(&e->board)) {
+            Error("Failed to allocate board \"%s\"\n", title);
+            free(e);
+            pthread_mutex_unlock(&table->lock);
+            return NULL;
+        }
+        e->hash = hash;
+        snprintf(e->title, sizeof e->title, "%s", title);
+        pthread_mutex_init(&e->watchLock, NULL);
+        atomic_store_explicit(slot, e, memory_order_release);
+        table->count++;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+    return e;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Call func on every board.
+ *
+ * Runs inside an RCU read-side section, so func must not block or take
+ * another read lock.  Boards created meanwhile may or may not be seen.
+ *
+ **************************************************************************
+ */
+void
+BoardTableForEach(BoardTable *table,     // IN
+                  BoardEntryFunc func,   // IN
+                  void *arg)             // IN
+{
+    BoardSlots *s;
+    size_t i;
+
+    RcuReadLock();
+    s = atomic_load(&table->slots);
+    for (i = 0; i <= s->mask; i++) {
+        BoardEntry *e = atomic_load_explicit(&s->slots[i],
+                                             memory_order_acquire);
+        if (e != NULL) {
+            func(e, arg);
+        }
+    }
+    RcuReadUnlock();
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start telling w about changes to a board.
+ *
+ **************************************************************************
+ */
+void
+BoardTableWatch(BoardEntry *entry,   // IN
+                BoardWatcher *w)     // IN
+{
+    pthread_mutex_lock(&entry->watchLock);
+    w->next = entry->watchers;
+    if (w->next != NULL) {
+        w->next->pprev = &w->next;
+    }
+    w->pprev = &entry->watchers;
+    entry->watchers = w;
+    pthread_mutex_unlock(&entry->watchLock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop telling w about changes to a board.
+ *
+ * No new notification is posted once this returns, but one may already
+ * be queued; the caller cancels it on w's loop.
+ *
+ **************************************************************************
+ */
+void
+BoardTableUnwatch(BoardEntry *entry,   // IN
+                  BoardWatcher *w)     // IN
+{
+    pthread_mutex_lock(&entry->watchLock);
+    *w->pprev = w->next;
+    if (w->next != NULL) {
+        w->next->pprev = w->pprev;
+    }
+    pthread_mutex_unlock(&entry->watchLock);
+    w->next  = NULL;
+    w->pprev = NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Post the task of every watcher of a board to its loop.
+ *
+ * A watcher already queued is not queued again, so changes made within
+ * delayUs of each other reach it as a single notification.
+ *
+ **************************************************************************
+ */
+void
+BoardTableNotify(BoardEntry *entry,   // IN
+                 long delayUs)        // IN
+{
+    BoardWatcher *w;
+
+    pthread_mutex_lock(&entry->watchLock);
+    for (w = entry->watchers; w != NULL; w = w->next) {
+        EventLoopPost(w->loop, &w->task, delayUs);
+    }
+    pthread_mutex_unlock(&entry->watchLock);
+}
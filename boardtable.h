@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _BOARDTABLE_H_
+#define _BOARDTABLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "board.h"
+#include "eventloop.h"
+
+#define BOARDTABLE_MIN_SLOTS 1024
+
+/**
+ * Someone to tell about changes to a board: task is posted to loop.
+ */
+typedef struct BoardWatcher {
+    struct BoardWatcher  *next;
+    struct BoardWatcher **pprev;
+    EventLoop            *loop;
+    EventTask             task;
+} BoardWatcher;
+
+/**
+ * A named board.  Entries are never freed once created.
+ */
+typedef struct BoardEntry {
+    unsigned         hash;
+    char             title[MAX_TITLE_LEN + 1];
+    WhiteBoard       board;
+    pthread_mutex_t  watchLock;
+    BoardWatcher    *watchers;
+    unsigned         replSync;   // Follower: full sync that sent the board
+} BoardEntry;
+
+/**
+ * A power-of-two array of slots probed linearly.
+ */
+typedef struct BoardSlots {
+    size_t                mask;
+    _Atomic(BoardEntry *) slots[0];
+} BoardSlots;
+
+/**
+ * Title -> board index.  Lookups are lock-free; inserts are serialized by
+ * lock and grow the slot array by publishing a copy under RCU.
+ */
+typedef struct BoardTable {
+    _Atomic(BoardSlots *) slots;
+    pthread_mutex_t       lock;
+    size_t                count;
+} BoardTable;
+
+typedef void (*BoardEntryFunc)(BoardEntry *entry, void *arg);
+
+unsigned BoardTitleHash(const char *title);
+bool BoardTableInit(BoardTable *table);
+BoardEntry *BoardTableLookup(BoardTable *table, const char *title,
+                             bool create);
+void BoardTableForEach(BoardTable *table, BoardEntryFunc func, void *arg);
+void BoardTableWatch(BoardEntry *entry, BoardWatcher *w);
+void BoardTableUnwatch(BoardEntry *entry, BoardWatcher *w);
+void BoardTableNotify(BoardEntry *entry, long delayUs);
+
+#endif
@@ -0,0 +1,36 @@
+#!/bin/sh
+##****************************************************************************
+## CMPE 207 (Network Programming and Applications) Sample Program.
+##
+## San Jose State University, Copyright (2016) Reserved.
+##
+## DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+##****************************************************************************
+##
+## Run bbcheck against the server on each event loop backend: epoll and
+## io_uring, with one thread and sharded over several, and with plain and
+## compressed replies.  Usage: ./check.sh [port]  (make check)
+
+PORT=${1:-18207}
+FAILED=0
+
+for opts in "" "--io-uring" "--threads 4 --shard" \
+            "--io-uring --threads 4 --shard"; do
+    ./server -v error $opts "$PORT" >check.log 2>&1 &
+    pid=$!
+    for compress in "" "--compress"; do
+        if ./bbcheck $compress 127.0.0.1 "$PORT"; then
+            echo "PASS server $opts, bbcheck $compress"
+        else
+            echo "FAIL server $opts, bbcheck $compress"
+            FAILED=1
+        fi
+    done
+    kill -INT $pid
+    wait $pid
+    if grep -q "io_uring" check.log; then
+        sed 's/^/    /' check.log
+    fi
+done
+rm -f check.log
+exit $FAILED
@@ -9,35 +9,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "common.h"
+#include "blackboard.h"
 #include "client.h"
 
-typedef bool (*CmdFunc)(int sd, char *data, int dataSize);
+typedef bool (*CmdFunc)(BbClient *c, char *data, int dataSize);
               
 typedef struct CmdHandler {
     const char *cmd;
     CmdFunc     func;
 } CmdHandler;
 
-static bool ProcessCmdHelp(int sd, char *data, int dataSize);
-static bool ProcessCmdShow(int sd, char *data, int dataSize);
-static bool ProcessCmdClear(int sd, char *data, int dataSize);
-static bool ProcessCmdPost(int sd, char *data, int dataSize);
+static bool ProcessCmdHelp(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdShow(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdClear(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdPost(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdBatch(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdBoard(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdList(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdPoll(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdWatch(BbClient *c, char *data, int dataSize);
+static bool ProcessCmdStats(BbClient *c, char *data, int dataSize);
 
 CmdHandler cmdHandlers[] = {
     { "help",  ProcessCmdHelp  },
     { "show",  ProcessCmdShow  },
     { "clear", ProcessCmdClear },
     { "post",  ProcessCmdPost  },
+    { "batch", ProcessCmdBatch },
+    { "board", ProcessCmdBoard },
+    { "list",  ProcessCmdList  },
+    { "poll",  ProcessCmdPoll  },
+    { "watch", ProcessCmdWatch },
+    { "stats", ProcessCmdStats },
 };
 
+/* Title of the board that show/clear/post act on. */
+static char curTitle[MAX_TITLE_LEN + 1] = "";
+
+/* How much of the current board "poll" has printed so far. */
+static MsgBoardPos curPos;
+
+#define MAX_PIPELINE_DEPTH 1024
+
+/* Requests kept in flight. */
+static int        pipeDepth    = 1;
+
+/* Whether "watch" has a subscription the server accepted. */
+static bool       watching     = false;
+
 
 /**
  **************************************************************************
@@ -50,7 +75,11 @@ static void
 Usage(const char *prog) // IN
 {
     Log("Usage:\n");
-    Log("    %s <server_ip> <server_port>\n", prog);
+    Log("    %s [options] <server_ip> <server_port>\n", prog);
+    Log("Options:\n");
+    Log("    -d, --depth N   Keep up to N requests in flight "
+        "(max %d, default 1)\n", MAX_PIPELINE_DEPTH);
+    Log("    -z, --compress  Compress large boards and posts on the wire\n");
     exit(EXIT_FAILURE);
 }
 
@@ -67,20 +96,188 @@ ParseArgs(int argc,             // IN
           char *argv[],         // IN
           ClientArgs *cliArgs)  // OUT
 {
-    if (argc < 3) {
-        Usage(argv[0]);
-    }
+    static const struct option options[] = {
+        { "depth",    required_argument, NULL, 'd' },
+        { "compress", no_argument,       NULL, 'z' },
+        { NULL,       0,                 NULL, 0   },
+    };
+    int opt;
 
     memset(cliArgs, 0, sizeof *cliArgs);
+    cliArgs->pipeDepth = 1;
+
+    while ((opt = getopt_long(argc, argv, "d:z", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            cliArgs->pipeDepth = atoi(optarg);
+            if (cliArgs->pipeDepth <= 0 ||
+                cliArgs->pipeDepth > MAX_PIPELINE_DEPTH) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'z':
+            cliArgs->compress = true;
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 2) {
+        Usage(argv[0]);
+    }
 
-    cliArgs->svrHost = argv[1];
-    cliArgs->svrPort = atoi(argv[2]);
+    cliArgs->svrHost = argv[optind];
+    cliArgs->svrPort = atoi(argv[optind + 1]);
     if (cliArgs->svrPort == 0) {
         Usage(argv[0]);
     }
 }
 
 
+/**
+ **************************************************************************
+ *
+ * \brief Print the board bytes of a BOARD_DELTA or NOTIFY.
+ *
+ **************************************************************************
+ */
+static void
+PrintDelta(const BbReply *reply)  // IN
+{
+    if (reply->status == MSG_STATUS_RESET) {
+        printf("--- board \"%s\" from the start ---\n", reply->title);
+    }
+    fwrite(reply->data, 1, reply->dataSize, stdout);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Report the failed items of a POST_BATCH.
+ *
+ **************************************************************************
+ */
+static void
+PrintItemResults(const BbReply *reply)  // IN
+{
+    const unsigned char *results = (const unsigned char *)reply->data;
+    int i;
+
+    for (i = 0; i < reply->dataSize; i++) {
+        if (results[i] != MSG_STATUS_SUCCESS) {
+            Error("   Item %d: %s\n", i + 1, MsgStatusToString(results[i]));
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Completion callback of every request: print the reply.
+ *
+ **************************************************************************
+ */
+static void
+PrintReply(void *arg,          // IN: unused
+           BbReply *reply)     // IN
+{
+    const char *board;
+    int size;
+
+    if (reply->status < 0 ||
+        (reply->type == MSG_STATUS && reply->status != MSG_STATUS_SUCCESS)) {
+        Error("Request failed: %s\n", BbStatusToString(reply->status));
+    }
+
+    switch (reply->type) {
+    case MSG_STATUS:
+        PrintItemResults(reply);
+        break;
+    case MSG_BOARD_DELTA:
+        curPos = reply->pos;
+        PrintDelta(reply);
+        break;
+    case MSG_BOARD:
+    case MSG_BOARD_LZ:
+        board = BbReplyBoard(reply, &size);
+        if (board != NULL) {
+            fwrite(board, 1, size, stdout);
+        }
+        break;
+    case MSG_TITLES:
+    case MSG_STATS_TEXT:
+        fwrite(reply->data, 1, reply->dataSize, stdout);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Subscription callback of "watch": print what is pushed.
+ *
+ * The first call is the reply to the SUBSCRIBE.  A subscription the
+ * server refuses, then or after a reconnect, ends the watch.
+ *
+ **************************************************************************
+ */
+static void
+PrintPush(void *arg,          // IN: unused
+          BbReply *reply)     // IN
+{
+    if (reply->type == MSG_NOTIFY) {
+        PrintDelta(reply);
+        fflush(stdout);
+        return;
+    }
+    watching = reply->type == MSG_STATUS &&
+               reply->status == MSG_STATUS_SUCCESS;
+    if (!watching) {
+        Error("Request failed: %s\n", BbStatusToString(reply->status));
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Wait for the replies to every request in flight.
+ *
+ **************************************************************************
+ */
+static bool
+DrainReplies(BbClient *c)  // IN
+{
+    return BbClientDrain(c, -1);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Wait until another request may be sent.
+ *
+ * Replies are handled once pipeDepth requests are in flight, so with a
+ * depth of 1 every command is a plain round trip.
+ *
+ **************************************************************************
+ */
+static bool
+WaitForRoom(BbClient *c)  // IN
+{
+    while (BbClientPending(c) >= pipeDepth) {
+        BbClientPoll(c, -1);
+    }
+    return true;
+}
+
+
 /**
  **************************************************************************
  *
@@ -89,15 +286,25 @@ ParseArgs(int argc,             // IN
  **************************************************************************
  */
 static bool
-ProcessCmdHelp(int sd,        // IN
+ProcessCmdHelp(BbClient *c,   // IN
                char *data,    // IN
                int dataSize)  // IN
 {
+    if (!DrainReplies(c)) {
+        return false;
+    }
+
     printf("Commands:\n");
     printf("   help          : Display this screen.\n");
     printf("   show          : Show the content of White Board.\n");
     printf("   clear         : Clear the content of White Board.\n");
     printf("   post message  : Post a message (\"msg\") to White Board.\n");
+    printf("   batch m1|m2   : Post several messages in one request.\n");
+    printf("   board [title] : Switch to the board named title.\n");
+    printf("   list          : List the boards on the server.\n");
+    printf("   poll          : Show what was posted since the last poll.\n");
+    printf("   watch         : Print posts to the board as they arrive.\n");
+    printf("   stats         : Show the server metrics.\n");
     printf("\n");
     return true;
 }
@@ -111,101 +318,202 @@ ProcessCmdHelp(int sd,        // IN
  **************************************************************************
  */
 static bool
-ProcessCmdShow(int sd,        // IN
+ProcessCmdShow(BbClient *c,   // IN
                char *data,    // IN
                int dataSize)  // IN
 {
-    MsgHdr req, reply;
+    return WaitForRoom(c) && BbShow(c, curTitle, PrintReply, NULL);
+}
 
-    memset(&req, 0, sizeof req);
-    req.type = MSG_SHOW;
-    
-    if (WriteFully(sd, &req, sizeof req) <= 0) {
-        return false;
-    }
 
-    if (ReadFully(sd, &reply, sizeof reply) <= 0) {
-        return false;
+/**
+ **************************************************************************
+ *
+ * \brief Process the "clear" command.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdClear(BbClient *c,   // IN
+                char *data,    // IN
+                int dataSize)  // IN
+{
+    return WaitForRoom(c) && BbClear(c, curTitle, PrintReply, NULL);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Process the "post" command.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdPost(BbClient *c,   // IN
+               char *data,    // IN
+               int dataSize)  // IN
+{
+    return WaitForRoom(c) &&
+           BbPost(c, curTitle, data, dataSize, PrintReply, NULL);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Process the "batch" command: post each '|'-separated message.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdBatch(BbClient *c,   // IN
+                char *data,    // IN
+                int dataSize)  // IN
+{
+    const char **posts;
+    int *sizes;
+    char *msg, *saveptr;
+    int numPosts = 0;
+    bool ok;
+
+    if (dataSize <= 0) {
+        return true;
     }
-    if (reply.type != MSG_BOARD) {
-        Error("Unexpected reply message type %d\n", reply.type);
+    /* At most one message per character of the line. */
+    posts = malloc(dataSize * sizeof *posts);
+    sizes = malloc(dataSize * sizeof *sizes);
+    if (posts == NULL || sizes == NULL) {
+        Error("Failed to allocate the batch\n");
+        free(posts);
+        free(sizes);
         return false;
     }
 
-    while (reply.dataSize > 0) {
-        char ch;
-        if (ReadFully(sd, &ch, sizeof ch) <= 0) {
-            return false;
-        }
-        printf("%c", ch);
-        reply.dataSize--;
+    for (msg = strtok_r(data, "|", &saveptr); msg != NULL;
+         msg = strtok_r(NULL, "|", &saveptr)) {
+        posts[numPosts] = msg;
+        sizes[numPosts] = strlen(msg);
+        numPosts++;
     }
-    return false;
+
+    ok = WaitForRoom(c) &&
+         BbPostBatch(c, curTitle, posts, sizes, numPosts, PrintReply, NULL);
+    free(posts);
+    free(sizes);
+    return ok;
 }
 
 
 /**
  **************************************************************************
  *
- * \brief Process the "clear" command.
+ * \brief Process the "board" command.
  *
  **************************************************************************
  */
 static bool
-ProcessCmdClear(int sd,        // IN
+ProcessCmdBoard(BbClient *c,   // IN
                 char *data,    // IN
                 int dataSize)  // IN
 {
-    MsgHdr req, reply;
-
-    memset(&req, 0, sizeof req);
-    req.type = MSG_CLEAR;
-    
-    if (WriteFully(sd, &req, sizeof req) <= 0) {
+    if (!DrainReplies(c)) {
         return false;
     }
-    if (ReadFully(sd, &reply, sizeof reply) <= 0) {
-        return false;
-    }
-    if (reply.type != MSG_STATUS) {
-        Error("Unexpected reply message type %d\n", reply.type);
-        return false;
+
+    if (dataSize > 0) {
+        if (strlen(data) > MAX_TITLE_LEN || strchr(data, '\n') != NULL) {
+            Error("Board titles are at most %d characters\n", MAX_TITLE_LEN);
+            return true;
+        }
+        snprintf(curTitle, sizeof curTitle, "%s", data);
+        memset(&curPos, 0, sizeof curPos);
     }
-    return false;
+    printf("Using board \"%s\"\n", curTitle);
+    return true;
 }
 
 
 /**
  **************************************************************************
  *
- * \brief Process the "post" command.
+ * \brief Process the "list" command.
  *
  **************************************************************************
  */
 static bool
-ProcessCmdPost(int sd,        // IN
+ProcessCmdList(BbClient *c,   // IN
                char *data,    // IN
                int dataSize)  // IN
 {
-    MsgHdr req, reply;
+    return WaitForRoom(c) && BbList(c, PrintReply, NULL);
+}
 
-    memset(&req, 0, sizeof req);
-    req.type     = MSG_POST;
-    req.dataSize = dataSize;
-    
-    if (WriteFully(sd, &req, sizeof req) <= 0) {
-        return false;
-    }
-    if (WriteFully(sd, data, dataSize) <= 0) {
+
+/**
+ **************************************************************************
+ *
+ * \brief Process the "stats" command.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdStats(BbClient *c,   // IN
+                char *data,    // IN
+                int dataSize)  // IN
+{
+    return WaitForRoom(c) && BbStatsText(c, PrintReply, NULL);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Process the "poll" command.
+ *
+ * The position sent is the one left by the previous poll's reply, so
+ * polls do not pipeline.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdPoll(BbClient *c,   // IN
+               char *data,    // IN
+               int dataSize)  // IN
+{
+    if (!DrainReplies(c)) {
         return false;
     }
+    return BbShowSince(c, curTitle, &curPos, PrintReply, NULL);
+}
+
 
-    if (ReadFully(sd, &reply, sizeof reply) <= 0) {
+/**
+ **************************************************************************
+ *
+ * \brief Process the "watch" command.
+ *
+ * Subscribes to the board and prints what the server pushes for as long
+ * as the server accepts the subscription.  Across reconnects, nothing
+ * posted in between is missed.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessCmdWatch(BbClient *c,   // IN
+                char *data,    // IN
+                int dataSize)  // IN
+{
+    if (!WaitForRoom(c) ||
+        BbSubscribe(c, curTitle, PrintPush, NULL) == NULL ||
+        !DrainReplies(c) || !watching) {
         return false;
     }
-    if (reply.type != MSG_STATUS) {
-        Error("Unexpected reply message type %d\n", reply.type);
-        return false;
+
+    printf("Watching board \"%s\"\n", curTitle);
+    fflush(stdout);
+    while (watching) {
+        BbClientPoll(c, -1);
     }
     return false;
 }
@@ -216,14 +524,21 @@ ProcessCmdPost(int sd,        // IN
  *
  * \brief Dispatch client commands.
  *
+ * When commands come from a terminal, every reply is printed before the
+ * next prompt.  Commands piped in from a file are pipelined up to the
+ * configured depth.
+ *
  **************************************************************************
  */
 void
-Client(int sock,                   // IN
+Client(BbClient *c,                // IN
        const ClientArgs *cliArgs)  // IN
 {
+    bool interactive = isatty(STDIN_FILENO);
     bool running = true;
 
+    pipeDepth = cliArgs->pipeDepth;
+
     Log("\n*** Welcome to 207 White Board Client. *** \n\n"); 
     Log("Enter a command or 'help' to see a list of available commands.\n\n");
 
@@ -234,14 +549,23 @@ Client(int sock,                   // IN
         int cmdBufSize, dataSize;
         int i;
 
+        if (interactive && !DrainReplies(c)) {
+            return;
+        }
+
         cmdBuf = readline("207> ");
         if (cmdBuf == NULL) {
+            DrainReplies(c);
             return;
         }
 
         cmdBufSize = strlen(cmdBuf);
 
         cmd = strtok_r(cmdBuf, " ", &saveptr);
+        if (cmd == NULL) {
+            free(cmdBuf);
+            continue;
+        }
 
         data     = cmdBuf + strlen(cmd) + 1;
         dataSize = cmdBufSize - strlen(cmd);
@@ -249,7 +573,7 @@ Client(int sock,                   // IN
         for (i = 0; i < ARRAYSIZE(cmdHandlers); i++) {
             CmdHandler *handler = &cmdHandlers[i];
             if (strcasecmp(cmd, handler->cmd) == 0) {
-                running = handler->func(sock, data, dataSize);
+                running = handler->func(c, data, dataSize);
                 break;
             }
         }
@@ -258,6 +582,9 @@ Client(int sock,                   // IN
             running = false;
         }
         free(cmdBuf);
+
+        /* Replies are handled later, but the request goes out now. */
+        BbClientFlush(c);
     }
+    DrainReplies(c);
 }
-
@@ -11,6 +11,7 @@
 #define _CLIENT_H_
 
 #include "common.h"
+#include "blackboard.h"
 
 /**
  * The client command line arguments.
@@ -18,10 +19,12 @@
 typedef struct ClientArgs {
     const char     *svrHost;
     unsigned short  svrPort;
+    int             pipeDepth;   // Requests kept in flight
+    bool            compress;    // Ask for compressed boards and posts
 } ClientArgs;
 
 void ParseArgs(int argc, char *argv[], ClientArgs *cliArgs);
-void Client(int sock, const ClientArgs *cliArgs);
+void Client(BbClient *c, const ClientArgs *cliArgs);
 
 #endif
 
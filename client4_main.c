@@ -9,55 +9,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <netdb.h>
 
 #include "common.h"
+#include "blackboard.h"
 #include "client.h"
 
+/* How long to keep trying to reach the server at startup. */
+#define CONNECT_TIMEOUT_MS 3000
+
 
 /**
  **************************************************************************
  *
- * \brief Create a client TCP socket and connect to the server.
+ * \brief Create a client of the server and wait until it is connected.
  *
  **************************************************************************
  */
-int
-CreateClientTCP(const char *svrHost,     // IN
-                unsigned short svrPort,  // IN
-                char *svrName,           // OUT
-                int svrNameLen)          // IN
+BbClient *
+CreateClient(const ClientArgs *cliArgs,  // IN
+             char *svrName,              // OUT
+             int svrNameLen)             // IN
 {
-    int sock;
-    struct sockaddr_in svrAddr;
+    char port[PORT_STRLEN];
+    BbConfig cfg;
+    BbClient *c;
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("Failed to allocate the client socket");
-        exit(EXIT_FAILURE);
-    }
+    snprintf(port, sizeof port, "%u", cliArgs->svrPort);
+    snprintf(svrName, svrNameLen, "%s:%s", cliArgs->svrHost, port);
 
-    memset(&svrAddr, 0, sizeof(svrAddr));
-    svrAddr.sin_family = AF_INET;
-    svrAddr.sin_port   = htons(svrPort);
+    BbConfigInit(&cfg, cliArgs->svrHost, port);
+    cfg.depth    = cliArgs->pipeDepth;
+    cfg.compress = cliArgs->compress;
 
-    if (inet_pton(AF_INET, svrHost, &svrAddr.sin_addr.s_addr) <= 0) {
-        perror("Failed to convert IP address\n");
+    Log("Attempting %s\n", svrName);
+    c = BbClientCreate(&cfg);
+    if (c == NULL) {
         exit(EXIT_FAILURE);
     }
-
-    SocketAddrToString(&svrAddr, svrName, svrNameLen);
-    Log("Attempting %s\n", svrName);
-
-    if (connect(sock, (struct sockaddr *)&svrAddr, sizeof(svrAddr)) < 0) {
-        perror("Failed to connect to the server");
+    if (!BbClientWaitReady(c, CONNECT_TIMEOUT_MS)) {
+        Error("Failed to connect to the server\n");
         exit(EXIT_FAILURE);
     }
-
-    return sock;
+    return c;
 }
 
 
@@ -71,21 +65,19 @@ CreateClientTCP(const char *svrHost,     // IN
 int
 main(int argc, char *argv[])
 {
-    int sock;
+    BbClient *c;
     ClientArgs cliArgs;
-    char svrName[INET_ADDRSTRLEN + PORT_STRLEN];
+    char svrName[NI_MAXHOST + PORT_STRLEN];
 
     ParseArgs(argc, argv, &cliArgs);
 
-    sock = CreateClientTCP(cliArgs.svrHost, cliArgs.svrPort,
-                           svrName, sizeof svrName);
+    c = CreateClient(&cliArgs, svrName, sizeof svrName);
 
     Log("Connected to server at %s\n", svrName);
 
-    Client(sock, &cliArgs);
+    Client(c, &cliArgs);
 
-    close(sock);
+    BbClientDestroy(c);
     Log("\nDisconnected from server at %s\n", svrName);
     return 0;
 }
-
@@ -9,12 +9,67 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 
 #include "common.h"
 
 
+static LogSinkFunc        logSink      = NULL;
+static LogLevel           logLevel     = LOG_MSG;
+static unsigned           logMsgSample = 1;
+static __thread unsigned  logMsgTick   = 0;
+static __thread bool      logMsgOn     = true;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Route log lines through sink (NULL: print them directly) and
+ *        drop those less important than level.
+ *
+ * With msgSample N > 1, PrintMsg() logs only every Nth request a thread
+ * sees, along with the replies and pushes that follow it.  Call before
+ * starting other threads.
+ *
+ **************************************************************************
+ */
+void
+LogSetup(LogSinkFunc sink,    // IN
+         LogLevel level,      // IN
+         unsigned msgSample)  // IN
+{
+    logSink      = sink;
+    logLevel     = level;
+    logMsgSample = MAX(msgSample, 1);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Log a line at the given level.
+ *
+ **************************************************************************
+ */
+static void
+LogV(LogLevel level,     // IN
+     const char *fmt,    // IN
+     va_list arg)        // IN
+{
+    if (level > logLevel) {
+        return;
+    }
+    if (logSink != NULL) {
+        logSink(level, fmt, arg);
+    } else {
+        vfprintf(level == LOG_ERROR ? stderr : stdout, fmt, arg);
+    }
+}
+
+
 /**
  **************************************************************************
  *
@@ -28,7 +83,7 @@ Log(const char *fmt, ...)
     va_list arg;
 
     va_start(arg, fmt);
-    vfprintf(stdout, fmt, arg);
+    LogV(LOG_INFO, fmt, arg);
     va_end(arg);
 }
 
@@ -46,7 +101,25 @@ Error(const char *fmt, ...)
     va_list arg;
 
     va_start(arg, fmt);
-    vfprintf(stderr, fmt, arg);
+    LogV(LOG_ERROR, fmt, arg);
+    va_end(arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Log a line about a message.
+ *
+ **************************************************************************
+ */
+static void
+LogMsg(const char *fmt, ...)
+{
+    va_list arg;
+
+    va_start(arg, fmt);
+    LogV(LOG_MSG, fmt, arg);
     va_end(arg);
 }
 
@@ -114,6 +187,67 @@ WriteFully(int sd,     // IN
 }
 
 
+/**
+ **************************************************************************
+ *
+ * \brief Write several buffers to the socket, gathering them into as few
+ *        system calls as the socket allows.
+ *
+ * iov is updated as bytes are written.
+ *
+ **************************************************************************
+ */
+int
+WriteFullyV(int sd,              // IN
+            struct iovec *iov,   // IN/OUT
+            int iovcnt)          // IN
+{
+    int total = 0;
+
+    while (iovcnt > 0) {
+        int n = writev(sd, iov, iovcnt);
+        if (n <= 0) {
+            if (n < 0) {
+                Error("write error: %d\n", n);
+            }
+            return n;
+        }
+        total += n;
+
+        while (iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base += n;
+            iov->iov_len  -= n;
+        }
+    }
+    return total;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Put a socket into non-blocking mode.
+ *
+ **************************************************************************
+ */
+bool
+SetNonBlocking(int sd)  // IN
+{
+    int flags = fcntl(sd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(sd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("Failed to make the socket non-blocking");
+        return false;
+    }
+    return true;
+}
+
+
 /**
  **************************************************************************
  *
@@ -169,6 +303,35 @@ SocketAddrToString6(const struct sockaddr *addr,  // IN
 }
 
 
+/**
+ **************************************************************************
+ *
+ * \brief Whether a message type is sent by clients.
+ *
+ **************************************************************************
+ */
+static bool
+MsgIsRequest(int type)  // IN
+{
+    switch (type) {
+        case MSG_SHOW:
+        case MSG_CLEAR:
+        case MSG_POST:
+        case MSG_LIST:
+        case MSG_SHOW_SINCE:
+        case MSG_SUBSCRIBE:
+        case MSG_UNSUBSCRIBE:
+        case MSG_STATS:
+        case MSG_POST_BATCH:
+        case MSG_HELLO:
+        case MSG_POST_LZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
 /**
  **************************************************************************
  *
@@ -180,25 +343,225 @@ void
 PrintMsg(const MsgHdr *msg,   // IN
          const char *prefix)  // IN
 {
+    if (logLevel < LOG_MSG) {
+        return;
+    }
+    if (MsgIsRequest(msg->type)) {
+        /* Sample requests; replies and pushes follow the last decision. */
+        logMsgOn = logMsgTick++ % logMsgSample == 0;
+    }
+    if (!logMsgOn) {
+        return;
+    }
+
     switch (msg->type) {
         case MSG_SHOW:
-            Log("   %s Request: SHOW\n", prefix);
+            LogMsg("   %s Request: SHOW \"%.*s\"\n", prefix,
+                   MAX_TITLE_LEN, msg->title);
             break;
         case MSG_CLEAR:
-            Log("   %s Request: CLEAR\n", prefix);
+            LogMsg("   %s Request: CLEAR \"%.*s\"\n", prefix,
+                   MAX_TITLE_LEN, msg->title);
             break;
         case MSG_POST:
-            Log("   %s Request: POST (%u bytes)\n", prefix, msg->dataSize);
+            LogMsg("   %s Request: POST \"%.*s\" (%u bytes)\n", prefix,
+                   MAX_TITLE_LEN, msg->title, msg->dataSize);
+            break;
+        case MSG_LIST:
+            LogMsg("   %s Request: LIST\n", prefix);
+            break;
+        case MSG_SHOW_SINCE:
+            LogMsg("   %s Request: SHOW_SINCE \"%.*s\"\n", prefix,
+                   MAX_TITLE_LEN, msg->title);
+            break;
+        case MSG_SUBSCRIBE:
+            LogMsg("   %s Request: SUBSCRIBE \"%.*s\"\n", prefix,
+                   MAX_TITLE_LEN, msg->title);
+            break;
+        case MSG_UNSUBSCRIBE:
+            LogMsg("   %s Request: UNSUBSCRIBE \"%.*s\"\n", prefix,
+                   MAX_TITLE_LEN, msg->title);
+            break;
+        case MSG_STATS:
+            LogMsg("   %s Request: STATS\n", prefix);
+            break;
+        case MSG_POST_BATCH:
+            LogMsg("   %s Request: POST_BATCH (%u bytes)\n", prefix,
+                   msg->dataSize);
+            break;
+        case MSG_HELLO:
+            LogMsg("   %s Hello (%u bytes)\n", prefix, msg->dataSize);
+            break;
+        case MSG_POST_LZ:
+            LogMsg("   %s Request: POST_LZ \"%.*s\" (%u bytes)\n", prefix,
+                   MAX_TITLE_LEN, msg->title, msg->dataSize);
+            break;
+        case MSG_BOARD_LZ:
+            LogMsg("   %s Reply: BOARD_LZ (%u bytes)\n", prefix,
+                   msg->dataSize);
             break;
         case MSG_BOARD:
-            Log("   %s Reply: BOARD (%u bytes)\n", prefix, msg->dataSize);
+            LogMsg("   %s Reply: BOARD (%u bytes)\n", prefix, msg->dataSize);
             break;
         case MSG_STATUS:
-            Log("   %s Reply: STATUS (%u)\n", prefix, msg->status);
+            if (msg->dataSize > 0) {
+                LogMsg("   %s Reply: STATUS (%u, %u items)\n", prefix,
+                       msg->status, msg->dataSize);
+                break;
+            }
+            LogMsg("   %s Reply: STATUS (%u)\n", prefix, msg->status);
+            break;
+        case MSG_TITLES:
+            LogMsg("   %s Reply: TITLES (%u bytes)\n", prefix, msg->dataSize);
+            break;
+        case MSG_BOARD_DELTA:
+            LogMsg("   %s Reply: BOARD_DELTA (%s, %u bytes)\n", prefix,
+                   msg->status == MSG_STATUS_RESET ? "reset" : "delta",
+                   msg->dataSize);
+            break;
+        case MSG_NOTIFY:
+            LogMsg("   %s Push: NOTIFY \"%.*s\" (%s, %u bytes)\n", prefix,
+                   MAX_TITLE_LEN, msg->title,
+                   msg->status == MSG_STATUS_RESET ? "reset" : "delta",
+                   msg->dataSize);
+            break;
+        case MSG_STATS_TEXT:
+            LogMsg("   %s Reply: STATS_TEXT (%u bytes)\n", prefix,
+                   msg->dataSize);
             break;
         default:
-            Log("   %s Unknown message type %d\n", prefix, msg->type);
+            LogMsg("   %s Unknown message type %d\n", prefix, msg->type);
     }
 }
 
 
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Describe a reply status.
+ *
+ **************************************************************************
+ */
+const char *
+MsgStatusToString(int status)  // IN
+{
+    switch (status) {
+        case MSG_STATUS_SUCCESS:
+            return "success";
+        case MSG_STATUS_TOO_LARGE:
+            return "post too large";
+        case MSG_STATUS_NO_SPACE:
+            return "board is full";
+        case MSG_STATUS_BAD_TITLE:
+            return "invalid board title";
+        case MSG_STATUS_BAD_REQUEST:
+            return "malformed request";
+        case MSG_STATUS_RESET:
+            return "board was reset";
+        case MSG_STATUS_READ_ONLY:
+            return "read-only follower";
+        default:
+            return "unknown error";
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Name a message type.
+ *
+ **************************************************************************
+ */
+const char *
+MsgTypeToString(int type)  // IN
+{
+    switch (type) {
+        case MSG_SHOW:
+            return "SHOW";
+        case MSG_CLEAR:
+            return "CLEAR";
+        case MSG_POST:
+            return "POST";
+        case MSG_LIST:
+            return "LIST";
+        case MSG_SHOW_SINCE:
+            return "SHOW_SINCE";
+        case MSG_SUBSCRIBE:
+            return "SUBSCRIBE";
+        case MSG_UNSUBSCRIBE:
+            return "UNSUBSCRIBE";
+        case MSG_STATS:
+            return "STATS";
+        case MSG_POST_BATCH:
+            return "POST_BATCH";
+        case MSG_HELLO:
+            return "HELLO";
+        case MSG_BOARD_LZ:
+            return "BOARD_LZ";
+        case MSG_POST_LZ:
+            return "POST_LZ";
+        case MSG_BOARD:
+            return "BOARD";
+        case MSG_STATUS:
+            return "STATUS";
+        case MSG_TITLES:
+            return "TITLES";
+        case MSG_BOARD_DELTA:
+            return "BOARD_DELTA";
+        case MSG_NOTIFY:
+            return "NOTIFY";
+        case MSG_STATS_TEXT:
+            return "STATS_TEXT";
+        case MSG_REPL_SYNC:
+            return "REPL_SYNC";
+        case MSG_REPL_ACK:
+            return "REPL_ACK";
+        case MSG_REPL_BOARD:
+            return "REPL_BOARD";
+        case MSG_REPL_START:
+            return "REPL_START";
+        case MSG_REPL_POST:
+            return "REPL_POST";
+        case MSG_REPL_CLEAR:
+            return "REPL_CLEAR";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Set the board title of a message, truncating it if needed.
+ *
+ **************************************************************************
+ */
+void
+MsgSetTitle(MsgHdr *msg,         // OUT
+            const char *title)   // IN
+{
+    size_t len = strnlen(title, sizeof msg->title);
+
+    memcpy(msg->title, title, len);
+    memset(msg->title + len, 0, sizeof msg->title - len);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy the board title of a message into a C string.
+ *
+ **************************************************************************
+ */
+void
+MsgGetTitle(const MsgHdr *msg,                  // IN
+            char title[MAX_TITLE_LEN + 1])      // OUT
+{
+    memcpy(title, msg->title, MAX_TITLE_LEN);
+    title[MAX_TITLE_LEN] = '\0';
+}
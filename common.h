@@ -10,18 +10,21 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #define ARRAYSIZE(_x)    (sizeof(_x) / sizeof((_x)[0]))
 #define MIN(x, y)        (((x) <= (y)) ? (x) : (y))
+#define MAX(x, y)        (((x) >= (y)) ? (x) : (y))
 
 #define PORT_STRLEN      6
 #define MAX_TITLE_LEN    32
 
-#define MAX_BOARD_DATA_SIZE 8192
+#define MAX_POST_DATA_SIZE  (1024 * 1024)
 
 /**
  *  Message type exchanged between client/server.
@@ -32,37 +35,177 @@ typedef enum MsgType {
     MSG_SHOW    = 1,
     MSG_CLEAR   = 2,
     MSG_POST    = 3,
+    MSG_LIST    = 6,
+    MSG_SHOW_SINCE = 8,   // MsgBoardPos the client last saw
+    MSG_SUBSCRIBE   = 10, // Optional MsgBoardPos to resume from
+    MSG_UNSUBSCRIBE = 11,
+    MSG_STATS       = 13,
+    MSG_POST_BATCH  = 15, // MsgBatchItems; STATUS reply has one per item
+    MSG_HELLO       = 16, // MSG_CAP_* flags (both ways)
+    MSG_POST_LZ     = 18, // MsgLzHdr, then the compressed post
+    /* Follower -> Leader */
+    MSG_REPL_SYNC   = 19, // MsgReplPos the follower has
+    MSG_REPL_ACK    = 20, // MsgReplPos the follower has applied
     /* Server -> Client */
     MSG_BOARD   = 4,
     MSG_STATUS  = 5,
+    MSG_TITLES  = 7,   // Newline-terminated board titles
+    MSG_BOARD_DELTA = 9,  // MsgBoardPos of the board, then new bytes
+    MSG_NOTIFY      = 12, // Pushed change: same payload as BOARD_DELTA
+    MSG_STATS_TEXT  = 14, // Server metrics, one "name value" per line
+    MSG_BOARD_LZ    = 17, // MsgLzHdr, then the compressed board
+    /* Leader -> Follower */
+    MSG_REPL_BOARD  = 21, // MsgReplChange, then the whole board
+    MSG_REPL_START  = 22, // MsgReplPos the stream of changes starts at
+    MSG_REPL_POST   = 23, // MsgReplChange, then the post
+    MSG_REPL_CLEAR  = 24, // MsgReplChange
 } MsgType;
 
 typedef enum MsgStatus {
-    MSG_STATUS_SUCCESS = 0,
+    MSG_STATUS_SUCCESS   = 0,
+    MSG_STATUS_TOO_LARGE = 1,   // POST exceeded MAX_POST_DATA_SIZE
+    MSG_STATUS_NO_SPACE  = 2,   // Board memory limit reached
+    MSG_STATUS_BAD_TITLE = 3,   // Title contains a newline
+    MSG_STATUS_BAD_REQUEST = 4, // Malformed request payload
+    MSG_STATUS_RESET     = 5,   // BOARD_DELTA holds the whole board
+    MSG_STATUS_READ_ONLY = 6,   // A follower: changes go to the leader
 } MsgStatus;
 
 /**
- * Data type for messages exchanged between client/server.
+ * Data type for messages exchanged between client/server.  title names
+ * the board a request is about; it is NUL-padded and need not be
+ * NUL-terminated when all MAX_TITLE_LEN bytes are used.  The server
+ * answers requests in order and echoes reqId in each reply, so a client
+ * may pipeline several requests on one connection.
  */
 typedef struct MsgHdr {
-    short type;
-    short status;
-    int   dataSize;
-    char  data[0];
+    short    type;
+    short    status;
+    int      dataSize;
+    unsigned reqId;
+    char     title[MAX_TITLE_LEN];
+    char     data[0];
 } MsgHdr;
 
+/**
+ * A position in a board: the first offset bytes of version seq.  A
+ * SHOW_SINCE request carries the position the client has, and the
+ * BOARD_DELTA reply starts with the position it brings the client to.
+ * The data after it extends the client's copy if status is SUCCESS and
+ * replaces it if status is RESET (the board was cleared, or the client's
+ * position is unknown to the server).  A client with no copy asks for
+ * position {0, 0}.
+ *
+ * After a SUBSCRIBE, changes to the board are pushed as NOTIFY messages
+ * with the SUBSCRIBE's reqId, in the same form.  Changes close together
+ * arrive in one NOTIFY, and a CLEAR shows up as a RESET.
+ */
+typedef struct MsgBoardPos {
+    unsigned long long seq;
+    int                offset;
+    int                reserved;
+} MsgBoardPos;
+
+/**
+ * Capabilities a client asks for in a HELLO request, as an unsigned int
+ * payload.  The server's HELLO reply carries the ones it granted, which
+ * hold for the rest of the connection.
+ */
+#define MSG_CAP_LZ       0x1   // BOARD_LZ replies to SHOW, POST_LZ requests
+
+/*
+ * Payloads smaller than this are not worth compressing.
+ */
+#define MSG_LZ_MIN_SIZE  1024
+
+/**
+ * Leads a BOARD_LZ or POST_LZ payload.  What follows is an LZ4-format
+ * block (see lz.h) holding rawSize bytes: the board, or the post.  A
+ * board that does not compress is sent as a plain BOARD.
+ */
+typedef struct MsgLzHdr {
+    int rawSize;
+    int reserved;
+} MsgLzHdr;
+
+/**
+ * Where a follower is in the leader's stream of changes: offset bytes of
+ * REPL_POST and REPL_CLEAR messages into the stream of leader run id.
+ *
+ * A follower opens an ordinary connection to the leader and sends
+ * REPL_SYNC with the position it has ({0, 0} the first time).  If the
+ * leader still holds the changes from there on, it answers with a
+ * REPL_START at that position and goes on from it.  Otherwise it sends
+ * a REPL_BOARD for every board it has, then a REPL_START with status
+ * RESET: boards the follower has that were not sent are empty now, and
+ * the changes that follow may include some the boards already have,
+ * which the version seq tells apart.  The follower reports its position
+ * with REPL_ACK as it applies the changes; neither side replies to
+ * REPL_ACK or to the leader's messages.
+ */
+typedef struct MsgReplPos {
+    unsigned long long id;
+    unsigned long long offset;
+} MsgReplPos;
+
+/**
+ * Leads a REPL_BOARD, REPL_POST or REPL_CLEAR payload: the version seq
+ * of the board the change made, and when the leader made it.
+ */
+typedef struct MsgReplChange {
+    unsigned long long seq;
+    long long          timeNs;   // CLOCK_REALTIME
+} MsgReplChange;
+
+/**
+ * One post in a POST_BATCH request.  The header is followed by titleLen
+ * bytes naming the board, then by the dataSize bytes posted; the next
+ * item follows directly, unaligned.  A titleLen of 0 posts to the board
+ * named in the request header.  Each board's items are added as one
+ * change, each on its own line as if posted in order.  The STATUS reply
+ * carries one MsgStatus byte per item, and its status is that of the
+ * first item that failed.
+ */
+typedef struct MsgBatchItem {
+    int           dataSize;
+    unsigned char titleLen;
+    unsigned char reserved[3];
+} MsgBatchItem;
+
+
+/**
+ * Log levels, most important first.  Error() logs at LOG_ERROR, Log() at
+ * LOG_INFO and PrintMsg() at LOG_MSG.
+ */
+typedef enum LogLevel {
+    LOG_ERROR = 0,
+    LOG_INFO  = 1,
+    LOG_MSG   = 2,   // One line per request, reply and push
+} LogLevel;
+
+/*
+ * Where log lines go instead of stdout/stderr, e.g. LoggerSink().
+ */
+typedef void (*LogSinkFunc)(LogLevel level, const char *fmt, va_list ap);
 
 void Log(const char *fmt, ...);
 void Error(const char *fmt, ...);
+void LogSetup(LogSinkFunc sink, LogLevel level, unsigned msgSample);
 
 int ReadFully(int sd, void *buf, int nbytes);
 int WriteFully(int sd, void *buf, int nbytes);
+int WriteFullyV(int sd, struct iovec *iov, int iovcnt);
+bool SetNonBlocking(int sd);
 
 void SocketAddrToString(const struct sockaddr_in *addr, char *addrStr,
                         int addrStrLen);
 void SocketAddrToString6(const struct sockaddr *addr, char *addrStr,
                          int addrStrLen);
 void PrintMsg(const MsgHdr *msg, const char *prefix); 
+const char *MsgStatusToString(int status);
+const char *MsgTypeToString(int type);
+void MsgSetTitle(MsgHdr *msg, const char *title);
+void MsgGetTitle(const MsgHdr *msg, char title[MAX_TITLE_LEN + 1]);
 
 #endif
 
@@ -0,0 +1,913 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+#include "eventloop.h"
+
+/*
+ * An io_uring request carries the object it is for in its user data,
+ * with the kind of request in the low bits.  User data 0 is a request
+ * whose completion needs no handling.
+ */
+#define EVENT_OP_POLL      1UL
+#define EVENT_OP_ACCEPT    2UL
+#define EVENT_OP_RECV      3UL
+#define EVENT_OP_SEND      4UL
+#define EVENT_OP_MASK      7UL
+#define EVENT_OP(obj, op)  ((uintptr_t)(obj) | (op))
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run the tasks posted so far.
+ *
+ * The whole list is taken at once, so tasks posted while it runs wait for
+ * the next batch.  Each task is unlinked under the lock before it runs,
+ * which lets it be posted again, or cancelled by an earlier task.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopRunTasks(EventLoop *loop)  // IN
+{
+    EventTask *batch;
+
+    pthread_mutex_lock(&loop->taskLock);
+    batch = loop->tasks;
+    if (batch != NULL) {
+        batch->pprev = &batch;
+    }
+    loop->tasks      = NULL;
+    loop->batchArmed = false;
+    pthread_mutex_unlock(&loop->taskLock);
+
+    for (;;) {
+        EventTask *task;
+
+        pthread_mutex_lock(&loop->taskLock);
+        task = batch;
+        if (task != NULL) {
+            batch = task->next;
+            if (batch != NULL) {
+                batch->pprev = &batch;
+            }
+            task->next  = NULL;
+            task->pprev = NULL;
+        }
+        pthread_mutex_unlock(&loop->taskLock);
+
+        if (task == NULL) {
+            return;
+        }
+        task->func(loop, task->arg);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drain the wakeup eventfd.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopWakeEvent(EventLoop *loop,   // IN
+                   void *arg,         // IN
+                   unsigned events)   // IN
+{
+    uint64_t count;
+
+    while (read(loop->wakefd, &count, sizeof count) > 0) {
+        continue;
+    }
+    EventLoopRunTasks(loop);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drain the batch timer.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopTimerEvent(EventLoop *loop,   // IN
+                    void *arg,         // IN
+                    unsigned events)   // IN
+{
+    uint64_t count;
+
+    while (read(loop->timerfd, &count, sizeof count) > 0) {
+        continue;
+    }
+    EventLoopRunTasks(loop);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The current tick of the timer wheel.
+ *
+ **************************************************************************
+ */
+static uint64_t
+EventLoopTick(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000) / EVENTLOOP_TICK_MS;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run the timers that expired, and stop ticking once none is left.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopTickEvent(EventLoop *loop,   // IN
+                   void *arg,         // IN
+                   unsigned events)   // IN
+{
+    uint64_t count;
+
+    while (read(loop->tickfd, &count, sizeof count) > 0) {
+        continue;
+    }
+    TimerWheelAdvance(&loop->timers, EventLoopTick());
+
+    if (loop->timers.count == 0 && loop->ticking) {
+        struct itimerspec its;
+
+        memset(&its, 0, sizeof its);
+        timerfd_settime(loop->tickfd, 0, &its, NULL);
+        loop->ticking = false;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an event loop.
+ *
+ **************************************************************************
+ */
+bool
+EventLoopInit(EventLoop *loop,         // OUT
+              EventBackend backend)    // IN
+{
+    memset(loop, 0, sizeof *loop);
+    loop->backend = backend;
+    loop->epfd    = -1;
+    loop->ring.fd = -1;
+    loop->wakefd  = -1;
+    loop->timerfd = -1;
+    loop->tickfd  = -1;
+    pthread_mutex_init(&loop->taskLock, NULL);
+    TimerWheelInit(&loop->timers, EventLoopTick());
+
+    if (backend == EVENT_BACKEND_URING) {
+        if (!UringInit(&loop->ring)) {
+            perror("Failed to set up the io_uring");
+            return false;
+        }
+    } else {
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd < 0) {
+            perror("Failed to create the epoll instance");
+            return false;
+        }
+    }
+
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakefd < 0) {
+        perror("Failed to create the wakeup eventfd");
+        EventLoopDestroy(loop);
+        return false;
+    }
+    loop->wakeSrc.fd   = loop->wakefd;
+    loop->wakeSrc.func = EventLoopWakeEvent;
+    loop->wakeSrc.arg  = loop;
+    if (!EventLoopAdd(loop, &loop->wakeSrc, EPOLLIN)) {
+        EventLoopDestroy(loop);
+        return false;
+    }
+
+    loop->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timerfd < 0) {
+        perror("Failed to create the batch timer");
+        EventLoopDestroy(loop);
+        return false;
+    }
+    loop->timerSrc.fd   = loop->timerfd;
+    loop->timerSrc.func = EventLoopTimerEvent;
+    loop->timerSrc.arg  = loop;
+    if (!EventLoopAdd(loop, &loop->timerSrc, EPOLLIN)) {
+        EventLoopDestroy(loop);
+        return false;
+    }
+
+    loop->tickfd = timerfd_create(CLOCK_MONOTONIC,
+                                  TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->tickfd < 0) {
+        perror("Failed to create the tick timer");
+        EventLoopDestroy(loop);
+        return false;
+    }
+    loop->tickSrc.fd   = loop->tickfd;
+    loop->tickSrc.func = EventLoopTickEvent;
+    loop->tickSrc.arg  = loop;
+    if (!EventLoopAdd(loop, &loop->tickSrc, EPOLLIN)) {
+        EventLoopDestroy(loop);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release the resources held by an event loop.
+ *
+ **************************************************************************
+ */
+void
+EventLoopDestroy(EventLoop *loop)  // IN
+{
+    if (loop->tickfd >= 0) {
+        close(loop->tickfd);
+        loop->tickfd = -1;
+    }
+    if (loop->timerfd >= 0) {
+        close(loop->timerfd);
+        loop->timerfd = -1;
+    }
+    if (loop->wakefd >= 0) {
+        close(loop->wakefd);
+        loop->wakefd = -1;
+    }
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+    if (loop->ring.fd >= 0) {
+        UringDestroy(&loop->ring);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Register a file descriptor with the event loop.
+ *
+ * The descriptor is always watched in edge-triggered mode, so the callback
+ * must drain it until EAGAIN.  io_uring watches it with a multishot poll.
+ *
+ **************************************************************************
+ */
+bool
+EventLoopAdd(EventLoop *loop,    // IN
+             EventSource *src,   // IN
+             unsigned events)    // IN
+{
+    struct epoll_event ev;
+
+    src->events = events;
+    if (loop->backend == EVENT_BACKEND_URING) {
+        UringPrepPoll(&loop->ring, src->fd, events,
+                      EVENT_OP(src, EVENT_OP_POLL));
+        return true;
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events   = events | EPOLLET;
+    ev.data.ptr = src;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+        perror("Failed to add a descriptor to the epoll instance");
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Unregister a file descriptor from the event loop.
+ *
+ **************************************************************************
+ */
+void
+EventLoopRemove(EventLoop *loop,    // IN
+                EventSource *src)   // IN
+{
+    struct epoll_event ev;
+    int i;
+
+    if (loop->backend == EVENT_BACKEND_URING) {
+        UringPrepPollRemove(&loop->ring, EVENT_OP(src, EVENT_OP_POLL));
+        return;
+    }
+
+    memset(&ev, 0, sizeof ev);
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, &ev);
+
+    /* The source may be freed next: drop its events not dispatched yet. */
+    for (i = 0; i < loop->numReady; i++) {
+        if (loop->ready[i].data.ptr == src) {
+            loop->ready[i].data.ptr = NULL;
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Close a stream no request refers to any more.
+ *
+ **************************************************************************
+ */
+static void
+EventStreamFinish(EventLoop *loop,   // IN
+                  EventStream *s)    // IN
+{
+    close(s->src.fd);
+    s->closed(loop, s->src.arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handle a completion of a stream's multishot receive.
+ *
+ * The buffer goes straight back to the kernel, so the callback has to
+ * copy what it keeps.  A receive that ended with data, for want of
+ * buffers or because it was paused is armed again, unless the stream is
+ * (still) paused.  The request stays counted in inflight until its
+ * callback returned, so a close from inside the callback is only
+ * finished here.
+ *
+ **************************************************************************
+ */
+static void
+EventStreamReceived(EventLoop *loop,       // IN
+                    EventStream *s,        // IN
+                    const UringCqe *cqe)   // IN
+{
+    bool retry = cqe->res > 0 || cqe->res == -ENOBUFS ||
+                 cqe->res == -ECANCELED;
+
+    if (!s->closing) {
+        if (cqe->bid >= 0) {
+            s->recv(loop, s->src.arg, UringBuf(&loop->ring, cqe->bid),
+                    cqe->res);
+        } else if (!retry) {
+            s->recv(loop, s->src.arg, NULL, cqe->res);
+        }
+    }
+    if (cqe->bid >= 0) {
+        UringBufRecycle(&loop->ring, cqe->bid);
+    }
+
+    if (!cqe->more) {
+        if (!s->closing && !s->recvPaused && retry) {
+            UringPrepRecv(&loop->ring, s->src.fd, EVENT_OP(s, EVENT_OP_RECV));
+        } else {
+            s->recvArmed = false;
+            s->inflight--;
+        }
+    }
+    if (s->closing && s->inflight == 0) {
+        EventStreamFinish(loop, s);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handle the completion of a stream's send.
+ *
+ **************************************************************************
+ */
+static void
+EventStreamSent(EventLoop *loop,       // IN
+                EventStream *s,        // IN
+                const UringCqe *cqe)   // IN
+{
+    s->sending = false;
+    if (!s->closing) {
+        s->sent(loop, s->src.arg, cqe->res);
+    }
+    s->inflight--;
+    if (s->closing && s->inflight == 0) {
+        EventStreamFinish(loop, s);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handle a completion of a listen socket's multishot accept.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopAccepted(EventLoop *loop,       // IN
+                  EventAcceptor *acc,    // IN
+                  const UringCqe *cqe)   // IN
+{
+    if (cqe->res < 0) {
+        errno = -cqe->res;
+        acc->func(loop, acc->arg, -1);
+        return;
+    }
+    if (!cqe->more) {
+        UringPrepAccept(&loop->ring, acc->src.fd,
+                        EVENT_OP(acc, EVENT_OP_ACCEPT));
+    }
+    acc->func(loop, acc->arg, cqe->res);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Dispatch one io_uring completion.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopComplete(EventLoop *loop,       // IN
+                  const UringCqe *cqe)   // IN
+{
+    void *obj = (void *)(uintptr_t)(cqe->data & ~EVENT_OP_MASK);
+    EventSource *src;
+
+    switch (cqe->data & EVENT_OP_MASK) {
+    case EVENT_OP_POLL:
+        src = obj;
+        if (cqe->res < 0) {
+            /* Removed, or the descriptor went away. */
+            break;
+        }
+        /* Re-arm first: the callback may remove the source. */
+        if (!cqe->more) {
+            UringPrepPoll(&loop->ring, src->fd, src->events, cqe->data);
+        }
+        src->func(loop, src->arg, cqe->res);
+        break;
+    case EVENT_OP_ACCEPT:
+        EventLoopAccepted(loop, obj, cqe);
+        break;
+    case EVENT_OP_RECV:
+        EventStreamReceived(loop, obj, cqe);
+        break;
+    case EVENT_OP_SEND:
+        EventStreamSent(loop, obj, cqe);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Dispatch io_uring completions until *running becomes false.
+ *
+ * Everything prepared while handling one batch of completions is
+ * submitted with the same system call that waits for the next.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopRunUring(EventLoop *loop,          // IN
+                  volatile bool *running)   // IN
+{
+    UringCqe cqe;
+
+    if (!UringEnable(&loop->ring)) {
+        perror("Failed to enable the io_uring");
+        return;
+    }
+
+    while (*running) {
+        if (UringSubmit(&loop->ring, 1) < 0 &&
+            errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            perror("Failed to wait for completions");
+            return;
+        }
+        while (UringNextCqe(&loop->ring, &cqe)) {
+            EventLoopComplete(loop, &cqe);
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Dispatch events until *running becomes false.
+ *
+ **************************************************************************
+ */
+void
+EventLoopRun(EventLoop *loop,          // IN
+             volatile bool *running)   // IN
+{
+    struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+    if (loop->backend == EVENT_BACKEND_URING) {
+        EventLoopRunUring(loop, running);
+        return;
+    }
+
+    while (*running) {
+        int n, i;
+
+        n = epoll_wait(loop->epfd, events, ARRAYSIZE(events), -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("Failed to wait for events");
+                return;
+            }
+            continue;
+        }
+
+        loop->ready    = events;
+        loop->numReady = n;
+        for (i = 0; i < n; i++) {
+            EventSource *src = events[i].data.ptr;
+
+            if (src != NULL) {
+                src->func(loop, src->arg, events[i].events);
+            }
+        }
+        loop->ready    = NULL;
+        loop->numReady = 0;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Wake the loop out of epoll_wait() from another thread.
+ *
+ * Only calls write(), so it is safe to use from a signal handler.
+ *
+ **************************************************************************
+ */
+void
+EventLoopWake(EventLoop *loop)  // IN
+{
+    uint64_t one = 1;
+    ssize_t n;
+
+    n = write(loop->wakefd, &one, sizeof one);
+    (void)n;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a task to run on the loop thread.
+ *
+ * May be called from any thread.  Tasks are run in batches: the first
+ * task posted to an idle loop starts a batch that runs after delayUs, and
+ * tasks posted meanwhile join it whatever their own delay.
+ *
+ **************************************************************************
+ */
+void
+EventLoopPost(EventLoop *loop,    // IN
+              EventTask *task,    // IN
+              long delayUs)       // IN
+{
+    bool arm = false;
+
+    pthread_mutex_lock(&loop->taskLock);
+    if (task->pprev == NULL) {
+        task->next = loop->tasks;
+        if (task->next != NULL) {
+            task->next->pprev = &task->next;
+        }
+        task->pprev = &loop->tasks;
+        loop->tasks = task;
+        if (!loop->batchArmed) {
+            loop->batchArmed = true;
+            arm = true;
+        }
+    }
+    pthread_mutex_unlock(&loop->taskLock);
+
+    if (!arm) {
+        return;
+    }
+    if (delayUs > 0) {
+        struct itimerspec its;
+
+        memset(&its, 0, sizeof its);
+        its.it_value.tv_sec  = delayUs / 1000000;
+        its.it_value.tv_nsec = (delayUs % 1000000) * 1000;
+        if (timerfd_settime(loop->timerfd, 0, &its, NULL) == 0) {
+            return;
+        }
+    }
+    EventLoopWake(loop);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Unqueue a task that has not run yet.
+ *
+ * Must be called from the loop thread, after which the task is neither
+ * queued nor running and may be freed.
+ *
+ **************************************************************************
+ */
+void
+EventLoopCancel(EventLoop *loop,    // IN
+                EventTask *task)    // IN
+{
+    pthread_mutex_lock(&loop->taskLock);
+    if (task->pprev != NULL) {
+        *task->pprev = task->next;
+        if (task->next != NULL) {
+            task->next->pprev = task->pprev;
+        }
+        task->next  = NULL;
+        task->pprev = NULL;
+    }
+    pthread_mutex_unlock(&loop->taskLock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run t->func(t->arg) on the loop thread in ms milliseconds.
+ *
+ * Rounded up to whole ticks of EVENTLOOP_TICK_MS.  Setting an armed
+ * timer moves it.  Timers belong to the loop thread: only it may set or
+ * cancel them.  Costs no system call except for the first timer of an
+ * idle loop, which starts the tick.
+ *
+ **************************************************************************
+ */
+void
+EventLoopTimerSet(EventLoop *loop,   // IN
+                  Timer *t,          // IN
+                  long ms)           // IN
+{
+    uint64_t now = EventLoopTick();
+
+    if (TimerArmed(t)) {
+        TimerWheelRemove(&loop->timers, t);
+    }
+
+    if (!loop->ticking) {
+        struct itimerspec its;
+
+        /* Catch the clock of the idle wheel up. */
+        TimerWheelAdvance(&loop->timers, now - 1);
+        memset(&its, 0, sizeof its);
+        its.it_value.tv_nsec    = EVENTLOOP_TICK_MS * 1000000L;
+        its.it_interval.tv_nsec = EVENTLOOP_TICK_MS * 1000000L;
+        if (timerfd_settime(loop->tickfd, 0, &its, NULL) == 0) {
+            loop->ticking = true;
+        } else {
+            perror("Failed to start the tick timer");
+        }
+    }
+
+    /* The current tick is partly over: count from the next one. */
+    TimerWheelAdd(&loop->timers, t,
+                  now + 1 + (ms + EVENTLOOP_TICK_MS - 1) / EVENTLOOP_TICK_MS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Disarm a timer, if armed.
+ *
+ **************************************************************************
+ */
+void
+EventLoopTimerCancel(EventLoop *loop,   // IN
+                     Timer *t)          // IN
+{
+    if (TimerArmed(t)) {
+        TimerWheelRemove(&loop->timers, t);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Epoll callback for a listen socket: accept all pending clients.
+ *
+ **************************************************************************
+ */
+static void
+EventLoopAcceptEvent(EventLoop *loop,   // IN
+                     void *arg,         // IN
+                     unsigned events)   // IN
+{
+    EventAcceptor *acc = arg;
+
+    for (;;) {
+        int sd = accept(acc->src.fd, NULL, NULL);
+
+        if (sd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+        }
+        acc->func(loop, acc->arg, sd);
+        if (sd < 0) {
+            return;
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start accepting connections on a non-blocking listen socket.
+ *
+ * io_uring keeps one multishot accept armed; epoll accepts every pending
+ * connection whenever the socket is ready.
+ *
+ **************************************************************************
+ */
+bool
+EventLoopListen(EventLoop *loop,      // IN
+                EventAcceptor *acc)   // IN
+{
+    if (loop->backend == EVENT_BACKEND_URING) {
+        UringPrepAccept(&loop->ring, acc->src.fd,
+                        EVENT_OP(acc, EVENT_OP_ACCEPT));
+        return true;
+    }
+    acc->src.func = EventLoopAcceptEvent;
+    acc->src.arg  = acc;
+    return EventLoopAdd(loop, &acc->src, EPOLLIN);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start serving a connected socket.
+ *
+ **************************************************************************
+ */
+bool
+EventStreamAdd(EventLoop *loop,   // IN
+               EventStream *s)    // IN
+{
+    if (loop->backend == EVENT_BACKEND_URING) {
+        UringPrepRecv(&loop->ring, s->src.fd, EVENT_OP(s, EVENT_OP_RECV));
+        s->recvArmed = true;
+        s->inflight++;
+        return true;
+    }
+    return EventLoopAdd(loop, &s->src, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop or restart receiving on a stream.
+ *
+ * With io_uring, pausing cancels the multishot receive, though bytes it
+ * already received may still be handed over.  With epoll the owner just
+ * stops reading, so this only records the state.
+ *
+ **************************************************************************
+ */
+void
+EventStreamPause(EventLoop *loop,   // IN
+                 EventStream *s,    // IN
+                 bool paused)       // IN
+{
+    if (s->recvPaused == paused) {
+        return;
+    }
+    s->recvPaused = paused;
+    if (loop->backend != EVENT_BACKEND_URING || s->closing) {
+        return;
+    }
+
+    if (paused) {
+        if (s->recvArmed) {
+            UringPrepCancel(&loop->ring, EVENT_OP(s, EVENT_OP_RECV));
+        }
+    } else if (!s->recvArmed) {
+        UringPrepRecv(&loop->ring, s->src.fd, EVENT_OP(s, EVENT_OP_RECV));
+        s->recvArmed = true;
+        s->inflight++;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send the first iovcnt entries of s->iov (io_uring only).
+ *
+ * A reply header and the payload behind it go out in one request.  Only
+ * one send may be in flight; s->sent is called when it completes, and
+ * the bytes must stay put until then.
+ *
+ **************************************************************************
+ */
+void
+EventStreamSend(EventLoop *loop,   // IN
+                EventStream *s,    // IN
+                int iovcnt)        // IN
+{
+    memset(&s->msg, 0, sizeof s->msg);
+    s->msg.msg_iov    = s->iov;
+    s->msg.msg_iovlen = iovcnt;
+    UringPrepSendMsg(&loop->ring, s->src.fd, &s->msg,
+                     EVENT_OP(s, EVENT_OP_SEND));
+    s->sending = true;
+    s->inflight++;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop serving a stream and close its socket.
+ *
+ * No callback of s runs after this.  s->closed is called once nothing
+ * refers to s any more: right away with epoll, and with io_uring once the
+ * receive and send in flight have completed, which shutting the socket
+ * down hurries along.
+ *
+ **************************************************************************
+ */
+void
+EventStreamClose(EventLoop *loop,   // IN
+                 EventStream *s)    // IN
+{
+    if (loop->backend == EVENT_BACKEND_EPOLL) {
+        EventLoopRemove(loop, &s->src);
+        EventStreamFinish(loop, s);
+        return;
+    }
+
+    s->closing = true;
+    if (s->inflight > 0) {
+        shutdown(s->src.fd, SHUT_RDWR);
+        return;
+    }
+    EventStreamFinish(loop, s);
+}
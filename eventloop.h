@@ -0,0 +1,138 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "timerwheel.h"
+#include "uring.h"
+
+#define EVENTLOOP_MAX_EVENTS 256
+#define EVENTLOOP_TICK_MS    100   // Resolution of EventLoopTimerSet()
+#define EVENTSTREAM_MAX_IOV  64
+
+struct EventLoop;
+
+typedef void (*EventFunc)(struct EventLoop *loop, void *arg, unsigned events);
+typedef void (*EventTaskFunc)(struct EventLoop *loop, void *arg);
+typedef void (*EventAcceptFunc)(struct EventLoop *loop, void *arg, int sd);
+typedef void (*EventRecvFunc)(struct EventLoop *loop, void *arg,
+                              const char *data, int len);
+typedef void (*EventSentFunc)(struct EventLoop *loop, void *arg, int res);
+
+/**
+ * How a loop waits for and performs I/O.
+ */
+typedef enum EventBackend {
+    EVENT_BACKEND_EPOLL,    // Readiness; the callbacks read and write
+    EVENT_BACKEND_URING,    // Completions; the loop reads and writes
+} EventBackend;
+
+/**
+ * A file descriptor registered with an event loop.
+ */
+typedef struct EventSource {
+    int        fd;
+    EventFunc  func;
+    void      *arg;
+    unsigned   events;   // Watched events, for io_uring to re-arm
+} EventSource;
+
+/**
+ * A listen socket.  func is called with every accepted socket, or with
+ * -1 and errno set when accepting failed, after which the socket may no
+ * longer be watched.
+ */
+typedef struct EventAcceptor {
+    EventSource      src;
+    EventAcceptFunc  func;
+    void            *arg;
+} EventAcceptor;
+
+/**
+ * A connected socket.  With epoll, src.func is called whenever the socket
+ * is ready, and reads and writes it itself.  With io_uring, the loop
+ * keeps a multishot receive armed and calls recv with what arrived (len
+ * 0 at end of stream, -errno on an error), and sends what the owner put
+ * in iov[] on EventStreamSend(), calling sent with the result.  closed is
+ * called once the loop holds no reference to the stream any more.
+ */
+typedef struct EventStream {
+    EventSource    src;
+    EventRecvFunc  recv;
+    EventSentFunc  sent;
+    EventTaskFunc  closed;
+    struct iovec   iov[EVENTSTREAM_MAX_IOV];
+    struct msghdr  msg;
+    int            inflight;   // io_uring requests not completed
+    bool           recvArmed;
+    bool           recvPaused;
+    bool           sending;
+    bool           closing;
+} EventStream;
+
+/**
+ * Work handed to a loop, possibly from another thread.  A task is queued
+ * at most once: posting it again before it ran does nothing.
+ */
+typedef struct EventTask {
+    struct EventTask  *next;
+    struct EventTask **pprev;   // NULL unless queued
+    EventTaskFunc      func;
+    void              *arg;
+} EventTask;
+
+/**
+ * An event loop: an edge-triggered epoll reactor, or an io_uring whose
+ * completions it dispatches.  Posted tasks are run in batches from the
+ * loop thread once the wake eventfd or the batch timer fires.  Timers
+ * live on a wheel that a periodic tick timer advances while any is
+ * armed.
+ */
+typedef struct EventLoop {
+    EventBackend     backend;
+    int              epfd;
+    struct epoll_event *ready;     // Batch being dispatched, or NULL
+    int              numReady;
+    Uring            ring;
+    int              wakefd;
+    EventSource      wakeSrc;
+    int              timerfd;
+    EventSource      timerSrc;
+    pthread_mutex_t  taskLock;
+    EventTask       *tasks;
+    bool             batchArmed;   // Wakeup or timer pending for tasks
+    int              tickfd;
+    EventSource      tickSrc;
+    bool             ticking;      // tickfd armed
+    TimerWheel       timers;
+} EventLoop;
+
+bool EventLoopInit(EventLoop *loop, EventBackend backend);
+void EventLoopDestroy(EventLoop *loop);
+bool EventLoopAdd(EventLoop *loop, EventSource *src, unsigned events);
+void EventLoopRemove(EventLoop *loop, EventSource *src);
+void EventLoopRun(EventLoop *loop, volatile bool *running);
+void EventLoopWake(EventLoop *loop);
+void EventLoopPost(EventLoop *loop, EventTask *task, long delayUs);
+void EventLoopCancel(EventLoop *loop, EventTask *task);
+void EventLoopTimerSet(EventLoop *loop, Timer *t, long ms);
+void EventLoopTimerCancel(EventLoop *loop, Timer *t);
+bool EventLoopListen(EventLoop *loop, EventAcceptor *acc);
+bool EventStreamAdd(EventLoop *loop, EventStream *s);
+void EventStreamSend(EventLoop *loop, EventStream *s, int iovcnt);
+void EventStreamPause(EventLoop *loop, EventStream *s, bool paused);
+void EventStreamClose(EventLoop *loop, EventStream *s);
+
+#endif
@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "histogram.h"
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate an empty histogram.
+ *
+ **************************************************************************
+ */
+Histogram *
+HistAlloc(void)
+{
+    /* calloc() leaves the pages of buckets never used untouched. */
+    Histogram *h = calloc(1, sizeof *h);
+
+    if (h != NULL) {
+        h->min = UINT64_MAX;
+    }
+    return h;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Free a histogram.
+ *
+ **************************************************************************
+ */
+void
+HistFree(Histogram *h)  // IN
+{
+    free(h);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Forget every recorded value.
+ *
+ **************************************************************************
+ */
+void
+HistReset(Histogram *h)  // OUT
+{
+    memset(h, 0, sizeof *h);
+    h->min = UINT64_MAX;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add the values recorded in src to dst.
+ *
+ **************************************************************************
+ */
+void
+HistAdd(Histogram *dst,        // IN/OUT
+        const Histogram *src)  // IN
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum   += src->sum;
+    dst->min    = MIN(dst->min, src->min);
+    dst->max    = MAX(dst->max, src->max);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The value pct percent of the recorded values are at or below.
+ *
+ * Reports the highest value the slot holding it covers, so percentiles
+ * err on the slow side, and never more than the largest value recorded.
+ *
+ **************************************************************************
+ */
+uint64_t
+HistPercentile(const Histogram *h,  // IN
+               double pct)          // IN
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    rank = (uint64_t)(pct / 100 * h->count + 0.5);
+    rank = MAX(rank, 1);
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t highest;
+
+            if (i < 2 * HIST_HALF) {
+                highest = i;
+            } else {
+                int shift = i / HIST_HALF - 1;
+                uint64_t sub = i - shift * HIST_HALF;
+
+                highest = ((sub + 1) << shift) - 1;
+            }
+            return MIN(highest, h->max);
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS    11   // Values keep 11 significant bits (< 0.1%)
+#define HIST_MAX_BITS    44   // Larger values are clamped to 2^44 - 1
+#define HIST_HALF        (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS     ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF)
+
+/**
+ * A log-linear histogram in the style of HdrHistogram.  Values below
+ * 2^HIST_SUB_BITS are counted exactly; above that, each power of two is
+ * split into HIST_HALF equal slots, so a recorded value is off by less
+ * than one part in 2^(HIST_SUB_BITS - 1) whatever its magnitude.
+ * Recording is a couple of shifts and an increment, and histograms from
+ * several threads merge by adding counts.
+ */
+typedef struct Histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[HIST_BUCKETS];
+} Histogram;
+
+Histogram *HistAlloc(void);
+void       HistFree(Histogram *h);
+void       HistReset(Histogram *h);
+void       HistAdd(Histogram *dst, const Histogram *src);
+uint64_t   HistPercentile(const Histogram *h, double pct);
+
+static inline int
+HistIndex(uint64_t v)
+{
+    int shift;
+
+    if (v < 2 * HIST_HALF) {
+        return v;
+    }
+    if (v >= (1ULL << HIST_MAX_BITS)) {
+        v = (1ULL << HIST_MAX_BITS) - 1;
+    }
+    shift = 64 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return shift * HIST_HALF + (v >> shift);
+}
+
+static inline void
+HistRecord(Histogram *h,  // IN/OUT
+           uint64_t v)    // IN
+{
+    h->counts[HistIndex(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static inline double
+HistMean(const Histogram *h)
+{
+    return h->count > 0 ? (double)h->sum / h->count : 0;
+}
+
+#endif
@@ -0,0 +1,352 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "logger.h"
+
+#define LOGGER_IDLE_NS  (2 * 1000 * 1000)   // Drain thread sleep when idle
+
+/**
+ * The header of each line in a ring; len bytes of text follow it.
+ */
+typedef struct LogRecord {
+    unsigned short len;
+    unsigned char  level;
+    unsigned char  reserved;
+} LogRecord;
+
+/**
+ * The lines logged by one thread, not yet written.  The thread is the
+ * only producer and advances tail; the drain thread is the only consumer
+ * and advances head.  Both only ever grow, and the bytes in use are
+ * tail - head.
+ */
+typedef struct LogRing {
+    struct LogRing   *next;
+    _Atomic size_t    head;
+    _Atomic size_t    tail;
+    _Atomic uint64_t  dropped;    // Lines that did not fit
+    char              buf[LOGGER_RING_SIZE];
+} LogRing;
+
+static _Atomic(LogRing *) logRings   = NULL;
+static _Atomic uint64_t   logLost    = 0;    // Lines of threads with no ring
+static __thread LogRing  *logSelf    = NULL;
+static FILE              *logFile    = NULL; // NULL: stdout and stderr
+static pthread_t          logThread;
+static atomic_bool        logStop    = false;
+static bool               logRunning = false;
+static LogLevel           logLevel;
+static unsigned           logMsgSample;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate the calling thread's ring.
+ *
+ * Rings are never freed, so lines a thread logged just before exiting
+ * still reach the file.
+ *
+ **************************************************************************
+ */
+static LogRing *
+LoggerRegister(void)
+{
+    LogRing *r = calloc(1, sizeof *r);
+
+    /* Error() would come back here, so just count the line as lost. */
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->next = atomic_load(&logRings);
+    while (!atomic_compare_exchange_weak(&logRings, &r->next, r)) {
+        continue;
+    }
+    logSelf = r;
+    return r;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy n bytes into a ring at position pos, wrapping around.
+ *
+ **************************************************************************
+ */
+static void
+RingCopyIn(LogRing *r,        // IN/OUT
+           size_t pos,        // IN
+           const void *src,   // IN
+           size_t n)          // IN
+{
+    size_t off   = pos % LOGGER_RING_SIZE;
+    size_t first = MIN(n, LOGGER_RING_SIZE - off);
+
+    memcpy(r->buf + off, src, first);
+    memcpy(r->buf, (const char *)src + first, n - first);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy n bytes out of a ring from position pos, wrapping around.
+ *
+ **************************************************************************
+ */
+static void
+RingCopyOut(const LogRing *r,  // IN
+            size_t pos,        // IN
+            void *dst,         // OUT
+            size_t n)          // IN
+{
+    size_t off   = pos % LOGGER_RING_SIZE;
+    size_t first = MIN(n, LOGGER_RING_SIZE - off);
+
+    memcpy(dst, r->buf + off, first);
+    memcpy((char *)dst + first, r->buf, n - first);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The log sink: queue a line in the calling thread's ring.
+ *
+ * Never blocks and never makes a system call.  A line that does not fit
+ * is dropped and counted.
+ *
+ **************************************************************************
+ */
+void
+LoggerSink(LogLevel level,    // IN
+           const char *fmt,   // IN
+           va_list ap)        // IN
+{
+    LogRing *r = logSelf != NULL ? logSelf : LoggerRegister();
+    char line[LOGGER_LINE_MAX];
+    LogRecord rec;
+    size_t head, tail;
+    int n;
+
+    if (r == NULL) {
+        atomic_fetch_add_explicit(&logLost, 1, memory_order_relaxed);
+        return;
+    }
+
+    n = vsnprintf(line, sizeof line, fmt, ap);
+    if (n <= 0) {
+        return;
+    }
+    memset(&rec, 0, sizeof rec);
+    rec.len   = MIN(n, sizeof line - 1);
+    rec.level = level;
+
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (LOGGER_RING_SIZE - (tail - head) < sizeof rec + rec.len) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    RingCopyIn(r, tail, &rec, sizeof rec);
+    RingCopyIn(r, tail + sizeof rec, line, rec.len);
+    atomic_store_explicit(&r->tail, tail + sizeof rec + rec.len,
+                          memory_order_release);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write out every line queued in a ring.
+ *
+ * Return true if there were any.
+ *
+ **************************************************************************
+ */
+static bool
+LoggerDrainRing(LogRing *r)  // IN/OUT
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    char line[LOGGER_LINE_MAX];
+
+    if (head == tail) {
+        return false;
+    }
+    while (head != tail) {
+        LogRecord rec;
+        FILE *f;
+
+        RingCopyOut(r, head, &rec, sizeof rec);
+        RingCopyOut(r, head + sizeof rec, line, rec.len);
+        head += sizeof rec + rec.len;
+
+        f = logFile != NULL ? logFile :
+            rec.level == LOG_ERROR ? stderr : stdout;
+        fwrite(line, 1, rec.len, f);
+    }
+    atomic_store_explicit(&r->head, head, memory_order_release);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The drain thread: copy queued lines to the log until stopped.
+ *
+ * Sleeps briefly whenever every ring is empty, and notes in the log when
+ * lines were dropped since it last looked.
+ *
+ **************************************************************************
+ */
+static void *
+LoggerLoop(void *arg)  // IN
+{
+    const struct timespec idle = { 0, LOGGER_IDLE_NS };
+    uint64_t reported = 0;
+
+    for (;;) {
+        bool stop = atomic_load(&logStop);
+        bool busy = false;
+        uint64_t dropped;
+        LogRing *r;
+
+        for (r = atomic_load(&logRings); r != NULL; r = r->next) {
+            busy |= LoggerDrainRing(r);
+        }
+
+        dropped = LoggerDropped();
+        if (dropped != reported) {
+            fprintf(logFile != NULL ? logFile : stderr,
+                    "Log full: dropped %llu line(s)\n",
+                    (unsigned long long)(dropped - reported));
+            reported = dropped;
+            busy = true;
+        }
+
+        if (busy) {
+            fflush(logFile != NULL ? logFile : stdout);
+            if (logFile == NULL) {
+                fflush(stderr);
+            }
+        } else if (stop) {
+            break;
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Log asynchronously from now on.
+ *
+ * Lines less important than level are dropped where they are logged,
+ * and only every msgSample-th request is traced (see LogSetup()).  path
+ * names a file to append to; NULL keeps writing to stdout and stderr.
+ * Call before starting other threads.  The queued lines are written out
+ * by LoggerStop(), which also runs at exit().
+ *
+ **************************************************************************
+ */
+bool
+LoggerStart(const char *path,    // IN
+            LogLevel level,      // IN
+            unsigned msgSample)  // IN
+{
+    int err;
+
+    if (path != NULL) {
+        logFile = fopen(path, "a");
+        if (logFile == NULL) {
+            Error("Failed to open log file %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+
+    atomic_store(&logStop, false);
+    err = pthread_create(&logThread, NULL, LoggerLoop, NULL);
+    if (err != 0) {
+        Error("Failed to start the log thread: %s\n", strerror(err));
+        if (logFile != NULL) {
+            fclose(logFile);
+            logFile = NULL;
+        }
+        return false;
+    }
+    logRunning   = true;
+    logLevel     = level;
+    logMsgSample = msgSample;
+    LogSetup(LoggerSink, level, msgSample);
+
+    atexit(LoggerStop);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write out every queued line and log synchronously again.
+ *
+ **************************************************************************
+ */
+void
+LoggerStop(void)
+{
+    if (!logRunning) {
+        return;
+    }
+    logRunning = false;
+
+    atomic_store(&logStop, true);
+    pthread_join(logThread, NULL);
+    LogSetup(NULL, logLevel, logMsgSample);
+
+    if (logFile != NULL) {
+        fclose(logFile);
+        logFile = NULL;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Lines dropped so far because a ring was full.
+ *
+ **************************************************************************
+ */
+uint64_t
+LoggerDropped(void)
+{
+    uint64_t dropped = atomic_load_explicit(&logLost, memory_order_relaxed);
+    LogRing *r;
+
+    for (r = atomic_load(&logRings); r != NULL; r = r->next) {
+        dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
@@ -0,0 +1,35 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define LOGGER_RING_SIZE  (256 * 1024)  // Bytes buffered per thread
+#define LOGGER_LINE_MAX   1024          // Longer lines are truncated
+
+/*
+ * Asynchronous logging.  Once LoggerStart() has run, Log(), Error() and
+ * PrintMsg() format each line into a ring owned by the calling thread
+ * and return; one background thread copies the lines to the log file.
+ * A thread whose ring is full drops the line and counts it rather than
+ * wait, so a slow disk or terminal never stalls an event loop.  Lines of
+ * one thread keep their order; lines of different threads may not.
+ */
+bool     LoggerStart(const char *path, LogLevel level, unsigned msgSample);
+void     LoggerStop(void);
+uint64_t LoggerDropped(void);
+void     LoggerSink(LogLevel level, const char *fmt, va_list ap);
+
+#endif
@@ -0,0 +1,271 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "lz.h"
+
+/*
+ * A compressed block is a series of sequences: a token byte holding the
+ * literal count and match length (4 bits each, 15 meaning more bytes
+ * follow), the literals, a 2-byte little-endian match offset and any
+ * extra length bytes.  The last sequence has literals only.  As in LZ4,
+ * the last LZ_LAST_LITERALS bytes are always literals and no match
+ * starts in the last LZ_MF_LIMIT bytes.
+ */
+#define LZ_MIN_MATCH       4
+#define LZ_LAST_LITERALS   5
+#define LZ_MF_LIMIT        12
+#define LZ_MAX_OFFSET      65535
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Load 4 unaligned bytes.
+ *
+ **************************************************************************
+ */
+static inline uint32_t
+LzRead32(const uint8_t *p)  // IN
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Hash the 4 bytes at p into the match table.
+ *
+ **************************************************************************
+ */
+static inline uint32_t
+LzHash(const uint8_t *p)  // IN
+{
+    return (LzRead32(p) * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write a length of 15 or more as the bytes after its token.
+ *
+ **************************************************************************
+ */
+static inline uint8_t *
+LzPutLength(uint8_t *op,   // OUT
+            int len)       // IN: Length minus 15
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len  -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write one sequence: literals, then a match unless matchLen is 0.
+ *
+ * Returns the end of the output, or NULL if it would pass oend.
+ *
+ **************************************************************************
+ */
+static uint8_t *
+LzPutSequence(uint8_t *op,            // OUT
+              uint8_t *oend,          // IN
+              const uint8_t *lit,     // IN
+              int litLen,             // IN
+              int offset,             // IN
+              int matchLen)           // IN
+{
+    uint8_t *token = op++;
+    int ml = matchLen - LZ_MIN_MATCH;
+
+    /* Token, length bytes, literals, offset and match bytes at most. */
+    if (oend - op < litLen + litLen / 255 + ml / 255 + 4) {
+        return NULL;
+    }
+
+    *token = MIN(litLen, 15) << 4;
+    if (litLen >= 15) {
+        op = LzPutLength(op, litLen - 15);
+    }
+    memcpy(op, lit, litLen);
+    op += litLen;
+
+    if (matchLen > 0) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        *token |= MIN(ml, 15);
+        if (ml >= 15) {
+            op = LzPutLength(op, ml - 15);
+        }
+    }
+    return op;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Compress srcLen bytes into dst.
+ *
+ * Returns the compressed size, or 0 if it would exceed dstCap; a dstCap
+ * of LZ_BOUND(srcLen) is always enough.
+ *
+ **************************************************************************
+ */
+int
+LzCompress(const char *src,  // IN
+           int srcLen,       // IN
+           char *dst,        // OUT
+           int dstCap)       // IN
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *base   = (const uint8_t *)src;
+    const uint8_t *ip     = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end    = base + srcLen;
+    uint8_t *op   = (uint8_t *)dst;
+    uint8_t *oend = op + dstCap;
+
+    /* Positions not yet seen point at offset 0; matches are verified. */
+    memset(table, 0, sizeof table);
+
+    if (srcLen > LZ_MF_LIMIT) {
+        const uint8_t *mfLimit    = end - LZ_MF_LIMIT;
+        const uint8_t *matchLimit = end - LZ_LAST_LITERALS;
+
+        ip++;
+        while (ip < mfLimit) {
+            uint32_t h = LzHash(ip);
+            const uint8_t *ref = base + table[h];
+            int len;
+
+            table[h] = ip - base;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+                LzRead32(ref) != LzRead32(ip)) {
+                ip++;
+                continue;
+            }
+
+            /* Extend backwards over literals, then forwards. */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            len = LZ_MIN_MATCH;
+            while (ip + len < matchLimit && ip[len] == ref[len]) {
+                len++;
+            }
+
+            op = LzPutSequence(op, oend, anchor, ip - anchor, ip - ref, len);
+            if (op == NULL) {
+                return 0;
+            }
+            ip    += len;
+            anchor = ip;
+            if (ip < mfLimit) {
+                table[LzHash(ip - 2)] = ip - 2 - base;
+            }
+        }
+    }
+
+    op = LzPutSequence(op, oend, anchor, end - anchor, 0, 0);
+    return op == NULL ? 0 : op - (uint8_t *)dst;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Decompress srcLen bytes into exactly dstLen bytes at dst.
+ *
+ * Returns false if the input is malformed or does not decompress to
+ * exactly dstLen bytes; nothing outside dst is ever written.
+ *
+ **************************************************************************
+ */
+bool
+LzDecompress(const char *src,  // IN
+             int srcLen,       // IN
+             char *dst,        // OUT
+             int dstLen)       // IN
+{
+    const uint8_t *ip   = (const uint8_t *)src;
+    const uint8_t *iend = ip + srcLen;
+    uint8_t *op   = (uint8_t *)dst;
+    uint8_t *oend = op + dstLen;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t litLen = token >> 4;
+        size_t matchLen = token & 15;
+        size_t offset;
+        unsigned b;
+
+        if (litLen == 15) {
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if (litLen > iend - ip || litLen > oend - op) {
+            return false;
+        }
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op - (uint8_t *)dst) {
+            return false;
+        }
+        if (matchLen == 15) {
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (matchLen > oend - op) {
+            return false;
+        }
+        /* Byte by byte: the match may overlap what it copies. */
+        while (matchLen-- > 0) {
+            *op = op[-offset];
+            op++;
+        }
+    }
+    return op == oend;
+}
@@ -0,0 +1,30 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <stdbool.h>
+
+/*
+ * A fast LZ77 compressor producing the LZ4 block format: greedy matching
+ * through a small hash table, no entropy coding.  Text compresses to
+ * roughly a third to a half at several hundred MB/s, so compressing a
+ * payload costs less than sending the bytes it saves.
+ */
+
+#define LZ_HASH_BITS   12
+
+/* Largest compressed size of n input bytes. */
+#define LZ_BOUND(n)    ((n) + (n) / 255 + 16)
+
+int  LzCompress(const char *src, int srcLen, char *dst, int dstCap);
+bool LzDecompress(const char *src, int srcLen, char *dst, int dstLen);
+
+#endif
@@ -0,0 +1,686 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "board.h"
+#include "eventloop.h"
+#include "outqueue.h"
+#include "rcu.h"
+#include "server.h"
+
+#define NS_PER_SEC       1000000000ULL
+#define MICRO_PIPELINE   64                  // Requests per server batch
+#define MICRO_BOARD_MAX  (16 * 1024 * 1024)  // Clear boards past this
+
+/*
+ * A benchmark runs iters operations on payloads of size bytes.
+ */
+typedef void (*MicroFunc)(int size, uint64_t iters);
+
+typedef struct MicroBench {
+    const char *name;
+    MicroFunc   func;
+    int         sizes[8];    // Zero-terminated, except a lone 0
+} MicroBench;
+
+static uint64_t    minTimeNs = NS_PER_SEC / 5;
+static int         repeats   = 3;
+static const char *filter;
+static FILE       *results;
+static char        payload[16 * 1024 * 1024];
+
+/* The in-process server and the client end of its connection. */
+static EventLoop      svrLoop;
+static EventBackend   svrBackend = EVENT_BACKEND_EPOLL;
+static pthread_t      svrThread;
+static volatile bool  svrRunning = true;
+static int            svrSock    = -1;
+static char          *svrReplies;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The monotonic clock in nanoseconds.
+ *
+ **************************************************************************
+ */
+static inline uint64_t
+NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Exit with a message if a benchmark's own plumbing failed.
+ *
+ **************************************************************************
+ */
+static void
+Check(bool ok,            // IN
+      const char *what)   // IN
+{
+    if (!ok) {
+        Error("microbench: %s failed: %s\n", what, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief WriteFully() then ReadFully() of size bytes over a socketpair.
+ *
+ **************************************************************************
+ */
+static void
+BenchReadWriteFully(int size,        // IN
+                    uint64_t iters)  // IN
+{
+    static int sv[2] = { -1, -1 };
+    static char buf[65536];
+    uint64_t i;
+
+    if (sv[0] < 0) {
+        int bufSize = 4 * sizeof buf;
+
+        Check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair");
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof bufSize);
+        setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof bufSize);
+    }
+    for (i = 0; i < iters; i++) {
+        Check(WriteFully(sv[0], payload, size) == size, "WriteFully");
+        Check(ReadFully(sv[1], buf, size) == size, "ReadFully");
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Frame a reply: fill in a header and queue it with its payload.
+ *
+ **************************************************************************
+ */
+static void
+BenchMsgEncode(int size,        // IN
+               uint64_t iters)  // IN
+{
+    OutQueue q;
+    uint64_t i;
+
+    OutQueueInit(&q);
+    for (i = 0; i < iters; i++) {
+        MsgHdr hdr;
+
+        memset(&hdr, 0, sizeof hdr);
+        hdr.type     = MSG_BOARD;
+        hdr.status   = MSG_STATUS_SUCCESS;
+        hdr.dataSize = size;
+        hdr.reqId    = i;
+        MsgSetTitle(&hdr, "microbench");
+        Check(OutQueueAppend(&q, &hdr, sizeof hdr), "OutQueueAppend");
+        if (size > 0) {
+            Check(OutQueueAppend(&q, payload, size), "OutQueueAppend");
+        }
+        if (i % MICRO_PIPELINE == MICRO_PIPELINE - 1) {
+            OutQueueReset(&q);
+        }
+    }
+    OutQueueReset(&q);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Parse frames back out of a buffer of back-to-back requests.
+ *
+ **************************************************************************
+ */
+static void
+BenchMsgDecode(int size,        // IN
+               uint64_t iters)  // IN
+{
+    static char *frames;
+    static int framesSize;
+    int frameLen = sizeof(MsgHdr) + size;
+    volatile unsigned sink = 0;
+    uint64_t i;
+    int off = 0;
+
+    if (framesSize < MICRO_PIPELINE * frameLen) {
+        free(frames);
+        framesSize = MICRO_PIPELINE * frameLen;
+        frames = malloc(framesSize);
+        Check(frames != NULL, "malloc");
+    }
+    for (i = 0; i < MICRO_PIPELINE; i++) {
+        MsgHdr *hdr = (MsgHdr *)(frames + i * frameLen);
+
+        memset(hdr, 0, sizeof *hdr);
+        hdr->type     = MSG_POST;
+        hdr->dataSize = size;
+        hdr->reqId    = i;
+        MsgSetTitle(hdr, "microbench");
+        memcpy(hdr->data, payload, size);
+    }
+
+    for (i = 0; i < iters; i++) {
+        char title[MAX_TITLE_LEN + 1];
+        MsgHdr hdr;
+
+        memcpy(&hdr, frames + off, sizeof hdr);
+        if (hdr.dataSize < 0 || hdr.dataSize > MAX_POST_DATA_SIZE) {
+            abort();
+        }
+        MsgGetTitle(&hdr, title);
+        sink += hdr.reqId + title[0] + frames[off + sizeof hdr];
+        off += sizeof hdr + hdr.dataSize;
+        if (off == framesSize) {
+            off = 0;
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append size-byte posts to a board, as POST does.
+ *
+ **************************************************************************
+ */
+static void
+BenchBoardAppend(int size,        // IN
+                 uint64_t iters)  // IN
+{
+    static WhiteBoard board;
+    static bool inited;
+    uint64_t i;
+    int len = 0;
+
+    if (!inited) {
+        Check(BoardInit(&board), "BoardInit");
+        inited = true;
+    }
+    for (i = 0; i < iters; i++) {
+        if (len > MICRO_BOARD_MAX) {
+            Check(BoardClear(&board, NULL, NULL), "BoardClear");
+            len = 0;
+        }
+        Check(BoardAppend(&board, payload, size, NULL, NULL), "BoardAppend");
+        len += size + 1;
+    }
+    BoardClear(&board, NULL, NULL);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a size-byte board for sending, as SHOW does, then drop it.
+ *
+ * The board's chunks are referenced, not copied, so the cost grows with
+ * the number of chunks rather than the number of bytes.
+ *
+ **************************************************************************
+ */
+static void
+BenchBoardSerialize(int size,        // IN
+                    uint64_t iters)  // IN
+{
+    static WhiteBoard board;
+    static int boardSize = -1;
+    BoardVersion *v;
+    OutQueue q;
+    uint64_t i;
+
+    if (boardSize < 0) {
+        Check(BoardInit(&board), "BoardInit");
+    }
+    if (boardSize != size) {
+        Check(BoardClear(&board, NULL, NULL), "BoardClear");
+        Check(BoardAppend(&board, payload, size - 1, NULL, NULL),
+              "BoardAppend");
+        boardSize = size;
+    }
+    OutQueueInit(&q);
+
+    for (i = 0; i < iters; i++) {
+        BoardCursor cur;
+        const char *chunk;
+        MsgHdr hdr;
+        int n;
+
+        v = BoardSnapshot(&board);
+        memset(&hdr, 0, sizeof hdr);
+        hdr.type     = MSG_BOARD;
+        hdr.dataSize = v->dataSize;
+        Check(OutQueueAppend(&q, &hdr, sizeof hdr), "OutQueueAppend");
+        BoardCursorInit(&cur, v);
+        while ((n = BoardCursorNext(&cur, &chunk)) > 0) {
+            BoardRetain(v);
+            Check(OutQueueAppendRef(&q, chunk, n, BoardRelease, v),
+                  "OutQueueAppendRef");
+        }
+        BoardRelease(v);
+        OutQueueReset(&q);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The in-process server's event loop thread.
+ *
+ **************************************************************************
+ */
+static void *
+ServerThread(void *arg)  // IN
+{
+    EventLoopRun(&svrLoop, &svrRunning);
+    RcuThreadOffline();
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start a server in this process with one connection to it.
+ *
+ * The connection goes over loopback TCP like a real client's, so the
+ * server benchmarks include the system calls a request costs.
+ *
+ **************************************************************************
+ */
+static void
+ServerStart(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof addr;
+    ServerArgs args;
+    int lsock, ssock, one = 1;
+
+    memset(&args, 0, sizeof args);
+    args.numThreads    = 1;
+    args.boardMemLimit = 1024UL << 20;
+    args.pushDelayUs   = SERVER_DEFAULT_PUSH_DELAY_US;
+    args.subQueueLimit = SERVER_DEFAULT_SUB_QUEUE;
+    args.outHighWater  = SERVER_DEFAULT_OUT_HIGH;
+    args.outLowWater   = SERVER_DEFAULT_OUT_HIGH / 4;
+    args.slowTimeoutS  = SERVER_DEFAULT_SLOW_TIMEOUT_S;
+    args.readTimeoutS  = SERVER_DEFAULT_READ_TIMEOUT_S;
+    args.idleTimeoutS  = SERVER_DEFAULT_IDLE_TIMEOUT_S;
+    args.logLevel      = LOG_MSG;
+    args.logSample     = 1;
+    Check(ServerInit(&args), "ServerInit");
+    Check(EventLoopInit(&svrLoop, svrBackend), "EventLoopInit");
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    lsock = socket(AF_INET, SOCK_STREAM, 0);
+    Check(lsock >= 0, "socket");
+    Check(bind(lsock, (struct sockaddr *)&addr, sizeof addr) == 0, "bind");
+    Check(listen(lsock, 1) == 0, "listen");
+    Check(getsockname(lsock, (struct sockaddr *)&addr, &addrLen) == 0,
+          "getsockname");
+
+    svrSock = socket(AF_INET, SOCK_STREAM, 0);
+    Check(svrSock >= 0, "socket");
+    Check(connect(svrSock, (struct sockaddr *)&addr, sizeof addr) == 0,
+          "connect");
+    setsockopt(svrSock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    ssock = accept(lsock, NULL, NULL);
+    Check(ssock >= 0, "accept");
+    close(lsock);
+
+    svrReplies = malloc(MAX_POST_DATA_SIZE * 2);
+    Check(svrReplies != NULL, "malloc");
+    ServerAddClient(&svrLoop, ssock);
+    Check(pthread_create(&svrThread, NULL, ServerThread, NULL) == 0,
+          "pthread_create");
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop the in-process server, if it was started.
+ *
+ **************************************************************************
+ */
+static void
+ServerStop(void)
+{
+    if (svrSock < 0) {
+        return;
+    }
+    close(svrSock);
+    svrRunning = false;
+    EventLoopWake(&svrLoop);
+    pthread_join(svrThread, NULL);
+    EventLoopDestroy(&svrLoop);
+    ServerExit();
+    free(svrReplies);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send count pipelined requests and read back every reply.
+ *
+ **************************************************************************
+ */
+static void
+ServerRoundTrips(MsgType type,        // IN
+                 const char *title,   // IN
+                 int size,            // IN
+                 int count)           // IN
+{
+    static char *reqs;
+    static int reqsSize;
+    int frameLen = sizeof(MsgHdr) + size;
+    int i;
+
+    if (svrSock < 0) {
+        ServerStart();
+    }
+    if (reqsSize < count * frameLen) {
+        free(reqs);
+        reqsSize = count * frameLen;
+        reqs = malloc(reqsSize);
+        Check(reqs != NULL, "malloc");
+    }
+    for (i = 0; i < count; i++) {
+        MsgHdr *hdr = (MsgHdr *)(reqs + i * frameLen);
+
+        memset(hdr, 0, sizeof *hdr);
+        hdr->type     = type;
+        hdr->dataSize = size;
+        hdr->reqId    = i;
+        MsgSetTitle(hdr, title);
+        memcpy(hdr->data, payload, size);
+    }
+    Check(WriteFully(svrSock, reqs, count * frameLen) == count * frameLen,
+          "WriteFully");
+
+    for (i = 0; i < count; i++) {
+        MsgHdr reply;
+
+        Check(ReadFully(svrSock, &reply, sizeof reply) == sizeof reply,
+              "ReadFully");
+        Check(reply.dataSize <= MAX_POST_DATA_SIZE * 2 &&
+              ReadFully(svrSock, svrReplies, reply.dataSize) ==
+              reply.dataSize, "ReadFully");
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Framing and msgHandlers dispatch: SHOW of an empty board.
+ *
+ **************************************************************************
+ */
+static void
+BenchServerDispatch(int size,        // IN
+                    uint64_t iters)  // IN
+{
+    while (iters > 0) {
+        int n = MIN(iters, MICRO_PIPELINE);
+
+        ServerRoundTrips(MSG_SHOW, "empty", 0, n);
+        iters -= n;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief POST of size bytes through the server.
+ *
+ **************************************************************************
+ */
+static void
+BenchServerPost(int size,        // IN
+                uint64_t iters)  // IN
+{
+    long len = 0;
+
+    while (iters > 0) {
+        int n = MIN(iters, MICRO_PIPELINE);
+
+        if (len > MICRO_BOARD_MAX) {
+            ServerRoundTrips(MSG_CLEAR, "post", 0, 1);
+            len = 0;
+        }
+        ServerRoundTrips(MSG_POST, "post", size, n);
+        len   += (long)n * (size + 1);
+        iters -= n;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief SHOW of a size-byte board through the server.
+ *
+ **************************************************************************
+ */
+static void
+BenchServerShow(int size,        // IN
+                uint64_t iters)  // IN
+{
+    static int boardSize = -1;
+
+    if (boardSize != size) {
+        ServerRoundTrips(MSG_CLEAR, "show", 0, 1);
+        ServerRoundTrips(MSG_POST, "show", size - 1, 1);
+        boardSize = size;
+    }
+    while (iters > 0) {
+        int n = MIN(iters, MICRO_PIPELINE);
+
+        ServerRoundTrips(MSG_SHOW, "show", 0, n);
+        iters -= n;
+    }
+}
+
+
+static const MicroBench benches[] = {
+    { "rw_fully",        BenchReadWriteFully,
+      { 64, 1024, 16384, 65536 } },
+    { "msg_encode",      BenchMsgEncode,      { 0, 64, 1024, 16384 } },
+    { "msg_decode",      BenchMsgDecode,      { 0, 64, 1024, 16384 } },
+    { "board_append",    BenchBoardAppend,    { 16, 256, 4096, 65536 } },
+    { "board_serialize", BenchBoardSerialize,
+      { 1024, 65536, 1048576, 16777216 } },
+    { "server_dispatch", BenchServerDispatch, { 0 } },
+    { "server_post",     BenchServerPost,     { 64, 1024, 16384, 262144 } },
+    { "server_show",     BenchServerShow,
+      { 1024, 65536, 1048576 } },
+};
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Time one benchmark at one size and print the result.
+ *
+ * The iteration count doubles until a run takes at least minTimeNs; the
+ * fastest of repeats runs at that count is reported, as one JSON object
+ * per line.
+ *
+ **************************************************************************
+ */
+static void
+RunBench(const MicroBench *b,  // IN
+         int size)             // IN
+{
+    uint64_t iters = 1, best = UINT64_MAX, t;
+    double nsPerOp;
+    int i;
+
+    b->func(size, 1);   // Warm up caches and lazily created state
+    for (;;) {
+        t = NowNs();
+        b->func(size, iters);
+        t = NowNs() - t;
+        if (t >= minTimeNs) {
+            break;
+        }
+        iters *= t > 0 ? MIN(MAX(minTimeNs / t + 1, 2), 100) : 100;
+    }
+    best = t;
+    for (i = 1; i < repeats; i++) {
+        t = NowNs();
+        b->func(size, iters);
+        best = MIN(best, NowNs() - t);
+    }
+
+    nsPerOp = (double)best / iters;
+    fprintf(results, "{\"bench\": \"%s\", \"size\": %d, \"iters\": %llu, "
+            "\"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+            "\"mb_per_sec\": %.1f}\n", b->name, size,
+            (unsigned long long)iters, nsPerOp, NS_PER_SEC / nsPerOp,
+            size * (NS_PER_SEC / nsPerOp) / (1 << 20));
+    fflush(results);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the usage message and exit the program.
+ *
+ **************************************************************************
+ */
+static void
+Usage(const char *prog) // IN
+{
+    Error("Usage:\n");
+    Error("    %s [options]\n", prog);
+    Error("Options:\n");
+    Error("    -f, --filter STR    Run only benchmarks whose name contains "
+          "STR\n");
+    Error("    -T, --time MS       Minimum time per run (default 200)\n");
+    Error("    -r, --repeat N      Report the best of N runs (default 3)\n");
+    Error("    -u, --io-uring      Run the server benchmarks over io_uring\n");
+    Error("    -l, --list          List the benchmarks\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Main entry point.
+ *
+ * Results go to stdout; the in-process server's own logging, which also
+ * goes to stdout, is discarded so the output stays machine-readable.
+ *
+ **************************************************************************
+ */
+int
+main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "filter", required_argument, NULL, 'f' },
+        { "time",   required_argument, NULL, 'T' },
+        { "repeat", required_argument, NULL, 'r' },
+        { "io-uring", no_argument,     NULL, 'u' },
+        { "list",   no_argument,       NULL, 'l' },
+        { NULL,     0,                 NULL, 0   },
+    };
+    int opt, i, j;
+
+    while ((opt = getopt_long(argc, argv, "f:T:r:ul", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 'T':
+            minTimeNs = atol(optarg) * 1000000ULL;
+            if (minTimeNs == 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            if (repeats <= 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'u':
+            svrBackend = EVENT_BACKEND_URING;
+            break;
+        case 'l':
+            for (i = 0; i < ARRAYSIZE(benches); i++) {
+                printf("%s\n", benches[i].name);
+            }
+            return 0;
+        default:
+            Usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        Usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(payload, 'x', sizeof payload);
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    Check(results != NULL && freopen("/dev/null", "w", stdout) != NULL,
+          "redirecting stdout");
+
+    for (i = 0; i < ARRAYSIZE(benches); i++) {
+        const MicroBench *b = &benches[i];
+
+        if (filter != NULL && strstr(b->name, filter) == NULL) {
+            continue;
+        }
+        j = 0;
+        do {
+            RunBench(b, b->sizes[j]);
+        } while (++j < ARRAYSIZE(b->sizes) && b->sizes[j] != 0);
+    }
+
+    ServerStop();
+    fclose(results);
+    return 0;
+}
@@ -0,0 +1,509 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "common.h"
+#include "outqueue.h"
+#include "slab.h"
+
+/*
+ * Segments of OUTSEG_MIN_SIZE and segments referencing bytes elsewhere
+ * come from per-thread caches; larger copies, and every segment of a
+ * heap queue, use malloc.
+ */
+static SlabCache outSegCache = SLAB_CACHE("out_segments",
+                                          sizeof(OutSeg) + OUTSEG_MIN_SIZE);
+static SlabCache outRefCache = SLAB_CACHE("out_refs", sizeof(OutSeg));
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an empty output queue.
+ *
+ **************************************************************************
+ */
+void
+OutQueueInit(OutQueue *q)  // OUT
+{
+    memset(q, 0, sizeof *q);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release a segment and whatever it references.
+ *
+ **************************************************************************
+ */
+static void
+OutSegFree(OutSeg *seg)  // IN
+{
+    if (seg->release != NULL) {
+        seg->release(seg->arg);
+    }
+    if (seg->heap) {
+        free(seg);
+    } else if (seg->cap == 0) {
+        SlabFree(&outRefCache, seg);
+    } else {
+        SlabFree(&outSegCache, seg);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drop all pending output.
+ *
+ * Segments still pinned by zerocopy sends are released as well, so the
+ * socket must be closed at the same time.
+ *
+ **************************************************************************
+ */
+void
+OutQueueReset(OutQueue *q)  // IN/OUT
+{
+    while (q->head != NULL) {
+        OutSeg *seg = q->head;
+        q->head = seg->next;
+        OutSegFree(seg);
+    }
+    while (q->zcHead != NULL) {
+        OutSeg *seg = q->zcHead;
+        q->zcHead = seg->next;
+        OutSegFree(seg);
+    }
+    q->tail   = NULL;
+    q->zcTail = NULL;
+    q->bytes  = 0;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Link a segment at the tail of the queue.
+ *
+ **************************************************************************
+ */
+static void
+OutQueueLink(OutQueue *q,   // IN/OUT
+             OutSeg *seg)   // IN
+{
+    seg->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = seg;
+    } else {
+        q->head = seg;
+    }
+    q->tail   = seg;
+    q->bytes += seg->len;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a copy of the given bytes.
+ *
+ * Small appends are coalesced into the tail segment when it has room, so
+ * several short replies leave in a single write.
+ *
+ **************************************************************************
+ */
+bool
+OutQueueAppend(OutQueue *q,        // IN/OUT
+               const void *data,   // IN
+               int len)            // IN
+{
+    OutSeg *seg = q->tail;
+    int cap;
+
+    if (len <= 0) {
+        return true;
+    }
+
+    if (seg != NULL && seg->cap - seg->len >= len) {
+        memcpy(seg->buf + seg->len, data, len);
+        seg->len += len;
+        q->bytes += len;
+        return true;
+    }
+
+    cap = len > OUTSEG_MIN_SIZE ? len : OUTSEG_MIN_SIZE;
+    seg = cap == OUTSEG_MIN_SIZE && !q->heap ? SlabAlloc(&outSegCache) :
+                                               malloc(sizeof *seg + cap);
+    if (seg == NULL) {
+        Error("Failed to allocate %d bytes of output\n", len);
+        return false;
+    }
+    memset(seg, 0, sizeof *seg);
+    seg->heap = q->heap || cap != OUTSEG_MIN_SIZE;
+    seg->data = seg->buf;
+    seg->len  = len;
+    seg->cap  = cap;
+    memcpy(seg->buf, data, len);
+
+    OutQueueLink(q, seg);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue bytes by reference.
+ *
+ * The bytes must stay valid until release(arg) is called, which happens
+ * once they are written or the queue is reset.
+ *
+ **************************************************************************
+ */
+bool
+OutQueueAppendRef(OutQueue *q,             // IN/OUT
+                  const void *data,        // IN
+                  int len,                 // IN
+                  OutSegRelease release,   // IN
+                  void *arg)               // IN
+{
+    OutSeg *seg;
+
+    seg = q->heap ? malloc(sizeof *seg) : SlabAlloc(&outRefCache);
+    if (seg == NULL) {
+        Error("Failed to allocate an output segment\n");
+        if (release != NULL) {
+            release(arg);
+        }
+        return false;
+    }
+    memset(seg, 0, sizeof *seg);
+    seg->heap    = q->heap;
+    seg->data    = data;
+    seg->len     = len;
+    seg->release = release;
+    seg->arg     = arg;
+
+    OutQueueLink(q, seg);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Move everything queued in src, none of it written yet, to the
+ * tail of q.
+ *
+ * src is left empty.  If it belongs to another thread, it must be a heap
+ * queue: a slab object freed here would join this thread's lists, and
+ * the other thread would go on carving slabs to replace it.
+ *
+ **************************************************************************
+ */
+void
+OutQueueSplice(OutQueue *q,     // IN/OUT
+               OutQueue *src)   // IN/OUT
+{
+    if (src->head == NULL) {
+        return;
+    }
+    if (q->tail != NULL) {
+        q->tail->next = src->head;
+    } else {
+        q->head = src->head;
+    }
+    q->tail   = src->tail;
+    q->bytes += src->bytes;
+
+    src->head  = NULL;
+    src->tail  = NULL;
+    src->bytes = 0;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Account for n bytes written from the head of the queue.
+ *
+ * Fully written segments are freed, or parked on the zc list if a
+ * zerocopy send still references them.
+ *
+ **************************************************************************
+ */
+static void
+OutQueueAdvance(OutQueue *q,       // IN/OUT
+                int n,             // IN
+                bool zerocopy)     // IN
+{
+    q->bytes -= n;
+    q->sent  += n;
+
+    while (q->head != NULL) {
+        OutSeg *seg = q->head;
+        int take = MIN(n, seg->len - seg->off);
+
+        if (take > 0 && zerocopy) {
+            seg->zcPinned = true;
+            seg->zcSeq    = q->zcNext - 1;
+        }
+        seg->off += take;
+        n        -= take;
+        if (seg->off < seg->len) {
+            break;
+        }
+
+        q->head = seg->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        if (!seg->zcPinned) {
+            OutSegFree(seg);
+            continue;
+        }
+        seg->next = NULL;
+        if (q->zcTail != NULL) {
+            q->zcTail->next = seg;
+        } else {
+            q->zcHead = seg;
+        }
+        q->zcTail = seg;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Point iov at the pending output, up to max segments of it.
+ *
+ * Returns the number of entries filled in, which is 0 only once the
+ * queue is empty.
+ *
+ **************************************************************************
+ */
+int
+OutQueueGather(OutQueue *q,         // IN/OUT
+               struct iovec *iov,   // OUT
+               int max)             // IN
+{
+    int cnt = 0;
+
+    while (q->head != NULL) {
+        OutSeg *seg;
+
+        for (seg = q->head; seg != NULL && cnt < max; seg = seg->next) {
+            if (seg->off < seg->len) {
+                iov[cnt].iov_base = (char *)seg->data + seg->off;
+                iov[cnt].iov_len  = seg->len - seg->off;
+                cnt++;
+            }
+        }
+        if (cnt > 0) {
+            break;
+        }
+        OutQueueAdvance(q, 0, false);
+    }
+    return cnt;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Account for n bytes of the gathered output having been sent.
+ *
+ * For callers that send what OutQueueGather() returned themselves.
+ *
+ **************************************************************************
+ */
+void
+OutQueueConsume(OutQueue *q,   // IN/OUT
+                int n)         // IN
+{
+    OutQueueAdvance(q, n, false);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write as much pending output as the socket accepts.
+ *
+ * Up to OUTQUEUE_MAX_IOV segments leave in a single sendmsg(), so a reply
+ * header and the board chunks behind it cost one system call.  Large
+ * writes use MSG_ZEROCOPY when it is enabled.  Once budget bytes (if not
+ * 0) are written, the rest is left for a later call.
+ *
+ * Returns 1 when the queue is drained, 0 when the socket is full or the
+ * budget used up, and -1 on a socket error.
+ *
+ **************************************************************************
+ */
+int
+OutQueueFlush(OutQueue *q,   // IN/OUT
+              int sd,        // IN
+              int budget)    // IN
+{
+    int sent = 0;
+
+    while (q->head != NULL) {
+        struct iovec iov[OUTQUEUE_MAX_IOV];
+        struct msghdr msg;
+        size_t total = 0;
+        bool zerocopy;
+        int i, n;
+
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = OutQueueGather(q, iov, OUTQUEUE_MAX_IOV);
+        if (msg.msg_iovlen == 0) {
+            break;
+        }
+        for (i = 0; i < msg.msg_iovlen; i++) {
+            total += iov[i].iov_len;
+        }
+
+        zerocopy = q->zerocopy && total >= OUTQUEUE_ZEROCOPY_MIN;
+        n = sendmsg(sd, &msg, zerocopy ? MSG_ZEROCOPY : 0);
+        if (n < 0 && errno == ENOBUFS && zerocopy) {
+            /* Out of option memory for notifications; copy instead. */
+            zerocopy = false;
+            n = sendmsg(sd, &msg, 0);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            Error("write error: %d\n", errno);
+            return -1;
+        }
+        if (zerocopy) {
+            q->zcNext++;
+        }
+        OutQueueAdvance(q, n, zerocopy);
+
+        sent += n;
+        if (budget > 0 && sent >= budget && q->head != NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send large writes on sd with MSG_ZEROCOPY from now on.
+ *
+ * Zerocopy sends leave the bytes in place until the kernel is done with
+ * them; OutQueueReap() must then be called whenever sd reports EPOLLERR.
+ *
+ **************************************************************************
+ */
+bool
+OutQueueEnableZeroCopy(OutQueue *q,  // IN/OUT
+                       int sd)       // IN
+{
+    int on = 1;
+
+    if (setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) < 0) {
+        perror("Failed to enable SO_ZEROCOPY");
+        return false;
+    }
+    q->zerocopy = true;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release the segments whose zerocopy sends have completed.
+ *
+ * Drains the socket error queue.  TCP completes sends in order, so every
+ * parked segment up to the highest reported sequence number is done.  If
+ * the kernel had to copy the data anyway, zerocopy is turned off for the
+ * queue.  Returns -1 if the socket has a pending error, 0 otherwise.
+ *
+ **************************************************************************
+ */
+int
+OutQueueReap(OutQueue *q,  // IN/OUT
+             int sd)       // IN
+{
+    int err = 0;
+    socklen_t errLen = sizeof err;
+
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        struct cmsghdr *cm;
+
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof control;
+
+        if (recvmsg(sd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *serr;
+
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 &&
+                  cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                q->zerocopy = false;
+            }
+            while (q->zcHead != NULL &&
+                   (int)(q->zcHead->zcSeq - serr->ee_data) <= 0) {
+                OutSeg *seg = q->zcHead;
+                q->zcHead = seg->next;
+                OutSegFree(seg);
+            }
+            if (q->zcHead == NULL) {
+                q->zcTail = NULL;
+            }
+        }
+    }
+
+    if (getsockopt(sd, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0) {
+        return -1;
+    }
+    return 0;
+}
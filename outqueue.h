@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _OUTQUEUE_H_
+#define _OUTQUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define OUTSEG_MIN_SIZE         4096
+#define OUTQUEUE_MAX_IOV        64
+#define OUTQUEUE_ZEROCOPY_MIN   32768   // Smallest write sent MSG_ZEROCOPY
+
+typedef void (*OutSegRelease)(void *arg);
+
+/**
+ * A chunk of pending output.  The bytes either live in buf[] (copied) or
+ * are referenced and handed back through release() once written.  A
+ * segment sent with MSG_ZEROCOPY is only released after the kernel
+ * reports that send zcSeq complete.
+ */
+typedef struct OutSeg {
+    struct OutSeg *next;
+    const char    *data;
+    int            len;
+    int            off;
+    int            cap;
+    bool           zcPinned;
+    bool           heap;        // From malloc, whatever its size
+    unsigned       zcSeq;
+    OutSegRelease  release;
+    void          *arg;
+    char           buf[0];
+} OutSeg;
+
+/**
+ * The pending output of a connection.  Segments that have been written
+ * but are still pinned by zerocopy sends wait on the zc list.  A heap
+ * queue takes all its segments from malloc, so they can be spliced onto
+ * a queue of another thread without draining this thread's slabs.
+ */
+typedef struct OutQueue {
+    OutSeg   *head;
+    OutSeg   *tail;
+    int       bytes;
+    uint64_t  sent;         // Bytes written since OutQueueInit()
+    bool      heap;         // Segments from malloc only
+    bool      zerocopy;     // Send large writes with MSG_ZEROCOPY
+    unsigned  zcNext;       // Sequence number of the next zerocopy send
+    OutSeg   *zcHead;
+    OutSeg   *zcTail;
+} OutQueue;
+
+void OutQueueInit(OutQueue *q);
+void OutQueueReset(OutQueue *q);
+bool OutQueueAppend(OutQueue *q, const void *data, int len);
+bool OutQueueAppendRef(OutQueue *q, const void *data, int len,
+                       OutSegRelease release, void *arg);
+void OutQueueSplice(OutQueue *q, OutQueue *src);
+int  OutQueueGather(OutQueue *q, struct iovec *iov, int max);
+void OutQueueConsume(OutQueue *q, int n);
+int  OutQueueFlush(OutQueue *q, int sd, int budget);
+bool OutQueueEnableZeroCopy(OutQueue *q, int sd);
+int  OutQueueReap(OutQueue *q, int sd);
+
+static inline bool
+OutQueueEmpty(const OutQueue *q)
+{
+    return q->head == NULL;
+}
+
+#endif
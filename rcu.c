@@ -0,0 +1,218 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "rcu.h"
+
+/**
+ * Per-thread reader record.  epoch is 0 while the thread is outside a
+ * read-side critical section.
+ */
+typedef struct RcuThread {
+    struct RcuThread *next;
+    atomic_ulong      epoch;
+    atomic_bool       inUse;
+} RcuThread;
+
+/**
+ * An object waiting for its grace period to end.
+ */
+typedef struct RcuRetired {
+    struct RcuRetired *next;
+    unsigned long      epoch;
+    void              *ptr;
+    RcuFreeFunc        freeFunc;
+} RcuRetired;
+
+static atomic_ulong          rcuEpoch   = 1;
+static _Atomic(RcuThread *)  rcuThreads = NULL;
+static pthread_mutex_t       rcuLock    = PTHREAD_MUTEX_INITIALIZER;
+static RcuRetired           *rcuRetired = NULL;
+static __thread RcuThread   *rcuSelf    = NULL;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Find or allocate the reader record of the calling thread.
+ *
+ **************************************************************************
+ */
+static RcuThread *
+RcuThreadSelf(void)
+{
+    RcuThread *t;
+
+    if (rcuSelf != NULL) {
+        return rcuSelf;
+    }
+
+    for (t = atomic_load(&rcuThreads); t != NULL; t = t->next) {
+        bool unused = false;
+        if (atomic_compare_exchange_strong(&t->inUse, &unused, true)) {
+            rcuSelf = t;
+            return t;
+        }
+    }
+
+    t = calloc(1, sizeof *t);
+    if (t == NULL) {
+        Error("Failed to allocate an RCU thread record\n");
+        abort();
+    }
+    atomic_init(&t->epoch, 0);
+    atomic_init(&t->inUse, true);
+
+    t->next = atomic_load(&rcuThreads);
+    while (!atomic_compare_exchange_weak(&rcuThreads, &t->next, t)) {
+        continue;
+    }
+    rcuSelf = t;
+    return t;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Enter a read-side critical section.
+ *
+ * Critical sections must be short and must not nest.
+ *
+ **************************************************************************
+ */
+void
+RcuReadLock(void)
+{
+    RcuThread *self = RcuThreadSelf();
+
+    atomic_store(&self->epoch, atomic_load(&rcuEpoch));
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Leave a read-side critical section.
+ *
+ **************************************************************************
+ */
+void
+RcuReadUnlock(void)
+{
+    atomic_store_explicit(&rcuSelf->epoch, 0, memory_order_release);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release the calling thread's reader record on thread exit.
+ *
+ **************************************************************************
+ */
+void
+RcuThreadOffline(void)
+{
+    if (rcuSelf != NULL) {
+        atomic_store(&rcuSelf->epoch, 0);
+        atomic_store(&rcuSelf->inUse, false);
+        rcuSelf = NULL;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Advance the global epoch if every active reader has seen it.
+ *
+ * Called with rcuLock held.  Returns the (possibly new) epoch.
+ *
+ **************************************************************************
+ */
+static unsigned long
+RcuTryAdvance(void)
+{
+    unsigned long epoch = atomic_load(&rcuEpoch);
+    RcuThread *t;
+
+    for (t = atomic_load(&rcuThreads); t != NULL; t = t->next) {
+        unsigned long e = atomic_load(&t->epoch);
+        if (e != 0 && e != epoch) {
+            return epoch;
+        }
+    }
+
+    atomic_store(&rcuEpoch, epoch + 1);
+    return epoch + 1;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Free ptr once no reader can still hold a reference to it.
+ *
+ * The caller must already have unlinked ptr from every shared location.
+ * An object retired in epoch e is freed once the epoch reaches e + 2.
+ *
+ **************************************************************************
+ */
+void
+RcuRetire(void *ptr,              // IN
+          RcuFreeFunc freeFunc)   // IN
+{
+    RcuRetired *r, **link;
+    RcuRetired *ready = NULL;
+    unsigned long epoch;
+
+    r = malloc(sizeof *r);
+    if (r == NULL) {
+        Error("Failed to allocate an RCU retire record\n");
+        abort();
+    }
+    r->ptr      = ptr;
+    r->freeFunc = freeFunc;
+
+    pthread_mutex_lock(&rcuLock);
+
+    r->epoch   = atomic_load(&rcuEpoch);
+    r->next    = rcuRetired;
+    rcuRetired = r;
+
+    epoch = RcuTryAdvance();
+
+    link = &rcuRetired;
+    while (*link != NULL) {
+        r = *link;
+        if (r->epoch + 2 <= epoch) {
+            *link   = r->next;
+            r->next = ready;
+            ready   = r;
+        } else {
+            link = &r->next;
+        }
+    }
+
+    pthread_mutex_unlock(&rcuLock);
+
+    while (ready != NULL) {
+        r = ready;
+        ready = r->next;
+        r->freeFunc(r->ptr);
+        free(r);
+    }
+}
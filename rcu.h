@@ -0,0 +1,27 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Epoch-based reclamation.  Readers bracket their access to shared
+ * pointers with RcuReadLock()/RcuReadUnlock(), which never block.  Writers
+ * unlink an object and hand it to RcuRetire(); it is freed once every
+ * reader that might still see it has left its critical section.
+ */
+
+typedef void (*RcuFreeFunc)(void *ptr);
+
+void RcuReadLock(void);
+void RcuReadUnlock(void);
+void RcuRetire(void *ptr, RcuFreeFunc freeFunc);
+void RcuThreadOffline(void);
+
+#endif
@@ -0,0 +1,272 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "recvbuf.h"
+#include "slab.h"
+
+/* Buffers of the usual size; larger ones come from malloc. */
+static SlabCache recvBufCache = SLAB_CACHE("recv_buffers", RECVBUF_SIZE);
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate buffer memory of cap bytes.
+ *
+ **************************************************************************
+ */
+static char *
+RecvBufAlloc(int cap)  // IN
+{
+    return cap == RECVBUF_SIZE ? SlabAlloc(&recvBufCache) : malloc(cap);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release buffer memory from RecvBufAlloc().
+ *
+ **************************************************************************
+ */
+static void
+RecvBufRelease(char *buf,   // IN
+               int cap)     // IN
+{
+    if (cap == RECVBUF_SIZE) {
+        SlabFree(&recvBufCache, buf);
+    } else {
+        free(buf);
+    }
+}
+
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an empty buffer.  Memory is allocated on first use.
+ *
+ **************************************************************************
+ */
+void
+RecvBufInit(RecvBuf *rb)  // OUT
+{
+    memset(rb, 0, sizeof *rb);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release the buffer memory.
+ *
+ **************************************************************************
+ */
+void
+RecvBufFree(RecvBuf *rb)  // IN
+{
+    RecvBufRelease(rb->buf, rb->cap);
+    RecvBufInit(rb);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Move the unconsumed bytes to the start of the buffer.
+ *
+ **************************************************************************
+ */
+static void
+RecvBufCompact(RecvBuf *rb)  // IN/OUT
+{
+    if (rb->head > 0) {
+        memmove(rb->buf, rb->buf + rb->head, rb->tail - rb->head);
+        rb->tail -= rb->head;
+        rb->head  = 0;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make sure len bytes starting at the head fit in the buffer.
+ *
+ **************************************************************************
+ */
+bool
+RecvBufReserve(RecvBuf *rb,  // IN/OUT
+               int len)      // IN
+{
+    if (rb->cap - rb->head >= len) {
+        return true;
+    }
+
+    RecvBufCompact(rb);
+    if (rb->cap < len) {
+        int cap = MAX(len, RECVBUF_SIZE);
+        char *buf = RecvBufAlloc(cap);
+        if (buf == NULL) {
+            Error("Failed to allocate a %d byte receive buffer\n", cap);
+            return false;
+        }
+        memcpy(buf, rb->buf, rb->tail);
+        RecvBufRelease(rb->buf, rb->cap);
+        rb->buf = buf;
+        rb->cap = cap;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drop len bytes from the head of the buffer.
+ *
+ * An emptied buffer is released; taking it from the thread's free list
+ * again costs next to nothing, and idle connections hold no buffer.
+ *
+ **************************************************************************
+ */
+void
+RecvBufConsume(RecvBuf *rb,  // IN/OUT
+               int len)      // IN
+{
+    rb->head += len;
+    if (rb->head == rb->tail) {
+        RecvBufFree(rb);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Receive as many bytes as fit with a single recv().
+ *
+ * Returns what recv() returned.
+ *
+ **************************************************************************
+ */
+int
+RecvBufFill(RecvBuf *rb,  // IN/OUT
+            int sd)       // IN
+{
+    int n;
+
+    if (rb->tail == rb->cap) {
+        if (rb->head > 0) {
+            RecvBufCompact(rb);
+        } else if (!RecvBufReserve(rb, MAX(rb->cap * 2, RECVBUF_SIZE))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    n = recv(sd, rb->buf + rb->tail, rb->cap - rb->tail, 0);
+    if (n > 0) {
+        rb->tail += n;
+    } else if (rb->tail == 0) {
+        RecvBufFree(rb);
+    }
+    return n;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append len bytes received elsewhere, growing the buffer if needed.
+ *
+ **************************************************************************
+ */
+bool
+RecvBufAppend(RecvBuf *rb,        // IN/OUT
+              const char *data,   // IN
+              int len)            // IN
+{
+    if (rb->cap - rb->tail < len &&
+        !RecvBufReserve(rb, RecvBufLen(rb) + len)) {
+        return false;
+    }
+    memcpy(rb->buf + rb->tail, data, len);
+    rb->tail += len;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Discard up to len bytes of input without copying them.
+ *
+ * Bytes already buffered are dropped first; otherwise the kernel throws
+ * the bytes away itself (MSG_TRUNC).  Returns the number of bytes
+ * discarded, or what recv() returned on EOF or error.
+ *
+ **************************************************************************
+ */
+int
+RecvBufSkip(RecvBuf *rb,  // IN/OUT
+            int sd,       // IN
+            int len)      // IN
+{
+    int n = MIN(len, RecvBufLen(rb));
+
+    if (n > 0) {
+        RecvBufConsume(rb, n);
+        return n;
+    }
+    return recv(sd, NULL, len, MSG_TRUNC);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Block until at least len bytes are buffered.
+ *
+ * For blocking sockets.  Returns false on EOF or error.
+ *
+ **************************************************************************
+ */
+bool
+RecvBufReadFully(RecvBuf *rb,  // IN/OUT
+                 int sd,       // IN
+                 int len)      // IN
+{
+    if (!RecvBufReserve(rb, len)) {
+        return false;
+    }
+
+    while (RecvBufLen(rb) < len) {
+        int n = RecvBufFill(rb, sd);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                Error("read error: %d\n", errno);
+            }
+            return false;
+        }
+    }
+    return true;
+}
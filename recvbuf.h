@@ -0,0 +1,51 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _RECVBUF_H_
+#define _RECVBUF_H_
+
+#include <stdbool.h>
+
+#define RECVBUF_SIZE 16384
+
+/**
+ * Buffered input of a socket.  Bytes [head, tail) of buf have been
+ * received but not consumed.  Each recv() asks for all the free space, so
+ * a burst of small frames costs one system call, and a frame can be parsed
+ * where it lies once RecvBufReserve() made room for all of it.
+ */
+typedef struct RecvBuf {
+    char *buf;
+    int   cap;
+    int   head;
+    int   tail;
+} RecvBuf;
+
+void RecvBufInit(RecvBuf *rb);
+void RecvBufFree(RecvBuf *rb);
+bool RecvBufReserve(RecvBuf *rb, int len);
+void RecvBufConsume(RecvBuf *rb, int len);
+bool RecvBufAppend(RecvBuf *rb, const char *data, int len);
+int  RecvBufFill(RecvBuf *rb, int sd);
+int  RecvBufSkip(RecvBuf *rb, int sd, int len);
+bool RecvBufReadFully(RecvBuf *rb, int sd, int len);
+
+static inline int
+RecvBufLen(const RecvBuf *rb)
+{
+    return rb->tail - rb->head;
+}
+
+static inline char *
+RecvBufData(const RecvBuf *rb)
+{
+    return rb->buf + rb->head;
+}
+
+#endif
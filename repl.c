@@ -0,0 +1,316 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "repl.h"
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate a backlog of size bytes for a new run of the leader.
+ *
+ * size must be at least REPL_MIN_BACKLOG, so that the largest change
+ * fits in the ring.
+ *
+ * The run id tells a follower that reconnects after the leader
+ * restarted that its offset means nothing any more.
+ *
+ **************************************************************************
+ */
+bool
+ReplBacklogInit(ReplBacklog *b,  // OUT
+                size_t size)     // IN
+{
+    struct timeval now;
+
+    memset(b, 0, sizeof *b);
+    b->size = size;
+    b->buf  = malloc(b->size);
+    if (b->buf == NULL) {
+        Error("Failed to allocate a replication backlog of %zu bytes\n",
+              b->size);
+        return false;
+    }
+    gettimeofday(&now, NULL);
+    b->id = ((unsigned long long)now.tv_sec * 1000000 + now.tv_usec) ^
+            ((unsigned long long)getpid() << 40);
+    pthread_mutex_init(&b->lock, NULL);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy len bytes in at the end of the stream.  Called under lock.
+ *
+ **************************************************************************
+ */
+static void
+ReplBacklogWrite(ReplBacklog *b,     // IN/OUT
+                 const void *data,   // IN
+                 size_t len)         // IN
+{
+    unsigned long long end = atomic_load(&b->end);
+    size_t at = end % b->size;
+    size_t n  = MIN(len, b->size - at);
+
+    memcpy(b->buf + at, data, n);
+    memcpy(b->buf, (const char *)data + n, len - n);
+    atomic_store_explicit(&b->end, end + len, memory_order_release);
+    if (end + len - b->start > b->size) {
+        b->start = end + len - b->size;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Copy len bytes from offset out of the ring.  Called under lock.
+ *
+ **************************************************************************
+ */
+static void
+ReplBacklogRead(ReplBacklog *b,              // IN
+                unsigned long long offset,   // IN
+                void *data,                  // OUT
+                size_t len)                  // IN
+{
+    size_t at = offset % b->size;
+    size_t n  = MIN(len, b->size - at);
+
+    memcpy(data, b->buf + at, n);
+    memcpy((char *)data + n, b->buf, len - n);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add a change, made as version seq of a board, to the stream.
+ *
+ * Called from the board's commit callback, so the changes of a board are
+ * added in the order they were made.  Every follower is told.
+ *
+ **************************************************************************
+ */
+void
+ReplBacklogAppend(ReplBacklog *b,        // IN/OUT
+                  MsgType type,          // IN: REPL_POST or REPL_CLEAR
+                  const char *title,     // IN
+                  BoardSeq seq,          // IN
+                  const char *data,      // IN
+                  int dataSize)          // IN
+{
+    MsgHdr hdr;
+    MsgReplChange change;
+    struct timespec now;
+    BoardWatcher *w;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(&hdr, 0, sizeof hdr);
+    hdr.type     = type;
+    hdr.dataSize = sizeof change + dataSize;
+    MsgSetTitle(&hdr, title);
+    change.seq    = seq;
+    change.timeNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    pthread_mutex_lock(&b->lock);
+    ReplBacklogWrite(b, &hdr, sizeof hdr);
+    ReplBacklogWrite(b, &change, sizeof change);
+    if (dataSize > 0) {
+        ReplBacklogWrite(b, data, dataSize);
+    }
+    for (w = b->feeds; w != NULL; w = w->next) {
+        EventLoopPost(w->loop, &w->task, 0);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start streaming to a follower that asks to go on from want.
+ *
+ * Returns true if the backlog still has everything from want on, with
+ * pos set to it.  Otherwise pos is the end of the stream, and the
+ * follower needs a copy of every board taken after this call.
+ *
+ **************************************************************************
+ */
+bool
+ReplBacklogStart(ReplBacklog *b,            // IN/OUT
+                 const MsgReplPos *want,    // IN
+                 ReplFeed *feed,            // IN/OUT
+                 MsgReplPos *pos)           // OUT
+{
+    unsigned long long end;
+    bool partial;
+
+    pthread_mutex_lock(&b->lock);
+    end     = atomic_load(&b->end);
+    partial = want->id == b->id &&
+              want->offset >= b->start && want->offset <= end;
+
+    pos->id     = b->id;
+    pos->offset = partial ? want->offset : end;
+    feed->offset = feed->acked = pos->offset;
+
+    feed->watcher.next = b->feeds;
+    if (b->feeds != NULL) {
+        b->feeds->pprev = &feed->watcher.next;
+    }
+    feed->watcher.pprev = &b->feeds;
+    b->feeds = &feed->watcher;
+    pthread_mutex_unlock(&b->lock);
+    return partial;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop streaming to a follower.
+ *
+ * Like BoardTableUnwatch(), a task already posted is left for the caller
+ * to cancel on the feed's loop.
+ *
+ **************************************************************************
+ */
+void
+ReplBacklogStop(ReplBacklog *b,    // IN/OUT
+                ReplFeed *feed)    // IN
+{
+    BoardWatcher *w = &feed->watcher;
+
+    pthread_mutex_lock(&b->lock);
+    *w->pprev = w->next;
+    if (w->next != NULL) {
+        w->next->pprev = w->pprev;
+    }
+    pthread_mutex_unlock(&b->lock);
+    w->next  = NULL;
+    w->pprev = NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue up to max bytes of the stream a follower has not been
+ * sent yet.
+ *
+ * Returns the bytes queued, or -1 if the follower fell so far behind
+ * that they are gone, or could not be queued.
+ *
+ **************************************************************************
+ */
+int
+ReplBacklogCopy(ReplBacklog *b,    // IN
+                ReplFeed *feed,    // IN/OUT
+                OutQueue *q,       // IN/OUT
+                int max)           // IN
+{
+    unsigned long long end;
+    size_t at, n, len;
+
+    pthread_mutex_lock(&b->lock);
+    end = atomic_load(&b->end);
+    if (feed->offset < b->start) {
+        pthread_mutex_unlock(&b->lock);
+        Error("   [%s] Follower fell behind the replication backlog\n",
+              feed->name);
+        return -1;
+    }
+
+    len = MIN(end - feed->offset, (unsigned long long)max);
+    at  = feed->offset % b->size;
+    n   = MIN(len, b->size - at);
+    if ((n > 0 && !OutQueueAppend(q, b->buf + at, n)) ||
+        (len > n && !OutQueueAppend(q, b->buf, len - n))) {
+        pthread_mutex_unlock(&b->lock);
+        return -1;
+    }
+    feed->offset += len;
+    pthread_mutex_unlock(&b->lock);
+    return len;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Record how far a follower has applied the stream.
+ *
+ **************************************************************************
+ */
+void
+ReplBacklogAck(ReplBacklog *b,                // IN
+               ReplFeed *feed,                // IN/OUT
+               unsigned long long offset)     // IN
+{
+    pthread_mutex_lock(&b->lock);
+    feed->acked = MIN(offset, feed->offset);
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the stream position and how far behind each follower is.
+ *
+ * In the same "name value" format as StatsPrint().  A follower's lag in
+ * time is the age of the oldest change it has not applied.
+ *
+ **************************************************************************
+ */
+void
+ReplBacklogPrint(ReplBacklog *b,  // IN
+                 FILE *f)         // IN
+{
+    unsigned long long end;
+    struct timespec now;
+    BoardWatcher *w;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    pthread_mutex_lock(&b->lock);
+    end = atomic_load(&b->end);
+    fprintf(f, "repl_offset %llu\n", end);
+    fprintf(f, "repl_backlog_bytes %llu\n", end - b->start);
+    for (w = b->feeds; w != NULL; w = w->next) {
+        ReplFeed *feed = (ReplFeed *)w;
+        long long lagMs = 0;
+
+        if (feed->acked < end && feed->acked >= b->start) {
+            MsgReplChange change;
+
+            ReplBacklogRead(b, feed->acked + sizeof(MsgHdr), &change,
+                            sizeof change);
+            lagMs = (now.tv_sec * 1000000000LL + now.tv_nsec -
+                     change.timeNs) / 1000000;
+        }
+        fprintf(f, "repl_follower_lag_bytes{follower=\"%s\"} %llu\n",
+                feed->name, end - feed->acked);
+        fprintf(f, "repl_follower_lag_ms{follower=\"%s\"} %lld\n",
+                feed->name, MAX(lagMs, 0));
+    }
+    pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _REPL_H_
+#define _REPL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "board.h"
+#include "boardtable.h"
+#include "outqueue.h"
+
+/*
+ * The leader side of replication: the most recent changes, already in
+ * the REPL_POST and REPL_CLEAR form they are streamed to followers in
+ * (see MsgReplPos), kept in a ring so that a follower that reconnects
+ * can carry on from where it was instead of copying every board again.
+ */
+
+#define REPL_MIN_BACKLOG        (4 * 1024 * 1024)  // Holds the largest POST
+#define REPL_ACK_MS             100    // How often a follower reports
+#define REPL_RETRY_MIN_MS       100    // Reconnect backoff of a follower
+#define REPL_RETRY_MAX_MS       5000
+#define REPL_CONNECT_TIMEOUT_S  2
+
+/**
+ * A follower being streamed to.  watcher's task is posted to its loop
+ * after every change; offset is only used by that loop.
+ */
+typedef struct ReplFeed {
+    BoardWatcher        watcher;
+    unsigned long long  offset;   // Next byte to send
+    unsigned long long  acked;    // Applied by the follower
+    char                name[INET6_ADDRSTRLEN + PORT_STRLEN];
+} ReplFeed;
+
+/**
+ * Bytes [start, end) of the stream of run id are in buf, at their offset
+ * modulo size.  Appends come from any thread, under lock.
+ */
+typedef struct ReplBacklog {
+    pthread_mutex_t              lock;
+    char                        *buf;
+    size_t                       size;
+    unsigned long long           id;
+    unsigned long long           start;
+    _Atomic unsigned long long   end;
+    BoardWatcher                *feeds;
+} ReplBacklog;
+
+bool ReplBacklogInit(ReplBacklog *b, size_t size);
+void ReplBacklogAppend(ReplBacklog *b, MsgType type, const char *title,
+                       BoardSeq seq, const char *data, int dataSize);
+bool ReplBacklogStart(ReplBacklog *b, const MsgReplPos *want,
+                      ReplFeed *feed, MsgReplPos *pos);
+void ReplBacklogStop(ReplBacklog *b, ReplFeed *feed);
+int  ReplBacklogCopy(ReplBacklog *b, ReplFeed *feed, OutQueue *q, int max);
+void ReplBacklogAck(ReplBacklog *b, ReplFeed *feed,
+                    unsigned long long offset);
+void ReplBacklogPrint(ReplBacklog *b, FILE *f);
+
+static inline unsigned long long
+ReplBacklogEnd(ReplBacklog *b)
+{
+    return atomic_load_explicit(&b->end, memory_order_acquire);
+}
+
+#endif
@@ -14,34 +14,259 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "common.h"
+#include "board.h"
+#include "boardtable.h"
+#include "outqueue.h"
+#include "rcu.h"
+#include "recvbuf.h"
+#include "repl.h"
+#include "shard.h"
+#include "slab.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "logger.h"
+#include "lz.h"
 #include "server.h"
 
-typedef struct WhiteBoard {
-    int  dataSize;
-    char dataBuf[MAX_BOARD_DATA_SIZE];
-} WhiteBoard;
+static BoardTable boards;
+static bool       useZeroCopy;
+static long       pushDelayUs;
+static int        subQueueLimit;
+static bool       kickSlowSubs;
+static int        outHighWater;
+static int        outLowWater;
+static int        slowTimeoutMs;
+static int        readTimeoutMs;
+static int        idleTimeoutMs;
+static bool       useWal;
+static Wal        wal;
+static bool       useBacklog;   // Followers may replicate from us
+static ReplBacklog backlog;
+static bool       logChanges;   // useWal || useBacklog
 
-static WhiteBoard board;
+/**
+ * The snapshot thread, which compacts the log once it grows past bytes.
+ */
+static struct {
+    char            *path;
+    size_t           bytes;
+    bool             pending;   // A rotated-out log is waiting to be covered
+    bool             stop;
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+} snap;
+
+/**
+ * A follower's link to its leader.  The follow thread connects, hands
+ * the socket to loop with linkTask, and waits for the link to go down
+ * before connecting again.  conn, pos, acked and sync are only used by
+ * loop.
+ */
+static struct {
+    char                         *host;     // NULL unless a follower
+    char                         *port;
+    EventLoop                    *loop;
+    pthread_t                     thread;
+    pthread_mutex_t               lock;
+    pthread_cond_t                cond;
+    bool                          stop;
+    bool                          linkUp;
+    bool                          synced;   // The link got to REPL_START
+    int                           sd;       // Connected, for linkTask
+    EventTask                     linkTask;
+    struct Conn                  *conn;
+    MsgReplPos                    pos;      // Applied so far
+    unsigned long long            acked;    // Sent in the last REPL_ACK
+    unsigned                      sync;     // Full syncs started
+    Timer                         ackTimer;
+    _Atomic unsigned long long    applied;  // pos.offset, for the stats
+} follow;
+
+/**
+ * Progress of a connection through the request currently being read.
+ */
+typedef enum ConnState {
+    CONN_READ_HDR,    // Waiting for the fixed-size MsgHdr
+    CONN_READ_DATA,   // Waiting for the whole payload to be buffered
+    CONN_SKIP_DATA,   // Discarding a payload over MAX_POST_DATA_SIZE
+} ConnState;
+
+/**
+ * The deadline a connection's timer is set for.  Only the most pressing
+ * one is kept: output that is not going out, then a request that is not
+ * coming in, then no request at all.
+ */
+typedef enum ConnTimer {
+    CONN_TIMER_NONE,
+    CONN_TIMER_WRITE,   // Pending output makes no progress
+    CONN_TIMER_READ,    // A request is incomplete and no other completes
+    CONN_TIMER_IDLE,    // Nothing pending, and no subscription to wait on
+} ConnTimer;
+
+/**
+ * Per-client connection state.
+ */
+typedef struct Conn {
+    EventStream  stream;
+    EventLoop   *loop;
+    char         cliName[INET6_ADDRSTRLEN + PORT_STRLEN];
+    ConnState    state;
+    MsgHdr       req;
+    int          dataLen;
+    int          skipBytes;
+    bool         peerClosed;
+    bool         outPaused;  // Over outHighWater: requests wait unread
+    EventTask    flushTask;  // Resumes writing or reading from the loop
+    Timer        timer;
+    ConnTimer    timerKind;
+    uint64_t     timerMark;  // Progress when the timer was set
+    uint64_t     requests;   // Requests dispatched
+    RecvBuf      in;
+    OutQueue     out;
+    struct Subscription *subs;
+    WalLsn       walLsn;     // Output is held until the log is synced to here
+    WalWaiter    walWait;
+    unsigned     caps;       // MSG_CAP_* granted by HELLO
+    int          shardPending;   // Requests out to another shard
+    int          shardOwner;     // The shard they went to
+    bool         shardBlocked;   // The next request waits for them
+    bool         closed;
+    bool         freed;          // ConnFree() ran while requests were out
+    ReplFeed    *feed;           // A follower streamed to
+    bool         upstream;       // Our link to the leader
+} Conn;
+
+static SlabCache connCache = SLAB_CACHE("connections", sizeof(Conn));
+
+/**
+ * A request forwarded to the shard that owns its board, and on the way
+ * back, the reply.  The owner runs the handler against a stand-in for
+ * the connection built from these fields and the copied payload, then
+ * returns the output it queued in out.  conn is only touched by the
+ * connection's own thread.
+ */
+typedef struct ShardCall {
+    ShardMsg     msg;
+    bool         done;       // Carries the reply
+    bool         ok;         // The handler did not ask to close
+    Conn        *conn;
+    MsgHdr       req;
+    int          dataLen;
+    unsigned     caps;
+    char         cliName[INET6_ADDRSTRLEN + PORT_STRLEN];
+    WalLsn       walLsn;
+    OutQueue     out;
+    char         data[0];
+} ShardCall;
+
+#define SHARD_CALL_INLINE   1024   // Payloads that fit a slab object
+
+static SlabCache shardCallCache = SLAB_CACHE("shard_calls",
+                                             sizeof(ShardCall) +
+                                             SHARD_CALL_INLINE);
+
+/**
+ * A change to be written to the log from inside BoardAppend/BoardClear.
+ */
+typedef struct WalChange {
+    WalRecType   type;
+    const char  *title;
+    const char  *data;
+    int          dataSize;
+    WalLsn       lsn;
+} WalChange;
+
+/**
+ * A connection's subscription to a board.  pos is what has been queued
+ * to the client so far.  A subscription is stalled when a push was held
+ * back because the client had too much output pending.
+ */
+typedef struct Subscription {
+    BoardWatcher          watcher;
+    Conn                 *conn;
+    BoardEntry           *entry;
+    unsigned              reqId;
+    MsgBoardPos           pos;
+    bool                  stalled;
+    struct Subscription  *next;
+} Subscription;
+
+static SlabCache subCache = SLAB_CACHE("subscriptions", sizeof(Subscription));
+
+typedef bool (*MsgFunc)(Conn *conn, const MsgHdr *req, const char *data);
 
-typedef bool (*MsgFunc)(int sd, const MsgHdr *req, const char *cliName);
-              
+/**
+ * The handler of a message type.  A sharded handler works on the board
+ * named in the request and, in a sharded server, runs on the thread that
+ * owns that board; the others run on the connection's thread.  Clients
+ * of a follower may not change boards.
+ */
 typedef struct MsgHandler {
     MsgType     type;
     MsgFunc     func;
+    bool        sharded;
+    bool        writes;    // Refused by a follower
 } MsgHandler;
 
-static bool ProcessMsgShow(int sd, const MsgHdr *req, const char *cliName);
-static bool ProcessMsgClear(int sd, const MsgHdr *req, const char *cliName);
-static bool ProcessMsgPost(int sd, const MsgHdr *req, const char *cliName);
+static bool ProcessMsgShow(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgClear(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgPost(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgList(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgStats(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgPostBatch(Conn *conn, const MsgHdr *req,
+                                const char *data);
+static bool ProcessMsgHello(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgPostLz(Conn *conn, const MsgHdr *req, const char *data);
+static bool ProcessMsgShowSince(Conn *conn, const MsgHdr *req,
+                                const char *data);
+static bool ProcessMsgSubscribe(Conn *conn, const MsgHdr *req,
+                                const char *data);
+static bool ProcessMsgUnsubscribe(Conn *conn, const MsgHdr *req,
+                                  const char *data);
+static bool ProcessMsgReplSync(Conn *conn, const MsgHdr *req,
+                               const char *data);
+static bool ProcessMsgReplAck(Conn *conn, const MsgHdr *req,
+                              const char *data);
+static bool ProcessMsgReplBoard(Conn *conn, const MsgHdr *req,
+                                const char *data);
+static bool ProcessMsgReplStart(Conn *conn, const MsgHdr *req,
+                                const char *data);
+static bool ProcessMsgReplChange(Conn *conn, const MsgHdr *req,
+                                 const char *data);
+static void ConnClose(Conn *conn);
+static bool ConnFlush(Conn *conn);
+static Conn *ConnAdd(EventLoop *loop, int sd);
+static void ServerShardRecv(EventLoop *loop, ShardMsg *msg);
 
 MsgHandler msgHandlers[] = {
-    { MSG_SHOW,  ProcessMsgShow  },
-    { MSG_CLEAR, ProcessMsgClear },
-    { MSG_POST,  ProcessMsgPost  },
+    { MSG_SHOW,        ProcessMsgShow,        true,  false },
+    { MSG_CLEAR,       ProcessMsgClear,       true,  true  },
+    { MSG_POST,        ProcessMsgPost,        true,  true  },
+    { MSG_LIST,        ProcessMsgList,        false, false },
+    { MSG_SHOW_SINCE,  ProcessMsgShowSince,   true,  false },
+    { MSG_SUBSCRIBE,   ProcessMsgSubscribe,   false, false },
+    { MSG_UNSUBSCRIBE, ProcessMsgUnsubscribe, false, false },
+    { MSG_STATS,       ProcessMsgStats,       false, false },
+    { MSG_POST_BATCH,  ProcessMsgPostBatch,   true,  true  },
+    { MSG_HELLO,       ProcessMsgHello,       false, false },
+    { MSG_POST_LZ,     ProcessMsgPostLz,      true,  true  },
+    { MSG_REPL_SYNC,   ProcessMsgReplSync,    false, false },
+    { MSG_REPL_ACK,    ProcessMsgReplAck,     false, false },
+    { MSG_REPL_BOARD,  ProcessMsgReplBoard,   false, false },
+    { MSG_REPL_START,  ProcessMsgReplStart,   false, false },
+    { MSG_REPL_POST,   ProcessMsgReplChange,  false, false },
+    { MSG_REPL_CLEAR,  ProcessMsgReplChange,  false, false },
 };
 
 
@@ -56,7 +281,70 @@ static void
 Usage(const char *prog) // IN
 {
     Log("Usage:\n");
-    Log("    %s <port>\n", prog);
+    Log("    %s [options] <port>\n", prog);
+    Log("Options:\n");
+    Log("    -t, --threads N     Serve with N event loop threads "
+        "(0 = one per CPU)\n");
+    Log("    -p, --pin           Pin each thread to its own CPU\n");
+    Log("    -S, --shard         Give each board to one thread, which serves "
+        "every\n"
+        "                        request for it\n");
+    Log("    -m, --board-mem MB  Memory limit for board data "
+        "(default %d)\n", BOARD_DEFAULT_MEM_LIMIT >> 20);
+    Log("    -z, --zerocopy      Send large replies with MSG_ZEROCOPY\n");
+    Log("    -u, --io-uring      Do socket I/O through io_uring instead of "
+        "epoll\n");
+    Log("    -w, --push-delay MS Coalesce changes pushed to subscribers "
+        "over MS (default %d)\n", SERVER_DEFAULT_PUSH_DELAY_US / 1000);
+    Log("    -q, --sub-queue KB  Output a subscriber may have pending "
+        "before pushes\n"
+        "                        are held back (default %d)\n",
+        SERVER_DEFAULT_SUB_QUEUE >> 10);
+    Log("    -k, --kick-slow     Disconnect subscribers over the limit "
+        "instead\n");
+    Log("    -H, --out-high KB   Stop reading from a client with KB of "
+        "output pending\n"
+        "                        (default %d)\n",
+        SERVER_DEFAULT_OUT_HIGH >> 10);
+    Log("    -L, --out-low KB    Read again once it is down to KB "
+        "(default a quarter\n"
+        "                        of --out-high)\n");
+    Log("    -T, --slow-timeout S  Disconnect a client that reads no "
+        "replies for S\n"
+        "                        seconds (default %d, 0 never)\n",
+        SERVER_DEFAULT_SLOW_TIMEOUT_S);
+    Log("    -R, --read-timeout S  Disconnect a client that leaves a "
+        "request unfinished\n"
+        "                        for S seconds (default %d, 0 never)\n",
+        SERVER_DEFAULT_READ_TIMEOUT_S);
+    Log("    -I, --idle-timeout S  Disconnect a client idle for S seconds "
+        "(default %d,\n"
+        "                        0 never); subscribers are never idle\n",
+        SERVER_DEFAULT_IDLE_TIMEOUT_S);
+    Log("    -l, --wal FILE      Log every change to FILE and replay it "
+        "on startup\n");
+    Log("    -g, --group-commit US  Wait US after the first logged change "
+        "before\n"
+        "                        syncing (default 0: sync changes made "
+        "during the\n"
+        "                        previous sync together)\n");
+    Log("    -s, --snapshot MB   Snapshot the boards and compact the log "
+        "once it\n"
+        "                        reaches MB (default %d, 0 never)\n",
+        SERVER_DEFAULT_SNAPSHOT_MB);
+    Log("    -o, --log FILE      Append the log to FILE instead of "
+        "stdout/stderr\n");
+    Log("    -v, --log-level L   Log errors, info or msg: every request "
+        "(default)\n");
+    Log("    -n, --log-sample N  Log only one request (and its reply) "
+        "in N\n");
+    Log("    -B, --backlog MB    Let followers replicate this server, "
+        "keeping MB of\n"
+        "                        recent changes for them to catch up "
+        "from (at least %d)\n", REPL_MIN_BACKLOG >> 20);
+    Log("    -F, --follow HOST:PORT  Replicate the leader at HOST:PORT "
+        "and refuse\n"
+        "                        changes from clients\n");
     exit(EXIT_FAILURE);
 }
 
@@ -73,10 +361,188 @@ ParseArgs(int argc,            // IN
           char *argv[],        // IN
           ServerArgs *svrArgs) // OUT
 {
-    if (argc != 2) {
+    static const struct option options[] = {
+        { "threads",   required_argument, NULL, 't' },
+        { "pin",       no_argument,       NULL, 'p' },
+        { "shard",     no_argument,       NULL, 'S' },
+        { "board-mem", required_argument, NULL, 'm' },
+        { "zerocopy",  no_argument,       NULL, 'z' },
+        { "io-uring",  no_argument,       NULL, 'u' },
+        { "push-delay", required_argument, NULL, 'w' },
+        { "sub-queue", required_argument, NULL, 'q' },
+        { "kick-slow", no_argument,       NULL, 'k' },
+        { "out-high",  required_argument, NULL, 'H' },
+        { "out-low",   required_argument, NULL, 'L' },
+        { "slow-timeout", required_argument, NULL, 'T' },
+        { "read-timeout", required_argument, NULL, 'R' },
+        { "idle-timeout", required_argument, NULL, 'I' },
+        { "wal",       required_argument, NULL, 'l' },
+        { "group-commit", required_argument, NULL, 'g' },
+        { "snapshot",  required_argument, NULL, 's' },
+        { "log",       required_argument, NULL, 'o' },
+        { "log-level", required_argument, NULL, 'v' },
+        { "log-sample", required_argument, NULL, 'n' },
+        { "backlog",   required_argument, NULL, 'B' },
+        { "follow",    required_argument, NULL, 'F' },
+        { NULL,        0,                 NULL, 0   },
+    };
+    int opt;
+
+    memset(svrArgs, 0, sizeof *svrArgs);
+    svrArgs->numThreads    = 1;
+    svrArgs->boardMemLimit = BOARD_DEFAULT_MEM_LIMIT;
+    svrArgs->pushDelayUs   = SERVER_DEFAULT_PUSH_DELAY_US;
+    svrArgs->subQueueLimit = SERVER_DEFAULT_SUB_QUEUE;
+    svrArgs->outHighWater  = SERVER_DEFAULT_OUT_HIGH;
+    svrArgs->outLowWater   = -1;
+    svrArgs->slowTimeoutS  = SERVER_DEFAULT_SLOW_TIMEOUT_S;
+    svrArgs->readTimeoutS  = SERVER_DEFAULT_READ_TIMEOUT_S;
+    svrArgs->idleTimeoutS  = SERVER_DEFAULT_IDLE_TIMEOUT_S;
+    svrArgs->snapshotBytes = (size_t)SERVER_DEFAULT_SNAPSHOT_MB << 20;
+    svrArgs->logLevel      = LOG_MSG;
+    svrArgs->logSample     = 1;
+
+    while ((opt = getopt_long(argc, argv,
+                              "t:pSm:zuw:q:kH:L:T:R:I:l:g:s:o:v:n:B:F:",
+                              options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            svrArgs->numThreads = atoi(optarg);
+            if (svrArgs->numThreads == 0) {
+                svrArgs->numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            if (svrArgs->numThreads <= 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'p':
+            svrArgs->pinThreads = true;
+            break;
+        case 'S':
+            svrArgs->shard = true;
+            break;
+        case 'm':
+            svrArgs->boardMemLimit = (size_t)atol(optarg) << 20;
+            if (svrArgs->boardMemLimit == 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'z':
+            svrArgs->zeroCopy = true;
+            break;
+        case 'u':
+            svrArgs->ioUring = true;
+            break;
+        case 'w':
+            svrArgs->pushDelayUs = atol(optarg) * 1000;
+            if (svrArgs->pushDelayUs < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'q':
+            svrArgs->subQueueLimit = atoi(optarg) << 10;
+            if (svrArgs->subQueueLimit <= 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'k':
+            svrArgs->kickSlowSubs = true;
+            break;
+        case 'H':
+            svrArgs->outHighWater = atoi(optarg) << 10;
+            if (svrArgs->outHighWater <= 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'L':
+            svrArgs->outLowWater = atoi(optarg) << 10;
+            if (svrArgs->outLowWater < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'T':
+            svrArgs->slowTimeoutS = atoi(optarg);
+            if (svrArgs->slowTimeoutS < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'R':
+            svrArgs->readTimeoutS = atoi(optarg);
+            if (svrArgs->readTimeoutS < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'I':
+            svrArgs->idleTimeoutS = atoi(optarg);
+            if (svrArgs->idleTimeoutS < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 'l':
+            svrArgs->walPath = optarg;
+            break;
+        case 'g':
+            svrArgs->walWindowUs = atol(optarg);
+            if (svrArgs->walWindowUs < 0) {
+                Usage(argv[0]);
+            }
+            break;
+        case 's':
+            if (atol(optarg) < 0) {
+                Usage(argv[0]);
+            }
+            svrArgs->snapshotBytes = (size_t)atol(optarg) << 20;
+            break;
+        case 'o':
+            svrArgs->logPath = optarg;
+            break;
+        case 'v':
+            if (strcmp(optarg, "error") == 0) {
+                svrArgs->logLevel = LOG_ERROR;
+            } else if (strcmp(optarg, "info") == 0) {
+                svrArgs->logLevel = LOG_INFO;
+            } else if (strcmp(optarg, "msg") == 0) {
+                svrArgs->logLevel = LOG_MSG;
+            } else {
+                Usage(argv[0]);
+            }
+            break;
+        case 'n':
+            if (atoi(optarg) <= 0) {
+                Usage(argv[0]);
+            }
+            svrArgs->logSample = atoi(optarg);
+            break;
+        case 'B':
+            if (atol(optarg) < REPL_MIN_BACKLOG >> 20) {
+                Usage(argv[0]);
+            }
+            svrArgs->replBacklog = (size_t)atol(optarg) << 20;
+            break;
+        case 'F':
+            svrArgs->follow = optarg;
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+
+    if (svrArgs->outLowWater < 0) {
+        svrArgs->outLowWater = svrArgs->outHighWater / 4;
+    }
+    if (svrArgs->outLowWater > svrArgs->outHighWater) {
+        Usage(argv[0]);
+    }
+    /* A follower's boards are the leader's: it neither logs nor leads. */
+    if (svrArgs->follow != NULL &&
+        (svrArgs->walPath != NULL || svrArgs->replBacklog > 0)) {
+        Usage(argv[0]);
+    }
+
+    if (optind != argc - 1) {
         Usage(argv[0]);
     }
-    svrArgs->listenPort = atoi(argv[1]);
+    svrArgs->listenPort = atoi(argv[optind]);
     if (svrArgs->listenPort == 0) {
         Usage(argv[0]);
     }
@@ -86,31 +552,235 @@ ParseArgs(int argc,            // IN
 /**
  **************************************************************************
  *
- * \brief Handler for MSG_SHOW.
+ * \brief Apply a change read back from the write-ahead log.
+ *
+ * Changes the snapshot already includes are skipped: a board's version
+ * seq only grows, so any record not past the loaded version is in it.
+ * A board first seen in the log starts just before its first record so
+ * the versions replay produces match the ones clients were told about.
  *
  **************************************************************************
  */
 static bool
-ProcessMsgShow(int sd,               // IN
-               const MsgHdr *req,    // IN
-               const char *cliName)  // IN
+ServerReplay(const WalRecord *rec,   // IN
+             const char *data,       // IN
+             void *arg)              // IN
 {
-    MsgHdr reply;
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    BoardVersion *v;
+    BoardSeq seq;
 
-    PrintMsg(req, cliName);
+    memcpy(title, rec->title, MAX_TITLE_LEN);
+    title[MAX_TITLE_LEN] = '\0';
 
-    memset(&reply, 0, sizeof reply);
-    reply.type     = MSG_BOARD;
-    reply.dataSize = board.dataSize;
+    entry = BoardTableLookup(&boards, title, false);
+    if (entry == NULL) {
+        entry = BoardTableLookup(&boards, title, true);
+        if (entry == NULL ||
+            !BoardRestore(&entry->board, "", 0, rec->seq - 1)) {
+            return false;
+        }
+    }
+
+    v = BoardSnapshot(&entry->board);
+    seq = v->seq;
+    BoardRelease(v);
+    if (rec->seq <= seq) {
+        return true;
+    }
+
+    switch (rec->type) {
+    case WAL_POST:
+        if (!BoardAppend(&entry->board, data, rec->dataSize, NULL, NULL)) {
+            Error("Board \"%s\" does not fit in the board memory limit\n",
+                  title);
+            return false;
+        }
+        return true;
+    case WAL_CLEAR:
+        return BoardClear(&entry->board, NULL, NULL);
+    default:
+        Error("Unknown write-ahead log record type %u\n", rec->type);
+        return false;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write a change to the log and pass it on to the followers.  A
+ * BoardCommitFunc.
+ *
+ **************************************************************************
+ */
+static void
+ServerLogChange(void *arg,      // IN
+                BoardSeq seq)   // IN
+{
+    WalChange *c = arg;
+
+    if (useWal) {
+        c->lsn = WalAppend(&wal, c->type, c->title, c->data, c->dataSize,
+                           seq);
+    }
+    if (useBacklog) {
+        ReplBacklogAppend(&backlog,
+                          c->type == WAL_POST ? MSG_REPL_POST : MSG_REPL_CLEAR,
+                          c->title, seq, c->data, c->dataSize);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The snapshot thread: compact the log once it is large enough.
+ *
+ * The log is rotated first, so the old file holds only changes already
+ * published; every version saved afterwards includes them, and the old
+ * file can go once the snapshot is safely on disk.  Nothing is paused:
+ * the boards are saved from immutable versions while writers carry on
+ * into the new log file.
+ *
+ **************************************************************************
+ */
+static void *
+ServerSnapshotLoop(void *arg)  // IN
+{
+    pthread_mutex_lock(&snap.lock);
+    while (!snap.stop) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec++;
+        pthread_cond_timedwait(&snap.cond, &snap.lock, &ts);
+        if (snap.stop) {
+            break;
+        }
+        if (!snap.pending && WalFileSize(&wal) < snap.bytes) {
+            continue;
+        }
+        pthread_mutex_unlock(&snap.lock);
+
+        /* Does nothing while an earlier old log is still waiting. */
+        WalRotate(&wal);
+        snap.pending = !SnapshotWrite(snap.path, &boards);
+        if (!snap.pending) {
+            WalDropOld(&wal);
+        }
+
+        pthread_mutex_lock(&snap.lock);
+    }
+    pthread_mutex_unlock(&snap.lock);
+
+    RcuThreadOffline();
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Split the leader's HOST:PORT; an IPv6 HOST may be in brackets.
+ *
+ **************************************************************************
+ */
+static bool
+FollowParse(const char *leader)  // IN
+{
+    char *colon;
+
+    follow.host = strdup(leader[0] == '[' ? leader + 1 : leader);
+    if (follow.host == NULL) {
+        Error("Failed to allocate the leader's address\n");
+        return false;
+    }
+    colon = strrchr(follow.host, ':');
+    if (colon == NULL || colon == follow.host || colon[1] == '\0') {
+        Error("The leader must be given as HOST:PORT, not %s\n", leader);
+        free(follow.host);
+        follow.host = NULL;
+        return false;
+    }
+    *colon = '\0';
+    follow.port = colon + 1;
+    if (colon[-1] == ']') {
+        colon[-1] = '\0';
+    }
+    return true;
+}
 
-    if (WriteFully(sd, &reply, sizeof reply) <= 0) {
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize the state shared by all event loop threads.
+ *
+ * With a write-ahead log, the boards are rebuilt from it first.  A
+ * follower only starts following once the loops exist; see
+ * ServerFollowStart().
+ *
+ **************************************************************************
+ */
+bool
+ServerInit(const ServerArgs *svrArgs)  // IN
+{
+    if (!LoggerStart(svrArgs->logPath, svrArgs->logLevel,
+                     svrArgs->logSample)) {
+        return false;
+    }
+    StatsInit();
+    BoardSetMemLimit(svrArgs->boardMemLimit);
+    useZeroCopy   = svrArgs->zeroCopy;
+    pushDelayUs   = svrArgs->pushDelayUs;
+    subQueueLimit = svrArgs->subQueueLimit;
+    kickSlowSubs  = svrArgs->kickSlowSubs;
+    outHighWater  = svrArgs->outHighWater;
+    outLowWater   = svrArgs->outLowWater;
+    slowTimeoutMs = svrArgs->slowTimeoutS * 1000;
+    readTimeoutMs = svrArgs->readTimeoutS * 1000;
+    idleTimeoutMs = svrArgs->idleTimeoutS * 1000;
+    if (!BoardTableInit(&boards)) {
         return false;
     }
-    if (WriteFully(sd, board.dataBuf, board.dataSize) <= 0) {
+
+    if (svrArgs->replBacklog > 0) {
+        if (!ReplBacklogInit(&backlog, svrArgs->replBacklog)) {
+            return false;
+        }
+        useBacklog = true;
+    }
+    if (svrArgs->follow != NULL && !FollowParse(svrArgs->follow)) {
         return false;
     }
+    logChanges = useBacklog || svrArgs->walPath != NULL;
+
+    if (svrArgs->walPath != NULL) {
+        int err;
+
+        if (asprintf(&snap.path, "%s.snap", svrArgs->walPath) < 0 ||
+            !SnapshotLoad(snap.path, &boards) ||
+            !WalOpen(&wal, svrArgs->walPath, svrArgs->walWindowUs,
+                     ServerReplay, NULL)) {
+            return false;
+        }
+        useWal = true;
 
-    PrintMsg(&reply, cliName);
+        if (svrArgs->snapshotBytes == 0) {
+            return true;
+        }
+        snap.bytes   = svrArgs->snapshotBytes;
+        snap.pending = WalHasOld(&wal);
+        pthread_mutex_init(&snap.lock, NULL);
+        pthread_cond_init(&snap.cond, NULL);
+        err = pthread_create(&snap.thread, NULL, ServerSnapshotLoop, NULL);
+        if (err != 0) {
+            Error("Failed to start the snapshot thread: %s\n", strerror(err));
+            return false;
+        }
+    }
     return true;
 }
 
@@ -118,31 +788,75 @@ ProcessMsgShow(int sd,               // IN
 /**
  **************************************************************************
  *
- * \brief Handler for MSG_CLEAR.
+ * \brief Release the state shared by all event loop threads.
+ *
+ **************************************************************************
+ */
+void
+ServerExit(void)
+{
+    if (snap.bytes > 0) {
+        pthread_mutex_lock(&snap.lock);
+        snap.stop = true;
+        pthread_cond_signal(&snap.cond);
+        pthread_mutex_unlock(&snap.lock);
+        pthread_join(snap.thread, NULL);
+        snap.bytes = 0;
+    }
+    if (useWal) {
+        WalClose(&wal);
+        useWal = false;
+    }
+    LoggerStop();
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Give each board to one of the given loops.
+ *
+ * Called before the loops run; loops[i] must be run by the thread that
+ * calls ShardThreadInit(i).  Requests that read or change a board are
+ * forwarded to its loop and served there, so its versions and log stay
+ * in one CPU's cache and its lock is never contended.
+ *
+ **************************************************************************
+ */
+bool
+ServerShardInit(EventLoop *loops[],  // IN
+                int numLoops)        // IN
+{
+    return ShardInit(loops, numLoops, ServerShardRecv);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a STATUS reply.
  *
  **************************************************************************
  */
 static bool
-ProcessMsgClear(int sd,               // IN
-                const MsgHdr *req,    // IN
-                const char *cliName)  // IN
+QueueStatus(Conn *conn,          // IN
+            const MsgHdr *req,   // IN
+            MsgStatus status)    // IN
 {
     MsgHdr reply;
 
-    PrintMsg(req, cliName);
-
     memset(&reply, 0, sizeof reply);
     reply.type     = MSG_STATUS;
-    reply.status   = MSG_STATUS_SUCCESS;
+    reply.status   = status;
     reply.dataSize = 0;
+    reply.reqId    = req->reqId;
 
-    board.dataSize = 0;
-
-    if (WriteFully(sd, &reply, sizeof reply) <= 0) {
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply)) {
         return false;
     }
 
-    PrintMsg(&reply, cliName);
+    StatsStatus(status);
+    PrintMsg(&reply, conn->cliName);
     return true;
 }
 
@@ -150,53 +864,93 @@ ProcessMsgClear(int sd,               // IN
 /**
  **************************************************************************
  *
- * \brief Handler for MSG_POST.
+ * \brief Queue len bytes at data, which belong to version v, by reference.
+ *
+ * Takes a reference on v that is dropped once the bytes are written.  On
+ * failure OutQueueAppendRef has already dropped it again, so the caller
+ * must not release v itself.
  *
  **************************************************************************
  */
 static bool
-ProcessMsgPost(int sd,               // IN
-               const MsgHdr *req,    // IN
-               const char *cliName)  // IN
+QueueVersionRef(Conn *conn,         // IN
+                BoardVersion *v,    // IN
+                const void *data,   // IN
+                int len)            // IN
 {
-    MsgHdr reply;
-    int bytesToStore, bytesToSkip;
-
-    PrintMsg(req, cliName);
+    BoardRetain(v);
+    return OutQueueAppendRef(&conn->out, data, len, BoardRelease, v);
+}
 
-    bytesToStore = MIN(req->dataSize,
-                       MAX_BOARD_DATA_SIZE - board.dataSize - 1);
-    bytesToSkip = req->dataSize - bytesToStore;
-        
-    if (bytesToStore > 0) {
-        if (ReadFully(sd, board.dataBuf + board.dataSize, bytesToStore) <= 0) {
-            return false;
-        }
-        board.dataSize += bytesToStore;
 
-        /* Always append a newline. */
-        board.dataBuf[board.dataSize] = '\n';
-        board.dataSize++;
-    }
+/**
+ **************************************************************************
+ *
+ * \brief Queue the bytes of a board version from offset on.
+ *
+ * Each chunk is queued by reference to the snapshot and released once
+ * written, so a slow reader holds on to an old version without blocking
+ * writers or copying the board.
+ *
+ **************************************************************************
+ */
+static bool
+QueueBoardData(Conn *conn,         // IN
+               BoardVersion *v,    // IN
+               int offset)         // IN
+{
+    BoardCursor cur;
+    const char *chunk;
+    int n;
 
-    while (bytesToSkip > 0) {
-        char ch;
-        if (ReadFully(sd, &ch, 1) <= 0) {
+    BoardCursorSeek(&cur, v, offset);
+    while ((n = BoardCursorNext(&cur, &chunk)) > 0) {
+        if (!QueueVersionRef(conn, v, chunk, n)) {
             return false;
         }
-        bytesToSkip--;
     }
+    return true;
+}
 
-    memset(&reply, 0, sizeof reply);
-    reply.type     = MSG_STATUS;
-    reply.status   = MSG_STATUS_SUCCESS;
-    reply.dataSize = 0;
 
-    if (WriteFully(sd, &reply, sizeof reply) <= 0) {
+/**
+ **************************************************************************
+ *
+ * \brief Queue version v compressed, as a BOARD_LZ reply.
+ *
+ * The compressed form is cached in the version, so however many clients
+ * read an unchanged board it is compressed once.  Leaves reply a BOARD
+ * and queues nothing if v does not compress.  Returns false if the
+ * output could not be queued.
+ *
+ **************************************************************************
+ */
+static bool
+QueueBoardPacked(Conn *conn,         // IN
+                 MsgHdr *reply,      // IN/OUT
+                 BoardVersion *v)    // IN
+{
+    const BoardPacked *packed = BoardPack(v);
+    MsgLzHdr lz;
+
+    if (packed == NULL || packed->size == 0) {
+        return true;
+    }
+
+    reply->type     = MSG_BOARD_LZ;
+    reply->dataSize = sizeof lz + packed->size;
+    memset(&lz, 0, sizeof lz);
+    lz.rawSize = v->dataSize;
+    if (!OutQueueAppend(&conn->out, reply, sizeof *reply) ||
+        !OutQueueAppend(&conn->out, &lz, sizeof lz)) {
+        return false;
+    }
+    if (!QueueVersionRef(conn, v, packed->data, packed->size)) {
         return false;
     }
 
-    PrintMsg(&reply, cliName);
+    StatsInc(STATS_LZ_REPLIES);
+    StatsAdd(STATS_LZ_BYTES_SAVED, v->dataSize - reply->dataSize);
     return true;
 }
 
@@ -204,48 +958,2585 @@ ProcessMsgPost(int sd,               // IN
 /**
  **************************************************************************
  *
- * \brief The server routine to handle requests from a particular client.
+ * \brief Handler for MSG_SHOW.
  *
  **************************************************************************
  */
-void
-Server(int sd)  // IN
+static bool
+ProcessMsgShow(Conn *conn,          // IN
+               const MsgHdr *req,   // IN
+               const char *data)    // IN
 {
-    struct sockaddr_storage cliAddr;
-    char cliName[INET6_ADDRSTRLEN + PORT_STRLEN];
-    socklen_t cliAddrLen;
-    MsgHdr req;
-    int i;
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    MsgHdr reply;
+    BoardVersion *v;
 
-    cliAddrLen = sizeof cliAddr;
-    if (getpeername(sd, (struct sockaddr *)&cliAddr, &cliAddrLen) < 0) {
-        perror("Failed to get peer address info for client socket");
-        close(sd);
-        return;
-    }
-    SocketAddrToString6((const struct sockaddr *)&cliAddr,
-                        cliName, sizeof cliName);
+    PrintMsg(req, conn->cliName);
 
-    Log("\nClient %s (sock=%u) connected\n", cliName, sd);
+    memset(&reply, 0, sizeof reply);
+    reply.type  = MSG_BOARD;
+    reply.reqId = req->reqId;
+    memcpy(reply.title, req->title, sizeof reply.title);
 
-    /*
-	Insert select statement somewhere here
-    */
-
-    if (ReadFully(sd, &req, sizeof(req)) > 0) {
-        for (i = 0; i < ARRAYSIZE(msgHandlers); i++) {
-            MsgHandler *handler = &msgHandlers[i];
-            if (handler->type == req.type) {
-                handler->func(sd, &req, cliName);
-                break;
-            }
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, false);
+    if (entry == NULL) {
+        if (!OutQueueAppend(&conn->out, &reply, sizeof reply)) {
+            return false;
         }
-        if (i == ARRAYSIZE(msgHandlers)) {
-            Error("   [%s] Unknown message type %d\n", cliName, req.type);
+        PrintMsg(&reply, conn->cliName);
+        return true;
+    }
+
+    v = BoardSnapshot(&entry->board);
+    if ((conn->caps & MSG_CAP_LZ) && v->dataSize >= MSG_LZ_MIN_SIZE &&
+        !QueueBoardPacked(conn, &reply, v)) {
+        BoardRelease(v);
+        return false;
+    }
+    if (reply.type == MSG_BOARD) {
+        reply.dataSize = v->dataSize;
+        if (!OutQueueAppend(&conn->out, &reply, sizeof reply) ||
+            !QueueBoardData(conn, v, 0)) {
+            BoardRelease(v);
+            return false;
         }
     }
+    BoardRelease(v);
+
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a delta reply bringing a client at *pos up to version v.
+ *
+ * reply has its type, reqId and title set.  Only the bytes after pos are
+ * queued when the client's copy is still a prefix of v; otherwise the
+ * reply is a RESET holding all of v.  *pos is advanced to v.
+ *
+ **************************************************************************
+ */
+static bool
+QueueBoardDelta(Conn *conn,          // IN
+                MsgHdr *reply,       // IN/OUT
+                BoardVersion *v,     // IN
+                MsgBoardPos *pos)    // IN/OUT
+{
+    int from;
+
+    if (BoardVersionHas(v, pos->seq, pos->offset)) {
+        from = pos->offset;
+        reply->status = MSG_STATUS_SUCCESS;
+    } else {
+        from = 0;
+        reply->status = MSG_STATUS_RESET;
+    }
+    reply->dataSize = sizeof *pos + v->dataSize - from;
+    pos->seq      = v->seq;
+    pos->offset   = v->dataSize;
+    pos->reserved = 0;
 
-    Log("Client %s (sock=%u) disconnected\n\n", cliName, sd);
-    close(sd);
+    return OutQueueAppend(&conn->out, reply, sizeof *reply) &&
+           OutQueueAppend(&conn->out, pos, sizeof *pos) &&
+           QueueBoardData(conn, v, from);
 }
 
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_SHOW_SINCE.
+ *
+ * Sends only the bytes appended after the client's position when its copy
+ * is still a prefix of the board, and the whole board otherwise.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgShowSince(Conn *conn,          // IN
+                    const MsgHdr *req,   // IN
+                    const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    MsgHdr reply;
+    MsgBoardPos pos;
+    BoardVersion *v;
+
+    PrintMsg(req, conn->cliName);
+
+    if (conn->dataLen != sizeof pos) {
+        return QueueStatus(conn, req, MSG_STATUS_BAD_REQUEST);
+    }
+    memcpy(&pos, data, sizeof pos);
+
+    memset(&reply, 0, sizeof reply);
+    reply.type  = MSG_BOARD_DELTA;
+    reply.reqId = req->reqId;
+    memcpy(reply.title, req->title, sizeof reply.title);
+
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, false);
+    if (entry == NULL) {
+        memset(&pos, 0, sizeof pos);
+        reply.status   = MSG_STATUS_RESET;
+        reply.dataSize = sizeof pos;
+        if (!OutQueueAppend(&conn->out, &reply, sizeof reply) ||
+            !OutQueueAppend(&conn->out, &pos, sizeof pos)) {
+            return false;
+        }
+        PrintMsg(&reply, conn->cliName);
+        return true;
+    }
+
+    v = BoardSnapshot(&entry->board);
+    if (!QueueBoardDelta(conn, &reply, v, &pos)) {
+        BoardRelease(v);
+        return false;
+    }
+    BoardRelease(v);
+
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Push what changed on a subscribed board since the last push.
+ *
+ * Runs on the subscriber's loop once per batch of changes.  A client with
+ * more than subQueueLimit bytes of output pending gets nothing until it
+ * has caught up, and then a single delta covering everything it missed;
+ * with kickSlowSubs it is disconnected instead.
+ *
+ **************************************************************************
+ */
+static void
+SubscriptionPush(EventLoop *loop,   // IN
+                 void *arg)         // IN
+{
+    Subscription *sub = arg;
+    Conn *conn = sub->conn;
+    MsgHdr msg;
+    BoardVersion *v;
+
+    if (conn->out.bytes > subQueueLimit) {
+        if (kickSlowSubs) {
+            Error("   [%s] Subscriber is too slow, disconnecting\n",
+                  conn->cliName);
+            StatsInc(STATS_SUBS_KICKED);
+            ConnClose(conn);
+        } else {
+            StatsInc(STATS_SUBS_STALLED);
+            sub->stalled = true;
+        }
+        return;
+    }
+
+    v = BoardSnapshot(&sub->entry->board);
+    if (v->seq == sub->pos.seq) {
+        BoardRelease(v);
+        return;
+    }
+
+    memset(&msg, 0, sizeof msg);
+    msg.type  = MSG_NOTIFY;
+    msg.reqId = sub->reqId;
+    MsgSetTitle(&msg, sub->entry->title);
+
+    if (!QueueBoardDelta(conn, &msg, v, &sub->pos)) {
+        BoardRelease(v);
+        ConnClose(conn);
+        return;
+    }
+    BoardRelease(v);
+
+    PrintMsg(&msg, conn->cliName);
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_SUBSCRIBE.
+ *
+ * From now on every change to the board is pushed to the client as a
+ * NOTIFY carrying this request's reqId.  An optional MsgBoardPos payload
+ * resumes from a position the client already has, so what it missed is
+ * pushed right away; without one, pushes start from the current version.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgSubscribe(Conn *conn,          // IN
+                    const MsgHdr *req,   // IN
+                    const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    Subscription *sub;
+    BoardVersion *v;
+
+    PrintMsg(req, conn->cliName);
+
+    MsgGetTitle(req, title);
+    if (strchr(title, '\n') != NULL) {
+        return QueueStatus(conn, req, MSG_STATUS_BAD_TITLE);
+    }
+    if (conn->dataLen != 0 && conn->dataLen != sizeof(MsgBoardPos)) {
+        return QueueStatus(conn, req, MSG_STATUS_BAD_REQUEST);
+    }
+
+    entry = BoardTableLookup(&boards, title, true);
+    if (entry == NULL) {
+        return QueueStatus(conn, req, MSG_STATUS_NO_SPACE);
+    }
+    for (sub = conn->subs; sub != NULL; sub = sub->next) {
+        if (sub->entry == entry) {
+            sub->reqId = req->reqId;
+            return QueueStatus(conn, req, MSG_STATUS_SUCCESS);
+        }
+    }
+
+    sub = SlabAlloc(&subCache);
+    if (sub == NULL) {
+        Error("   [%s] Failed to allocate a subscription\n", conn->cliName);
+        return QueueStatus(conn, req, MSG_STATUS_NO_SPACE);
+    }
+    memset(sub, 0, sizeof *sub);
+    sub->watcher.loop      = conn->loop;
+    sub->watcher.task.func = SubscriptionPush;
+    sub->watcher.task.arg  = sub;
+    sub->conn  = conn;
+    sub->entry = entry;
+    sub->reqId = req->reqId;
+    sub->next  = conn->subs;
+    conn->subs = sub;
+
+    /*
+     * Watch before reading the position, so a change published in between
+     * is either in the snapshot or notified.
+     */
+    BoardTableWatch(entry, &sub->watcher);
+    if (conn->dataLen != 0) {
+        memcpy(&sub->pos, data, sizeof sub->pos);
+        EventLoopPost(conn->loop, &sub->watcher.task, 0);
+    } else {
+        v = BoardSnapshot(&entry->board);
+        sub->pos.seq    = v->seq;
+        sub->pos.offset = v->dataSize;
+        BoardRelease(v);
+    }
+    return QueueStatus(conn, req, MSG_STATUS_SUCCESS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Drop a subscription.
+ *
+ **************************************************************************
+ */
+static void
+SubscriptionFree(Subscription *sub)  // IN
+{
+    BoardTableUnwatch(sub->entry, &sub->watcher);
+    EventLoopCancel(sub->conn->loop, &sub->watcher.task);
+    SlabFree(&subCache, sub);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_UNSUBSCRIBE.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgUnsubscribe(Conn *conn,          // IN
+                      const MsgHdr *req,   // IN
+                      const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    Subscription **link;
+
+    PrintMsg(req, conn->cliName);
+
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, false);
+    for (link = &conn->subs; *link != NULL; link = &(*link)->next) {
+        Subscription *sub = *link;
+        if (sub->entry == entry) {
+            *link = sub->next;
+            SubscriptionFree(sub);
+            break;
+        }
+    }
+    return QueueStatus(conn, req, MSG_STATUS_SUCCESS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_CLEAR.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgClear(Conn *conn,          // IN
+                const MsgHdr *req,   // IN
+                const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+
+    PrintMsg(req, conn->cliName);
+
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, false);
+    if (entry != NULL) {
+        WalChange c = { WAL_CLEAR, title, NULL, 0, 0 };
+
+        if (!BoardClear(&entry->board, logChanges ? ServerLogChange : NULL,
+                        &c)) {
+            return false;
+        }
+        conn->walLsn = MAX(conn->walLsn, c.lsn);
+        BoardTableNotify(entry, pushDelayUs);
+    }
+    return QueueStatus(conn, req, MSG_STATUS_SUCCESS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append a post to the board named in req, creating the board.
+ *
+ **************************************************************************
+ */
+static MsgStatus
+PostData(Conn *conn,          // IN
+         const MsgHdr *req,   // IN
+         const char *data,    // IN
+         int dataSize)        // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    BoardEntry *entry;
+    WalChange c = { WAL_POST, title, data, dataSize, 0 };
+
+    MsgGetTitle(req, title);
+    if (strchr(title, '\n') != NULL) {
+        return MSG_STATUS_BAD_TITLE;
+    }
+    if ((entry = BoardTableLookup(&boards, title, true)) == NULL ||
+        !BoardAppend(&entry->board, data, dataSize,
+                     logChanges ? ServerLogChange : NULL, &c)) {
+        return MSG_STATUS_NO_SPACE;
+    }
+    conn->walLsn = MAX(conn->walLsn, c.lsn);
+    BoardTableNotify(entry, pushDelayUs);
+    return MSG_STATUS_SUCCESS;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_POST.
+ *
+ * The board is created on its first post.  Posts over MAX_POST_DATA_SIZE
+ * have been discarded while reading and are refused, as are posts that
+ * would exceed the board memory limit.  With a write-ahead log, the reply
+ * is held back until the post is durable.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgPost(Conn *conn,          // IN
+               const MsgHdr *req,   // IN
+               const char *data)    // IN
+{
+    MsgStatus status;
+
+    PrintMsg(req, conn->cliName);
+
+    if (conn->dataLen < req->dataSize) {
+        status = MSG_STATUS_TOO_LARGE;
+    } else {
+        status = PostData(conn, req, data, conn->dataLen);
+    }
+    return QueueStatus(conn, req, status);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_POST_LZ: a POST whose data is compressed.
+ *
+ * Only for clients granted MSG_CAP_LZ.  The decompressed post is subject
+ * to the same limits as a plain one.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgPostLz(Conn *conn,          // IN
+                 const MsgHdr *req,   // IN
+                 const char *data)    // IN
+{
+    MsgLzHdr lz;
+    MsgStatus status;
+    char *post;
+
+    PrintMsg(req, conn->cliName);
+
+    if (!(conn->caps & MSG_CAP_LZ) || conn->dataLen < sizeof lz) {
+        return QueueStatus(conn, req, conn->dataLen < req->dataSize ?
+                           MSG_STATUS_TOO_LARGE : MSG_STATUS_BAD_REQUEST);
+    }
+    memcpy(&lz, data, sizeof lz);
+    if (lz.rawSize > MAX_POST_DATA_SIZE) {
+        return QueueStatus(conn, req, MSG_STATUS_TOO_LARGE);
+    }
+    if (lz.rawSize < 0 || (post = malloc(MAX(lz.rawSize, 1))) == NULL) {
+        return QueueStatus(conn, req, MSG_STATUS_BAD_REQUEST);
+    }
+
+    if (!LzDecompress(data + sizeof lz, conn->dataLen - sizeof lz,
+                      post, lz.rawSize)) {
+        status = MSG_STATUS_BAD_REQUEST;
+    } else {
+        status = PostData(conn, req, post, lz.rawSize);
+    }
+    free(post);
+    return QueueStatus(conn, req, status);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_HELLO: grant the capabilities asked for that
+ *        the server supports.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgHello(Conn *conn,          // IN
+                const MsgHdr *req,   // IN
+                const char *data)    // IN
+{
+    unsigned caps = 0;
+    MsgHdr reply;
+
+    PrintMsg(req, conn->cliName);
+
+    if (conn->dataLen >= sizeof caps) {
+        memcpy(&caps, data, sizeof caps);
+    }
+    conn->caps = caps & MSG_CAP_LZ;
+
+    memset(&reply, 0, sizeof reply);
+    reply.type     = MSG_HELLO;
+    reply.dataSize = sizeof conn->caps;
+    reply.reqId    = req->reqId;
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply) ||
+        !OutQueueAppend(&conn->out, &conn->caps, sizeof conn->caps)) {
+        return false;
+    }
+
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ * One post of a POST_BATCH request, pointing into the request payload.
+ */
+typedef struct BatchItem {
+    const char *title;     // Not NUL-terminated
+    int         titleLen;
+    const char *data;
+    int         dataSize;
+    int         index;     // Position in the request
+} BatchItem;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Order batch items by board, and in request order on each board.
+ *
+ **************************************************************************
+ */
+static int
+BatchItemCompare(const void *a,  // IN
+                 const void *b)  // IN
+{
+    const BatchItem *x = a;
+    const BatchItem *y = b;
+
+    if (x->titleLen != y->titleLen) {
+        return x->titleLen - y->titleLen;
+    }
+    if (x->titleLen > 0) {
+        int d = memcmp(x->title, y->title, x->titleLen);
+        if (d != 0) {
+            return d;
+        }
+    }
+    return x->index - y->index;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Split a POST_BATCH payload into its items.
+ *
+ * Fills in items unless it is NULL.  Returns the number of items, or -1
+ * if the payload is malformed.
+ *
+ **************************************************************************
+ */
+static int
+BatchParse(const MsgHdr *req,     // IN
+           const char *data,      // IN
+           int dataLen,           // IN
+           BatchItem *items)      // OUT: May be NULL
+{
+    int off = 0, numItems = 0;
+
+    while (off < dataLen) {
+        MsgBatchItem hdr;
+
+        if (dataLen - off < sizeof hdr) {
+            return -1;
+        }
+        memcpy(&hdr, data + off, sizeof hdr);
+        off += sizeof hdr;
+        if (hdr.titleLen > MAX_TITLE_LEN || hdr.dataSize < 0 ||
+            dataLen - off < hdr.titleLen ||
+            dataLen - off - hdr.titleLen < hdr.dataSize) {
+            return -1;
+        }
+
+        if (items != NULL) {
+            BatchItem *item = &items[numItems];
+
+            if (hdr.titleLen == 0) {
+                item->title    = req->title;
+                item->titleLen = strnlen(req->title, MAX_TITLE_LEN);
+            } else {
+                item->title    = data + off;
+                item->titleLen = strnlen(data + off, hdr.titleLen);
+            }
+            item->data     = data + off + hdr.titleLen;
+            item->dataSize = hdr.dataSize;
+            item->index    = numItems;
+        }
+        off += hdr.titleLen + hdr.dataSize;
+        numItems++;
+    }
+    return numItems;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Post the batch items for one board as a single change.
+ *
+ * The items are joined with newlines, the way separate posts would be,
+ * so the board and the write-ahead log see one ordinary POST.  Empty
+ * items add nothing, as with POST.
+ *
+ **************************************************************************
+ */
+static MsgStatus
+BatchPost(Conn *conn,              // IN
+          const BatchItem *items,  // IN: Same board, in request order
+          int numItems)            // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    const char *post = NULL;
+    char *buf = NULL;
+    int i, size = 0, numPosts = 0;
+    BoardEntry *entry;
+    MsgStatus status = MSG_STATUS_SUCCESS;
+    WalChange c = { WAL_POST, title, NULL, 0, 0 };
+
+    memcpy(title, items[0].title, items[0].titleLen);
+    title[items[0].titleLen] = '\0';
+    if (strchr(title, '\n') != NULL) {
+        return MSG_STATUS_BAD_TITLE;
+    }
+
+    for (i = 0; i < numItems; i++) {
+        if (items[i].dataSize > 0) {
+            post  = items[i].data;
+            size += items[i].dataSize + (numPosts > 0 ? 1 : 0);
+            numPosts++;
+        }
+    }
+    if (numPosts == 0) {
+        return MSG_STATUS_SUCCESS;
+    }
+
+    if (numPosts > 1) {
+        char *p = buf = malloc(size);
+
+        if (buf == NULL) {
+            return MSG_STATUS_NO_SPACE;
+        }
+        for (i = 0; i < numItems; i++) {
+            if (items[i].dataSize == 0) {
+                continue;
+            }
+            if (p > buf) {
+                *p++ = '\n';
+            }
+            memcpy(p, items[i].data, items[i].dataSize);
+            p += items[i].dataSize;
+        }
+        post = buf;
+    }
+
+    c.data     = post;
+    c.dataSize = size;
+    if ((entry = BoardTableLookup(&boards, title, true)) == NULL ||
+        !BoardAppend(&entry->board, post, size,
+                     logChanges ? ServerLogChange : NULL, &c)) {
+        status = MSG_STATUS_NO_SPACE;
+    } else {
+        conn->walLsn = MAX(conn->walLsn, c.lsn);
+        BoardTableNotify(entry, pushDelayUs);
+    }
+    free(buf);
+    return status;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_POST_BATCH.
+ *
+ * Each board named in the batch gets all of its items as one new
+ * version, so readers and subscribers never see part of them; different
+ * boards are updated one after the other.  The STATUS reply carries the
+ * result of every item.  A malformed batch is refused as a whole.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgPostBatch(Conn *conn,          // IN
+                    const MsgHdr *req,   // IN
+                    const char *data)    // IN
+{
+    BatchItem *items;
+    unsigned char *results;
+    MsgStatus status = MSG_STATUS_SUCCESS;
+    MsgHdr reply;
+    int i, j, numItems;
+
+    PrintMsg(req, conn->cliName);
+
+    if (conn->dataLen < req->dataSize) {
+        return QueueStatus(conn, req, MSG_STATUS_TOO_LARGE);
+    }
+    numItems = BatchParse(req, data, conn->dataLen, NULL);
+    if (numItems <= 0) {
+        return QueueStatus(conn, req, numItems < 0 ?
+                           MSG_STATUS_BAD_REQUEST : MSG_STATUS_SUCCESS);
+    }
+    items   = malloc(numItems * sizeof *items);
+    results = malloc(numItems);
+    if (items == NULL || results == NULL) {
+        Error("   [%s] Failed to allocate a batch of %d items\n",
+              conn->cliName, numItems);
+        free(items);
+        free(results);
+        return false;
+    }
+    BatchParse(req, data, conn->dataLen, items);
+
+    qsort(items, numItems, sizeof *items, BatchItemCompare);
+    for (i = 0; i < numItems; i = j) {
+        MsgStatus s;
+
+        for (j = i + 1; j < numItems; j++) {
+            if (items[j].titleLen != items[i].titleLen ||
+                memcmp(items[j].title, items[i].title, items[i].titleLen)) {
+                break;
+            }
+        }
+        s = BatchPost(conn, items + i, j - i);
+        for (; i < j; i++) {
+            results[items[i].index] = s;
+        }
+    }
+    free(items);
+
+    for (i = 0; i < numItems; i++) {
+        if (results[i] != MSG_STATUS_SUCCESS) {
+            status = results[i];
+            break;
+        }
+    }
+
+    memset(&reply, 0, sizeof reply);
+    reply.type     = MSG_STATUS;
+    reply.status   = status;
+    reply.dataSize = numItems;
+    reply.reqId    = req->reqId;
+
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply)) {
+        free(results);
+        return false;
+    }
+    if (!OutQueueAppendRef(&conn->out, results, numItems, free, results)) {
+        return false;
+    }
+
+    StatsStatus(status);
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ * Growing buffer of newline-terminated titles built by ProcessMsgList.
+ */
+typedef struct TitleList {
+    char *buf;
+    int   len;
+    int   cap;
+    bool  failed;
+} TitleList;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Append one board title to a TitleList.
+ *
+ **************************************************************************
+ */
+static void
+TitleListAdd(BoardEntry *entry,  // IN
+             void *arg)          // IN/OUT
+{
+    TitleList *list = arg;
+    int len = strlen(entry->title);
+
+    if (list->failed) {
+        return;
+    }
+    if (list->len + len + 1 > list->cap) {
+        int cap = MAX(list->cap * 2, list->len + len + 1 + 4096);
+        char *buf = realloc(list->buf, cap);
+        if (buf == NULL) {
+            list->failed = true;
+            return;
+        }
+        list->buf = buf;
+        list->cap = cap;
+    }
+    memcpy(list->buf + list->len, entry->title, len);
+    list->buf[list->len + len] = '\n';
+    list->len += len + 1;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_LIST.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgList(Conn *conn,          // IN
+               const MsgHdr *req,   // IN
+               const char *data)    // IN
+{
+    TitleList list;
+    MsgHdr reply;
+
+    PrintMsg(req, conn->cliName);
+
+    memset(&list, 0, sizeof list);
+    BoardTableForEach(&boards, TitleListAdd, &list);
+    if (list.failed) {
+        Error("   [%s] Failed to allocate the board list\n", conn->cliName);
+        free(list.buf);
+        return false;
+    }
+
+    memset(&reply, 0, sizeof reply);
+    reply.type     = MSG_TITLES;
+    reply.dataSize = list.len;
+    reply.reqId    = req->reqId;
+
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply)) {
+        free(list.buf);
+        return false;
+    }
+    if (list.len > 0 &&
+        !OutQueueAppendRef(&conn->out, list.buf, list.len, free, list.buf)) {
+        return false;
+    }
+
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ * Board totals gathered by ServerStatsAddBoard.
+ */
+typedef struct BoardStats {
+    unsigned long long boards;
+    unsigned long long bytes;
+    int                maxBytes;
+} BoardStats;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add a board to the totals.  A BoardEntryFunc.
+ *
+ **************************************************************************
+ */
+static void
+ServerStatsAddBoard(BoardEntry *entry,  // IN
+                    void *arg)          // IN
+{
+    BoardStats *bs = arg;
+    int size = BoardPeekSize(&entry->board);
+
+    bs->boards++;
+    bs->bytes   += size;
+    bs->maxBytes = MAX(bs->maxBytes, size);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the server metrics: the counters of every thread, then
+ *        the boards and their memory, then replication.
+ *
+ **************************************************************************
+ */
+void
+ServerPrintStats(FILE *f)  // IN
+{
+    BoardStats bs;
+    size_t used, limit;
+
+    StatsPrint(f);
+
+    memset(&bs, 0, sizeof bs);
+    BoardTableForEach(&boards, ServerStatsAddBoard, &bs);
+    BoardMemUsage(&used, &limit);
+    fprintf(f, "boards %llu\n", bs.boards);
+    fprintf(f, "board_bytes %llu\n", bs.bytes);
+    fprintf(f, "board_bytes_max %d\n", bs.maxBytes);
+    fprintf(f, "board_mem_bytes %zu\n", used);
+    fprintf(f, "board_mem_limit_bytes %zu\n", limit);
+    fprintf(f, "board_versions_compressed %llu\n", BoardPackCount());
+    fprintf(f, "log_lines_dropped %llu\n",
+            (unsigned long long)LoggerDropped());
+    if (useBacklog) {
+        ReplBacklogPrint(&backlog, f);
+    }
+    if (follow.host != NULL) {
+        pthread_mutex_lock(&follow.lock);
+        fprintf(f, "repl_link_up %d\n", follow.linkUp && follow.synced);
+        pthread_mutex_unlock(&follow.lock);
+        fprintf(f, "repl_applied_offset %llu\n",
+                atomic_load(&follow.applied));
+    }
+    SlabPrint(f);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Process the STATS message: reply with the server metrics.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgStats(Conn *conn,          // IN
+                const MsgHdr *req,   // IN
+                const char *data)    // IN
+{
+    MsgHdr reply;
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f;
+
+    PrintMsg(req, conn->cliName);
+
+    f = open_memstream(&text, &len);
+    if (f == NULL) {
+        Error("   [%s] Failed to allocate the stats\n", conn->cliName);
+        return false;
+    }
+    ServerPrintStats(f);
+    fclose(f);
+
+    memset(&reply, 0, sizeof reply);
+    reply.type     = MSG_STATS_TEXT;
+    reply.dataSize = len;
+    reply.reqId    = req->reqId;
+
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply)) {
+        free(text);
+        return false;
+    }
+    if (!OutQueueAppendRef(&conn->out, text, len, free, text)) {
+        return false;
+    }
+
+    PrintMsg(&reply, conn->cliName);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for the writes a follower refuses.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReadOnly(Conn *conn,          // IN
+                   const MsgHdr *req,   // IN
+                   const char *data)    // IN
+{
+    PrintMsg(req, conn->cliName);
+    return QueueStatus(conn, req, MSG_STATUS_READ_ONLY);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task: queue the part of the stream a follower has not been sent.
+ *
+ * Posted after every change, and by ConnFlush() once the follower's
+ * output is down to outLowWater; stops queueing at outHighWater.  A
+ * follower that fell out of the backlog is disconnected, and gets a
+ * full sync when it reconnects.
+ *
+ **************************************************************************
+ */
+static void
+ConnReplFeed(EventLoop *loop,   // IN
+             void *arg)         // IN
+{
+    Conn *conn = arg;
+    int n = 0;
+
+    while (conn->out.bytes < outHighWater &&
+           (n = ReplBacklogCopy(&backlog, conn->feed, &conn->out,
+                                SERVER_FLUSH_BUDGET)) > 0) {
+    }
+    if (n < 0) {
+        ConnClose(conn);
+        return;
+    }
+    ConnFlush(conn);
+}
+
+
+/**
+ * The boards found by EntryListAdd, to be worked on once the walk of
+ * the table is over: a BoardEntryFunc may not take a lock or another
+ * RCU read section.
+ */
+typedef struct EntryList {
+    BoardEntry **entries;
+    size_t       count;
+    size_t       cap;
+    bool         failed;
+} EntryList;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add an entry to an EntryList.  A BoardEntryFunc.
+ *
+ **************************************************************************
+ */
+static void
+EntryListAdd(BoardEntry *entry,  // IN
+             void *arg)          // IN/OUT
+{
+    EntryList *list = arg;
+
+    if (list->count == list->cap) {
+        size_t cap = MAX(list->cap * 2, 1024);
+        BoardEntry **entries = realloc(list->entries, cap * sizeof *entries);
+
+        if (entries == NULL) {
+            list->failed = true;
+            return;
+        }
+        list->entries = entries;
+        list->cap     = cap;
+    }
+    list->entries[list->count++] = entry;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a REPL_BOARD with the current version of a board.
+ *
+ **************************************************************************
+ */
+static bool
+ConnReplBoard(Conn *conn,          // IN
+              BoardEntry *entry)   // IN
+{
+    MsgHdr hdr;
+    MsgReplChange change;
+    struct timespec now;
+    BoardVersion *v;
+    bool ok;
+
+    v = BoardSnapshot(&entry->board);
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(&hdr, 0, sizeof hdr);
+    hdr.type     = MSG_REPL_BOARD;
+    hdr.dataSize = sizeof change + v->dataSize;
+    MsgSetTitle(&hdr, entry->title);
+    change.seq    = v->seq;
+    change.timeNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    ok = OutQueueAppend(&conn->out, &hdr, sizeof hdr) &&
+         OutQueueAppend(&conn->out, &change, sizeof change) &&
+         QueueBoardData(conn, v, 0);
+    BoardRelease(v);
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_REPL_SYNC: make the client a follower.
+ *
+ * The follower is registered for changes before the boards are copied,
+ * so every change is either in the copy, in the stream, or both; the
+ * follower skips the ones it already has by their version seq.  Board
+ * data is queued by reference, like a SHOW.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReplSync(Conn *conn,          // IN
+                   const MsgHdr *req,   // IN
+                   const char *data)    // IN
+{
+    MsgReplPos want, pos;
+    MsgHdr reply;
+    ReplFeed *feed;
+    EntryList list;
+    bool partial;
+    size_t i;
+
+    PrintMsg(req, conn->cliName);
+
+    if (!useBacklog || conn->feed != NULL || conn->dataLen != sizeof want) {
+        return QueueStatus(conn, req, MSG_STATUS_BAD_REQUEST);
+    }
+    memcpy(&want, data, sizeof want);
+
+    feed = calloc(1, sizeof *feed);
+    if (feed == NULL) {
+        Error("   [%s] Failed to allocate a follower\n", conn->cliName);
+        return QueueStatus(conn, req, MSG_STATUS_NO_SPACE);
+    }
+    feed->watcher.loop      = conn->loop;
+    feed->watcher.task.func = ConnReplFeed;
+    feed->watcher.task.arg  = conn;
+    memcpy(feed->name, conn->cliName, sizeof feed->name);
+    conn->feed = feed;
+
+    partial = ReplBacklogStart(&backlog, &want, feed, &pos);
+    if (!partial) {
+        memset(&list, 0, sizeof list);
+        BoardTableForEach(&boards, EntryListAdd, &list);
+        for (i = 0; !list.failed && i < list.count; i++) {
+            list.failed = !ConnReplBoard(conn, list.entries[i]);
+        }
+        free(list.entries);
+        if (list.failed) {
+            Error("   [%s] Failed to queue the boards\n", conn->cliName);
+            return false;
+        }
+    }
+
+    memset(&reply, 0, sizeof reply);
+    reply.type     = MSG_REPL_START;
+    reply.status   = partial ? MSG_STATUS_SUCCESS : MSG_STATUS_RESET;
+    reply.dataSize = sizeof pos;
+    reply.reqId    = req->reqId;
+    if (!OutQueueAppend(&conn->out, &reply, sizeof reply) ||
+        !OutQueueAppend(&conn->out, &pos, sizeof pos)) {
+        return false;
+    }
+
+    StatsInc(partial ? STATS_REPL_PARTIAL : STATS_REPL_FULL);
+    Log("   [%s] Follower synced %s, streaming from offset %llu\n",
+        conn->cliName, partial ? "from the backlog" : "every board",
+        pos.offset);
+    PrintMsg(&reply, conn->cliName);
+    EventLoopPost(conn->loop, &feed->watcher.task, 0);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_REPL_ACK: how far a follower has got.
+ *
+ * Not logged: followers send one every REPL_ACK_MS while changes flow.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReplAck(Conn *conn,          // IN
+                  const MsgHdr *req,   // IN
+                  const char *data)    // IN
+{
+    MsgReplPos pos;
+
+    if (conn->feed == NULL || conn->dataLen != sizeof pos) {
+        Error("   [%s] Unexpected REPL_ACK\n", conn->cliName);
+        StatsInc(STATS_PROTOCOL_ERRORS);
+        return false;
+    }
+    memcpy(&pos, data, sizeof pos);
+    ReplBacklogAck(&backlog, conn->feed, pos.offset);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Check that a message meant for a follower came from its leader
+ * with at least size bytes of payload.
+ *
+ **************************************************************************
+ */
+static bool
+FollowCheck(const Conn *conn,  // IN
+            int size)          // IN
+{
+    if (!conn->upstream || conn->dataLen < size) {
+        Error("   [%s] Unexpected %s\n", conn->cliName,
+              MsgTypeToString(conn->req.type));
+        StatsInc(STATS_PROTOCOL_ERRORS);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_REPL_BOARD: a board copied by a full sync.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReplBoard(Conn *conn,          // IN
+                    const MsgHdr *req,   // IN
+                    const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    MsgReplChange change;
+    BoardEntry *entry;
+
+    PrintMsg(req, conn->cliName);
+
+    if (!FollowCheck(conn, sizeof change)) {
+        return false;
+    }
+    memcpy(&change, data, sizeof change);
+
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, true);
+    if (entry == NULL ||
+        !BoardRestore(&entry->board, data + sizeof change,
+                      conn->dataLen - sizeof change, change.seq)) {
+        Error("   [%s] Failed to copy board \"%s\"\n", conn->cliName,
+              title);
+        return false;
+    }
+    entry->replSync = follow.sync + 1;
+    BoardTableNotify(entry, pushDelayUs);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Empty the boards the last full sync did not copy.
+ *
+ **************************************************************************
+ */
+static bool
+FollowDropBoards(void)
+{
+    EntryList list;
+    size_t i;
+
+    memset(&list, 0, sizeof list);
+    BoardTableForEach(&boards, EntryListAdd, &list);
+    if (list.failed) {
+        Error("Failed to allocate the list of boards\n");
+        free(list.entries);
+        return false;
+    }
+    for (i = 0; i < list.count; i++) {
+        BoardEntry *entry = list.entries[i];
+
+        if (entry->replSync != follow.sync &&
+            BoardPeekSize(&entry->board) > 0 &&
+            BoardClear(&entry->board, NULL, NULL)) {
+            BoardTableNotify(entry, pushDelayUs);
+        }
+    }
+    free(list.entries);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_REPL_START: the stream of changes starts here.
+ *
+ * After a full sync, the boards the leader did not send are gone from
+ * it.  From now on the follower reports its position every REPL_ACK_MS.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReplStart(Conn *conn,          // IN
+                    const MsgHdr *req,   // IN
+                    const char *data)    // IN
+{
+    PrintMsg(req, conn->cliName);
+
+    if (!FollowCheck(conn, sizeof follow.pos)) {
+        return false;
+    }
+    memcpy(&follow.pos, data, sizeof follow.pos);
+    follow.acked = follow.pos.offset;
+    atomic_store(&follow.applied, follow.pos.offset);
+
+    if (req->status == MSG_STATUS_RESET) {
+        follow.sync++;
+        if (!FollowDropBoards()) {
+            return false;
+        }
+    }
+    Log("   [%s] Following the leader from offset %llu (%s sync)\n",
+        conn->cliName, follow.pos.offset,
+        req->status == MSG_STATUS_RESET ? "full" : "partial");
+
+    pthread_mutex_lock(&follow.lock);
+    follow.synced = true;
+    pthread_mutex_unlock(&follow.lock);
+    EventLoopTimerSet(conn->loop, &follow.ackTimer, REPL_ACK_MS);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Handler for MSG_REPL_POST and MSG_REPL_CLEAR: apply a change
+ * the leader made.
+ *
+ * Like ServerReplay(): a change the board already has is skipped, and a
+ * board the last full sync did not copy starts just before its first
+ * change, so the follower's versions are the leader's.
+ *
+ **************************************************************************
+ */
+static bool
+ProcessMsgReplChange(Conn *conn,          // IN
+                     const MsgHdr *req,   // IN
+                     const char *data)    // IN
+{
+    char title[MAX_TITLE_LEN + 1];
+    MsgReplChange change;
+    BoardEntry *entry;
+    BoardVersion *v;
+    BoardSeq seq;
+    bool ok = true;
+
+    PrintMsg(req, conn->cliName);
+
+    if (!FollowCheck(conn, sizeof change)) {
+        return false;
+    }
+    memcpy(&change, data, sizeof change);
+
+    MsgGetTitle(req, title);
+    entry = BoardTableLookup(&boards, title, true);
+    if (entry != NULL && entry->replSync != follow.sync) {
+        ok = BoardRestore(&entry->board, "", 0, change.seq - 1);
+        entry->replSync = follow.sync;
+    }
+    if (entry == NULL || !ok) {
+        Error("   [%s] Failed to create board \"%s\"\n", conn->cliName,
+              title);
+        return false;
+    }
+
+    v = BoardSnapshot(&entry->board);
+    seq = v->seq;
+    BoardRelease(v);
+    if (change.seq > seq) {
+        if (req->type == MSG_REPL_POST) {
+            ok = BoardAppend(&entry->board, data + sizeof change,
+                             conn->dataLen - sizeof change, NULL, NULL);
+        } else {
+            ok = BoardClear(&entry->board, NULL, NULL);
+        }
+        if (!ok) {
+            Error("   [%s] Board \"%s\" does not fit in the board memory "
+                  "limit\n", conn->cliName, title);
+            return false;
+        }
+        BoardTableNotify(entry, pushDelayUs);
+    }
+
+    follow.pos.offset += sizeof *req + req->dataSize;
+    atomic_store_explicit(&follow.applied, follow.pos.offset,
+                          memory_order_relaxed);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Timer callback: tell the leader how far the follower has got.
+ *
+ **************************************************************************
+ */
+static void
+FollowAck(void *arg)  // IN
+{
+    Conn *conn = follow.conn;
+    MsgHdr hdr;
+
+    if (follow.pos.offset != follow.acked) {
+        memset(&hdr, 0, sizeof hdr);
+        hdr.type     = MSG_REPL_ACK;
+        hdr.dataSize = sizeof follow.pos;
+        if (!OutQueueAppend(&conn->out, &hdr, sizeof hdr) ||
+            !OutQueueAppend(&conn->out, &follow.pos, sizeof follow.pos)) {
+            ConnClose(conn);
+            return;
+        }
+        follow.acked = follow.pos.offset;
+        if (!ConnFlush(conn)) {
+            return;
+        }
+    }
+    EventLoopTimerSet(conn->loop, &follow.ackTimer, REPL_ACK_MS);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Tell the follow thread that the link to the leader is down.
+ *
+ **************************************************************************
+ */
+static void
+FollowLinkDown(void)
+{
+    pthread_mutex_lock(&follow.lock);
+    follow.linkUp = false;
+    pthread_cond_signal(&follow.cond);
+    pthread_mutex_unlock(&follow.lock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task: serve the link the follow thread connected, and ask the
+ * leader for the changes since the position the follower has.
+ *
+ **************************************************************************
+ */
+static void
+FollowLinkUp(EventLoop *loop,   // IN
+             void *arg)         // IN
+{
+    Conn *conn = ConnAdd(loop, follow.sd);
+    MsgHdr hdr;
+
+    if (conn == NULL) {
+        FollowLinkDown();
+        return;
+    }
+    conn->upstream = true;
+    follow.conn    = conn;
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.type     = MSG_REPL_SYNC;
+    hdr.dataSize = sizeof follow.pos;
+    if (!OutQueueAppend(&conn->out, &hdr, sizeof hdr) ||
+        !OutQueueAppend(&conn->out, &follow.pos, sizeof follow.pos)) {
+        ConnClose(conn);
+        return;
+    }
+    PrintMsg(&hdr, conn->cliName);
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Connect to the leader.  Returns the socket, or -1.
+ *
+ **************************************************************************
+ */
+static int
+FollowConnect(void)
+{
+    struct timeval tv = { REPL_CONNECT_TIMEOUT_S, 0 };
+    struct addrinfo hints, *res, *ai;
+    int sd = -1;
+    int err;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    err = getaddrinfo(follow.host, follow.port, &hints, &res);
+    if (err != 0) {
+        Error("Failed to resolve the leader %s: %s\n", follow.host,
+              gai_strerror(err));
+        return -1;
+    }
+
+    err = 0;
+    for (ai = res; ai != NULL && sd < 0; ai = ai->ai_next) {
+        sd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sd < 0) {
+            err = errno;
+            continue;
+        }
+        /* Bounds connect(); the socket is non-blocking from here on. */
+        setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        if (connect(sd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            err = errno;
+            close(sd);
+            sd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (sd < 0) {
+        Error("Failed to connect to the leader %s port %s: %s\n",
+              follow.host, follow.port, strerror(err));
+    }
+    return sd;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The follow thread: keep a link to the leader.
+ *
+ * Connects, hands the socket to the loop, and waits until the link goes
+ * down.  Failed attempts back off from REPL_RETRY_MIN_MS to
+ * REPL_RETRY_MAX_MS; a link that got as far as syncing starts over.
+ *
+ **************************************************************************
+ */
+static void *
+FollowLoop(void *arg)  // IN
+{
+    int delayMs = REPL_RETRY_MIN_MS;
+
+    pthread_mutex_lock(&follow.lock);
+    while (!follow.stop) {
+        struct timespec ts;
+        int sd;
+
+        pthread_mutex_unlock(&follow.lock);
+        sd = FollowConnect();
+        pthread_mutex_lock(&follow.lock);
+
+        if (sd >= 0 && follow.stop) {
+            close(sd);
+        } else if (sd >= 0) {
+            follow.sd     = sd;
+            follow.linkUp = true;
+            follow.synced = false;
+            EventLoopPost(follow.loop, &follow.linkTask, 0);
+            while (follow.linkUp && !follow.stop) {
+                pthread_cond_wait(&follow.cond, &follow.lock);
+            }
+            if (follow.synced) {
+                delayMs = REPL_RETRY_MIN_MS;
+            }
+        }
+        if (follow.stop) {
+            break;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += delayMs / 1000;
+        ts.tv_nsec += (delayMs % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&follow.cond, &follow.lock, &ts);
+        delayMs = MIN(delayMs * 2, REPL_RETRY_MAX_MS);
+    }
+    pthread_mutex_unlock(&follow.lock);
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start following the leader named by --follow, on loop.
+ *
+ * Called before the loops run.
+ *
+ **************************************************************************
+ */
+bool
+ServerFollowStart(EventLoop *loop)  // IN
+{
+    int err;
+
+    follow.loop          = loop;
+    follow.linkTask.func = FollowLinkUp;
+    follow.ackTimer.func = FollowAck;
+    pthread_mutex_init(&follow.lock, NULL);
+    pthread_cond_init(&follow.cond, NULL);
+
+    err = pthread_create(&follow.thread, NULL, FollowLoop, NULL);
+    if (err != 0) {
+        Error("Failed to start the follow thread: %s\n", strerror(err));
+        return false;
+    }
+    Log("Following the leader at %s port %s\n", follow.host, follow.port);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop the follow thread.  Called once the loops have stopped,
+ * before they are destroyed.
+ *
+ **************************************************************************
+ */
+void
+ServerFollowStop(void)
+{
+    if (follow.loop == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&follow.lock);
+    follow.stop = true;
+    pthread_cond_signal(&follow.cond);
+    pthread_mutex_unlock(&follow.lock);
+    pthread_join(follow.thread, NULL);
+    follow.loop = NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release the state of a closed connection.
+ *
+ * Called by the event loop once no I/O refers to the connection's
+ * buffers any more.
+ *
+ **************************************************************************
+ */
+static void
+ConnFree(EventLoop *loop,   // IN
+         void *arg)         // IN
+{
+    Conn *conn = arg;
+
+    OutQueueReset(&conn->out);
+    RecvBufFree(&conn->in);
+    if (conn->shardPending > 0) {
+        /* The last reply to come back frees it. */
+        conn->freed = true;
+        return;
+    }
+    SlabFree(&connCache, conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Close a client connection and release its state.
+ *
+ **************************************************************************
+ */
+static void
+ConnClose(Conn *conn)  // IN
+{
+    Log("Client %s (sock=%u) disconnected\n\n", conn->cliName,
+        conn->stream.src.fd);
+
+    while (conn->subs != NULL) {
+        Subscription *sub = conn->subs;
+        conn->subs = sub->next;
+        SubscriptionFree(sub);
+    }
+    if (useWal) {
+        WalCancel(&wal, &conn->walWait);
+        EventLoopCancel(conn->loop, &conn->walWait.task);
+    }
+    if (conn->feed != NULL) {
+        ReplBacklogStop(&backlog, conn->feed);
+        EventLoopCancel(conn->loop, &conn->feed->watcher.task);
+        free(conn->feed);
+        conn->feed = NULL;
+    }
+    if (conn->upstream) {
+        EventLoopTimerCancel(conn->loop, &follow.ackTimer);
+        follow.conn = NULL;
+        FollowLinkDown();
+    }
+    EventLoopCancel(conn->loop, &conn->flushTask);
+    EventLoopTimerCancel(conn->loop, &conn->timer);
+    conn->closed = true;
+    StatsInc(STATS_CLOSED);
+    EventStreamClose(conn->loop, &conn->stream);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief What the deadline of the given kind waits on.
+ *
+ **************************************************************************
+ */
+static uint64_t
+ConnProgress(const Conn *conn,   // IN
+             ConnTimer kind)     // IN
+{
+    return kind == CONN_TIMER_WRITE ? conn->out.sent : conn->requests;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Set the connection's timer for the deadline that applies now.
+ *
+ * Called whenever the loop is done with the connection for the moment.
+ * Subscribers and replication links wait for changes, so are never idle.
+ * The write and read deadlines are not moved for each byte or request:
+ * when one expires, ConnTimeout() checks whether any progress was made
+ * since it was set, and only then sets it again.  The idle deadline is
+ * moved on every call, which costs no more than unlinking and linking
+ * the timer.
+ *
+ **************************************************************************
+ */
+static void
+ConnSetTimer(Conn *conn)  // IN
+{
+    ConnTimer kind;
+    int ms;
+
+    if (!OutQueueEmpty(&conn->out)) {
+        kind = CONN_TIMER_WRITE;
+        ms   = slowTimeoutMs;
+    } else if (conn->state != CONN_READ_HDR || RecvBufLen(&conn->in) > 0) {
+        kind = CONN_TIMER_READ;
+        ms   = readTimeoutMs;
+    } else if (conn->subs == NULL && conn->feed == NULL && !conn->upstream) {
+        kind = CONN_TIMER_IDLE;
+        ms   = idleTimeoutMs;
+    } else {
+        kind = CONN_TIMER_NONE;
+        ms   = 0;
+    }
+    if (ms == 0) {
+        kind = CONN_TIMER_NONE;
+    }
+
+    if (kind == conn->timerKind && kind != CONN_TIMER_IDLE) {
+        return;
+    }
+    conn->timerKind = kind;
+    conn->timerMark = ConnProgress(conn, kind);
+    if (kind == CONN_TIMER_NONE) {
+        EventLoopTimerCancel(conn->loop, &conn->timer);
+    } else {
+        EventLoopTimerSet(conn->loop, &conn->timer, ms);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Timer callback: disconnect a client that missed its deadline.
+ *
+ **************************************************************************
+ */
+static void
+ConnTimeout(void *arg)  // IN
+{
+    Conn *conn = arg;
+
+    if (conn->timerKind != CONN_TIMER_IDLE &&
+        ConnProgress(conn, conn->timerKind) != conn->timerMark) {
+        conn->timerMark = ConnProgress(conn, conn->timerKind);
+        EventLoopTimerSet(conn->loop, &conn->timer,
+                          conn->timerKind == CONN_TIMER_WRITE ?
+                          slowTimeoutMs : readTimeoutMs);
+        return;
+    }
+
+    switch (conn->timerKind) {
+    case CONN_TIMER_WRITE:
+        Error("   [%s] Client stopped reading its replies\n",
+              conn->cliName);
+        StatsInc(STATS_SLOW_CLOSED);
+        break;
+    case CONN_TIMER_READ:
+        Error("   [%s] Request not received in time\n", conn->cliName);
+        StatsInc(STATS_READ_TIMEOUTS);
+        break;
+    default:
+        Log("   [%s] Client idle, disconnecting\n", conn->cliName);
+        StatsInc(STATS_IDLE_CLOSED);
+        break;
+    }
+    ConnClose(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop taking requests from a client that has too much output
+ * pending.
+ *
+ * Its requests wait unread, in the receive buffer or the socket, until
+ * ConnContinue() finds its output down to outLowWater.
+ *
+ **************************************************************************
+ */
+static void
+ConnPause(Conn *conn)  // IN
+{
+    conn->outPaused = true;
+    EventStreamPause(conn->loop, &conn->stream, true);
+    StatsInc(STATS_READS_PAUSED);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The handler of the given message type, or NULL.
+ *
+ **************************************************************************
+ */
+static const MsgHandler *
+MsgHandlerFind(int type)  // IN
+{
+    int i;
+
+    for (i = 0; i < ARRAYSIZE(msgHandlers); i++) {
+        if (msgHandlers[i].type == type) {
+            return &msgHandlers[i];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run the handler for the fully received request.
+ *
+ **************************************************************************
+ */
+static bool
+ConnDispatch(Conn *conn,           // IN
+             const char *data)    // IN
+{
+    const MsgHandler *handler = MsgHandlerFind(conn->req.type);
+    struct timespec start, end;
+    int outBytes = conn->out.bytes;
+    bool ok;
+
+    if (handler == NULL) {
+        Error("   [%s] Unknown message type %d\n", conn->cliName,
+              conn->req.type);
+        StatsInc(STATS_PROTOCOL_ERRORS);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (handler->writes && follow.host != NULL) {
+        ok = ProcessMsgReadOnly(conn, &conn->req, data);
+    } else {
+        ok = handler->func(conn, &conn->req, data);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    conn->requests++;
+    StatsRequest(conn->req.type, conn->req.dataSize,
+                 ok ? conn->out.bytes - outBytes : 0,
+                 (end.tv_sec - start.tv_sec) * 1000000000ULL +
+                 end.tv_nsec - start.tv_nsec);
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The shard the fully received request is to run on.
+ *
+ **************************************************************************
+ */
+static int
+ConnShardOf(const Conn *conn)  // IN
+{
+    const MsgHandler *handler;
+    char title[MAX_TITLE_LEN + 1];
+
+    if (ShardCount() < 2 ||
+        (handler = MsgHandlerFind(conn->req.type)) == NULL ||
+        !handler->sharded) {
+        return ShardSelf();
+    }
+    MsgGetTitle(&conn->req, title);
+    return BoardTitleHash(title) % ShardCount();
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Whether a request for shard may run before the ones forwarded
+ * earlier completed.
+ *
+ * Replies must leave in request order, and only requests to one shard
+ * are answered in the order they were sent: another shard, or this one,
+ * could answer sooner.  So a connection stops reading until the replies
+ * are back; ConnShardDone() carries on.
+ *
+ **************************************************************************
+ */
+static bool
+ConnShardReady(Conn *conn,   // IN/OUT
+               int shard)    // IN
+{
+    if (conn->shardPending == 0 ||
+        (shard == conn->shardOwner && shard != ShardSelf())) {
+        return true;
+    }
+    if (!conn->shardBlocked) {
+        conn->shardBlocked = true;
+        EventStreamPause(conn->loop, &conn->stream, true);
+    }
+    return false;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send the fully received request to the shard owning its board.
+ *
+ * The payload is copied, so the request can be consumed right away.
+ *
+ **************************************************************************
+ */
+static bool
+ConnForward(Conn *conn,         // IN/OUT
+            int shard,          // IN
+            const char *data)   // IN
+{
+    ShardCall *call;
+
+    if (conn->dataLen <= SHARD_CALL_INLINE) {
+        call = SlabAlloc(&shardCallCache);
+    } else {
+        call = malloc(sizeof *call + conn->dataLen);
+    }
+    if (call == NULL) {
+        Error("   [%s] Failed to allocate a forwarded request\n",
+              conn->cliName);
+        return false;
+    }
+
+    memset(call, 0, sizeof *call);
+    call->conn    = conn;
+    call->req     = conn->req;
+    call->dataLen = conn->dataLen;
+    call->caps    = conn->caps;
+    memcpy(call->cliName, conn->cliName, sizeof call->cliName);
+    memcpy(call->data, data, conn->dataLen);
+    OutQueueInit(&call->out);
+
+    conn->shardPending++;
+    conn->shardOwner = shard;
+    StatsInc(STATS_SHARD_FORWARDED);
+    ShardSend(shard, &call->msg);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run every request that is completely buffered.
+ *
+ * Payloads are handed to the handlers where they lie in the receive
+ * buffer.  Returns false if the connection must be closed.
+ *
+ **************************************************************************
+ */
+static bool
+ConnAdvance(Conn *conn)  // IN
+{
+    const char *data;
+    int shard;
+
+    for (;;) {
+        switch (conn->state) {
+        case CONN_READ_HDR:
+            if (conn->out.bytes > outHighWater) {
+                if (!conn->outPaused) {
+                    ConnPause(conn);
+                }
+                return true;
+            }
+            if (RecvBufLen(&conn->in) < sizeof conn->req) {
+                return true;
+            }
+            memcpy(&conn->req, RecvBufData(&conn->in), sizeof conn->req);
+            if (conn->req.dataSize < 0) {
+                Error("   [%s] Invalid payload size %d\n",
+                      conn->cliName, conn->req.dataSize);
+                StatsInc(STATS_PROTOCOL_ERRORS);
+                return false;
+            }
+            conn->dataLen = conn->req.dataSize;
+            if (conn->dataLen > MAX_POST_DATA_SIZE && !conn->upstream) {
+                RecvBufConsume(&conn->in, sizeof conn->req);
+                conn->skipBytes = conn->dataLen;
+                conn->dataLen   = 0;
+                conn->state     = CONN_SKIP_DATA;
+                break;
+            }
+            if (!RecvBufReserve(&conn->in, sizeof conn->req + conn->dataLen)) {
+                return false;
+            }
+            conn->state = CONN_READ_DATA;
+            break;
+
+        case CONN_READ_DATA:
+            if (RecvBufLen(&conn->in) < sizeof conn->req + conn->dataLen) {
+                return true;
+            }
+            data  = RecvBufData(&conn->in) + sizeof conn->req;
+            shard = ConnShardOf(conn);
+            if (!ConnShardReady(conn, shard)) {
+                return true;
+            }
+            if (shard != ShardSelf() ? !ConnForward(conn, shard, data)
+                                     : !ConnDispatch(conn, data)) {
+                return false;
+            }
+            RecvBufConsume(&conn->in, sizeof conn->req + conn->dataLen);
+            conn->state = CONN_READ_HDR;
+            break;
+
+        case CONN_SKIP_DATA: {
+            int n = MIN(conn->skipBytes, RecvBufLen(&conn->in));
+
+            RecvBufConsume(&conn->in, n);
+            conn->skipBytes -= n;
+            if (conn->skipBytes > 0 || !ConnShardReady(conn, ShardSelf())) {
+                return true;
+            }
+            if (!ConnDispatch(conn, NULL)) {
+                return false;
+            }
+            conn->state = CONN_READ_HDR;
+            break;
+        }
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Read everything the socket has, dispatching complete requests.
+ *
+ * Returns false if the connection must be closed.
+ *
+ **************************************************************************
+ */
+static bool
+ConnRead(Conn *conn)  // IN
+{
+    while (!conn->peerClosed && !conn->outPaused && !conn->shardBlocked) {
+        int n;
+
+        if (conn->state == CONN_SKIP_DATA) {
+            n = RecvBufSkip(&conn->in, conn->stream.src.fd,
+                            conn->skipBytes);
+        } else {
+            n = RecvBufFill(&conn->in, conn->stream.src.fd);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Error("read error: %d\n", errno);
+            return false;
+        }
+        if (n == 0) {
+            conn->peerClosed = true;
+            break;
+        }
+
+        if (conn->state == CONN_SKIP_DATA) {
+            conn->skipBytes -= n;
+        }
+
+        if (!ConnAdvance(conn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Push to the stalled subscriptions of a client that caught up.
+ *
+ **************************************************************************
+ */
+static void
+ConnResumeSubs(Conn *conn)  // IN
+{
+    Subscription *sub;
+
+    for (sub = conn->subs; sub != NULL; sub = sub->next) {
+        if (sub->stalled) {
+            sub->stalled = false;
+            EventLoopPost(conn->loop, &sub->watcher.task, 0);
+        }
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Hand the queued output to the io_uring loop.
+ *
+ * The whole queue, up to EVENTSTREAM_MAX_IOV segments, goes out as one
+ * send; ConnSent() continues once it completes.  Returns 1 when the queue
+ * is empty and 0 while a send is in flight, like OutQueueFlush().
+ *
+ **************************************************************************
+ */
+static int
+ConnSend(Conn *conn)  // IN
+{
+    int iovcnt;
+
+    if (conn->stream.sending) {
+        return 0;
+    }
+    iovcnt = OutQueueGather(&conn->out, conn->stream.iov,
+                            EVENTSTREAM_MAX_IOV);
+    if (iovcnt == 0) {
+        return 1;
+    }
+    EventStreamSend(conn->loop, &conn->stream, iovcnt);
+    return 0;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send as much queued output as the socket takes.
+ *
+ * Nothing is sent while a change the client made is not yet durable;
+ * walWait flushes again once it is.  Returns false if the connection was
+ * closed.
+ *
+ **************************************************************************
+ */
+static bool
+ConnFlush(Conn *conn)  // IN
+{
+    int pending = conn->out.bytes;
+    int rc;
+
+    if (conn->walLsn > WalDurableLsn(&wal)) {
+        conn->walWait.lsn = conn->walLsn;
+        if (WalWait(&wal, &conn->walWait)) {
+            return true;
+        }
+    }
+
+    if (conn->loop->backend == EVENT_BACKEND_URING) {
+        rc = ConnSend(conn);
+    } else {
+        rc = OutQueueFlush(&conn->out, conn->stream.src.fd,
+                           SERVER_FLUSH_BUDGET);
+        if (rc == 0 && pending - conn->out.bytes >= SERVER_FLUSH_BUDGET) {
+            /* Let the other connections write before sending more. */
+            StatsInc(STATS_FLUSH_YIELDS);
+            EventLoopPost(conn->loop, &conn->flushTask, 0);
+        }
+    }
+    if (rc >= 0 && conn->outPaused && conn->out.bytes <= outLowWater) {
+        EventLoopPost(conn->loop, &conn->flushTask, 0);
+    }
+
+    switch (rc) {
+    case -1:
+        ConnClose(conn);
+        return false;
+    case 1:
+        if (conn->peerClosed && !conn->outPaused &&
+            conn->shardPending == 0) {
+            ConnClose(conn);
+            return false;
+        }
+        ConnResumeSubs(conn);
+        break;
+    default:
+        break;
+    }
+    if (conn->feed != NULL && conn->out.bytes <= outLowWater &&
+        conn->feed->offset != ReplBacklogEnd(&backlog)) {
+        EventLoopPost(conn->loop, &conn->feed->watcher.task, 0);
+    }
+    ConnSetTimer(conn);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task that carries on with a connection from the loop.
+ *
+ * Runs after a write was cut short to let other connections go first,
+ * and once a paused client is down to outLowWater, when the requests it
+ * sent meanwhile are served before reading on.
+ *
+ **************************************************************************
+ */
+static void
+ConnContinue(EventLoop *loop,   // IN
+             void *arg)         // IN
+{
+    Conn *conn = arg;
+
+    if (conn->outPaused && conn->out.bytes <= outLowWater) {
+        conn->outPaused = false;
+        if (!conn->shardBlocked) {
+            EventStreamPause(loop, &conn->stream, false);
+        }
+        StatsInc(STATS_READS_RESUMED);
+
+        if (!ConnAdvance(conn) ||
+            (loop->backend == EVENT_BACKEND_EPOLL && !ConnRead(conn))) {
+            ConnClose(conn);
+            return;
+        }
+    }
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task run once the log is durable up to conn->walLsn.
+ *
+ **************************************************************************
+ */
+static void
+ConnWalDurable(EventLoop *loop,   // IN
+               void *arg)         // IN
+{
+    ConnFlush(arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Serve a forwarded request on the shard owning its board, and
+ * send the reply back.
+ *
+ **************************************************************************
+ */
+static void
+ShardCallRun(EventLoop *loop,   // IN
+             ShardCall *call)   // IN/OUT
+{
+    Conn proxy;
+
+    memset(&proxy, 0, sizeof proxy);
+    proxy.loop    = loop;
+    proxy.req     = call->req;
+    proxy.dataLen = call->dataLen;
+    proxy.caps    = call->caps;
+    memcpy(proxy.cliName, call->cliName, sizeof proxy.cliName);
+    OutQueueInit(&proxy.out);
+    proxy.out.heap = true;   // Freed by the connection's own thread
+
+    call->ok     = ConnDispatch(&proxy, call->data);
+    call->walLsn = proxy.walLsn;
+    call->done   = true;
+    OutQueueSplice(&call->out, &proxy.out);
+    ShardSend(call->msg.from, &call->msg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue the reply to a forwarded request on its connection.
+ *
+ * Once the last one is back, the requests that waited for it run.
+ *
+ **************************************************************************
+ */
+static void
+ConnShardDone(ShardCall *call)  // IN
+{
+    Conn *conn = call->conn;
+    bool ok    = call->ok;
+
+    conn->shardPending--;
+    if (conn->closed) {
+        OutQueueReset(&call->out);
+    } else {
+        OutQueueSplice(&conn->out, &call->out);
+        conn->walLsn = MAX(conn->walLsn, call->walLsn);
+        conn->requests++;
+    }
+    if (call->dataLen <= SHARD_CALL_INLINE) {
+        SlabFree(&shardCallCache, call);
+    } else {
+        free(call);
+    }
+
+    if (conn->closed) {
+        if (conn->shardPending == 0 && conn->freed) {
+            SlabFree(&connCache, conn);
+        }
+        return;
+    }
+    if (!ok) {
+        ConnClose(conn);
+        return;
+    }
+
+    if (conn->shardPending == 0 && conn->shardBlocked) {
+        conn->shardBlocked = false;
+        if (!conn->outPaused) {
+            EventStreamPause(conn->loop, &conn->stream, false);
+        }
+        if (!ConnAdvance(conn) ||
+            (conn->loop->backend == EVENT_BACKEND_EPOLL && !ConnRead(conn))) {
+            ConnClose(conn);
+            return;
+        }
+    }
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Shard callback: a request forwarded here, or a reply.
+ *
+ **************************************************************************
+ */
+static void
+ServerShardRecv(EventLoop *loop,   // IN
+                ShardMsg *msg)     // IN
+{
+    ShardCall *call = (ShardCall *)msg;
+
+    if (call->done) {
+        ConnShardDone(call);
+    } else {
+        ShardCallRun(loop, call);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Event callback for a client socket.
+ *
+ **************************************************************************
+ */
+static void
+ConnEvent(EventLoop *loop,   // IN
+          void *arg,         // IN
+          unsigned events)   // IN
+{
+    Conn *conn = arg;
+
+    /* Zerocopy completions are delivered as EPOLLERR, too. */
+    if ((events & EPOLLERR) &&
+        OutQueueReap(&conn->out, conn->stream.src.fd) < 0) {
+        ConnClose(conn);
+        return;
+    }
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !ConnRead(conn)) {
+        ConnClose(conn);
+        return;
+    }
+
+    /* Replies to every pipelined request read above leave together. */
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief io_uring callback with bytes received from a client.
+ *
+ * The bytes are in a buffer the loop reuses, so the ones a request
+ * still needs are copied into the receive buffer; a payload over
+ * MAX_POST_DATA_SIZE is dropped right here.
+ *
+ **************************************************************************
+ */
+static void
+ConnReceived(EventLoop *loop,    // IN
+             void *arg,          // IN
+             const char *data,   // IN
+             int len)            // IN
+{
+    Conn *conn = arg;
+
+    if (len < 0) {
+        Error("read error: %d\n", -len);
+        ConnClose(conn);
+        return;
+    }
+    if (len == 0) {
+        conn->peerClosed = true;
+    } else {
+        if (conn->state == CONN_SKIP_DATA) {
+            int n = MIN(conn->skipBytes, len);
+
+            conn->skipBytes -= n;
+            data            += n;
+            len             -= n;
+        }
+        if (!RecvBufAppend(&conn->in, data, len) || !ConnAdvance(conn)) {
+            ConnClose(conn);
+            return;
+        }
+    }
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief io_uring callback once a send to a client completed.
+ *
+ **************************************************************************
+ */
+static void
+ConnSent(EventLoop *loop,   // IN
+         void *arg,         // IN
+         int res)           // IN
+{
+    Conn *conn = arg;
+
+    if (res < 0) {
+        Error("write error: %d\n", -res);
+        ConnClose(conn);
+        return;
+    }
+    OutQueueConsume(&conn->out, res);
+    ConnFlush(conn);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Serve a connected socket on loop.  Returns NULL, with the socket
+ * closed, on failure.
+ *
+ **************************************************************************
+ */
+static Conn *
+ConnAdd(EventLoop *loop,  // IN
+        int sd)           // IN
+{
+    struct sockaddr_storage cliAddr;
+    socklen_t cliAddrLen;
+    Conn *conn;
+    int one = 1;
+
+    cliAddrLen = sizeof cliAddr;
+    if (getpeername(sd, (struct sockaddr *)&cliAddr, &cliAddrLen) < 0) {
+        perror("Failed to get peer address info for client socket");
+        close(sd);
+        return NULL;
+    }
+
+    if (!SetNonBlocking(sd)) {
+        close(sd);
+        return NULL;
+    }
+
+    /*
+     * Replies are already gathered into as few writes as possible; Nagle
+     * would only hold back the tail of a pipelined batch until the
+     * client's delayed ACK.
+     */
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    conn = SlabAlloc(&connCache);
+    if (conn == NULL) {
+        Error("Failed to allocate state for client socket %d\n", sd);
+        close(sd);
+        return NULL;
+    }
+    memset(conn, 0, sizeof *conn);
+    conn->loop  = loop;
+    conn->state = CONN_READ_HDR;
+    conn->stream.src.fd   = sd;
+    conn->stream.src.func = ConnEvent;
+    conn->stream.src.arg  = conn;
+    conn->stream.recv     = ConnReceived;
+    conn->stream.sent     = ConnSent;
+    conn->stream.closed   = ConnFree;
+    RecvBufInit(&conn->in);
+    OutQueueInit(&conn->out);
+    conn->walWait.loop      = loop;
+    conn->walWait.task.func = ConnWalDurable;
+    conn->walWait.task.arg  = conn;
+    conn->flushTask.func    = ConnContinue;
+    conn->flushTask.arg     = conn;
+    conn->timer.func        = ConnTimeout;
+    conn->timer.arg         = conn;
+    if (useZeroCopy && loop->backend == EVENT_BACKEND_EPOLL) {
+        OutQueueEnableZeroCopy(&conn->out, sd);
+    }
+
+    SocketAddrToString6((const struct sockaddr *)&cliAddr,
+                        conn->cliName, sizeof conn->cliName);
+
+    Log("\nClient %s (sock=%u) connected\n", conn->cliName, sd);
+
+    if (!EventStreamAdd(loop, &conn->stream)) {
+        close(sd);
+        SlabFree(&connCache, conn);
+        return NULL;
+    }
+    ConnSetTimer(conn);
+    StatsInc(STATS_ACCEPTED);
+    return conn;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start serving requests from a newly accepted client.
+ *
+ * The client stays connected across requests until it closes the socket.
+ *
+ **************************************************************************
+ */
+void
+ServerAddClient(EventLoop *loop,  // IN
+                int sd)           // IN
+{
+    ConnAdd(loop, sd);
+}
@@ -10,15 +10,57 @@
 #ifndef _SERVER_H_
 #define _SERVER_H_
 
+#include <stdio.h>
+
+#include "common.h"
+#include "eventloop.h"
+
+#define SERVER_DEFAULT_PUSH_DELAY_US   2000
+#define SERVER_DEFAULT_SUB_QUEUE       (1024 * 1024)
+#define SERVER_DEFAULT_SNAPSHOT_MB     64
+#define SERVER_DEFAULT_OUT_HIGH        (4 * 1024 * 1024)
+#define SERVER_DEFAULT_SLOW_TIMEOUT_S  30
+#define SERVER_DEFAULT_READ_TIMEOUT_S  30
+#define SERVER_DEFAULT_IDLE_TIMEOUT_S  300
+#define SERVER_FLUSH_BUDGET            (256 * 1024)  // Bytes per write turn
+
 /**
  * The server command line arguments.
  */
 typedef struct ServerArgs {
     unsigned short listenPort;
+    int            numThreads;     // Event loop threads, one listener each
+    bool           pinThreads;     // Pin thread i to CPU i
+    bool           shard;          // Each board is served by one thread
+    size_t         boardMemLimit;  // Bytes of board data across all boards
+    bool           zeroCopy;       // Send large replies with MSG_ZEROCOPY
+    bool           ioUring;        // Use the io_uring backend
+    long           pushDelayUs;    // Window for coalescing pushed changes
+    int            subQueueLimit;  // Output bytes a subscriber may lag by
+    bool           kickSlowSubs;   // Close lagging subscribers
+    int            outHighWater;   // Pending output that pauses requests
+    int            outLowWater;    // Pending output that resumes them
+    int            slowTimeoutS;   // Output stuck this long: close
+    int            readTimeoutS;   // A request unfinished this long: close
+    int            idleTimeoutS;   // No request this long: close
+    const char    *walPath;        // Write-ahead log, or NULL
+    long           walWindowUs;    // Group commit window
+    size_t         snapshotBytes;  // Log size that triggers a snapshot
+    const char    *logPath;        // Log file, or NULL for stdout/stderr
+    LogLevel       logLevel;       // Least important lines logged
+    unsigned       logSample;      // Trace one request in logSample
+    size_t         replBacklog;    // Bytes of changes kept for followers
+    const char    *follow;         // HOST:PORT of the leader, or NULL
 } ServerArgs;
 
 void ParseArgs(int argc, char *argv[], ServerArgs *svrArgs);
-void Server(int sd);
+bool ServerInit(const ServerArgs *svrArgs);
+void ServerExit(void);
+bool ServerShardInit(EventLoop *loops[], int numLoops);
+bool ServerFollowStart(EventLoop *loop);
+void ServerFollowStop(void);
+void ServerAddClient(EventLoop *loop, int sd);
+void ServerPrintStats(FILE *f);
 
 #endif
 
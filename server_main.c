@@ -19,11 +19,30 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "common.h"
+#include "eventloop.h"
+#include "rcu.h"
+#include "shard.h"
 #include "server.h"
 
-static int            msock           = -1;
+/**
+ * An event loop thread with its own listen socket (SO_REUSEPORT when
+ * there are several).
+ */
+typedef struct Worker {
+    int            id;
+    pthread_t      thread;
+    int            msock;
+    int            cpu;          // CPU to pin to, or -1
+    EventLoop      loop;
+    EventAcceptor  acceptor;
+} Worker;
+
+static Worker        *workers         = NULL;
+static int            numWorkers      = 0;
 static volatile bool  listenerRunning = true;
 
 
@@ -37,26 +56,70 @@ static volatile bool  listenerRunning = true;
 static void
 SignalHandler(int signo)
 {
+    int i;
+
     if (signo == SIGINT) {
-        if (msock > 0) {
-            shutdown(msock, SHUT_RDWR);
-        }
         listenerRunning = false;
+        for (i = 0; i < numWorkers; i++) {
+            if (workers[i].msock > 0) {
+                shutdown(workers[i].msock, SHUT_RDWR);
+            }
+            EventLoopWake(&workers[i].loop);
+        }
     }
 }
 
 
+/**
+ **************************************************************************
+ *
+ * \brief Dump the server metrics to stdout on every SIGUSR1.
+ *
+ * SIGUSR1 is blocked in every other thread, so it is taken here with
+ * sigwait() and the dump runs as ordinary code rather than in a signal
+ * handler.
+ *
+ **************************************************************************
+ */
+static void *
+StatsSignalLoop(void *arg)  // IN
+{
+    const sigset_t *sigs = arg;
+    int signo;
+
+    for (;;) {
+        if (sigwait(sigs, &signo) != 0) {
+            continue;
+        }
+        Log("\n");
+        ServerPrintStats(stdout);
+        Log("\n");
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+
 /**
  **************************************************************************
  *
  * \brief Create a TCP listen socket on the given port.
  *
+ * With several workers, SO_REUSEPORT lets each bind its own socket to the
+ * same port and have the kernel spread incoming connections across
+ * them.  A single worker leaves it off, so a second server started on
+ * the port fails to bind instead of quietly taking half the clients.
+ * SO_REUSEADDR still lets a restarted server bind while connections of
+ * the previous one linger in TIME_WAIT.
+ *
  **************************************************************************
  */
 static int
-CreatePassiveTCP6(unsigned port)
+CreatePassiveTCP6(unsigned port,     // IN
+                  bool reusePort)    // IN
 {
     int msock;
+    int on = 1;
     struct sockaddr_in6 svrAddr;
 
     msock = socket(AF_INET6, SOCK_STREAM, 0);
@@ -65,6 +128,16 @@ CreatePassiveTCP6(unsigned port)
         exit(EXIT_FAILURE);
     }
 
+    if (setsockopt(msock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) < 0) {
+        perror("Failed to set SO_REUSEADDR on the listen socket");
+        exit(EXIT_FAILURE);
+    }
+    if (reusePort &&
+        setsockopt(msock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) < 0) {
+        perror("Failed to set SO_REUSEPORT on the listen socket");
+        exit(EXIT_FAILURE);
+    }
+
     memset(&svrAddr, 0, sizeof(svrAddr));
     svrAddr.sin6_family = AF_INET6;
     svrAddr.sin6_port   = htons(port);
@@ -75,11 +148,15 @@ CreatePassiveTCP6(unsigned port)
         exit(EXIT_FAILURE);
     }
 
-    if (listen(msock, 10) < 0) {
+    if (listen(msock, SOMAXCONN) < 0) {
         perror("Failed to listen for connections");
         exit(EXIT_FAILURE);
     }
 
+    if (!SetNonBlocking(msock)) {
+        exit(EXIT_FAILURE);
+    }
+
     return msock;
 }
 
@@ -104,7 +181,8 @@ ValidateClientSocket(int ssock)   // IN
     char cliName[INET6_ADDRSTRLEN + PORT_STRLEN];
 
     if (ssock < 0) {
-        if (listenerRunning && errno != EINTR) {
+        if (listenerRunning && errno != EINTR &&
+            errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("Failed to accept a connection");
             listenerRunning = false;
         }
@@ -138,24 +216,57 @@ ValidateClientSocket(int ssock)   // IN
 /**
  **************************************************************************
  *
- * \brief The server loop to accept new client connections.
+ * \brief Accept callback for the listen socket: serve the new client.
  *
  **************************************************************************
  */
 static void
-ServerListenerLoop(void)
+AcceptEvent(EventLoop *loop,   // IN
+            void *arg,         // IN
+            int ssock)         // IN
 {
-    while (listenerRunning) {
-        int ssock;
-        struct sockaddr_storage cliAddr;
-        socklen_t cliAddrLen = sizeof cliAddr;
+    if (ValidateClientSocket(ssock)) {
+        ServerAddClient(loop, ssock);
+    }
+}
 
-        ssock = accept(msock, (struct sockaddr *)&cliAddr, &cliAddrLen);
 
-        if (ValidateClientSocket(ssock)) {
-            Server(ssock);
+/**
+ **************************************************************************
+ *
+ * \brief The worker thread loop to accept and serve client connections.
+ *
+ **************************************************************************
+ */
+static void *
+ServerListenerLoop(void *arg)  // IN
+{
+    Worker *worker = arg;
+
+    ShardThreadInit(worker->id);
+    if (worker->cpu >= 0) {
+        cpu_set_t cpus;
+        int err;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if (err != 0) {
+            Error("Failed to pin worker %d to CPU %d: %s\n",
+                  worker->id, worker->cpu, strerror(err));
         }
     }
+
+    worker->acceptor.src.fd = worker->msock;
+    worker->acceptor.func   = AcceptEvent;
+    worker->acceptor.arg    = worker;
+    if (!EventLoopListen(&worker->loop, &worker->acceptor)) {
+        exit(EXIT_FAILURE);
+    }
+
+    EventLoopRun(&worker->loop, &listenerRunning);
+    RcuThreadOffline();
+    return NULL;
 }
 
 
@@ -171,21 +282,106 @@ main(int argc,      // IN
      char *argv[])  // IN
 {
     ServerArgs svrArgs;
+    EventBackend backend;
+    static sigset_t statsSigs;
+    pthread_t statsThread;
+    int numCpus;
+    int i;
 
-    signal(SIGINT, SignalHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Block SIGUSR1 before any thread starts so all of them inherit it. */
+    sigemptyset(&statsSigs);
+    sigaddset(&statsSigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &statsSigs, NULL);
 
     ParseArgs(argc, argv, &svrArgs);
+    if (!ServerInit(&svrArgs)) {
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&statsThread, NULL, StatsSignalLoop, &statsSigs) != 0) {
+        Error("Failed to start the stats thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(statsThread);
+
+    workers = calloc(svrArgs.numThreads, sizeof *workers);
+    if (workers == NULL) {
+        Error("Failed to allocate %d workers\n", svrArgs.numThreads);
+        exit(EXIT_FAILURE);
+    }
+
+    numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    backend = svrArgs.ioUring ? EVENT_BACKEND_URING : EVENT_BACKEND_EPOLL;
+    for (i = 0; i < svrArgs.numThreads; i++) {
+        Worker *worker = &workers[i];
+
+        worker->id    = i;
+        worker->cpu   = svrArgs.pinThreads ? i % numCpus : -1;
+        worker->msock = CreatePassiveTCP6(svrArgs.listenPort,
+                                          svrArgs.numThreads > 1);
+        if (!EventLoopInit(&worker->loop, backend)) {
+            if (backend != EVENT_BACKEND_URING) {
+                exit(EXIT_FAILURE);
+            }
+            Error("io_uring is not available, falling back to epoll\n");
+            backend = EVENT_BACKEND_EPOLL;
+            if (!EventLoopInit(&worker->loop, backend)) {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    numWorkers = svrArgs.numThreads;
+
+    if (svrArgs.shard && numWorkers > 1) {
+        EventLoop **loops = malloc(numWorkers * sizeof *loops);
 
-    msock = CreatePassiveTCP6(svrArgs.listenPort);
+        if (loops == NULL) {
+            Error("Failed to allocate %d loops\n", numWorkers);
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < numWorkers; i++) {
+            loops[i] = &workers[i].loop;
+        }
+        if (!ServerShardInit(loops, numWorkers)) {
+            exit(EXIT_FAILURE);
+        }
+        free(loops);
+    }
+
+    if (svrArgs.follow != NULL && !ServerFollowStart(&workers[0].loop)) {
+        exit(EXIT_FAILURE);
+    }
 
-    Log("\nServer started listening at *:%u\n", svrArgs.listenPort);
+    signal(SIGINT, SignalHandler);
+
+    Log("\nServer started listening at *:%u with %d %s thread(s)\n",
+        svrArgs.listenPort, numWorkers,
+        backend == EVENT_BACKEND_URING ? "io_uring" : "epoll");
+    if (svrArgs.shard && numWorkers > 1) {
+        Log("Boards are sharded across the threads\n");
+    }
     Log("Press Ctrl-C to stop the server.\n\n");
 
-    ServerListenerLoop();
+    for (i = 0; i < numWorkers; i++) {
+        int err = pthread_create(&workers[i].thread, NULL,
+                                 ServerListenerLoop, &workers[i]);
+        if (err != 0) {
+            Error("Failed to start worker %d: %s\n", i, strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    close(msock);
+    for (i = 0; i < numWorkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    ServerFollowStop();
+    for (i = 0; i < numWorkers; i++) {
+        EventLoopDestroy(&workers[i].loop);
+        close(workers[i].msock);
+    }
     Log("Server stopped listening at *:%u\n", svrArgs.listenPort);
+    ServerExit();
 
     return 0;
 }
-
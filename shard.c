@@ -0,0 +1,317 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "common.h"
+#include "shard.h"
+#include "stats.h"
+
+#define SHARD_RING_MASK   (SHARD_RING_SIZE - 1)
+
+/**
+ * A bounded ring of messages from one loop to another.  The producer and
+ * the consumer each write only their own index, on their own cache line;
+ * the producer re-reads the consumer's index only when its cached copy
+ * says the ring is full.
+ */
+typedef struct ShardRing {
+    _Alignas(64) _Atomic unsigned long tail;   // Written by the producer
+    unsigned long                      headCache;
+    _Alignas(64) _Atomic unsigned long head;   // Written by the consumer
+    _Alignas(64) ShardMsg             *slots[SHARD_RING_SIZE];
+} ShardRing;
+
+/**
+ * Everything from shard from to shard to.  drainTask runs on the loop of
+ * to and retryTask on the loop of from; overflow is only touched by from.
+ */
+typedef struct ShardChannel {
+    ShardRing     ring;
+    int           from;
+    int           to;
+    atomic_bool   drainPosted;   // drainTask posted and not started
+    EventTask     drainTask;
+    atomic_bool   full;          // The producer waits for room
+    EventTask     retryTask;
+    ShardMsg     *overflow;
+    ShardMsg    **overflowTail;
+} ShardChannel;
+
+static ShardChannel   *shardChannels;   // [from * shardCount + to]
+static EventLoop     **shardLoops;
+static int             shardCount;
+static ShardRecvFunc   shardRecv;
+static __thread int    shardSelf = -1;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Queue a message, unless the ring is full.
+ *
+ **************************************************************************
+ */
+static bool
+ShardRingPush(ShardRing *r,     // IN/OUT
+              ShardMsg *msg)    // IN
+{
+    unsigned long tail = atomic_load_explicit(&r->tail,
+                                              memory_order_relaxed);
+
+    if (tail - r->headCache == SHARD_RING_SIZE) {
+        r->headCache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail - r->headCache == SHARD_RING_SIZE) {
+            return false;
+        }
+    }
+    r->slots[tail & SHARD_RING_MASK] = msg;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take the oldest message, or NULL if the ring is empty.
+ *
+ **************************************************************************
+ */
+static ShardMsg *
+ShardRingPop(ShardRing *r)  // IN/OUT
+{
+    unsigned long head = atomic_load_explicit(&r->head,
+                                              memory_order_relaxed);
+    ShardMsg *msg;
+
+    if (head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+        return NULL;
+    }
+    msg = r->slots[head & SHARD_RING_MASK];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return msg;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Wake the receiving loop, unless it is already going to drain.
+ *
+ **************************************************************************
+ */
+static void
+ShardDoorbell(ShardChannel *ch)  // IN
+{
+    if (!atomic_exchange(&ch->drainPosted, true)) {
+        EventLoopPost(shardLoops[ch->to], &ch->drainTask, 0);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Move the overflow list into the ring as far as it goes.
+ *
+ * If the ring fills up, full asks the consumer to post retryTask once
+ * it drained.  The flag is raised before the last attempt, so a drain
+ * that finished just before is not missed.
+ *
+ **************************************************************************
+ */
+static void
+ShardFlushOverflow(ShardChannel *ch)  // IN/OUT
+{
+    bool pushed = false;
+
+    while (ch->overflow != NULL) {
+        ShardMsg *msg = ch->overflow;
+
+        if (!ShardRingPush(&ch->ring, msg)) {
+            atomic_store(&ch->full, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (!ShardRingPush(&ch->ring, msg)) {
+                break;
+            }
+        }
+        ch->overflow = msg->next;
+        if (ch->overflow == NULL) {
+            ch->overflowTail = &ch->overflow;
+        }
+        pushed = true;
+    }
+    if (pushed) {
+        ShardDoorbell(ch);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task on the receiving loop: handle every queued message.
+ *
+ **************************************************************************
+ */
+static void
+ShardDrain(EventLoop *loop,   // IN
+           void *arg)         // IN
+{
+    ShardChannel *ch = arg;
+    ShardMsg *msg;
+
+    /* Messages queued from here on ring again. */
+    atomic_store(&ch->drainPosted, false);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while ((msg = ShardRingPop(&ch->ring)) != NULL) {
+        shardRecv(loop, msg);
+    }
+    if (atomic_exchange(&ch->full, false)) {
+        EventLoopPost(shardLoops[ch->from], &ch->retryTask, 0);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Task on the sending loop once a full ring has room again.
+ *
+ **************************************************************************
+ */
+static void
+ShardRetry(EventLoop *loop,   // IN
+           void *arg)         // IN
+{
+    ShardFlushOverflow(arg);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Connect numShards loops with each other.
+ *
+ * Called before any of the loops runs.  recv is called on the loop of
+ * the receiving shard with every message sent to it.
+ *
+ **************************************************************************
+ */
+bool
+ShardInit(EventLoop *loops[],      // IN
+          int numShards,           // IN
+          ShardRecvFunc recv)      // IN
+{
+    size_t size = (size_t)numShards * numShards * sizeof *shardChannels;
+    int i;
+
+    shardChannels = aligned_alloc(64, (size + 63) & ~(size_t)63);
+    shardLoops    = malloc(numShards * sizeof *shardLoops);
+    if (shardChannels == NULL || shardLoops == NULL) {
+        Error("Failed to allocate the shard queues\n");
+        free(shardChannels);
+        free(shardLoops);
+        return false;
+    }
+    memset(shardChannels, 0, size);
+
+    for (i = 0; i < numShards * numShards; i++) {
+        ShardChannel *ch = &shardChannels[i];
+
+        ch->from           = i / numShards;
+        ch->to             = i % numShards;
+        ch->drainTask.func = ShardDrain;
+        ch->drainTask.arg  = ch;
+        ch->retryTask.func = ShardRetry;
+        ch->retryTask.arg  = ch;
+        ch->overflowTail   = &ch->overflow;
+    }
+    memcpy(shardLoops, loops, numShards * sizeof *shardLoops);
+    shardRecv  = recv;
+    shardCount = numShards;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make the calling thread the one running the loop of shard id.
+ *
+ **************************************************************************
+ */
+void
+ShardThreadInit(int id)  // IN
+{
+    shardSelf = id;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The shard of the calling thread, or -1.
+ *
+ **************************************************************************
+ */
+int
+ShardSelf(void)
+{
+    return shardSelf;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The number of shards; 0 unless the server is sharded.
+ *
+ **************************************************************************
+ */
+int
+ShardCount(void)
+{
+    return shardCount;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send a message from the calling shard to shard to.
+ *
+ * Messages between two shards arrive in the order they were sent.  The
+ * receiver owns msg from here on.
+ *
+ **************************************************************************
+ */
+void
+ShardSend(int to,          // IN
+          ShardMsg *msg)   // IN
+{
+    ShardChannel *ch = &shardChannels[shardSelf * shardCount + to];
+
+    msg->from = shardSelf;
+    msg->next = NULL;
+    if (ch->overflow == NULL && ShardRingPush(&ch->ring, msg)) {
+        ShardDoorbell(ch);
+        return;
+    }
+
+    StatsInc(STATS_SHARD_QUEUE_FULL);
+    *ch->overflowTail = msg;
+    ch->overflowTail  = &msg->next;
+    ShardFlushOverflow(ch);
+}
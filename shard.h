@@ -0,0 +1,44 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include <stdbool.h>
+
+#include "eventloop.h"
+
+/*
+ * Messages between the event loops of a sharded server.  Every ordered
+ * pair of loops has a lock-free single-producer single-consumer ring;
+ * the receiving loop is only woken when its ring goes from idle to busy,
+ * and drains everything queued by then in one go.  A message that finds
+ * the ring full waits on an overflow list of the sender until the
+ * receiver has made room, so sending never fails or blocks.
+ */
+
+#define SHARD_RING_SIZE   1024   // Messages per pair of loops (power of 2)
+
+/**
+ * The start of every message.
+ */
+typedef struct ShardMsg {
+    struct ShardMsg  *next;   // On the overflow list
+    int               from;   // Shard that sent it
+} ShardMsg;
+
+typedef void (*ShardRecvFunc)(EventLoop *loop, ShardMsg *msg);
+
+bool ShardInit(EventLoop *loops[], int numShards, ShardRecvFunc recv);
+void ShardThreadInit(int id);
+int  ShardSelf(void);
+int  ShardCount(void);
+void ShardSend(int to, ShardMsg *msg);
+
+#endif
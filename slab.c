@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "slab.h"
+
+static _Atomic(SlabThread *) slabThreads = NULL;
+static pthread_mutex_t       slabLock    = PTHREAD_MUTEX_INITIALIZER;
+static SlabCache            *slabCaches[SLAB_MAX_CACHES];
+static int                   slabNumCaches;
+__thread SlabThread         *slabSelf    = NULL;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate the calling thread's free lists.
+ *
+ * Records are never freed: objects on the lists of a thread that exited
+ * are lost, but its slabs stay counted.
+ *
+ **************************************************************************
+ */
+SlabThread *
+SlabThreadRegister(void)
+{
+    SlabThread *t = calloc(1, sizeof *t);
+
+    if (t == NULL) {
+        Error("Failed to allocate a slab thread record\n");
+        abort();
+    }
+
+    t->next = atomic_load(&slabThreads);
+    while (!atomic_compare_exchange_weak(&slabThreads, &t->next, t)) {
+        continue;
+    }
+    slabSelf = t;
+    return t;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Give a cache its slot in the per-thread lists.
+ *
+ **************************************************************************
+ */
+int
+SlabCacheRegister(SlabCache *cache)  // IN/OUT
+{
+    pthread_mutex_lock(&slabLock);
+    if (cache->id < 0) {
+        if (slabNumCaches == SLAB_MAX_CACHES) {
+            Error("Too many slab caches\n");
+            abort();
+        }
+        slabCaches[slabNumCaches] = cache;
+        cache->id = slabNumCaches++;
+    }
+    pthread_mutex_unlock(&slabLock);
+    return cache->id;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Carve a new slab into objects for an empty free list.
+ *
+ * Returns the new head of the list, or NULL if memory ran out.
+ *
+ **************************************************************************
+ */
+void *
+SlabGrow(SlabCache *cache,   // IN
+         SlabList *list)     // IN/OUT
+{
+    size_t size  = (cache->size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+    size_t count = MAX(SLAB_SIZE / size, 1);
+    char *slab;
+    size_t i;
+
+    slab = aligned_alloc(SLAB_ALIGN, count * size);
+    if (slab == NULL) {
+        Error("Failed to allocate a slab of %s\n", cache->name);
+        return NULL;
+    }
+    for (i = count; i-- > 0; ) {
+        void *obj = slab + i * size;
+
+        *(void **)obj = list->free;
+        list->free    = obj;
+    }
+    list->bytes += count * size;
+    return list->free;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the memory of every cache, summed over all threads.
+ *
+ * In the same "name value" format as StatsPrint(): the bytes carved into
+ * slabs and the objects allocated from them.
+ *
+ **************************************************************************
+ */
+void
+SlabPrint(FILE *f)  // IN
+{
+    int n, i;
+
+    pthread_mutex_lock(&slabLock);
+    n = slabNumCaches;
+    pthread_mutex_unlock(&slabLock);
+
+    for (i = 0; i < n; i++) {
+        SlabThread *t;
+        uint64_t bytes = 0;
+        int64_t inUse = 0;
+
+        for (t = atomic_load(&slabThreads); t != NULL; t = t->next) {
+            bytes += t->lists[i].bytes;
+            inUse += t->lists[i].inUse;
+        }
+        fprintf(f, "slab_bytes{cache=\"%s\"} %llu\n", slabCaches[i]->name,
+                (unsigned long long)bytes);
+        fprintf(f, "slab_objects{cache=\"%s\"} %lld\n", slabCaches[i]->name,
+                (long long)inUse);
+    }
+}
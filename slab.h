@@ -0,0 +1,108 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A per-thread slab allocator for the fixed-size objects connections are
+ * made of.  Each cache hands out objects of one size from a free list of
+ * the calling thread, carving SLAB_SIZE bytes at a time from malloc when
+ * it runs dry, so allocating and freeing take no lock and touch no
+ * memory other threads use.  An object may be freed by any thread; it
+ * joins that thread's list.  Slabs are never given back: the memory a
+ * burst of connections needed waits for the next burst.
+ */
+
+#define SLAB_SIZE         (256 * 1024)   // Bytes carved at a time
+#define SLAB_ALIGN        64             // Objects start on a cache line
+#define SLAB_MAX_CACHES   16
+
+/**
+ * A kind of object.  Declare one statically with SLAB_CACHE(); it is
+ * registered the first time it is used.
+ */
+typedef struct SlabCache {
+    const char  *name;
+    size_t       size;
+    int          id;
+} SlabCache;
+
+#define SLAB_CACHE(name, size)   { (name), (size), -1 }
+
+/**
+ * The free list of one cache in one thread.  inUse is what the thread
+ * allocated minus what it freed, so only the sum over threads is
+ * meaningful.
+ */
+typedef struct SlabList {
+    void     *free;
+    int64_t   inUse;
+    uint64_t  bytes;    // Carved into objects of this cache
+} SlabList;
+
+typedef struct SlabThread {
+    struct SlabThread *next;
+    SlabList           lists[SLAB_MAX_CACHES];
+} SlabThread;
+
+extern __thread SlabThread *slabSelf;
+
+SlabThread *SlabThreadRegister(void);
+int         SlabCacheRegister(SlabCache *cache);
+void       *SlabGrow(SlabCache *cache, SlabList *list);
+void        SlabPrint(FILE *f);
+
+static inline SlabList *
+SlabListOf(SlabCache *cache)
+{
+    SlabThread *self = slabSelf != NULL ? slabSelf : SlabThreadRegister();
+    int id = cache->id >= 0 ? cache->id : SlabCacheRegister(cache);
+
+    return &self->lists[id];
+}
+
+/*
+ * Take an object of the cache, or NULL if memory ran out.  The object is
+ * not cleared.
+ */
+static inline void *
+SlabAlloc(SlabCache *cache)
+{
+    SlabList *list = SlabListOf(cache);
+    void *obj = list->free;
+
+    if (obj == NULL && (obj = SlabGrow(cache, list)) == NULL) {
+        return NULL;
+    }
+    list->free = *(void **)obj;
+    list->inUse++;
+    return obj;
+}
+
+static inline void
+SlabFree(SlabCache *cache,
+         void *obj)
+{
+    SlabList *list;
+
+    if (obj == NULL) {
+        return;
+    }
+    list = SlabListOf(cache);
+    *(void **)obj = list->free;
+    list->free    = obj;
+    list->inUse--;
+}
+
+#endif
@@ -0,0 +1,271 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "board.h"
+#include "snapshot.h"
+
+/**
+ * The boards found by SnapshotCollect.
+ */
+typedef struct EntryList {
+    BoardEntry **entries;
+    size_t       count;
+    size_t       cap;
+    bool         failed;
+} EntryList;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add an entry to an EntryList.  A BoardEntryFunc.
+ *
+ **************************************************************************
+ */
+static void
+SnapshotCollect(BoardEntry *entry,  // IN
+                void *arg)          // IN
+{
+    EntryList *list = arg;
+
+    if (list->count == list->cap) {
+        size_t cap = MAX(list->cap * 2, 1024);
+        BoardEntry **entries = realloc(list->entries, cap * sizeof *entries);
+
+        if (entries == NULL) {
+            list->failed = true;
+            return;
+        }
+        list->entries = entries;
+        list->cap     = cap;
+    }
+    list->entries[list->count++] = entry;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write one board to a snapshot file.
+ *
+ * The contents come straight out of an immutable version, so writers
+ * carry on meanwhile.
+ *
+ **************************************************************************
+ */
+static bool
+SnapshotWriteBoard(FILE *f,             // IN
+                   BoardEntry *entry)   // IN
+{
+    SnapshotBoard rec;
+    BoardVersion *v;
+    BoardCursor cur;
+    const char *data;
+    int n;
+    bool ok;
+
+    v = BoardSnapshot(&entry->board);
+
+    memset(&rec, 0, sizeof rec);
+    memcpy(rec.title, entry->title, strnlen(entry->title, sizeof rec.title));
+    rec.seq      = v->seq;
+    rec.dataSize = v->dataSize;
+    ok = fwrite(&rec, sizeof rec, 1, f) == 1;
+
+    BoardCursorInit(&cur, v);
+    while (ok && (n = BoardCursorNext(&cur, &data)) > 0) {
+        ok = fwrite(data, 1, n, f) == n;
+    }
+
+    BoardRelease(v);
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Save every board to path.
+ *
+ * Each board is saved as it is when reached, so a change made meanwhile
+ * may or may not be included; its log record carries the version it
+ * produced, which tells replay whether to apply it.  The file is written
+ * next to path and renamed over it once synced, so a crash leaves the
+ * previous snapshot in place.
+ *
+ **************************************************************************
+ */
+bool
+SnapshotWrite(const char *path,    // IN
+              BoardTable *table)   // IN
+{
+    EntryList list;
+    SnapshotHdr hdr;
+    char *tmpPath;
+    FILE *f;
+    size_t i;
+    bool ok;
+
+    memset(&list, 0, sizeof list);
+    BoardTableForEach(table, SnapshotCollect, &list);
+    if (list.failed) {
+        Error("Failed to allocate the list of boards to save\n");
+        free(list.entries);
+        return false;
+    }
+
+    if (asprintf(&tmpPath, "%s.tmp", path) < 0) {
+        free(list.entries);
+        return false;
+    }
+    f = fopen(tmpPath, "we");
+    if (f == NULL) {
+        Error("Failed to create %s: %s\n", tmpPath, strerror(errno));
+        free(tmpPath);
+        free(list.entries);
+        return false;
+    }
+
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof hdr.magic);
+    hdr.numBoards = list.count;
+    ok = fwrite(&hdr, sizeof hdr, 1, f) == 1;
+    for (i = 0; ok && i < list.count; i++) {
+        ok = SnapshotWriteBoard(f, list.entries[i]);
+    }
+    ok = fflush(f) == 0 && ok;
+    ok = ok && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmpPath, path) == 0;
+
+    if (ok) {
+        int dfd;
+        char *slash = strrchr(tmpPath, '/');
+
+        /* Make the rename durable before the log it covers goes away. */
+        if (slash == NULL) {
+            strcpy(tmpPath, ".");
+        } else {
+            slash[slash == tmpPath ? 1 : 0] = '\0';
+        }
+        dfd = open(tmpPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ok = dfd >= 0 && fsync(dfd) == 0;
+        if (dfd >= 0) {
+            close(dfd);
+        }
+    } else {
+        Error("Failed to write snapshot %s: %s\n", path, strerror(errno));
+        unlink(tmpPath);
+    }
+
+    free(tmpPath);
+    free(list.entries);
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Load the boards saved in path, if it exists.
+ *
+ * The file is mapped and each board is copied into the chunk pool
+ * directly from the mapping.
+ *
+ **************************************************************************
+ */
+bool
+SnapshotLoad(const char *path,    // IN
+             BoardTable *table)   // IN
+{
+    struct stat st;
+    const char *map;
+    SnapshotHdr hdr;
+    size_t off;
+    uint64_t i;
+    bool ok = true;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        Error("Failed to open snapshot %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof hdr) {
+        Error("Snapshot %s is truncated\n", path);
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the snapshot");
+        return false;
+    }
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    memcpy(&hdr, map, sizeof hdr);
+    if (memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof hdr.magic) != 0) {
+        Error("%s is not a board snapshot\n", path);
+        munmap((void *)map, st.st_size);
+        return false;
+    }
+
+    off = sizeof hdr;
+    for (i = 0; ok && i < hdr.numBoards; i++) {
+        char title[MAX_TITLE_LEN + 1];
+        SnapshotBoard rec;
+        BoardEntry *entry;
+
+        if (st.st_size - off < sizeof rec) {
+            ok = false;
+            break;
+        }
+        memcpy(&rec, map + off, sizeof rec);
+        off += sizeof rec;
+        if (rec.dataSize > st.st_size - off || rec.dataSize > INT32_MAX) {
+            ok = false;
+            break;
+        }
+
+        memcpy(title, rec.title, MAX_TITLE_LEN);
+        title[MAX_TITLE_LEN] = '\0';
+        entry = BoardTableLookup(table, title, true);
+        if (entry == NULL ||
+            !BoardRestore(&entry->board, map + off, rec.dataSize, rec.seq)) {
+            Error("Board \"%s\" does not fit in the board memory limit\n",
+                  title);
+            munmap((void *)map, st.st_size);
+            return false;
+        }
+        off += rec.dataSize;
+    }
+    munmap((void *)map, st.st_size);
+
+    if (!ok) {
+        Error("Snapshot %s is truncated\n", path);
+        return false;
+    }
+    Log("Loaded %llu boards from %s\n", (unsigned long long)hdr.numBoards,
+        path);
+    return true;
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "boardtable.h"
+
+#define SNAPSHOT_MAGIC "BBSNAP1\n"
+
+/**
+ * Snapshot file header, followed by numBoards SnapshotBoard records.
+ */
+typedef struct SnapshotHdr {
+    char     magic[8];
+    uint64_t numBoards;
+} SnapshotHdr;
+
+/**
+ * A saved board: version seq of its contents, followed by dataSize bytes.
+ */
+typedef struct SnapshotBoard {
+    char     title[MAX_TITLE_LEN];
+    uint64_t seq;
+    uint64_t dataSize;
+} SnapshotBoard;
+
+bool SnapshotWrite(const char *path, BoardTable *table);
+bool SnapshotLoad(const char *path, BoardTable *table);
+
+#endif
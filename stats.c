@@ -0,0 +1,201 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "histogram.h"
+#include "stats.h"
+
+static const char *counterNames[STATS_NUM_COUNTERS] = {
+    [STATS_ACCEPTED]         = "connections_accepted",
+    [STATS_CLOSED]           = "connections_closed",
+    [STATS_PROTOCOL_ERRORS]  = "protocol_errors",
+    [STATS_SUBS_STALLED]     = "subscriber_pushes_stalled",
+    [STATS_SUBS_KICKED]      = "subscribers_kicked",
+    [STATS_LZ_REPLIES]       = "lz_replies",
+    [STATS_LZ_BYTES_SAVED]   = "lz_bytes_saved",
+    [STATS_READS_PAUSED]     = "reads_paused",
+    [STATS_READS_RESUMED]    = "reads_resumed",
+    [STATS_SLOW_CLOSED]      = "slow_consumers_closed",
+    [STATS_READ_TIMEOUTS]    = "read_timeouts",
+    [STATS_IDLE_CLOSED]      = "idle_closed",
+    [STATS_FLUSH_YIELDS]     = "flush_yields",
+    [STATS_SHARD_FORWARDED]  = "shard_requests_forwarded",
+    [STATS_SHARD_QUEUE_FULL] = "shard_queue_full",
+    [STATS_REPL_FULL]        = "repl_full_syncs",
+    [STATS_REPL_PARTIAL]     = "repl_partial_syncs",
+};
+
+static _Atomic(StatsThread *) statsThreads = NULL;
+static pthread_mutex_t        statsLock    = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec        statsStart;
+static struct timespec        statsLastPrint;
+static uint64_t               statsLastAccepted;
+__thread StatsThread         *statsSelf    = NULL;
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Seconds from a to b.
+ *
+ **************************************************************************
+ */
+static double
+Elapsed(const struct timespec *a,   // IN
+        const struct timespec *b)   // IN
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start the clock uptime and rates are measured from.
+ *
+ **************************************************************************
+ */
+void
+StatsInit(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &statsStart);
+    statsLastPrint = statsStart;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Allocate the calling thread's counters.
+ *
+ * Records are never freed, so the totals of threads that exited are
+ * still reported.
+ *
+ **************************************************************************
+ */
+StatsThread *
+StatsThreadRegister(void)
+{
+    StatsThread *t = calloc(1, sizeof *t);
+
+    if (t == NULL) {
+        Error("Failed to allocate a stats thread record\n");
+        abort();
+    }
+
+    t->next = atomic_load(&statsThreads);
+    while (!atomic_compare_exchange_weak(&statsThreads, &t->next, t)) {
+        continue;
+    }
+    statsSelf = t;
+    return t;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Print the totals of every thread, one "name value" per line.
+ *
+ * The format is the Prometheus text format, so the output can be scraped
+ * as it is.  Handler latencies are in microseconds.  accept_rate covers
+ * the time since the previous call.
+ *
+ **************************************************************************
+ */
+void
+StatsPrint(FILE *f)  // IN
+{
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    StatsThread *t, total;
+    Histogram *latency[STATS_MSG_TYPES];
+    struct timespec now;
+    double interval;
+    int i, j;
+
+    memset(&total, 0, sizeof total);
+    memset(latency, 0, sizeof latency);
+    for (t = atomic_load(&statsThreads); t != NULL; t = t->next) {
+        for (i = 0; i < STATS_NUM_COUNTERS; i++) {
+            total.counters[i] += t->counters[i];
+        }
+        for (i = 0; i < STATS_STATUSES; i++) {
+            total.statuses[i] += t->statuses[i];
+        }
+        for (i = 0; i < STATS_MSG_TYPES; i++) {
+            total.requests[i]   += t->requests[i];
+            total.reqBytes[i]   += t->reqBytes[i];
+            total.replyBytes[i] += t->replyBytes[i];
+            if (t->latency[i] == NULL) {
+                continue;
+            }
+            if (latency[i] == NULL && (latency[i] = HistAlloc()) == NULL) {
+                continue;
+            }
+            HistAdd(latency[i], t->latency[i]);
+        }
+    }
+
+    pthread_mutex_lock(&statsLock);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    interval = Elapsed(&statsLastPrint, &now);
+    fprintf(f, "uptime_seconds %.1f\n", Elapsed(&statsStart, &now));
+    fprintf(f, "connections_active %llu\n",
+            (unsigned long long)(total.counters[STATS_ACCEPTED] -
+                                 total.counters[STATS_CLOSED]));
+    fprintf(f, "accept_rate %.1f\n", interval > 0 ?
+            (total.counters[STATS_ACCEPTED] - statsLastAccepted) / interval :
+            0);
+    statsLastPrint    = now;
+    statsLastAccepted = total.counters[STATS_ACCEPTED];
+    pthread_mutex_unlock(&statsLock);
+
+    for (i = 0; i < STATS_NUM_COUNTERS; i++) {
+        fprintf(f, "%s %llu\n", counterNames[i],
+                (unsigned long long)total.counters[i]);
+    }
+    for (i = 0; i < STATS_STATUSES; i++) {
+        if (total.statuses[i] > 0) {
+            fprintf(f, "replies{status=\"%s\"} %llu\n", MsgStatusToString(i),
+                    (unsigned long long)total.statuses[i]);
+        }
+    }
+
+    for (i = 0; i < STATS_MSG_TYPES; i++) {
+        const char *type = MsgTypeToString(i);
+
+        if (total.requests[i] == 0) {
+            continue;
+        }
+        fprintf(f, "requests{type=\"%s\"} %llu\n", type,
+                (unsigned long long)total.requests[i]);
+        fprintf(f, "request_bytes{type=\"%s\"} %llu\n", type,
+                (unsigned long long)total.reqBytes[i]);
+        fprintf(f, "reply_bytes{type=\"%s\"} %llu\n", type,
+                (unsigned long long)total.replyBytes[i]);
+        if (latency[i] == NULL) {
+            continue;
+        }
+        for (j = 0; j < ARRAYSIZE(pcts); j++) {
+            fprintf(f, "latency_us{type=\"%s\",quantile=\"%g\"} %.1f\n",
+                    type, pcts[j] / 100,
+                    HistPercentile(latency[i], pcts[j]) / 1000.0);
+        }
+        fprintf(f, "latency_us{type=\"%s\",quantile=\"1\"} %.1f\n", type,
+                latency[i]->max / 1000.0);
+        HistFree(latency[i]);
+    }
+}
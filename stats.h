@@ -0,0 +1,116 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define STATS_MSG_TYPES   32   // Message types counted separately
+#define STATS_STATUSES    8    // Reply statuses counted separately
+
+typedef enum StatsCounter {
+    STATS_ACCEPTED,          // Connections accepted
+    STATS_CLOSED,            // Connections closed
+    STATS_PROTOCOL_ERRORS,   // Connections dropped over a malformed frame
+    STATS_SUBS_STALLED,      // Pushes held back from a lagging subscriber
+    STATS_SUBS_KICKED,       // Lagging subscribers disconnected
+    STATS_LZ_REPLIES,        // Boards sent compressed
+    STATS_LZ_BYTES_SAVED,    // Bytes compression kept off the wire
+    STATS_READS_PAUSED,      // Connections paused over the output limit
+    STATS_READS_RESUMED,     // Paused connections that caught up
+    STATS_SLOW_CLOSED,       // Clients closed for not reading replies
+    STATS_READ_TIMEOUTS,     // Clients closed mid-request
+    STATS_IDLE_CLOSED,       // Idle clients closed
+    STATS_FLUSH_YIELDS,      // Writes cut short to let others go first
+    STATS_SHARD_FORWARDED,   // Requests sent to the shard owning the board
+    STATS_SHARD_QUEUE_FULL,  // Messages that found a shard queue full
+    STATS_REPL_FULL,         // Followers sent a copy of every board
+    STATS_REPL_PARTIAL,      // Followers that carried on from the backlog
+    STATS_NUM_COUNTERS,
+} StatsCounter;
+
+/**
+ * The counters of one thread.  Only the owning thread writes them, with
+ * plain increments; StatsPrint() sums every thread's record without
+ * locking, so a dump may miss increments made while it runs but never
+ * slows the threads down.
+ */
+typedef struct StatsThread {
+    struct StatsThread *next;
+    uint64_t            counters[STATS_NUM_COUNTERS];
+    uint64_t            statuses[STATS_STATUSES];    // STATUS replies
+    uint64_t            requests[STATS_MSG_TYPES];
+    uint64_t            reqBytes[STATS_MSG_TYPES];   // Payload received
+    uint64_t            replyBytes[STATS_MSG_TYPES]; // Queued in reply
+    Histogram          *latency[STATS_MSG_TYPES];    // Handler ns
+} StatsThread;
+
+extern __thread StatsThread *statsSelf;
+
+void         StatsInit(void);
+StatsThread *StatsThreadRegister(void);
+void         StatsPrint(FILE *f);
+
+static inline StatsThread *
+StatsSelf(void)
+{
+    return statsSelf != NULL ? statsSelf : StatsThreadRegister();
+}
+
+static inline void
+StatsInc(StatsCounter c)
+{
+    StatsSelf()->counters[c]++;
+}
+
+static inline void
+StatsAdd(StatsCounter c,
+         uint64_t n)
+{
+    StatsSelf()->counters[c] += n;
+}
+
+static inline void
+StatsStatus(int status)
+{
+    if (status >= 0 && status < STATS_STATUSES) {
+        StatsSelf()->statuses[status]++;
+    }
+}
+
+/*
+ * Account for a request of the given type, handled in ns nanoseconds.
+ */
+static inline void
+StatsRequest(int type,
+             int reqBytes,
+             int replyBytes,
+             uint64_t ns)
+{
+    StatsThread *self = StatsSelf();
+
+    if (type < 0 || type >= STATS_MSG_TYPES) {
+        return;
+    }
+    self->requests[type]++;
+    self->reqBytes[type]   += reqBytes;
+    self->replyBytes[type] += replyBytes;
+    if (self->latency[type] == NULL) {
+        self->latency[type] = HistAlloc();
+    }
+    if (self->latency[type] != NULL) {
+        HistRecord(self->latency[type], ns);
+    }
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <string.h>
+
+#include "common.h"
+#include "timerwheel.h"
+
+#define TIMERWHEEL_MASK       (TIMERWHEEL_SLOTS - 1)
+
+/* Ticks covered by the levels below level. */
+#define TIMERWHEEL_SPAN(level)  (1ULL << ((level) * TIMERWHEEL_BITS))
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Initialize an empty wheel whose next tick is now.
+ *
+ **************************************************************************
+ */
+void
+TimerWheelInit(TimerWheel *w,     // OUT
+               uint64_t now)      // IN
+{
+    memset(w, 0, sizeof *w);
+    w->now = now;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Arm a timer to run at tick expires.
+ *
+ * An expiry already past runs on the next tick.  One beyond the top
+ * level is parked in the farthest slot and placed again from there.
+ * The timer must not be armed.
+ *
+ **************************************************************************
+ */
+void
+TimerWheelAdd(TimerWheel *w,       // IN/OUT
+              Timer *t,            // IN
+              uint64_t expires)    // IN
+{
+    uint64_t at;
+    Timer **slot;
+    int level;
+
+    if (expires < w->now) {
+        expires = w->now;
+    }
+    at = MIN(expires, w->now + TIMERWHEEL_SPAN(TIMERWHEEL_LEVELS) - 1);
+    for (level = 0; at - w->now >= TIMERWHEEL_SPAN(level + 1); level++) {
+        continue;
+    }
+    slot = &w->slots[level][(at >> (level * TIMERWHEEL_BITS)) &
+                            TIMERWHEEL_MASK];
+
+    t->expires = expires;
+    t->next    = *slot;
+    if (t->next != NULL) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = slot;
+    *slot    = t;
+    w->count++;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Disarm an armed timer.
+ *
+ **************************************************************************
+ */
+void
+TimerWheelRemove(TimerWheel *w,   // IN/OUT
+                 Timer *t)        // IN
+{
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next  = NULL;
+    t->pprev = NULL;
+    w->count--;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Move the timers of the level slot now comes up to further down.
+ *
+ **************************************************************************
+ */
+static void
+TimerWheelCascade(TimerWheel *w,   // IN/OUT
+                  int level)       // IN
+{
+    Timer **slot = &w->slots[level][(w->now >> (level * TIMERWHEEL_BITS)) &
+                                    TIMERWHEEL_MASK];
+    Timer *list = *slot;
+
+    *slot = NULL;
+    while (list != NULL) {
+        Timer *t = list;
+
+        list = t->next;
+        w->count--;
+        TimerWheelAdd(w, t, t->expires);
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Run every timer that expires up to and including tick now.
+ *
+ * Each timer is disarmed before its function runs, which may arm it
+ * again or add and remove any other timer.  An empty wheel just moves
+ * its clock.
+ *
+ **************************************************************************
+ */
+void
+TimerWheelAdvance(TimerWheel *w,    // IN/OUT
+                  uint64_t now)     // IN
+{
+    while (w->now <= now) {
+        Timer **slot;
+        Timer *batch;
+        int level;
+
+        if (w->count == 0) {
+            w->now = now + 1;
+            return;
+        }
+
+        for (level = 1; level < TIMERWHEEL_LEVELS &&
+                        (w->now & (TIMERWHEEL_SPAN(level) - 1)) == 0;
+             level++) {
+            TimerWheelCascade(w, level);
+        }
+
+        slot  = &w->slots[0][w->now & TIMERWHEEL_MASK];
+        batch = *slot;
+        *slot = NULL;
+        if (batch != NULL) {
+            batch->pprev = &batch;
+        }
+        w->now++;
+
+        while (batch != NULL) {
+            Timer *t = batch;
+
+            TimerWheelRemove(w, t);
+            t->func(t->arg);
+        }
+    }
+}
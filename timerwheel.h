@@ -0,0 +1,58 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A hierarchical timing wheel.  Time is counted in ticks; level 0 has a
+ * slot for each of the next TIMERWHEEL_SLOTS ticks, and each level above
+ * it slots as many spans of the level below.  A timer is linked into the
+ * slot of its expiry at the lowest level that reaches it and moved down
+ * as that slot comes up, so adding and removing a timer are O(1), and
+ * timers that are removed before they expire (the common case for
+ * timeouts) are never looked at again.
+ */
+
+#define TIMERWHEEL_BITS     6
+#define TIMERWHEEL_SLOTS    (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS   4
+
+typedef void (*TimerFunc)(void *arg);
+
+typedef struct Timer {
+    struct Timer   *next;
+    struct Timer  **pprev;     // NULL unless armed
+    uint64_t        expires;   // Tick
+    TimerFunc       func;
+    void           *arg;
+} Timer;
+
+typedef struct TimerWheel {
+    uint64_t   now;      // Next tick to expire
+    unsigned   count;    // Timers armed
+    Timer     *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+} TimerWheel;
+
+void TimerWheelInit(TimerWheel *w, uint64_t now);
+void TimerWheelAdd(TimerWheel *w, Timer *t, uint64_t expires);
+void TimerWheelRemove(TimerWheel *w, Timer *t);
+void TimerWheelAdvance(TimerWheel *w, uint64_t now);
+
+static inline bool
+TimerArmed(const Timer *t)
+{
+    return t->pprev != NULL;
+}
+
+#endif
@@ -0,0 +1,534 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "uring.h"
+
+#ifndef NO_URING
+
+#include <linux/io_uring.h>
+
+#define URING_BUF_GROUP  0
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Create the ring, preferring the flags that suit one event loop.
+ *
+ * Only the loop thread submits, so the kernel may run completion work
+ * when that thread next waits instead of interrupting it
+ * (DEFER_TASKRUN).  The loop is set up on another thread than the one
+ * that runs it, so the ring starts disabled and UringEnable() hands it to
+ * the loop thread.  Kernels before 6.1 get a plain ring.
+ *
+ **************************************************************************
+ */
+static int
+UringSetup(struct io_uring_params *p,  // OUT
+           bool *disabled)             // OUT
+{
+    static const unsigned flags[] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+        IORING_SETUP_R_DISABLED,
+        IORING_SETUP_CQSIZE,
+    };
+    int i, fd = -1;
+
+    for (i = 0; i < ARRAYSIZE(flags) && fd < 0; i++) {
+        memset(p, 0, sizeof *p);
+        p->flags      = flags[i];
+        p->cq_entries = URING_ENTRIES * URING_CQ_FACTOR;
+        fd = syscall(__NR_io_uring_setup, URING_ENTRIES, p);
+        *disabled = (flags[i] & IORING_SETUP_R_DISABLED) != 0;
+    }
+    return fd;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Register the provided buffer ring and fill it.
+ *
+ **************************************************************************
+ */
+static bool
+UringSetupBufs(Uring *ring)  // IN/OUT
+{
+    struct io_uring_buf_reg reg;
+    size_t size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    int i;
+
+    /* The kernel wants the ring page aligned. */
+    ring->bufRing = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->bufRing == MAP_FAILED) {
+        ring->bufRing = NULL;
+        return false;
+    }
+    ring->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (ring->bufs == NULL) {
+        return false;
+    }
+
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr    = (uintptr_t)ring->bufRing;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid         = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        return false;
+    }
+
+    for (i = 0; i < URING_BUF_COUNT; i++) {
+        UringBufRecycle(ring, i);
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Set up an io_uring with its rings mapped and buffers provided.
+ *
+ * Fails, with errno set, on kernels without io_uring or without the
+ * multishot receive and buffer rings of Linux 6.0.
+ *
+ **************************************************************************
+ */
+bool
+UringInit(Uring *ring)  // OUT
+{
+    struct io_uring_params p;
+    unsigned *array;
+    int i, err;
+
+    memset(ring, 0, sizeof *ring);
+    ring->fd = UringSetup(&p, &ring->disabled);
+    if (ring->fd < 0) {
+        return false;
+    }
+
+    ring->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = p.cq_off.cqes +
+                      p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqMapSize = MAX(ring->sqMapSize, ring->cqMapSize);
+    }
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+    if (ring->sqMap == MAP_FAILED) {
+        ring->sqMap = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqMap = ring->sqMap;
+    } else {
+        ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+        if (ring->cqMap == MAP_FAILED) {
+            ring->cqMap = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    ring->sqHead    = (unsigned *)((char *)ring->sqMap + p.sq_off.head);
+    ring->sqTail    = (unsigned *)((char *)ring->sqMap + p.sq_off.tail);
+    ring->sqMask    = *(unsigned *)((char *)ring->sqMap + p.sq_off.ring_mask);
+    ring->sqEntries = p.sq_entries;
+    ring->sqLocalTail = *ring->sqTail;
+    ring->cqHead    = (unsigned *)((char *)ring->cqMap + p.cq_off.head);
+    ring->cqTail    = (unsigned *)((char *)ring->cqMap + p.cq_off.tail);
+    ring->cqMask    = *(unsigned *)((char *)ring->cqMap + p.cq_off.ring_mask);
+    ring->cqes      = (struct io_uring_cqe *)((char *)ring->cqMap +
+                                              p.cq_off.cqes);
+
+    /* Slot i of the submission ring always holds SQE i. */
+    array = (unsigned *)((char *)ring->sqMap + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    if (!UringSetupBufs(ring)) {
+        goto fail;
+    }
+    return true;
+
+fail:
+    err = errno;
+    UringDestroy(ring);
+    errno = err;
+    return false;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Release everything a ring holds.
+ *
+ * Requests still in flight are cancelled by the kernel.
+ *
+ **************************************************************************
+ */
+void
+UringDestroy(Uring *ring)  // IN/OUT
+{
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqEntries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cqMap != NULL && ring->cqMap != ring->sqMap) {
+        munmap(ring->cqMap, ring->cqMapSize);
+    }
+    if (ring->sqMap != NULL) {
+        munmap(ring->sqMap, ring->sqMapSize);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    if (ring->bufRing != NULL) {
+        munmap(ring->bufRing, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    free(ring->bufs);
+    memset(ring, 0, sizeof *ring);
+    ring->fd = -1;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make the calling thread the one that submits to the ring.
+ *
+ **************************************************************************
+ */
+bool
+UringEnable(Uring *ring)  // IN/OUT
+{
+    if (!ring->disabled) {
+        return true;
+    }
+    if (syscall(__NR_io_uring_register, ring->fd,
+                IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+        return false;
+    }
+    ring->disabled = false;
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Submit the prepared requests and wait for waitNr completions.
+ *
+ * One system call does both.  Returns what io_uring_enter() returned.
+ *
+ **************************************************************************
+ */
+int
+UringSubmit(Uring *ring,      // IN/OUT
+            unsigned waitNr)  // IN
+{
+    unsigned pending;
+
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    pending = ring->sqLocalTail - __atomic_load_n(ring->sqHead,
+                                                  __ATOMIC_ACQUIRE);
+    if (pending == 0 && waitNr == 0) {
+        return 0;
+    }
+    return syscall(__NR_io_uring_enter, ring->fd, pending, waitNr,
+                   waitNr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Take the next completion, if there is one.
+ *
+ **************************************************************************
+ */
+bool
+UringNextCqe(Uring *ring,     // IN/OUT
+             UringCqe *cqe)   // OUT
+{
+    unsigned head = *ring->cqHead;
+    const struct io_uring_cqe *c;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    c = &ring->cqes[head & ring->cqMask];
+    cqe->data = c->user_data;
+    cqe->res  = c->res;
+    cqe->bid  = (c->flags & IORING_CQE_F_BUFFER) ?
+                (int)(c->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    cqe->more = (c->flags & IORING_CQE_F_MORE) != 0;
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The data of provided buffer bid.
+ *
+ **************************************************************************
+ */
+char *
+UringBuf(Uring *ring,  // IN
+         int bid)      // IN
+{
+    return ring->bufs + (size_t)bid * URING_BUF_SIZE;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Give buffer bid back to the kernel once its data was consumed.
+ *
+ **************************************************************************
+ */
+void
+UringBufRecycle(Uring *ring,  // IN/OUT
+                int bid)      // IN
+{
+    struct io_uring_buf *buf;
+
+    buf = &ring->bufRing->bufs[ring->bufTail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uintptr_t)UringBuf(ring, bid);
+    buf->len  = URING_BUF_SIZE;
+    buf->bid  = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Get a cleared submission entry, submitting first if all are in
+ * use.
+ *
+ **************************************************************************
+ */
+static struct io_uring_sqe *
+UringGetSqe(Uring *ring,     // IN/OUT
+            uint64_t data)   // IN
+{
+    struct io_uring_sqe *sqe;
+
+    while (ring->sqLocalTail - __atomic_load_n(ring->sqHead,
+                                               __ATOMIC_ACQUIRE) >=
+           ring->sqEntries) {
+        if (UringSubmit(ring, 0) < 0 && errno != EINTR) {
+            /* Nothing to do but wait for the kernel to catch up. */
+            sched_yield();
+        }
+    }
+    sqe = &ring->sqes[ring->sqLocalTail & ring->sqMask];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->user_data = data;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Watch fd for events until cancelled (multishot poll).
+ *
+ **************************************************************************
+ */
+void
+UringPrepPoll(Uring *ring,       // IN/OUT
+              int fd,            // IN
+              unsigned events,   // IN
+              uint64_t data)     // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, data);
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = events;
+    sqe->len           = IORING_POLL_ADD_MULTI;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Cancel the poll submitted with user data target.
+ *
+ * The removal itself completes with user data 0.
+ *
+ **************************************************************************
+ */
+void
+UringPrepPollRemove(Uring *ring,       // IN/OUT
+                    uint64_t target)   // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, 0);
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd     = -1;
+    sqe->addr   = target;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Cancel the request submitted with user data target.
+ *
+ * The request completes with -ECANCELED unless it already finished; the
+ * cancellation itself completes with user data 0.
+ *
+ **************************************************************************
+ */
+void
+UringPrepCancel(Uring *ring,       // IN/OUT
+                uint64_t target)   // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, 0);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd     = -1;
+    sqe->addr   = target;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Accept connections on fd until cancelled (multishot accept).
+ *
+ * Each completion carries one accepted socket.
+ *
+ **************************************************************************
+ */
+void
+UringPrepAccept(Uring *ring,     // IN/OUT
+                int fd,          // IN
+                uint64_t data)   // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, data);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd     = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Receive from fd into provided buffers until EOF or an error
+ * (multishot recv).
+ *
+ **************************************************************************
+ */
+void
+UringPrepRecv(Uring *ring,     // IN/OUT
+              int fd,          // IN
+              uint64_t data)   // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, data);
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Send msg on fd.
+ *
+ * MSG_WAITALL has the kernel retry a short send itself, so the request
+ * completes once every byte is in the socket or the socket failed.  msg
+ * and its iovecs must stay valid until the completion.
+ *
+ **************************************************************************
+ */
+void
+UringPrepSendMsg(Uring *ring,                // IN/OUT
+                 int fd,                     // IN
+                 const struct msghdr *msg,   // IN
+                 uint64_t data)              // IN
+{
+    struct io_uring_sqe *sqe = UringGetSqe(ring, data);
+
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = fd;
+    sqe->addr      = (uintptr_t)msg;
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+}
+
+#else /* NO_URING */
+
+/*
+ * Built without io_uring: UringInit() always fails, so the event loop
+ * never calls the rest.
+ */
+
+bool
+UringInit(Uring *ring)  // OUT
+{
+    memset(ring, 0, sizeof *ring);
+    ring->fd = -1;
+    errno = ENOSYS;
+    return false;
+}
+
+void UringDestroy(Uring *ring) { }
+bool UringEnable(Uring *ring) { return false; }
+int  UringSubmit(Uring *ring, unsigned waitNr) { errno = ENOSYS; return -1; }
+bool UringNextCqe(Uring *ring, UringCqe *cqe) { return false; }
+char *UringBuf(Uring *ring, int bid) { return NULL; }
+void UringBufRecycle(Uring *ring, int bid) { }
+void UringPrepPoll(Uring *ring, int fd, unsigned events, uint64_t data) { }
+void UringPrepPollRemove(Uring *ring, uint64_t target) { }
+void UringPrepCancel(Uring *ring, uint64_t target) { }
+void UringPrepAccept(Uring *ring, int fd, uint64_t data) { }
+void UringPrepRecv(Uring *ring, int fd, uint64_t data) { }
+void UringPrepSendMsg(Uring *ring, int fd, const struct msghdr *msg,
+                      uint64_t data) { }
+
+#endif /* NO_URING */
@@ -0,0 +1,85 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define URING_ENTRIES     256      // Submission queue entries
+#define URING_CQ_FACTOR   16       // Completion queue entries per SQE
+#define URING_BUF_COUNT   256      // Provided receive buffers (power of 2)
+#define URING_BUF_SIZE    16384    // Bytes per provided receive buffer
+
+/*
+ * A minimal io_uring, driven with raw system calls (no liburing): the
+ * submission and completion rings mapped from the kernel, helpers that
+ * prepare the few operations the event loop issues, and one ring of
+ * provided buffers that multishot receives fill.  Building with
+ * -DNO_URING leaves only stubs that fail UringInit().
+ */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/**
+ * One completion, copied out of the completion ring.  bid is the provided
+ * buffer holding the data of a receive, or -1.  more is set while a
+ * multishot request stays armed.
+ */
+typedef struct UringCqe {
+    uint64_t  data;
+    int       res;
+    int       bid;
+    bool      more;
+} UringCqe;
+
+typedef struct Uring {
+    int                        fd;
+    bool                       disabled;   // Created IORING_SETUP_R_DISABLED
+    void                      *sqMap;
+    size_t                     sqMapSize;
+    void                      *cqMap;
+    size_t                     cqMapSize;
+    unsigned                  *sqHead;
+    unsigned                  *sqTail;
+    unsigned                   sqMask;
+    unsigned                   sqEntries;
+    unsigned                   sqLocalTail;  // Prepared up to here
+    struct io_uring_sqe       *sqes;
+    unsigned                  *cqHead;
+    unsigned                  *cqTail;
+    unsigned                   cqMask;
+    struct io_uring_cqe       *cqes;
+    struct io_uring_buf_ring  *bufRing;
+    unsigned short             bufTail;
+    char                      *bufs;
+} Uring;
+
+bool  UringInit(Uring *ring);
+void  UringDestroy(Uring *ring);
+bool  UringEnable(Uring *ring);
+int   UringSubmit(Uring *ring, unsigned waitNr);
+bool  UringNextCqe(Uring *ring, UringCqe *cqe);
+char *UringBuf(Uring *ring, int bid);
+void  UringBufRecycle(Uring *ring, int bid);
+
+void  UringPrepPoll(Uring *ring, int fd, unsigned events, uint64_t data);
+void  UringPrepPollRemove(Uring *ring, uint64_t target);
+void  UringPrepCancel(Uring *ring, uint64_t target);
+void  UringPrepAccept(Uring *ring, int fd, uint64_t data);
+void  UringPrepRecv(Uring *ring, int fd, uint64_t data);
+void  UringPrepSendMsg(Uring *ring, int fd, const struct msghdr *msg,
+                       uint64_t data);
+
+#endif
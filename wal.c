@@ -0,0 +1,641 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "wal.h"
+
+static uint32_t crcTable[256];
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Fill in the CRC-32 lookup table.
+ *
+ **************************************************************************
+ */
+static void
+WalCrcInit(void)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (j = 0; j < 8; j++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[i] = c;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Continue a CRC-32 over len more bytes.
+ *
+ **************************************************************************
+ */
+static uint32_t
+WalCrc(uint32_t crc,          // IN
+       const void *data,      // IN
+       size_t len)            // IN
+{
+    const unsigned char *p = data;
+
+    crc = ~crc;
+    while (len-- > 0) {
+        crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Checksum of a record: its header after crc, then its data.
+ *
+ **************************************************************************
+ */
+static uint32_t
+WalRecordCrc(const WalRecord *rec,   // IN
+             const char *data)       // IN
+{
+    uint32_t crc;
+
+    crc = WalCrc(0, (const char *)rec + sizeof rec->crc,
+                 sizeof *rec - sizeof rec->crc);
+    return WalCrc(crc, data, rec->dataSize);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Feed every intact record of the log to replay.
+ *
+ * A record that is cut short or fails its checksum can only be the tail
+ * of a write interrupted by a crash, which was never acknowledged, so the
+ * log is truncated there.  Returns false if replay() fails.
+ *
+ **************************************************************************
+ */
+static bool
+WalReplay(int fd,                 // IN
+          const char *path,       // IN
+          WalReplayFunc replay,   // IN
+          void *arg)              // IN
+{
+    struct stat st;
+    const char *map;
+    off_t off = 0;
+    long numRecs = 0;
+    bool ok = true;
+
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to stat the write-ahead log");
+        return false;
+    }
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the write-ahead log");
+        return false;
+    }
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    while (st.st_size - off >= sizeof(WalRecord)) {
+        WalRecord rec;
+        const char *data = map + off + sizeof rec;
+
+        memcpy(&rec, map + off, sizeof rec);
+        if (rec.dataSize > st.st_size - off - sizeof rec ||
+            WalRecordCrc(&rec, data) != rec.crc) {
+            break;
+        }
+        if (!replay(&rec, data, arg)) {
+            ok = false;
+            break;
+        }
+        off += sizeof rec + rec.dataSize;
+        numRecs++;
+    }
+    munmap((void *)map, st.st_size);
+
+    if (ok && off < st.st_size) {
+        Error("Write-ahead log %s has a torn record at offset %lld, "
+              "truncating it\n", path, (long long)off);
+        if (ftruncate(fd, off) < 0 || fdatasync(fd) < 0) {
+            perror("Failed to truncate the write-ahead log");
+            return false;
+        }
+    }
+    if (ok) {
+        Log("Replayed %ld records from %s\n", numRecs, path);
+    }
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Write all of buf.  Failure is fatal.
+ *
+ **************************************************************************
+ */
+static void
+WalWriteAll(Wal *wal,          // IN
+            const char *buf,   // IN
+            size_t len)        // IN
+{
+    while (len > 0) {
+        ssize_t n = write(wal->fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Make a rename or create in the log's directory durable.
+ *
+ **************************************************************************
+ */
+static bool
+WalSyncDir(const char *path)  // IN
+{
+    char *dir = strdup(path);
+    char *slash;
+    int fd;
+    bool ok;
+
+    if (dir == NULL) {
+        return false;
+    }
+    slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ok = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(dir);
+    return ok;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Move the synced log to oldPath and continue in a new, empty one.
+ *
+ * Runs on the syncer thread between batches.  Failure is fatal.
+ *
+ **************************************************************************
+ */
+static void
+WalSwitchFile(Wal *wal)  // IN
+{
+    int fd;
+
+    if (rename(wal->path, wal->oldPath) < 0) {
+        Error("Failed to rename %s: %s\n", wal->path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fd = open(wal->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+              0644);
+    if (fd < 0 || !WalSyncDir(wal->path)) {
+        Error("Failed to start a new log %s: %s\n", wal->path,
+              strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(wal->fd);
+    wal->fd = fd;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief The syncer thread: write and sync whatever has been appended.
+ *
+ * Appends are never undone in memory, so a log that cannot be written
+ * makes the server exit rather than acknowledge writes it would lose.
+ *
+ **************************************************************************
+ */
+static void *
+WalSyncLoop(void *arg)  // IN
+{
+    Wal *wal = arg;
+    char *spare = NULL;
+    size_t spareCap = 0;
+
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        char *buf;
+        size_t len, cap;
+        WalLsn lsn;
+        WalWaiter *w, *next;
+        bool rotate;
+
+        while (wal->len == 0 && !wal->stop && !wal->rotate) {
+            pthread_cond_wait(&wal->cond, &wal->lock);
+        }
+        if (wal->len == 0 && !wal->rotate) {
+            break;
+        }
+
+        if (wal->windowUs > 0 && !wal->stop && !wal->rotate) {
+            struct timespec ts;
+
+            ts.tv_sec  = wal->windowUs / 1000000;
+            ts.tv_nsec = (wal->windowUs % 1000000) * 1000;
+            pthread_mutex_unlock(&wal->lock);
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&wal->lock);
+        }
+
+        /* Swap buffers so appends carry on while this batch is written. */
+        buf       = wal->buf;
+        cap       = wal->cap;
+        len       = wal->len;
+        lsn       = wal->appendLsn;
+        wal->buf  = spare;
+        wal->cap  = spareCap;
+        wal->len  = 0;
+        spare     = buf;
+        spareCap  = cap;
+        rotate    = wal->rotate;
+        pthread_mutex_unlock(&wal->lock);
+
+        if (len > 0) {
+            WalWriteAll(wal, buf, len);
+            if (fdatasync(wal->fd) < 0) {
+                perror("Failed to sync the write-ahead log");
+                exit(EXIT_FAILURE);
+            }
+            atomic_store_explicit(&wal->durableLsn, lsn,
+                                  memory_order_release);
+        }
+        if (rotate) {
+            WalSwitchFile(wal);
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        if (rotate) {
+            wal->rotate       = false;
+            wal->fileStartLsn = lsn;
+            wal->rotations++;
+            pthread_cond_broadcast(&wal->rotateCond);
+        }
+        for (w = wal->waiters; w != NULL; w = next) {
+            next = w->next;
+            if (w->lsn <= lsn) {
+                *w->pprev = w->next;
+                if (w->next != NULL) {
+                    w->next->pprev = w->pprev;
+                }
+                w->next  = NULL;
+                w->pprev = NULL;
+                EventLoopPost(w->loop, &w->task, 0);
+            }
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    free(spare);
+    return NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Open the log at path, replay it, and start the syncer.
+ *
+ * windowUs > 0 makes the syncer wait that long after the first append of
+ * a batch, trading latency for fewer syncs.  A log rotated out but not
+ * yet covered by a snapshot is replayed first.
+ *
+ **************************************************************************
+ */
+bool
+WalOpen(Wal *wal,               // OUT
+        const char *path,       // IN
+        long windowUs,          // IN
+        WalReplayFunc replay,   // IN
+        void *arg)              // IN
+{
+    off_t end;
+    int err;
+
+    memset(wal, 0, sizeof *wal);
+    WalCrcInit();
+
+    if (asprintf(&wal->oldPath, "%s.old", path) < 0) {
+        Error("Failed to allocate the log file name\n");
+        return false;
+    }
+    wal->path = strdup(path);
+
+    wal->fd = open(wal->oldPath, O_RDWR | O_CLOEXEC);
+    if (wal->fd >= 0) {
+        bool ok = WalReplay(wal->fd, wal->oldPath, replay, arg);
+        close(wal->fd);
+        if (!ok) {
+            return false;
+        }
+    }
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (wal->fd < 0) {
+        Error("Failed to open write-ahead log %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!WalReplay(wal->fd, path, replay, arg)) {
+        close(wal->fd);
+        return false;
+    }
+
+    end = lseek(wal->fd, 0, SEEK_END);
+    if (end < 0) {
+        perror("Failed to seek to the end of the write-ahead log");
+        close(wal->fd);
+        return false;
+    }
+    wal->appendLsn = end;
+    atomic_init(&wal->durableLsn, end);
+    wal->windowUs  = windowUs;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+    pthread_cond_init(&wal->rotateCond, NULL);
+
+    err = pthread_create(&wal->thread, NULL, WalSyncLoop, wal);
+    if (err != 0) {
+        Error("Failed to start the log syncer: %s\n", strerror(err));
+        close(wal->fd);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Sync what is left and stop the syncer.
+ *
+ **************************************************************************
+ */
+void
+WalClose(Wal *wal)  // IN
+{
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = true;
+    pthread_cond_signal(&wal->cond);
+    pthread_mutex_unlock(&wal->lock);
+
+    pthread_join(wal->thread, NULL);
+    close(wal->fd);
+    free(wal->buf);
+    free(wal->path);
+    free(wal->oldPath);
+    wal->buf = NULL;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Add a record to the log.
+ *
+ * Returns the LSN the log must be durable up to for the record to be.
+ * Records are written in the order they are appended.
+ *
+ **************************************************************************
+ */
+WalLsn
+WalAppend(Wal *wal,                // IN
+          WalRecType type,         // IN
+          const char *title,       // IN
+          const char *data,        // IN
+          int dataSize,            // IN
+          unsigned long long seq)  // IN
+{
+    WalRecord rec;
+    size_t need = sizeof rec + dataSize;
+    WalLsn lsn;
+
+    memset(&rec, 0, sizeof rec);
+    rec.dataSize = dataSize;
+    rec.seq      = seq;
+    rec.type     = type;
+    memcpy(rec.title, title, strnlen(title, sizeof rec.title));  // NUL-padded
+    rec.crc      = WalRecordCrc(&rec, data);
+
+    pthread_mutex_lock(&wal->lock);
+    if (wal->cap - wal->len < need) {
+        size_t cap = MAX(wal->cap * 2, WAL_BUF_SIZE);
+        char *buf;
+
+        while (cap - wal->len < need) {
+            cap *= 2;
+        }
+        buf = realloc(wal->buf, cap);
+        if (buf == NULL) {
+            Error("Failed to grow the write-ahead log buffer to %zu bytes\n",
+                  cap);
+            exit(EXIT_FAILURE);
+        }
+        wal->buf = buf;
+        wal->cap = cap;
+    }
+
+    memcpy(wal->buf + wal->len, &rec, sizeof rec);
+    memcpy(wal->buf + wal->len + sizeof rec, data, dataSize);
+    if (wal->len == 0) {
+        pthread_cond_signal(&wal->cond);
+    }
+    wal->len       += need;
+    wal->appendLsn += need;
+    lsn = wal->appendLsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Have w's task posted once the log is durable up to w->lsn.
+ *
+ * Returns false, without queueing w, if it already is.
+ *
+ **************************************************************************
+ */
+bool
+WalWait(Wal *wal,        // IN
+        WalWaiter *w)    // IN
+{
+    bool waiting = true;
+
+    pthread_mutex_lock(&wal->lock);
+    if (w->lsn <= WalDurableLsn(wal)) {
+        waiting = false;
+    } else if (w->pprev == NULL) {
+        w->next = wal->waiters;
+        if (w->next != NULL) {
+            w->next->pprev = &w->next;
+        }
+        w->pprev = &wal->waiters;
+        wal->waiters = w;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return waiting;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Stop waiting.  The caller cancels a task already posted.
+ *
+ **************************************************************************
+ */
+void
+WalCancel(Wal *wal,        // IN
+          WalWaiter *w)    // IN
+{
+    pthread_mutex_lock(&wal->lock);
+    if (w->pprev != NULL) {
+        *w->pprev = w->next;
+        if (w->next != NULL) {
+            w->next->pprev = w->pprev;
+        }
+        w->next  = NULL;
+        w->pprev = NULL;
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Start a new log file, leaving everything appended so far in
+ *        oldPath.
+ *
+ * Blocks until the syncer has switched files.  Refuses, returning false,
+ * while an earlier old log has not been dropped yet.
+ *
+ **************************************************************************
+ */
+bool
+WalRotate(Wal *wal)  // IN
+{
+    unsigned gen;
+
+    if (WalHasOld(wal)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    gen = wal->rotations;
+    wal->rotate = true;
+    pthread_cond_signal(&wal->cond);
+    while (wal->rotations == gen) {
+        pthread_cond_wait(&wal->rotateCond, &wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return true;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Delete the rotated-out log once a snapshot covers it.
+ *
+ **************************************************************************
+ */
+void
+WalDropOld(Wal *wal)  // IN
+{
+    if (unlink(wal->oldPath) == 0) {
+        WalSyncDir(wal->oldPath);
+    } else if (errno != ENOENT) {
+        Error("Failed to remove %s: %s\n", wal->oldPath, strerror(errno));
+    }
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Whether a rotated-out log is still waiting to be dropped.
+ *
+ **************************************************************************
+ */
+bool
+WalHasOld(Wal *wal)  // IN
+{
+    return access(wal->oldPath, F_OK) == 0;
+}
+
+
+/**
+ **************************************************************************
+ *
+ * \brief Bytes appended to the current log file, synced or not.
+ *
+ **************************************************************************
+ */
+size_t
+WalFileSize(Wal *wal)  // IN
+{
+    size_t size;
+
+    pthread_mutex_lock(&wal->lock);
+    size = wal->appendLsn - wal->fileStartLsn;
+    pthread_mutex_unlock(&wal->lock);
+    return size;
+}
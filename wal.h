@@ -0,0 +1,108 @@
+/*****************************************************************************
+ * CMPE 207 (Network Programming and Applications) Sample Program.
+ *
+ * San Jose State University, Copyright (2016) Reserved.
+ *
+ * DO NOT REDISTRIBUTE WITHOUT THE PERMISSION OF THE INSTRUCTOR.
+ *****************************************************************************
+ */
+
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "eventloop.h"
+
+#define WAL_BUF_SIZE   (256 * 1024)
+
+typedef unsigned long long WalLsn;   // File offset just past a record
+
+typedef enum WalRecType {
+    WAL_POST  = 1,
+    WAL_CLEAR = 2,
+} WalRecType;
+
+/**
+ * On-disk record header, followed by dataSize bytes.  crc covers the
+ * rest of the header and the data, so a record torn by a crash is found
+ * and dropped on replay.  seq is the board version the change produced.
+ */
+typedef struct WalRecord {
+    uint32_t crc;
+    uint32_t dataSize;
+    uint64_t seq;
+    uint32_t type;
+    uint32_t reserved;
+    char     title[MAX_TITLE_LEN];
+} WalRecord;
+
+/**
+ * Someone waiting for the log to be durable up to lsn: task is posted to
+ * loop once it is.
+ */
+typedef struct WalWaiter {
+    struct WalWaiter  *next;
+    struct WalWaiter **pprev;   // NULL unless waiting
+    WalLsn             lsn;
+    EventLoop         *loop;
+    EventTask          task;
+} WalWaiter;
+
+/**
+ * A write-ahead log with group commit.  Appends only copy the record into
+ * buf; the syncer thread writes everything appended so far with a single
+ * write() and fdatasync(), so all appends made while the previous sync
+ * was running (or within windowUs of the first) share one sync.
+ *
+ * The log lives in path.  WalRotate() renames it to oldPath, where it
+ * stays until WalDropOld() once a snapshot covers it.
+ */
+typedef struct Wal {
+    int               fd;
+    char             *path;
+    char             *oldPath;
+    bool              rotate;       // Syncer is asked to rotate
+    unsigned          rotations;
+    pthread_cond_t    rotateCond;
+    WalLsn            fileStartLsn; // LSN at the start of path
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    char             *buf;          // Appended, not yet written
+    size_t            len;
+    size_t            cap;
+    WalLsn            appendLsn;    // End of the last appended record
+    _Atomic WalLsn    durableLsn;   // End of the last synced record
+    long              windowUs;
+    bool              stop;
+    WalWaiter        *waiters;
+} Wal;
+
+typedef bool (*WalReplayFunc)(const WalRecord *rec, const char *data,
+                              void *arg);
+
+bool   WalOpen(Wal *wal, const char *path, long windowUs,
+               WalReplayFunc replay, void *arg);
+void   WalClose(Wal *wal);
+WalLsn WalAppend(Wal *wal, WalRecType type, const char *title,
+                 const char *data, int dataSize, unsigned long long seq);
+bool   WalRotate(Wal *wal);
+void   WalDropOld(Wal *wal);
+bool   WalHasOld(Wal *wal);
+size_t WalFileSize(Wal *wal);
+bool   WalWait(Wal *wal, WalWaiter *w);
+void   WalCancel(Wal *wal, WalWaiter *w);
+
+static inline WalLsn
+WalDurableLsn(Wal *wal)
+{
+    return atomic_load_explicit(&wal->durableLsn, memory_order_acquire);
+}
+
+#endif